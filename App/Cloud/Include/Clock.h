@@ -0,0 +1,10 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+uint64_t Clock_GetMs(void);
+uint64_t Clock_GetNs(void);
+uint64_t Clock_GetRealtimeMs(void);
+
+#endif
@@ -2,6 +2,17 @@
 #define CLOUD_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "RateLimiter.h"
+#include "CredentialStore.h"
+
+#define CLOUD_DEFAULT_REPORT_INTERVAL_SECONDS 300
+#define CLOUD_DEFAULT_SAS_TOKEN_LIFETIME_SECONDS 3600
+#define CLOUD_MIN_SAS_TOKEN_LIFETIME_SECONDS 60
+#define CLOUD_MAX_HOSTNAME_LENGTH 256
+#define CLOUD_MAX_DEVICE_ID_LENGTH 128
+#define CLOUD_MAX_ID_SCOPE_LENGTH 32
 
 typedef enum eCloudEvent {
     CLOUD_EVENT_CONNECTIONSTATUSCHANGED,
@@ -9,6 +20,7 @@ typedef enum eCloudEvent {
     CLOUD_EVENT_SENDDATAFAILED,
     CLOUD_EVENT_REGISTRATIONSUCCEEDED,
     CLOUD_EVENT_REGISTRATIONFAILED,
+    CLOUD_EVENT_TUNINGREQUESTED,
 } CloudEvent;
 
 typedef enum eCloudConnectionStatus {
@@ -24,24 +36,111 @@ typedef enum eCloudConnectionStatus {
     CLOUD_CONNECTION_DISCONNECTED_QUOTA_EXCEEDED,
 } CloudConnectionStatus;
 
+typedef enum eCloudRetryPolicy {
+    CLOUD_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER,
+    CLOUD_RETRY_EXPONENTIAL_BACKOFF,
+    CLOUD_RETRY_LINEAR_BACKOFF,
+    CLOUD_RETRY_INTERVAL,
+    CLOUD_RETRY_RANDOM,
+    CLOUD_RETRY_IMMEDIATE,
+    CLOUD_RETRY_NONE,
+} CloudRetryPolicy;
+
+typedef enum eCloudTransport {
+    CLOUD_TRANSPORT_MQTT,
+    CLOUD_TRANSPORT_MQTT_WEBSOCKET,
+    CLOUD_TRANSPORT_AMQP,
+    CLOUD_TRANSPORT_AMQP_WEBSOCKET,
+    CLOUD_TRANSPORT_HTTP,
+    CLOUD_TRANSPORT_COUNT,
+} CloudTransport;
+
+/* The certificate, the key (or the connection strings) and the trusted certificate are held in the credential store,
+ * the params hold a reference to each. */
 typedef struct sCloudConnectParams {
-    char hostname[1024];
-    char dpsEndPoint[1024];
-    char dpsIdScope[32];
-    char deviceId[1024];
-    char cert[4096];
-    char key[4096];
+    char hostname[CLOUD_MAX_HOSTNAME_LENGTH];
+    char dpsEndPoint[CLOUD_MAX_HOSTNAME_LENGTH];
+    char dpsIdScope[CLOUD_MAX_ID_SCOPE_LENGTH];
+    char deviceId[CLOUD_MAX_DEVICE_ID_LENGTH + 1];
+    CredentialHandle cert;
+    CredentialHandle key;
+    CredentialHandle trustedCert;
     bool isX509;
+    CloudRetryPolicy retryPolicy;
+    size_t retryTimeoutSeconds;
+    CloudTransport transport;
+    bool isTuningEnabled;
+    size_t sasTokenLifetimeSeconds;
 } CloudConnectParams;
 
+typedef struct sCloudSendStats {
+    size_t sentCount;
+    size_t ackCount;
+    size_t failCount;
+    size_t resendCount;
+    size_t reconnectCount;
+    size_t inFlightCount;
+    uint64_t sentBytes;
+    uint64_t ackBytes;
+    size_t tokenRenewCount;
+    uint64_t tokenRenewMs;
+    uint64_t maxTokenRenewMs;
+} CloudSendStats;
+
+typedef enum eCloudPriority {
+    CLOUD_PRIORITY_NORMAL,
+    CLOUD_PRIORITY_HIGH,
+    CLOUD_PRIORITY_LOW,
+    CLOUD_PRIORITY_COUNT,
+} CloudPriority;
+
+typedef struct sCloudMessageProperty {
+    const char *name;
+    const char *value;
+} CloudMessageProperty;
+
+typedef struct sCloudMessageOptions {
+    const char *contentType;
+    const char *contentEncoding;
+    const CloudMessageProperty *properties;
+    size_t propertyCount;
+    CloudPriority priority;
+} CloudMessageOptions;
+
+/* A setting from the tuning section of the desired properties, passed with CLOUD_EVENT_TUNINGREQUESTED. The handler
+ * sets isApplied if it took the value; otherwise the setting is reported back as rejected. */
+typedef struct sCloudTuningSetting {
+    const char *name;
+    const char *value;
+    bool isApplied;
+} CloudTuningSetting;
+
 typedef void (*Cloud_EventHandler)(CloudEvent evt, void *data);
 
+/* Receives the payload of a message that failed for good, right before CLOUD_EVENT_SENDDATAFAILED is raised for it, so
+ * the application can keep messages it holds no copy of */
+typedef void (*Cloud_UnsentHandler)(const void *data, size_t size, const char *contentType, void *contextData);
+
 int Cloud_Initialize(void);
 void Cloud_Deinitialize(void);
 void Cloud_RegisterEventHandler(Cloud_EventHandler eventHandler);
+void Cloud_RegisterUnsentHandler(Cloud_UnsentHandler unsentHandler);
 int Cloud_Connect(CloudConnectParams *params);
+void Cloud_Disconnect(void);
 int Cloud_Register(CloudConnectParams *params);
 void Cloud_Task(void);
 int Cloud_SendData(const char *data, void *contextData);
+int Cloud_SendDataEx(const void *data, size_t size, const CloudMessageOptions *options, void *contextData);
+void Cloud_SetRateLimit(const RateLimiterParams *params);
+void Cloud_SetInFlightWindow(size_t window);
+void Cloud_SetLogTrace(bool isOn);
+void Cloud_SetReportInterval(unsigned int seconds);
+size_t Cloud_GetPendingCount(void);
+void Cloud_GetSendStats(CloudSendStats *stats);
+bool Cloud_IsConnected(void);
+void Cloud_CollectMetrics(void);
+int Cloud_ParseRetryPolicy(const char *name, CloudRetryPolicy *policy);
+int Cloud_ParseTransport(const char *name, CloudTransport *transport);
+const char *Cloud_GetTransportName(CloudTransport transport);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef CLOUDGATEWAY_H
+#define CLOUDGATEWAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "Cloud.h"
+
+#define CLOUDGATEWAY_MAX_IN_FLIGHT 4096
+#define CLOUDGATEWAY_DEVICE_ID_SIZE 128
+
+/* A gateway sends for many device identities over a single connection to the IoT Hub. Each identity has its own
+ * device client, and all clients share the one transport, so the TLS session and the socket exist once instead of
+ * once per identity. Only AMQP, AMQP over websockets and HTTP can be shared; MQTT has one identity per connection.
+ *
+ * The gateway is independent of Cloud_Connect, but needs Cloud_Initialize to have been called. */
+typedef struct sCloudDevice CloudDevice;
+
+/* Same events as the Cloud library, for the identity they belong to */
+typedef void (*CloudGateway_EventHandler)(CloudDevice *device, CloudEvent evt, void *data);
+
+typedef struct sCloudGatewayStats {
+    size_t deviceCount;
+    size_t connectedCount;
+    size_t sentCount;
+    size_t ackCount;
+    size_t failCount;
+    size_t inFlightCount;
+} CloudGatewayStats;
+
+int CloudGateway_Open(const char *hostname, CloudTransport transport, size_t maxDevices);
+void CloudGateway_Close(void);
+void CloudGateway_RegisterEventHandler(CloudGateway_EventHandler eventHandler);
+CloudDevice *CloudGateway_AddDevice(const char *deviceId, const char *deviceKey, void *userContext);
+void CloudGateway_RemoveDevice(CloudDevice *device);
+void CloudGateway_Task(void);
+int CloudGateway_SendData(CloudDevice *device, const void *data, size_t size, const CloudMessageOptions *options,
+                          void *contextData);
+const char *CloudGateway_GetDeviceId(const CloudDevice *device);
+void *CloudGateway_GetDeviceContext(const CloudDevice *device);
+CloudConnectionStatus CloudGateway_GetDeviceStatus(const CloudDevice *device);
+void CloudGateway_GetStats(CloudGatewayStats *stats);
+
+#endif
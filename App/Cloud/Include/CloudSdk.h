@@ -0,0 +1,12 @@
+#ifndef CLOUDSDK_H
+#define CLOUDSDK_H
+
+#include "Cloud.h"
+#include "iothub_device_client_ll.h"
+
+/* Shared by the modules of the Cloud library that drive device clients of the Azure SDK themselves */
+IOTHUB_CLIENT_TRANSPORT_PROVIDER Cloud_GetTransportProtocol(CloudTransport transport);
+CloudConnectionStatus Cloud_TranslateConnectionStatus(IOTHUB_CLIENT_CONNECTION_STATUS status,
+                                                      IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason);
+
+#endif
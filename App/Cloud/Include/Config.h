@@ -0,0 +1,55 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define CONFIG_MAX_LINE_LENGTH 512
+#define CONFIG_MAX_PATH_LENGTH 256
+
+typedef struct sConfigurationSetting {
+    char *name;
+    char *value;
+} ConfigurationSetting;
+
+typedef int (*Config_Handler)(ConfigurationSetting *setting, void *context);
+
+/* Parses a value into result, or only checks it when result is NULL. Returns 0 when the value is valid. */
+typedef int (*Config_ParseFunction)(const char *value, void *result);
+
+/* Applies the values of the schema to the running process, e.g. to a live connection. Returns 0 on success. */
+typedef int (*Config_ApplyFunction)(void);
+
+typedef enum eConfigType {
+    CONFIG_TYPE_UINT,
+    CONFIG_TYPE_ULONG,
+    CONFIG_TYPE_SIZE,
+    CONFIG_TYPE_DOUBLE,
+    CONFIG_TYPE_SWITCH,
+    CONFIG_TYPE_STRING,
+    CONFIG_TYPE_PARSED,
+} ConfigType;
+
+/* A setting with a fixed type, stored in value. Numbers are unsigned, switches take true/false, on/off or 1/0.
+ * Strings are copied into a buffer of size bytes, their parse function only checks them; other values of size bytes
+ * are converted by parse. When the file changes, a reloadable setting is stored and applied right away, and put back
+ * if apply fails. Any other setting keeps its value until the next start. */
+typedef struct sConfigField {
+    const char *name;
+    ConfigType type;
+    void *value;
+    size_t size;
+    Config_ParseFunction parse;
+    Config_ApplyFunction apply;
+    bool isReloadable;
+} ConfigField;
+
+int Config_Parse(const char *filename, Config_Handler handler, void *context);
+int Config_Load(const char *filename, const ConfigField *schema, size_t count, Config_Handler handler, void *context);
+int Config_Reload(const char *filename, const ConfigField *schema, size_t count);
+int Config_Set(const ConfigField *schema, size_t count, const char *name, const char *value);
+int Config_Watch(const char *filename);
+bool Config_IsChanged(void);
+void Config_Unwatch(void);
+
+#endif
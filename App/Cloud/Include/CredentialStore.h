@@ -0,0 +1,32 @@
+#ifndef CREDENTIALSTORE_H
+#define CREDENTIALSTORE_H
+
+#include <stddef.h>
+
+#define CREDENTIALSTORE_MAX_FILE_SIZE (1024 * 1024)
+#define CREDENTIALSTORE_MAX_BLOCKS 16
+
+/* Refers to a loaded credential, e.g. a certificate chain, a private key or connection strings. 0 is no credential. */
+typedef size_t CredentialHandle;
+
+#define CREDENTIAL_NONE ((CredentialHandle)0)
+
+/* Blocks are PEM sections, or the whole text when it has none. Identical blocks are kept once, however many
+ * credentials hold them. */
+typedef struct sCredentialStoreStats {
+    size_t credentialCount;
+    size_t blockCount;
+    size_t blockBytes;
+    size_t sharedBytes;
+} CredentialStoreStats;
+
+CredentialHandle CredentialStore_Load(const char *filename);
+CredentialHandle CredentialStore_Add(const char *data, size_t size);
+CredentialHandle CredentialStore_Retain(CredentialHandle handle);
+void CredentialStore_Release(CredentialHandle handle);
+size_t CredentialStore_GetLength(CredentialHandle handle);
+char *CredentialStore_Compose(CredentialHandle handle);
+void CredentialStore_Free(char *text);
+void CredentialStore_GetStats(CredentialStoreStats *stats);
+
+#endif
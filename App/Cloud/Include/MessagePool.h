@@ -0,0 +1,42 @@
+#ifndef MESSAGEPOOL_H
+#define MESSAGEPOOL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MESSAGEPOOL_MAX_MESSAGES 1024
+#define MESSAGEPOOL_MAX_INTERNED_STRINGS 128
+
+/* handle is the IoT Hub message with the payload and properties, which the owner of the slot creates and destroys */
+typedef struct sPoolMessage {
+    void *handle;
+    size_t size;
+    const char *contentType;
+    void *contextData;
+    uint64_t sendTimeMs;
+    uint64_t firstSendTimeMs;
+    uint32_t sequence;
+    unsigned int resendCount;
+    int priority;
+    bool inUse;
+    struct sPoolMessage *next;
+} PoolMessage;
+
+typedef struct sMessagePoolStats {
+    size_t capacity;
+    size_t inUse;
+    size_t peakInUse;
+    size_t acquireCount;
+    size_t acquireFailCount;
+    size_t internedCount;
+} MessagePoolStats;
+
+int MessagePool_Initialize(size_t messageCount);
+void MessagePool_Deinitialize(void);
+PoolMessage *MessagePool_Acquire(void);
+void MessagePool_Release(PoolMessage *msg);
+const char *MessagePool_Intern(const char *str);
+void MessagePool_GetStats(MessagePoolStats *stats);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_MAX_METRICS 48
+#define METRICS_MAX_COLLECTORS 4
+#define METRICS_MAX_NAME_LENGTH 64
+#define METRICS_MAX_PATH_LENGTH 256
+#define METRICS_MAX_LABELS_LENGTH 128
+#define METRICS_DEFAULT_INTERVAL_SECONDS 15
+
+typedef enum eMetricsType {
+    METRICS_TYPE_COUNTER,
+    METRICS_TYPE_GAUGE,
+} MetricsType;
+
+typedef struct sMetricsParams {
+    char textFile[METRICS_MAX_PATH_LENGTH];
+    char socketPath[METRICS_MAX_PATH_LENGTH];
+    char labels[METRICS_MAX_LABELS_LENGTH];
+    unsigned int intervalSeconds;
+} MetricsParams;
+
+/* Called before the metrics are exported, to set the current values */
+typedef void (*Metrics_Collector)(void);
+
+int Metrics_Initialize(const MetricsParams *params);
+void Metrics_Deinitialize(void);
+int Metrics_AddCollector(Metrics_Collector collector);
+int Metrics_Set(const char *name, MetricsType type, const char *help, double value);
+void Metrics_Task(uint64_t nowMs);
+int Metrics_WriteTextFile(void);
+size_t Metrics_Format(char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RATELIMITER_MAX_PATH_LENGTH 256
+
+typedef enum eRateLimiterResult {
+    RATELIMITER_OK,
+    RATELIMITER_WAIT,
+    RATELIMITER_BUDGET_EXHAUSTED,
+} RateLimiterResult;
+
+typedef struct sRateLimiterParams {
+    double messagesPerSecond;
+    double bytesPerSecond;
+    unsigned long dailyMessageBudget;
+    size_t messageMeterSize;
+    char stateFile[RATELIMITER_MAX_PATH_LENGTH];
+} RateLimiterParams;
+
+typedef struct sRateLimiterStats {
+    double effectiveMessagesPerSecond;
+    double effectiveBytesPerSecond;
+    unsigned long dailyMessagesUsed;
+    size_t waitCount;
+    size_t throttleSignalCount;
+    size_t budgetRejectCount;
+} RateLimiterStats;
+
+int RateLimiter_GetTierParams(const char *tier, unsigned int units, RateLimiterParams *params);
+void RateLimiter_Configure(const RateLimiterParams *params);
+RateLimiterResult RateLimiter_Acquire(size_t size, uint64_t nowMs);
+void RateLimiter_ReportThrottle(uint64_t nowMs);
+void RateLimiter_ReportAck(uint64_t latencyMs, uint64_t nowMs);
+void RateLimiter_Save(void);
+void RateLimiter_GetStats(RateLimiterStats *stats);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef TLSSESSION_H
+#define TLSSESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "CredentialStore.h"
+
+#define TLSSESSION_MAX_PATH_LENGTH 256
+
+/* Handshakes made since the start. The full handshake time of a resumed session is the one that was measured when the
+ * session was first established, possibly by an earlier run. */
+typedef struct sTlsSessionStats {
+    size_t handshakeCount;
+    size_t resumedCount;
+    uint64_t fullHandshakeMs;
+    uint64_t resumedHandshakeMs;
+    uint64_t resumedFullHandshakeMs;
+    size_t savedCount;
+} TlsSessionStats;
+
+int TlsSession_Configure(const char *directory, CredentialHandle identity);
+void TlsSession_GetStats(TlsSessionStats *stats);
+void TlsSession_CollectMetrics(void);
+
+#endif
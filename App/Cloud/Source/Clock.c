@@ -0,0 +1,22 @@
+#include "Clock.h"
+#include <time.h>
+
+uint64_t Clock_GetMs(void)
+{
+    return Clock_GetNs() / 1000000ull;
+}
+
+uint64_t Clock_GetNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Wall clock time, for anything that has to line up with calendar time rather than measure intervals */
+uint64_t Clock_GetRealtimeMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000ull + (uint64_t)ts.tv_nsec / 1000000ull;
+}
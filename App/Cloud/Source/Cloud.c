@@ -1,6 +1,16 @@
 #include "Cloud.h"
+#include "CloudSdk.h"
+#include "MessagePool.h"
+#include "RateLimiter.h"
+#include "Clock.h"
+#include "Metrics.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <json-c/json.h>
 
 #include "iothub.h"
 #include "iothub_device_client_ll.h"
@@ -15,6 +25,21 @@
 #include "azure_c_shared_utility/crt_abstractions.h"
 #include "azure_c_shared_utility/shared_util_options.h"
 #include "iothubtransportmqtt.h"
+#include "iothubtransportmqtt_websockets.h"
+#include "iothubtransportamqp.h"
+#include "iothubtransportamqp_websockets.h"
+#include "iothubtransporthttp.h"
+
+/* SAS tokens are renewed at this share of their lifetime, ahead of the MQTT transport of the SDK, which drops the
+ * connection at 80% to open a new one. Messages in flight get this long to be acknowledged before the renewal. */
+#define TOKEN_RENEW_PERCENT 75
+#define TOKEN_DRAIN_TIMEOUT_MS 5000
+
+typedef enum eTokenRenewal {
+    TOKEN_RENEWAL_IDLE,
+    TOKEN_RENEWAL_DRAINING,
+    TOKEN_RENEWAL_CONNECTING,
+} TokenRenewal;
 
 static IOTHUB_DEVICE_CLIENT_LL_HANDLE mIoTClient = NULL;
 static PROV_DEVICE_LL_HANDLE mProvisioningDevice = NULL;
@@ -22,21 +47,123 @@ static PROV_DEVICE_TRANSPORT_PROVIDER_FUNCTION prov_transport = NULL;
 static bool mIsInit = false;
 static bool mIsConnected = false;
 static Cloud_EventHandler mEventHandler = NULL;
+static Cloud_UnsentHandler mUnsentHandler = NULL;
+static PoolMessage *mPendingHead[CLOUD_PRIORITY_COUNT];
+static PoolMessage *mPendingTail[CLOUD_PRIORITY_COUNT];
+static size_t mPendingCount = 0;
+static size_t mInFlightWindow = 0;
+static bool mIsLinkDown = false;
+static bool mIsRetryExpired = false;
+static bool mIsConnectionAnnounced = true;
+static CloudTransport mTransport = CLOUD_TRANSPORT_MQTT;
+static CloudRetryPolicy mRetryPolicy = CLOUD_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER;
+static size_t mRetryTimeoutSeconds = 0;
+static CloudSendStats mSendStats;
+static uint32_t mSequence = 0;
+static char mSessionId[24];
+static bool mIsTraceOn = true;
+static bool mIsTuningEnabled = false;
+static int64_t mTuningVersion = -1;
+static json_object *mAppliedTuning = NULL;
+static json_object *mRejectedTuning = NULL;
+static unsigned int mReportIntervalSeconds = CLOUD_DEFAULT_REPORT_INTERVAL_SECONDS;
+static uint64_t mLastReportMs = 0;
+static CloudSendStats mLastReportStats;
+static const CloudConnectParams *mConnectParams = NULL;
+static bool mIsSasKey = false;
+static bool mIsTokenRenewed = false;
+static size_t mTokenLifetimeSeconds = CLOUD_DEFAULT_SAS_TOKEN_LIFETIME_SECONDS;
+static uint64_t mTokenIssuedMs = 0;
+static uint64_t mRenewStartMs = 0;
+static TokenRenewal mTokenRenewal = TOKEN_RENEWAL_IDLE;
+
+static const char *DEFAULT_CONTENT_TYPE = "application/json";
+static const char *DEFAULT_CONTENT_ENCODING = "utf-8";
 
-static int SetOptions(CloudConnectParams *params);
+/* Pending queues are served strictly in this order */
+static const CloudPriority mDispatchOrder[CLOUD_PRIORITY_COUNT] = {
+    CLOUD_PRIORITY_HIGH,
+    CLOUD_PRIORITY_NORMAL,
+    CLOUD_PRIORITY_LOW,
+};
+
+/* clang-format off */
+static const struct {
+    const char *name;
+    CloudRetryPolicy policy;
+} mRetryPolicyNames[] = {
+    {"exponential_jitter", CLOUD_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER},
+    {"exponential", CLOUD_RETRY_EXPONENTIAL_BACKOFF},
+    {"linear", CLOUD_RETRY_LINEAR_BACKOFF},
+    {"interval", CLOUD_RETRY_INTERVAL},
+    {"random", CLOUD_RETRY_RANDOM},
+    {"immediate", CLOUD_RETRY_IMMEDIATE},
+    {"none", CLOUD_RETRY_NONE},
+};
+/* The websocket transports tunnel through port 443 for sites that block 8883 and 5671 */
+static const struct {
+    const char *name;
+    IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol;
+} mTransports[CLOUD_TRANSPORT_COUNT] = {
+    [CLOUD_TRANSPORT_MQTT] = {"mqtt", MQTT_Protocol},
+    [CLOUD_TRANSPORT_MQTT_WEBSOCKET] = {"mqtt_websocket", MQTT_WebSocket_Protocol},
+    [CLOUD_TRANSPORT_AMQP] = {"amqp", AMQP_Protocol},
+    [CLOUD_TRANSPORT_AMQP_WEBSOCKET] = {"amqp_websocket", AMQP_Protocol_over_WebSocketsTls},
+    [CLOUD_TRANSPORT_HTTP] = {"http", HTTP_Protocol},
+};
+/* clang-format on */
+
+static int CreateClient(const CloudConnectParams *params);
+static int ConfigureClient(const CloudConnectParams *params);
+static int SetOptions(const CloudConnectParams *params);
+static int SetCredentialOption(const char *name, CredentialHandle handle);
+static void RenewToken(uint64_t nowMs);
 static int SetProvisioningDeviceOptions(CloudConnectParams *params);
+static int SetProvisioningCredentialOption(const char *name, CredentialHandle handle);
+static int SendPoolMessage(PoolMessage *msg);
+static void DispatchPendingMessages(void);
+static void FailPendingMessages(void);
+static void ReleaseMessage(PoolMessage *msg);
+static void CompleteMessage(PoolMessage *msg, CloudEvent evt);
+static bool ShouldResendMessage(PoolMessage *msg, IOTHUB_CLIENT_CONFIRMATION_RESULT result, uint64_t now);
+static void RequeueMessage(PoolMessage *msg);
+static void PushPendingMessage(PoolMessage *msg, bool atFront);
+static PoolMessage *PeekPendingMessage(void);
+static PoolMessage *PopPendingMessage(void);
+static IOTHUB_CLIENT_RETRY_POLICY TranslateRetryPolicy(CloudRetryPolicy policy);
 static void SendCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *userContextCallback);
 static void ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
                                      IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void *user_context);
 static void RegisterDeviceCallback(PROV_DEVICE_RESULT register_result, const char *iothub_uri, const char *device_id,
                                    void *user_context);
 static void RegistrationStatusCallback(PROV_DEVICE_REG_STATUS reg_status, void *user_context);
-static CloudConnectionStatus TranslateIoTClientConnectionStatus(IOTHUB_CLIENT_CONNECTION_STATUS status,
-                                                                IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason);
+static void DeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload, size_t size,
+                               void *userContextCallback);
+static void ApplyTuningSetting(const char *name, json_object *value);
+static void ReportTuning(void);
+static void ReportThroughput(uint64_t nowMs);
+static void SendReportedState(json_object *reported);
+static void ReportedStateCallback(int statusCode, void *userContextCallback);
 
 int Cloud_Initialize(void)
 {
     int res = IoTHub_Init();
+
+    if (res == 0) {
+        res = MessagePool_Initialize(MESSAGEPOOL_MAX_MESSAGES);
+    }
+
+    memset(mPendingHead, 0, sizeof(mPendingHead));
+    memset(mPendingTail, 0, sizeof(mPendingTail));
+    mPendingCount = 0;
+    mIsLinkDown = false;
+    memset(&mSendStats, 0, sizeof(mSendStats));
+    mAppliedTuning = json_object_new_object();
+    mRejectedTuning = json_object_new_object();
+
+    /* Message ids are unique per run, so the backend can drop duplicates of messages that are resent */
+    snprintf(mSessionId, sizeof(mSessionId), "%lx%04x", (unsigned long)time(NULL), (unsigned int)getpid() & 0xffff);
+
     mIsInit = (res == 0);
     mIoTClient = NULL;
     mIsConnected = false;
@@ -45,11 +172,22 @@ int Cloud_Initialize(void)
 
 void Cloud_Deinitialize(void)
 {
-    IoTHubDeviceClient_LL_Destroy(mIoTClient);
-    mIoTClient = NULL;
+    /* Destroying the client completes all queued messages, which returns them to the pool. Those still waiting for
+     * the client are dropped. */
+    Cloud_Disconnect();
+
+    while (mPendingCount) {
+        ReleaseMessage(PopPendingMessage());
+    }
+
     Prov_Device_LL_Destroy(mProvisioningDevice);
     mProvisioningDevice = NULL;
-    mIsConnected = false;
+    MessagePool_Deinitialize();
+    RateLimiter_Save();
+    json_object_put(mAppliedTuning);
+    json_object_put(mRejectedTuning);
+    mAppliedTuning = NULL;
+    mRejectedTuning = NULL;
     mIsInit = false;
 }
 
@@ -58,36 +196,79 @@ void Cloud_RegisterEventHandler(Cloud_EventHandler eventHandler)
     mEventHandler = eventHandler;
 }
 
-int Cloud_Connect(CloudConnectParams *params)
+void Cloud_RegisterUnsentHandler(Cloud_UnsentHandler unsentHandler)
 {
-    char connectionString[1024];
+    mUnsentHandler = unsentHandler;
+}
 
+/* params stay in use while connected, a SAS token is renewed with the same settings */
+int Cloud_Connect(CloudConnectParams *params)
+{
     if (mIsConnected || mIoTClient != NULL) {
         return -1;
     }
 
-    params->isX509 ? snprintf(connectionString, sizeof(connectionString), "HostName=%s;DeviceId=%s;x509=true",
-                              params->hostname, params->deviceId)
-                   : snprintf(connectionString, sizeof(connectionString), "%s", params->key);
+    if (params->transport >= CLOUD_TRANSPORT_COUNT) {
+        return -1;
+    }
 
-    /* Create the iothub handle */
-    mIoTClient = IoTHubDeviceClient_LL_CreateFromConnectionString(connectionString, MQTT_Protocol);
+    mTransport = params->transport;
+    mConnectParams = params;
 
-    if (mIoTClient == NULL) {
-        printf("Failure creating IotHub device. Hint: Check your connection string.\n");
-        return -1;
+    /* The SDK makes the SAS tokens from the key of a connection string. HTTP uses a new one for every request and
+     * AMQP renews it on the open connection, so only MQTT needs the client replaced. */
+    char *key = params->isX509 ? NULL : CredentialStore_Compose(params->key);
+    mIsSasKey = key && strstr(key, "SharedAccessKey=") != NULL;
+    CredentialStore_Free(key);
+    mIsTokenRenewed = mIsSasKey && (mTransport == CLOUD_TRANSPORT_MQTT || mTransport == CLOUD_TRANSPORT_MQTT_WEBSOCKET);
+    mTokenLifetimeSeconds =
+        params->sasTokenLifetimeSeconds ? params->sasTokenLifetimeSeconds : CLOUD_DEFAULT_SAS_TOKEN_LIFETIME_SECONDS;
+
+    if (mTokenLifetimeSeconds < CLOUD_MIN_SAS_TOKEN_LIFETIME_SECONDS) {
+        mTokenLifetimeSeconds = CLOUD_MIN_SAS_TOKEN_LIFETIME_SECONDS;
     }
 
-    /* Set any option that are necessary. For available options please see the iothub_sdk_options.md documentation */
-    if (SetOptions(params) != 0) {
-        printf("Failure in setting options.\n");
+    mTokenRenewal = TOKEN_RENEWAL_IDLE;
+
+    /* The SDK reconnects by itself according to this policy. Messages that fail meanwhile are replayed by
+     * ConnectionStatusCallback/SendCallback once the link is back. */
+    mRetryPolicy = params->retryPolicy;
+    mRetryTimeoutSeconds = params->retryTimeoutSeconds;
+
+    /* The desired properties arrive in full once connected and as patches afterwards. HTTP has no twin. */
+    mIsTuningEnabled = params->isTuningEnabled && mTransport != CLOUD_TRANSPORT_HTTP;
+    mTuningVersion = -1;
+    mLastReportMs = 0;
+
+    if (CreateClient(params) != 0) {
+        mConnectParams = NULL;
         return -1;
     }
 
-    IoTHubDeviceClient_LL_SetConnectionStatusCallback(mIoTClient, ConnectionStatusCallback, NULL);
+    mIsLinkDown = false;
+    mIsRetryExpired = false;
+
+    /* HTTP has no standing connection that could be reported up, requests are made as messages are sent */
+    mIsConnectionAnnounced = (mTransport != CLOUD_TRANSPORT_HTTP);
     return 0;
 }
 
+void Cloud_Disconnect(void)
+{
+    /* Messages completed by destroying the client are not resent from here on */
+    mTokenRenewal = TOKEN_RENEWAL_IDLE;
+    mConnectParams = NULL;
+    FailPendingMessages();
+
+    if (mIoTClient) {
+        IoTHubDeviceClient_LL_Destroy(mIoTClient);
+        mIoTClient = NULL;
+    }
+
+    mIsConnected = false;
+    mIsLinkDown = false;
+}
+
 int Cloud_Register(CloudConnectParams *params)
 {
     (void)prov_dev_security_init(SECURE_DEVICE_TYPE_X509);
@@ -114,65 +295,538 @@ int Cloud_Register(CloudConnectParams *params)
 
 void Cloud_Task(void)
 {
+    if (mIoTClient && !mIsConnectionAnnounced) {
+        mIsConnectionAnnounced = true;
+        ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_AUTHENTICATED, IOTHUB_CLIENT_CONNECTION_OK, NULL);
+    }
+
     if (mIoTClient) {
+        RenewToken(Clock_GetMs());
+    }
+
+    if (mIoTClient) {
+        DispatchPendingMessages();
         IoTHubDeviceClient_LL_DoWork(mIoTClient);
     }
 
+    if (mIoTClient && mIsTuningEnabled && mIsConnected && mReportIntervalSeconds) {
+        ReportThroughput(Clock_GetMs());
+    }
+
     if (mProvisioningDevice) {
         Prov_Device_LL_DoWork(mProvisioningDevice);
     }
 }
 
 int Cloud_SendData(const char *data, void *contextData)
+{
+    if (data == NULL) {
+        return -1;
+    }
+
+    return Cloud_SendDataEx(data, strlen(data), NULL, contextData);
+}
+
+int Cloud_SendDataEx(const void *data, size_t size, const CloudMessageOptions *options, void *contextData)
 {
     if (mIoTClient == NULL) {
         return -1;
     }
 
-    IOTHUB_MESSAGE_HANDLE msgHandle = IoTHubMessage_CreateFromString(data);
+    PoolMessage *msg = MessagePool_Acquire();
+    const char *contentEncoding = DEFAULT_CONTENT_ENCODING;
 
-    if (msgHandle == NULL) {
+    if (msg == NULL) {
         return -1;
     }
 
-    /* Set ContentEncoding and ContentType accordingly */
-    (void)IoTHubMessage_SetContentTypeSystemProperty(msgHandle, "application/json");
-    (void)IoTHubMessage_SetContentEncodingSystemProperty(msgHandle, "utf-8");
+    /* The message made here is the only copy of the payload and properties, kept in the slot until the send is
+     * confirmed, so the caller's buffer is free again once this returns */
+    IOTHUB_MESSAGE_HANDLE msgHandle = IoTHubMessage_CreateFromByteArray(data, size);
+    int res = msgHandle ? 0 : -1;
 
-    int res =
-        (IoTHubDeviceClient_LL_SendEventAsync(mIoTClient, msgHandle, SendCallback, contextData) == IOTHUB_CLIENT_OK)
-            ? 0
-            : -1;
+    /* The content type is interned, as the unsent handler may get it long after the options are gone. A type that
+     * does not fit into the table fails the send rather than going out without it. */
+    msg->handle = msgHandle;
+    msg->size = size;
+    msg->contentType = DEFAULT_CONTENT_TYPE;
+    msg->contextData = contextData;
 
-    IoTHubMessage_Destroy(msgHandle);
-    return res;
+    if (options && res == 0) {
+        if (options->contentType && (msg->contentType = MessagePool_Intern(options->contentType)) == NULL) {
+            res = -1;
+        }
+
+        contentEncoding = options->contentEncoding ? options->contentEncoding : contentEncoding;
+
+        for (size_t i = 0; i < options->propertyCount && res == 0; i++) {
+            if (IoTHubMessage_SetProperty(msgHandle, options->properties[i].name, options->properties[i].value) !=
+                IOTHUB_MESSAGE_OK) {
+                res = -1;
+            }
+        }
+
+        if (options->priority < CLOUD_PRIORITY_COUNT) {
+            msg->priority = options->priority;
+        }
+    }
+
+    if (res == 0) {
+        (void)IoTHubMessage_SetContentTypeSystemProperty(msgHandle, msg->contentType);
+
+        /* An empty encoding leaves it unset, which is what binary payloads need */
+        if (contentEncoding[0]) {
+            (void)IoTHubMessage_SetContentEncodingSystemProperty(msgHandle, contentEncoding);
+        }
+    }
+
+    if (res != 0) {
+        ReleaseMessage(msg);
+        return res;
+    }
+
+    /* Messages are queued and handed to the SDK as the rate limiter and in-flight window allow, starting right away */
+    PushPendingMessage(msg, false);
+    DispatchPendingMessages();
+    return 0;
 }
 
-static int SetOptions(CloudConnectParams *params)
+void Cloud_SetRateLimit(const RateLimiterParams *params)
+{
+    RateLimiter_Configure(params);
+}
+
+void Cloud_SetInFlightWindow(size_t window)
+{
+    mInFlightWindow = window;
+}
+
+/* Takes effect right away on a connected client */
+void Cloud_SetLogTrace(bool isOn)
+{
+    mIsTraceOn = isOn;
+
+    if (mIoTClient) {
+        (void)IoTHubDeviceClient_LL_SetOption(mIoTClient, OPTION_LOG_TRACE, &mIsTraceOn);
+    }
+}
+
+/* How often the throughput is reported to the device twin, 0 for never */
+void Cloud_SetReportInterval(unsigned int seconds)
+{
+    mReportIntervalSeconds = seconds;
+}
+
+size_t Cloud_GetPendingCount(void)
+{
+    return mPendingCount;
+}
+
+void Cloud_GetSendStats(CloudSendStats *stats)
+{
+    if (stats) {
+        *stats = mSendStats;
+    }
+}
+
+bool Cloud_IsConnected(void)
+{
+    return mIsConnected;
+}
+
+/* A metrics collector, see Metrics_AddCollector */
+void Cloud_CollectMetrics(void)
+{
+    MessagePoolStats poolStats;
+    RateLimiterStats rateStats;
+
+    MessagePool_GetStats(&poolStats);
+    RateLimiter_GetStats(&rateStats);
+
+    Metrics_Set("cloud_messages_sent_total", METRICS_TYPE_COUNTER,
+                "Messages handed to the IoT Hub client, resends included.", (double)mSendStats.sentCount);
+    Metrics_Set("cloud_messages_acked_total", METRICS_TYPE_COUNTER, "Messages confirmed by the IoT Hub.",
+                (double)mSendStats.ackCount);
+    Metrics_Set("cloud_messages_failed_total", METRICS_TYPE_COUNTER, "Messages given up on.",
+                (double)mSendStats.failCount);
+    Metrics_Set("cloud_messages_resent_total", METRICS_TYPE_COUNTER, "Messages sent again after a failed attempt.",
+                (double)mSendStats.resendCount);
+    Metrics_Set("cloud_bytes_sent_total", METRICS_TYPE_COUNTER, "Payload bytes handed to the IoT Hub client.",
+                (double)mSendStats.sentBytes);
+    Metrics_Set("cloud_bytes_acked_total", METRICS_TYPE_COUNTER, "Payload bytes confirmed by the IoT Hub.",
+                (double)mSendStats.ackBytes);
+    Metrics_Set("cloud_messages_in_flight", METRICS_TYPE_GAUGE, "Messages sent and not yet confirmed.",
+                (double)mSendStats.inFlightCount);
+    Metrics_Set("cloud_messages_pending", METRICS_TYPE_GAUGE, "Messages queued in front of the in-flight window.",
+                (double)mPendingCount);
+    Metrics_Set("cloud_message_pool_in_use", METRICS_TYPE_GAUGE, "Message pool slots in use.",
+                (double)poolStats.inUse);
+    Metrics_Set("cloud_reconnects_total", METRICS_TYPE_COUNTER, "Connections established again after a loss.",
+                (double)mSendStats.reconnectCount);
+    Metrics_Set("cloud_token_renewals_total", METRICS_TYPE_COUNTER, "SAS tokens renewed by replacing the connection.",
+                (double)mSendStats.tokenRenewCount);
+    Metrics_Set("cloud_token_renewal_seconds_total", METRICS_TYPE_COUNTER,
+                "Time sends were held or reconnecting for SAS token renewals.",
+                (double)mSendStats.tokenRenewMs / 1000.0);
+    Metrics_Set("cloud_connected", METRICS_TYPE_GAUGE, "1 while the IoT Hub connection is up.", mIsConnected ? 1 : 0);
+    Metrics_Set("cloud_throttle_signals_total", METRICS_TYPE_COUNTER, "Throttling signals seen by the rate limiter.",
+                (double)rateStats.throttleSignalCount);
+    Metrics_Set("cloud_rate_limit_messages_per_second", METRICS_TYPE_GAUGE, "Effective message rate limit, 0 for none.",
+                rateStats.effectiveMessagesPerSecond);
+}
+
+int Cloud_ParseRetryPolicy(const char *name, CloudRetryPolicy *policy)
+{
+    for (size_t i = 0; name && i < sizeof(mRetryPolicyNames) / sizeof(mRetryPolicyNames[0]); i++) {
+        if (strcasecmp(mRetryPolicyNames[i].name, name) == 0) {
+            if (policy) {
+                *policy = mRetryPolicyNames[i].policy;
+            }
+
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int Cloud_ParseTransport(const char *name, CloudTransport *transport)
+{
+    for (size_t i = 0; name && i < CLOUD_TRANSPORT_COUNT; i++) {
+        if (strcasecmp(mTransports[i].name, name) == 0) {
+            if (transport) {
+                *transport = (CloudTransport)i;
+            }
+
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+const char *Cloud_GetTransportName(CloudTransport transport)
+{
+    return transport < CLOUD_TRANSPORT_COUNT ? mTransports[transport].name : "unknown";
+}
+
+IOTHUB_CLIENT_TRANSPORT_PROVIDER Cloud_GetTransportProtocol(CloudTransport transport)
+{
+    return transport < CLOUD_TRANSPORT_COUNT ? mTransports[transport].protocol : NULL;
+}
+
+static int CreateClient(const CloudConnectParams *params)
+{
+    char x509ConnectionString[CLOUD_MAX_HOSTNAME_LENGTH + CLOUD_MAX_DEVICE_ID_LENGTH + 32];
+    char *connectionString = NULL;
+
+    if (params->isX509) {
+        snprintf(x509ConnectionString, sizeof(x509ConnectionString), "HostName=%s;DeviceId=%s;x509=true",
+                 params->hostname, params->deviceId);
+    } else {
+        connectionString = CredentialStore_Compose(params->key);
+    }
+
+    /* Create the iothub handle */
+    mIoTClient = IoTHubDeviceClient_LL_CreateFromConnectionString(params->isX509 ? x509ConnectionString
+                                                                                  : connectionString,
+                                                                  mTransports[mTransport].protocol);
+    CredentialStore_Free(connectionString);
+
+    if (mIoTClient == NULL) {
+        printf("Failure creating IotHub device. Hint: Check your connection string.\n");
+        return -1;
+    }
+
+    /* A client without its options, twin callback or token settings is not left running */
+    if (ConfigureClient(params) != 0) {
+        IoTHubDeviceClient_LL_Destroy(mIoTClient);
+        mIoTClient = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int ConfigureClient(const CloudConnectParams *params)
+{
+    /* Set any option that are necessary. For available options please see the iothub_sdk_options.md documentation */
+    if (SetOptions(params) != 0) {
+        printf("Failure in setting options.\n");
+        return -1;
+    }
+
+    if (IoTHubDeviceClient_LL_SetRetryPolicy(mIoTClient, TranslateRetryPolicy(mRetryPolicy), mRetryTimeoutSeconds) !=
+        IOTHUB_CLIENT_OK) {
+        printf("Failure in setting retry policy.\n");
+        return -1;
+    }
+
+    IoTHubDeviceClient_LL_SetConnectionStatusCallback(mIoTClient, ConnectionStatusCallback, NULL);
+
+    if (mIsTuningEnabled &&
+        IoTHubDeviceClient_LL_SetDeviceTwinCallback(mIoTClient, DeviceTwinCallback, NULL) != IOTHUB_CLIENT_OK) {
+        printf("Failure in subscribing to the device twin.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int SetOptions(const CloudConnectParams *params)
 {
-    bool traceOn = true;
     bool urlEncodeOn = true;
     int res = 0;
 
-    res |= IoTHubDeviceClient_LL_SetOption(mIoTClient, OPTION_LOG_TRACE, &traceOn) != IOTHUB_CLIENT_OK;
+    res |= IoTHubDeviceClient_LL_SetOption(mIoTClient, OPTION_LOG_TRACE, &mIsTraceOn) != IOTHUB_CLIENT_OK;
 
 #ifdef SET_TRUSTED_CERT_IN_SAMPLES
     /* Setting the Trusted Certificate. This is only necessary on systems without built in certificate stores. */
     res |= IoTHubDeviceClient_LL_SetOption(mIoTClient, OPTION_TRUSTED_CERT, certificates) != IOTHUB_CLIENT_OK;
 #endif // SET_TRUSTED_CERT_IN_SAMPLES
 
+    /* A hub that presents a certificate of its own, such as cloud-hub on the local machine */
+    if (CredentialStore_GetLength(params->trustedCert)) {
+        res |= SetCredentialOption(OPTION_TRUSTED_CERT, params->trustedCert);
+    }
+
     /* Setting the auto URL Encoder (recommended for MQTT). Please use this option unless you are URL Encoding inputs
      * yourself. ONLY valid for use with MQTT */
-    res |= IoTHubDeviceClient_LL_SetOption(mIoTClient, OPTION_AUTO_URL_ENCODE_DECODE, &urlEncodeOn) != IOTHUB_CLIENT_OK;
+    if (mTransport == CLOUD_TRANSPORT_MQTT || mTransport == CLOUD_TRANSPORT_MQTT_WEBSOCKET) {
+        res |= IoTHubDeviceClient_LL_SetOption(mIoTClient, OPTION_AUTO_URL_ENCODE_DECODE, &urlEncodeOn) !=
+               IOTHUB_CLIENT_OK;
+    }
 
     if (params->isX509) {
-        res |= IoTHubDeviceClient_LL_SetOption(mIoTClient, OPTION_X509_CERT, params->cert) != IOTHUB_CLIENT_OK;
-        res |= IoTHubDeviceClient_LL_SetOption(mIoTClient, OPTION_X509_PRIVATE_KEY, params->key) != IOTHUB_CLIENT_OK;
+        res |= SetCredentialOption(OPTION_X509_CERT, params->cert);
+        res |= SetCredentialOption(OPTION_X509_PRIVATE_KEY, params->key);
+    }
+
+    if (mIsSasKey) {
+        size_t refreshSeconds = mTokenLifetimeSeconds * TOKEN_RENEW_PERCENT / 100;
+
+        res |= IoTHubDeviceClient_LL_SetOption(mIoTClient, OPTION_SAS_TOKEN_LIFETIME, &mTokenLifetimeSeconds) !=
+               IOTHUB_CLIENT_OK;
+
+        if (mTransport == CLOUD_TRANSPORT_AMQP || mTransport == CLOUD_TRANSPORT_AMQP_WEBSOCKET) {
+            res |= IoTHubDeviceClient_LL_SetOption(mIoTClient, OPTION_SAS_TOKEN_REFRESH_TIME, &refreshSeconds) !=
+                   IOTHUB_CLIENT_OK;
+        }
+    }
+
+    return res;
+}
+
+/* The IoT Hub client keeps a copy of the option, the composed text is only needed for the call */
+static int SetCredentialOption(const char *name, CredentialHandle handle)
+{
+    char *text = CredentialStore_Compose(handle);
+    int res = text == NULL || IoTHubDeviceClient_LL_SetOption(mIoTClient, name, text) != IOTHUB_CLIENT_OK;
+
+    CredentialStore_Free(text);
+    return res;
+}
+
+/* An MQTT connection keeps the SAS token it was opened with, so a new token takes a new connection. Left to the SDK,
+ * the connection is dropped when the token is due and the messages in flight wait for their resend timeout. Instead,
+ * sends are held until the in-flight window has drained, and the client is replaced while nothing is in flight. */
+static void RenewToken(uint64_t nowMs)
+{
+    uint64_t lifetimeMs = (uint64_t)mTokenLifetimeSeconds * 1000;
+    uint64_t drainTimeoutMs = lifetimeMs / 40 < TOKEN_DRAIN_TIMEOUT_MS ? lifetimeMs / 40 : TOKEN_DRAIN_TIMEOUT_MS;
+
+    if (!mIsTokenRenewed || mConnectParams == NULL) {
+        return;
+    }
+
+    if (mTokenRenewal == TOKEN_RENEWAL_IDLE && mIsConnected && !mIsLinkDown &&
+        nowMs - mTokenIssuedMs >= lifetimeMs * TOKEN_RENEW_PERCENT / 100) {
+        mTokenRenewal = TOKEN_RENEWAL_DRAINING;
+        mRenewStartMs = nowMs;
+    }
+
+    if (mTokenRenewal != TOKEN_RENEWAL_DRAINING) {
+        return;
+    }
+
+    if (mSendStats.inFlightCount && nowMs - mRenewStartMs < drainTimeoutMs) {
+        return;
+    }
+
+    /* Messages still in flight are completed by destroying the client and sent again, with their id */
+    mTokenRenewal = TOKEN_RENEWAL_CONNECTING;
+    IoTHubDeviceClient_LL_Destroy(mIoTClient);
+    mIoTClient = NULL;
+
+    if (CreateClient(mConnectParams) != 0) {
+        /* Without a client nothing can be delivered any more, as when the SDK gives up reconnecting */
+        printf("Failure renewing the SAS token.\n");
+        mTokenRenewal = TOKEN_RENEWAL_IDLE;
+        ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED, IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED,
+                                 NULL);
+    }
+}
+
+static int SendPoolMessage(PoolMessage *msg)
+{
+    /* The SDK clones the message when it is queued. The slot keeps its own for a resend until the send is confirmed. */
+    IOTHUB_MESSAGE_HANDLE msgHandle = (IOTHUB_MESSAGE_HANDLE)msg->handle;
+
+    /* A resent message keeps its id */
+    if (msg->sequence == 0) {
+        msg->sequence = ++mSequence;
+    }
+
+    char messageId[48];
+    snprintf(messageId, sizeof(messageId), "%s-%u", mSessionId, (unsigned int)msg->sequence);
+    (void)IoTHubMessage_SetMessageId(msgHandle, messageId);
+
+    msg->sendTimeMs = Clock_GetMs();
+
+    if (msg->firstSendTimeMs == 0) {
+        msg->firstSendTimeMs = msg->sendTimeMs;
+    }
+
+    int res = (IoTHubDeviceClient_LL_SendEventAsync(mIoTClient, msgHandle, SendCallback, msg) == IOTHUB_CLIENT_OK)
+                  ? 0
+                  : -1;
+
+    if (res == 0) {
+        mSendStats.sentCount++;
+        mSendStats.inFlightCount++;
+        mSendStats.sentBytes += msg->size;
     }
 
     return res;
 }
 
+static void DispatchPendingMessages(void)
+{
+    /* While the link is down, messages wait here rather than in the SDK, so nothing is sent into a dead connection.
+     * The same goes for a connection that is about to be replaced for a new SAS token. */
+    while (mPendingCount && mIoTClient && !mIsLinkDown && mTokenRenewal != TOKEN_RENEWAL_DRAINING) {
+        /* Keeping the SDK queue short is what lets a high priority message overtake queued bulk messages */
+        if (mInFlightWindow && mSendStats.inFlightCount >= mInFlightWindow) {
+            break;
+        }
+
+        RateLimiterResult limit = RateLimiter_Acquire(PeekPendingMessage()->size, Clock_GetMs());
+
+        if (limit == RATELIMITER_WAIT) {
+            break;
+        }
+
+        PoolMessage *msg = PopPendingMessage();
+
+        /* Messages over the daily budget are failed rather than held, so the caller keeps them for a later run */
+        if (limit == RATELIMITER_BUDGET_EXHAUSTED || SendPoolMessage(msg) != 0) {
+            CompleteMessage(msg, CLOUD_EVENT_SENDDATAFAILED);
+        }
+    }
+}
+
+static void FailPendingMessages(void)
+{
+    PoolMessage *msg;
+
+    while ((msg = PopPendingMessage()) != NULL) {
+        CompleteMessage(msg, CLOUD_EVENT_SENDDATAFAILED);
+    }
+}
+
+static void PushPendingMessage(PoolMessage *msg, bool atFront)
+{
+    int p = msg->priority;
+
+    if (atFront) {
+        msg->next = mPendingHead[p];
+        mPendingHead[p] = msg;
+
+        if (mPendingTail[p] == NULL) {
+            mPendingTail[p] = msg;
+        }
+    } else {
+        msg->next = NULL;
+
+        if (mPendingTail[p]) {
+            mPendingTail[p]->next = msg;
+        } else {
+            mPendingHead[p] = msg;
+        }
+
+        mPendingTail[p] = msg;
+    }
+
+    mPendingCount++;
+}
+
+static PoolMessage *PeekPendingMessage(void)
+{
+    for (size_t i = 0; i < CLOUD_PRIORITY_COUNT; i++) {
+        if (mPendingHead[mDispatchOrder[i]]) {
+            return mPendingHead[mDispatchOrder[i]];
+        }
+    }
+
+    return NULL;
+}
+
+static PoolMessage *PopPendingMessage(void)
+{
+    PoolMessage *msg = PeekPendingMessage();
+
+    if (msg) {
+        int p = msg->priority;
+        mPendingHead[p] = msg->next;
+
+        if (mPendingHead[p] == NULL) {
+            mPendingTail[p] = NULL;
+        }
+
+        msg->next = NULL;
+        mPendingCount--;
+    }
+
+    return msg;
+}
+
+/* The message of the slot goes with it, the next send makes a new one */
+static void ReleaseMessage(PoolMessage *msg)
+{
+    if (msg->handle) {
+        IoTHubMessage_Destroy((IOTHUB_MESSAGE_HANDLE)msg->handle);
+    }
+
+    MessagePool_Release(msg);
+}
+
+static void CompleteMessage(PoolMessage *msg, CloudEvent evt)
+{
+    void *contextData = msg->contextData;
+
+    if (evt == CLOUD_EVENT_SENDDATASUCCEEDED) {
+        mSendStats.ackCount++;
+        mSendStats.ackBytes += msg->size;
+    } else {
+        mSendStats.failCount++;
+
+        const unsigned char *data;
+        size_t size;
+
+        if (mUnsentHandler &&
+            IoTHubMessage_GetByteArray((IOTHUB_MESSAGE_HANDLE)msg->handle, &data, &size) == IOTHUB_MESSAGE_OK) {
+            mUnsentHandler(data, size, msg->contentType, contextData);
+        }
+    }
+
+    /* Return the message to the pool before notifying, so the handler can send again right away */
+    ReleaseMessage(msg);
+
+    if (mEventHandler) {
+        mEventHandler(evt, contextData);
+    }
+}
+
 static int SetProvisioningDeviceOptions(CloudConnectParams *params)
 {
     bool traceOn = true;
@@ -181,9 +835,8 @@ static int SetProvisioningDeviceOptions(CloudConnectParams *params)
     res |= Prov_Device_LL_SetOption(mProvisioningDevice, PROV_OPTION_LOG_TRACE, &traceOn) != PROV_DEVICE_RESULT_OK;
 
     if (params->isX509) {
-        res |= Prov_Device_LL_SetOption(mProvisioningDevice, OPTION_X509_CERT, params->cert) != PROV_DEVICE_RESULT_OK;
-        res |= Prov_Device_LL_SetOption(mProvisioningDevice, OPTION_X509_PRIVATE_KEY, params->key) !=
-               PROV_DEVICE_RESULT_OK;
+        res |= SetProvisioningCredentialOption(OPTION_X509_CERT, params->cert);
+        res |= SetProvisioningCredentialOption(OPTION_X509_PRIVATE_KEY, params->key);
         res |= Prov_Device_LL_SetOption(mProvisioningDevice, PROV_REGISTRATION_ID, params->deviceId) !=
                PROV_DEVICE_RESULT_OK;
     }
@@ -191,14 +844,37 @@ static int SetProvisioningDeviceOptions(CloudConnectParams *params)
     return res;
 }
 
+static int SetProvisioningCredentialOption(const char *name, CredentialHandle handle)
+{
+    char *text = CredentialStore_Compose(handle);
+    int res = text == NULL || Prov_Device_LL_SetOption(mProvisioningDevice, name, text) != PROV_DEVICE_RESULT_OK;
+
+    CredentialStore_Free(text);
+    return res;
+}
+
 static void SendCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *userContextCallback)
 {
-    CloudEvent evt =
-        result == IOTHUB_CLIENT_CONFIRMATION_OK ? CLOUD_EVENT_SENDDATASUCCEEDED : CLOUD_EVENT_SENDDATAFAILED;
+    PoolMessage *msg = (PoolMessage *)userContextCallback;
+    uint64_t now = Clock_GetMs();
 
-    if (mEventHandler) {
-        mEventHandler(evt, userContextCallback);
+    if (mSendStats.inFlightCount) {
+        mSendStats.inFlightCount--;
+    }
+
+    /* A failed confirmation carries no reason, a timeout or an error is as likely a lost link or a shutdown. The hub
+     * throttles by delaying acks and by quota disconnects, which are what the rate limiter is told about. */
+    if (result == IOTHUB_CLIENT_CONFIRMATION_OK) {
+        RateLimiter_ReportAck(now - msg->sendTimeMs, now);
     }
+
+    if (ShouldResendMessage(msg, result, now)) {
+        RequeueMessage(msg);
+        return;
+    }
+
+    CompleteMessage(msg, result == IOTHUB_CLIENT_CONFIRMATION_OK ? CLOUD_EVENT_SENDDATASUCCEEDED
+                                                                 : CLOUD_EVENT_SENDDATAFAILED);
 }
 
 static void ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
@@ -206,14 +882,103 @@ static void ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
 {
     (void)user_context;
     CloudEvent evt = CLOUD_EVENT_CONNECTIONSTATUSCHANGED;
-    CloudConnectionStatus s = TranslateIoTClientConnectionStatus(result, reason);
+    CloudConnectionStatus s = Cloud_TranslateConnectionStatus(result, reason);
+    bool wasConnected = mIsConnected;
     mIsConnected = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
 
+    if (s == CLOUD_CONNECTION_DISCONNECTED_QUOTA_EXCEEDED) {
+        RateLimiter_ReportThrottle(Clock_GetMs());
+    }
+
+    if (mIsConnected) {
+        uint64_t nowMs = Clock_GetMs();
+
+        if (mIsLinkDown) {
+            mSendStats.reconnectCount++;
+        }
+
+        /* The SDK makes a new token for every connection */
+        if (mTokenRenewal == TOKEN_RENEWAL_CONNECTING) {
+            uint64_t renewMs = nowMs - mRenewStartMs;
+
+            mSendStats.tokenRenewCount++;
+            mSendStats.tokenRenewMs += renewMs;
+            mSendStats.maxTokenRenewMs = renewMs > mSendStats.maxTokenRenewMs ? renewMs : mSendStats.maxTokenRenewMs;
+            mTokenRenewal = TOKEN_RENEWAL_IDLE;
+        }
+
+        mTokenIssuedMs = nowMs;
+
+        mIsLinkDown = false;
+    } else if (wasConnected) {
+        mIsLinkDown = true;
+    }
+
+    /* The SDK gave up reconnecting, so held messages can no longer be delivered */
+    if (s == CLOUD_CONNECTION_DISCONNECTED_RETRY_EXPIRED) {
+        mIsRetryExpired = true;
+        FailPendingMessages();
+    }
+
     if (mEventHandler) {
         mEventHandler(evt, &s);
     }
 }
 
+static bool ShouldResendMessage(PoolMessage *msg, IOTHUB_CLIENT_CONFIRMATION_RESULT result, uint64_t now)
+{
+    if (result == IOTHUB_CLIENT_CONFIRMATION_OK) {
+        return false;
+    }
+
+    /* Messages completed because the client is being destroyed are not resent, the caller asked for that, unless the
+     * client is only replaced for a new SAS token */
+    if (result == IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY) {
+        return mTokenRenewal == TOKEN_RENEWAL_CONNECTING;
+    }
+
+    if (mRetryPolicy == CLOUD_RETRY_NONE || mIsRetryExpired || mIoTClient == NULL) {
+        return false;
+    }
+
+    /* Use the same limit as the reconnect policy, so a message is never held longer than the link is retried */
+    return mRetryTimeoutSeconds == 0 || now - msg->firstSendTimeMs < (uint64_t)mRetryTimeoutSeconds * 1000;
+}
+
+static void RequeueMessage(PoolMessage *msg)
+{
+    /* Requeue at the front so replayed messages go out before newer ones of the same priority */
+    PushPendingMessage(msg, true);
+    msg->resendCount++;
+    mSendStats.resendCount++;
+}
+
+static IOTHUB_CLIENT_RETRY_POLICY TranslateRetryPolicy(CloudRetryPolicy policy)
+{
+    switch (policy) {
+        case CLOUD_RETRY_EXPONENTIAL_BACKOFF:
+            return IOTHUB_CLIENT_RETRY_EXPONENTIAL_BACKOFF;
+
+        case CLOUD_RETRY_LINEAR_BACKOFF:
+            return IOTHUB_CLIENT_RETRY_LINEAR_BACKOFF;
+
+        case CLOUD_RETRY_INTERVAL:
+            return IOTHUB_CLIENT_RETRY_INTERVAL;
+
+        case CLOUD_RETRY_RANDOM:
+            return IOTHUB_CLIENT_RETRY_RANDOM;
+
+        case CLOUD_RETRY_IMMEDIATE:
+            return IOTHUB_CLIENT_RETRY_IMMEDIATE;
+
+        case CLOUD_RETRY_NONE:
+            return IOTHUB_CLIENT_RETRY_NONE;
+
+        default:
+            return IOTHUB_CLIENT_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER;
+    }
+}
+
 static void RegisterDeviceCallback(PROV_DEVICE_RESULT register_result, const char *iothub_uri, const char *device_id,
                                    void *user_context)
 {
@@ -234,8 +999,8 @@ static void RegistrationStatusCallback(PROV_DEVICE_REG_STATUS reg_status, void *
     (void)reg_status;
 }
 
-static CloudConnectionStatus TranslateIoTClientConnectionStatus(IOTHUB_CLIENT_CONNECTION_STATUS status,
-                                                                IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason)
+CloudConnectionStatus Cloud_TranslateConnectionStatus(IOTHUB_CLIENT_CONNECTION_STATUS status,
+                                                      IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason)
 {
     CloudConnectionStatus s = CLOUD_CONNECTION_DISCONNECTED_UNKNOWN;
 
@@ -282,3 +1047,148 @@ static CloudConnectionStatus TranslateIoTClientConnectionStatus(IOTHUB_CLIENT_CO
 
     return s;
 }
+
+/* Applies the tuning section of the desired properties, either of the full twin or of a patch, and reports what was
+ * applied. A patch that leaves the tuning section alone is not reported. */
+static void DeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload, size_t size,
+                               void *userContextCallback)
+{
+    (void)userContextCallback;
+    json_tokener *tokener = json_tokener_new();
+    json_object *twin = tokener ? json_tokener_parse_ex(tokener, (const char *)payload, (int)size) : NULL;
+    json_object *desired = twin;
+    json_object *version = NULL;
+    json_object *tuning = NULL;
+
+    json_tokener_free(tokener);
+
+    if (twin && updateState == DEVICE_TWIN_UPDATE_COMPLETE && !json_object_object_get_ex(twin, "desired", &desired)) {
+        desired = NULL;
+    }
+
+    /* The full twin comes again with every reconnect, a version that was applied already is skipped */
+    if (desired == NULL || !json_object_object_get_ex(desired, "$version", &version) ||
+        json_object_get_int64(version) == mTuningVersion) {
+        json_object_put(twin);
+        return;
+    }
+
+    mTuningVersion = json_object_get_int64(version);
+
+    if (json_object_object_get_ex(desired, "tuning", &tuning) && json_object_is_type(tuning, json_type_object)) {
+        json_object_object_foreach(tuning, name, value)
+        {
+            ApplyTuningSetting(name, value);
+        }
+    }
+
+    if (tuning || updateState == DEVICE_TWIN_UPDATE_COMPLETE) {
+        ReportTuning();
+    }
+
+    json_object_put(twin);
+}
+
+/* Every setting is handed to the application, which keeps the values of its configuration and applies them, the ones
+ * of the Cloud library included, through the Cloud_Set functions. A setting removed from the desired properties keeps
+ * its last value. */
+static void ApplyTuningSetting(const char *name, json_object *value)
+{
+    CloudTuningSetting setting = {name, json_object_get_string(value), false};
+
+    if (value == NULL) {
+        return;
+    }
+
+    if (mEventHandler) {
+        mEventHandler(CLOUD_EVENT_TUNINGREQUESTED, &setting);
+    }
+
+    printf("Tuning %s to %s%s\n", name, setting.value, setting.isApplied ? "" : " rejected");
+
+    /* A null in the reported properties removes an earlier rejection */
+    if (setting.isApplied) {
+        json_object_object_add(mAppliedTuning, name, json_object_get(value));
+
+        if (json_object_object_get_ex(mRejectedTuning, name, NULL)) {
+            json_object_object_add(mRejectedTuning, name, NULL);
+        }
+    } else {
+        json_object_object_add(mRejectedTuning, name, json_object_get(value));
+    }
+}
+
+static void ReportTuning(void)
+{
+    json_object *reported = json_object_new_object();
+    json_object *tuning = json_object_new_object();
+
+    json_object_object_add(tuning, "version", json_object_new_int64(mTuningVersion));
+    json_object_object_add(tuning, "applied", json_object_get(mAppliedTuning));
+    json_object_object_add(tuning, "rejected", json_object_get(mRejectedTuning));
+    json_object_object_add(reported, "tuning", tuning);
+    SendReportedState(reported);
+}
+
+/* Rates over the last report interval, from the same counters as Cloud_GetSendStats */
+static void ReportThroughput(uint64_t nowMs)
+{
+    if (mLastReportMs == 0) {
+        mLastReportMs = nowMs;
+        mLastReportStats = mSendStats;
+        return;
+    }
+
+    if (nowMs - mLastReportMs < (uint64_t)mReportIntervalSeconds * 1000) {
+        return;
+    }
+
+    double seconds = (double)(nowMs - mLastReportMs) / 1000.0;
+    json_object *reported = json_object_new_object();
+    json_object *throughput = json_object_new_object();
+
+    json_object_object_add(throughput, "intervalSeconds", json_object_new_int64((int64_t)seconds));
+    json_object_object_add(throughput, "messagesPerSecond",
+                           json_object_new_double((double)(mSendStats.ackCount - mLastReportStats.ackCount) / seconds));
+    json_object_object_add(throughput, "bytesPerSecond",
+                           json_object_new_double((double)(mSendStats.ackBytes - mLastReportStats.ackBytes) / seconds));
+    json_object_object_add(throughput, "failed",
+                           json_object_new_int64((int64_t)(mSendStats.failCount - mLastReportStats.failCount)));
+    json_object_object_add(throughput, "resent",
+                           json_object_new_int64((int64_t)(mSendStats.resendCount - mLastReportStats.resendCount)));
+    json_object_object_add(
+        throughput, "reconnects",
+        json_object_new_int64((int64_t)(mSendStats.reconnectCount - mLastReportStats.reconnectCount)));
+    json_object_object_add(
+        throughput, "tokenRenewals",
+        json_object_new_int64((int64_t)(mSendStats.tokenRenewCount - mLastReportStats.tokenRenewCount)));
+    json_object_object_add(throughput, "inFlight", json_object_new_int64((int64_t)mSendStats.inFlightCount));
+    json_object_object_add(throughput, "pending", json_object_new_int64((int64_t)mPendingCount));
+    json_object_object_add(reported, "throughput", throughput);
+    SendReportedState(reported);
+
+    mLastReportMs = nowMs;
+    mLastReportStats = mSendStats;
+}
+
+/* Takes the reference to reported. The client copies the document and sends it in the background. */
+static void SendReportedState(json_object *reported)
+{
+    const char *text = json_object_to_json_string_ext(reported, JSON_C_TO_STRING_PLAIN);
+
+    if (IoTHubDeviceClient_LL_SendReportedState(mIoTClient, (const unsigned char *)text, strlen(text),
+                                                ReportedStateCallback, NULL) != IOTHUB_CLIENT_OK) {
+        printf("Failure in reporting to the device twin.\n");
+    }
+
+    json_object_put(reported);
+}
+
+static void ReportedStateCallback(int statusCode, void *userContextCallback)
+{
+    (void)userContextCallback;
+
+    if (statusCode < 200 || statusCode >= 300) {
+        printf("Reported properties refused with status %d\n", statusCode);
+    }
+}
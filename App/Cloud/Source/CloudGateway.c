@@ -0,0 +1,353 @@
+#include "CloudGateway.h"
+#include "CloudSdk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iothub_device_client_ll.h"
+#include "iothub_message.h"
+#include "iothub_transport.h"
+
+struct sCloudDevice {
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE client;
+    char deviceId[CLOUDGATEWAY_DEVICE_ID_SIZE];
+    void *userContext;
+    CloudConnectionStatus status;
+    bool isAnnounced;
+};
+
+/* Ties a send confirmation back to the identity the message was sent for */
+typedef struct sGatewayMessage {
+    CloudDevice *device;
+    void *contextData;
+    struct sGatewayMessage *next;
+} GatewayMessage;
+
+static TRANSPORT_HANDLE mTransportHandle = NULL;
+static CloudTransport mTransport = CLOUD_TRANSPORT_AMQP;
+static CloudDevice *mDevices = NULL;
+static size_t mMaxDevices = 0;
+static CloudDevice *mDriver = NULL;
+static size_t mUnannouncedCount = 0;
+static GatewayMessage *mMessages = NULL;
+static GatewayMessage *mFreeMessages = NULL;
+static CloudGateway_EventHandler mEventHandler = NULL;
+static CloudGatewayStats mStats;
+
+static const char *DEFAULT_CONTENT_TYPE = "application/json";
+static const char *DEFAULT_CONTENT_ENCODING = "utf-8";
+
+static bool IsShareable(CloudTransport transport);
+static CloudDevice *FindDriver(void);
+static void SendCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *userContextCallback);
+static void ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
+                                     IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void *user_context);
+
+int CloudGateway_Open(const char *hostname, CloudTransport transport, size_t maxDevices)
+{
+    char hubName[256];
+    const char *suffix = hostname ? strchr(hostname, '.') : NULL;
+
+    if (mTransportHandle != NULL || suffix == NULL || maxDevices == 0) {
+        return -1;
+    }
+
+    if (!IsShareable(transport)) {
+        printf("Transport %s cannot carry more than one device\n", Cloud_GetTransportName(transport));
+        return -1;
+    }
+
+    /* The transport takes the hub name and the suffix apart, e.g. "myhub" and "azure-devices.net" */
+    snprintf(hubName, sizeof(hubName), "%.*s", (int)(suffix - hostname), hostname);
+
+    mDevices = calloc(maxDevices, sizeof(CloudDevice));
+    mMessages = calloc(CLOUDGATEWAY_MAX_IN_FLIGHT, sizeof(GatewayMessage));
+
+    if (mDevices == NULL || mMessages == NULL) {
+        CloudGateway_Close();
+        return -1;
+    }
+
+    mTransportHandle = IoTHubTransport_Create(Cloud_GetTransportProtocol(transport), hubName, suffix + 1);
+
+    if (mTransportHandle == NULL) {
+        printf("Failure creating the shared transport for %s\n", hostname);
+        CloudGateway_Close();
+        return -1;
+    }
+
+    mFreeMessages = NULL;
+
+    for (size_t i = CLOUDGATEWAY_MAX_IN_FLIGHT; i > 0; i--) {
+        mMessages[i - 1].next = mFreeMessages;
+        mFreeMessages = &mMessages[i - 1];
+    }
+
+    mTransport = transport;
+    mMaxDevices = maxDevices;
+    mDriver = NULL;
+    mUnannouncedCount = 0;
+    memset(&mStats, 0, sizeof(mStats));
+    return 0;
+}
+
+void CloudGateway_Close(void)
+{
+    /* Destroying a client completes its queued messages, which returns them to the free list */
+    for (size_t i = 0; mDevices && i < mMaxDevices; i++) {
+        if (mDevices[i].client) {
+            CloudGateway_RemoveDevice(&mDevices[i]);
+        }
+    }
+
+    if (mTransportHandle) {
+        IoTHubTransport_Destroy(mTransportHandle);
+        mTransportHandle = NULL;
+    }
+
+    free(mDevices);
+    free(mMessages);
+    mDevices = NULL;
+    mMessages = NULL;
+    mFreeMessages = NULL;
+    mMaxDevices = 0;
+}
+
+void CloudGateway_RegisterEventHandler(CloudGateway_EventHandler eventHandler)
+{
+    mEventHandler = eventHandler;
+}
+
+CloudDevice *CloudGateway_AddDevice(const char *deviceId, const char *deviceKey, void *userContext)
+{
+    CloudDevice *device = NULL;
+
+    if (mTransportHandle == NULL || deviceId == NULL || deviceKey == NULL ||
+        strlen(deviceId) >= CLOUDGATEWAY_DEVICE_ID_SIZE) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < mMaxDevices && device == NULL; i++) {
+        if (mDevices[i].client == NULL) {
+            device = &mDevices[i];
+        }
+    }
+
+    if (device == NULL) {
+        return NULL;
+    }
+
+    IOTHUB_CLIENT_DEVICE_CONFIG config;
+    memset(&config, 0, sizeof(config));
+    config.protocol = Cloud_GetTransportProtocol(mTransport);
+    config.transportHandle = IoTHubTransport_GetLLTransport(mTransportHandle);
+    config.deviceId = deviceId;
+    config.deviceKey = deviceKey;
+
+    device->client = IoTHubDeviceClient_LL_CreateWithTransport(&config);
+
+    if (device->client == NULL) {
+        printf("Failure adding device %s to the shared transport\n", deviceId);
+        return NULL;
+    }
+
+    snprintf(device->deviceId, sizeof(device->deviceId), "%s", deviceId);
+    device->userContext = userContext;
+    device->status = CLOUD_CONNECTION_DISCONNECTED_UNKNOWN;
+    IoTHubDeviceClient_LL_SetConnectionStatusCallback(device->client, ConnectionStatusCallback, device);
+
+    /* HTTP has no standing connection that could be reported up, so each identity is announced once from the task */
+    device->isAnnounced = (mTransport != CLOUD_TRANSPORT_HTTP);
+
+    if (!device->isAnnounced) {
+        mUnannouncedCount++;
+    }
+
+    if (mDriver == NULL) {
+        mDriver = device;
+    }
+
+    mStats.deviceCount++;
+    return device;
+}
+
+void CloudGateway_RemoveDevice(CloudDevice *device)
+{
+    if (device == NULL || device->client == NULL) {
+        return;
+    }
+
+    IoTHubDeviceClient_LL_Destroy(device->client);
+    device->client = NULL;
+
+    if (device->status == CLOUD_CONNECTION_CONNECTED && mStats.connectedCount) {
+        mStats.connectedCount--;
+    }
+
+    if (!device->isAnnounced && mUnannouncedCount) {
+        mUnannouncedCount--;
+    }
+
+    memset(device, 0, sizeof(CloudDevice));
+    mStats.deviceCount--;
+
+    if (mDriver == device) {
+        mDriver = FindDriver();
+    }
+}
+
+void CloudGateway_Task(void)
+{
+    for (size_t i = 0; mUnannouncedCount && i < mMaxDevices; i++) {
+        CloudDevice *device = &mDevices[i];
+
+        if (device->client && !device->isAnnounced) {
+            device->isAnnounced = true;
+            mUnannouncedCount--;
+            ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_AUTHENTICATED, IOTHUB_CLIENT_CONNECTION_OK, device);
+        }
+    }
+
+    /* DoWork of any one client runs the shared transport, which serves every identity registered on it. Driving each
+     * client in turn would walk all identities once per client. */
+    if (mDriver) {
+        IoTHubDeviceClient_LL_DoWork(mDriver->client);
+    }
+}
+
+int CloudGateway_SendData(CloudDevice *device, const void *data, size_t size, const CloudMessageOptions *options,
+                          void *contextData)
+{
+    if (device == NULL || device->client == NULL || data == NULL || mFreeMessages == NULL) {
+        return -1;
+    }
+
+    IOTHUB_MESSAGE_HANDLE msgHandle = IoTHubMessage_CreateFromByteArray(data, size);
+
+    if (msgHandle == NULL) {
+        return -1;
+    }
+
+    const char *contentType = DEFAULT_CONTENT_TYPE;
+    const char *contentEncoding = DEFAULT_CONTENT_ENCODING;
+
+    /* Messages go to the SDK right away, so the priority of the options does not apply here */
+    if (options) {
+        contentType = options->contentType ? options->contentType : contentType;
+        contentEncoding = options->contentEncoding ? options->contentEncoding : contentEncoding;
+
+        for (size_t i = 0; i < options->propertyCount; i++) {
+            (void)IoTHubMessage_SetProperty(msgHandle, options->properties[i].name, options->properties[i].value);
+        }
+    }
+
+    (void)IoTHubMessage_SetContentTypeSystemProperty(msgHandle, contentType);
+
+    /* An empty encoding leaves it unset, which is what binary payloads need */
+    if (contentEncoding[0]) {
+        (void)IoTHubMessage_SetContentEncodingSystemProperty(msgHandle, contentEncoding);
+    }
+
+    GatewayMessage *msg = mFreeMessages;
+    mFreeMessages = msg->next;
+    msg->device = device;
+    msg->contextData = contextData;
+
+    int res = (IoTHubDeviceClient_LL_SendEventAsync(device->client, msgHandle, SendCallback, msg) == IOTHUB_CLIENT_OK)
+                  ? 0
+                  : -1;
+
+    IoTHubMessage_Destroy(msgHandle);
+
+    if (res != 0) {
+        msg->next = mFreeMessages;
+        mFreeMessages = msg;
+        return -1;
+    }
+
+    mStats.sentCount++;
+    mStats.inFlightCount++;
+    return 0;
+}
+
+const char *CloudGateway_GetDeviceId(const CloudDevice *device)
+{
+    return device ? device->deviceId : NULL;
+}
+
+void *CloudGateway_GetDeviceContext(const CloudDevice *device)
+{
+    return device ? device->userContext : NULL;
+}
+
+CloudConnectionStatus CloudGateway_GetDeviceStatus(const CloudDevice *device)
+{
+    return device ? device->status : CLOUD_CONNECTION_DISCONNECTED_UNKNOWN;
+}
+
+void CloudGateway_GetStats(CloudGatewayStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+    }
+}
+
+static bool IsShareable(CloudTransport transport)
+{
+    return transport == CLOUD_TRANSPORT_AMQP || transport == CLOUD_TRANSPORT_AMQP_WEBSOCKET ||
+           transport == CLOUD_TRANSPORT_HTTP;
+}
+
+static CloudDevice *FindDriver(void)
+{
+    for (size_t i = 0; i < mMaxDevices; i++) {
+        if (mDevices[i].client) {
+            return &mDevices[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void SendCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *userContextCallback)
+{
+    GatewayMessage *msg = (GatewayMessage *)userContextCallback;
+    CloudDevice *device = msg->device;
+    void *contextData = msg->contextData;
+    CloudEvent evt = (result == IOTHUB_CLIENT_CONFIRMATION_OK) ? CLOUD_EVENT_SENDDATASUCCEEDED
+                                                               : CLOUD_EVENT_SENDDATAFAILED;
+
+    if (mStats.inFlightCount) {
+        mStats.inFlightCount--;
+    }
+
+    evt == CLOUD_EVENT_SENDDATASUCCEEDED ? mStats.ackCount++ : mStats.failCount++;
+
+    /* The message is free again before the handler runs, so the handler can send the next one */
+    msg->next = mFreeMessages;
+    mFreeMessages = msg;
+
+    if (mEventHandler) {
+        mEventHandler(device, evt, contextData);
+    }
+}
+
+static void ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
+                                     IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void *user_context)
+{
+    CloudDevice *device = (CloudDevice *)user_context;
+    CloudConnectionStatus s = Cloud_TranslateConnectionStatus(result, reason);
+
+    if (s == CLOUD_CONNECTION_CONNECTED && device->status != CLOUD_CONNECTION_CONNECTED) {
+        mStats.connectedCount++;
+    } else if (s != CLOUD_CONNECTION_CONNECTED && device->status == CLOUD_CONNECTION_CONNECTED &&
+               mStats.connectedCount) {
+        mStats.connectedCount--;
+    }
+
+    device->status = s;
+
+    if (mEventHandler) {
+        mEventHandler(device, CLOUD_EVENT_CONNECTIONSTATUSCHANGED, &s);
+    }
+}
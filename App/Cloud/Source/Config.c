@@ -0,0 +1,421 @@
+#include "Config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+/* Aligned for any type, as parsed values of other types are kept in it */
+typedef union __attribute__((aligned)) uConfigValue {
+    unsigned int uintValue;
+    unsigned long ulongValue;
+    size_t sizeValue;
+    double doubleValue;
+    bool switchValue;
+    char stringValue[CONFIG_MAX_LINE_LENGTH];
+} ConfigValue;
+
+typedef struct sConfigContext {
+    const ConfigField *schema;
+    size_t count;
+    Config_Handler handler;
+    void *handlerContext;
+    bool isApplying;
+    int changeCount;
+    size_t settingIndex;
+    size_t *lastIndexes;
+} ConfigContext;
+
+static int mWatchFd = -1;
+static char mWatchName[CONFIG_MAX_PATH_LENGTH];
+
+static int LoadSetting(ConfigurationSetting *setting, void *context);
+static int ReloadSetting(ConfigurationSetting *setting, void *context);
+static const ConfigField *FindField(const ConfigField *schema, size_t count, const char *name);
+static int ParseValue(const ConfigField *field, const char *text, ConfigValue *value);
+static int ParseUnsigned(const char *text, unsigned long long max, unsigned long long *number);
+static size_t GetValueSize(const ConfigField *field);
+static bool IsEqual(const ConfigField *field, const ConfigValue *value);
+static void StoreValue(const ConfigField *field, const ConfigValue *value);
+static int ApplyValue(const ConfigField *field, const ConfigValue *value);
+
+/* Reads "Name=Value" lines, skipping empty lines and comments, and hands each setting to the handler until it fails.
+ * The setting points into the line buffer and is only valid during the call. */
+int Config_Parse(const char *filename, Config_Handler handler, void *context)
+{
+    FILE *file = fopen(filename, "r");
+    int res = 0;
+
+    if (file == NULL) {
+        perror("Error opening file");
+        return -1;
+    }
+
+    char line[CONFIG_MAX_LINE_LENGTH];
+
+    while (fgets(line, sizeof(line), file)) {
+        /* Remove trailing newline character */
+        line[strcspn(line, "\n")] = '\0';
+
+        /* Ignore empty lines and lines starting with '#' */
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+
+        /* Find the '=' character to split setting name and value */
+        char *delimiter = strchr(line, '=');
+
+        if (delimiter == NULL) {
+            fprintf(stderr, "Invalid line format: %s\n", line);
+            fclose(file);
+            return -1;
+        }
+
+        /* Replace '=' with '\0' to split string */
+        *delimiter = '\0';
+        char *value = delimiter + 1;
+
+        /* Trim leading and trailing spaces from setting value */
+        while (*value && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+
+        size_t len = strlen(value);
+
+        while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t')) {
+            value[--len] = '\0';
+        }
+
+        ConfigurationSetting setting = {line, value};
+        res = handler(&setting, context);
+
+        if (res != 0) {
+            break;
+        }
+    }
+
+    fclose(file);
+    return res;
+}
+
+/* Settings of the schema are checked against their type and stored, the others go to the handler */
+int Config_Load(const char *filename, const ConfigField *schema, size_t count, Config_Handler handler, void *context)
+{
+    ConfigContext configContext = {schema, count, handler, context, false, 0, 0, NULL};
+
+    return Config_Parse(filename, LoadSetting, &configContext);
+}
+
+/* Applies the reloadable settings of the schema that changed in the file. The file is checked as a whole first, so
+ * one invalid value leaves the running configuration as it is, and only the last line of a setting is applied.
+ * Returns the number of settings changed. */
+int Config_Reload(const char *filename, const ConfigField *schema, size_t count)
+{
+    ConfigContext configContext = {schema, count, NULL, NULL, false, 0, 0, calloc(count ? count : 1, sizeof(size_t))};
+    int res = -1;
+
+    if (configContext.lastIndexes == NULL) {
+        return -1;
+    }
+
+    if (Config_Parse(filename, ReloadSetting, &configContext) == 0) {
+        configContext.isApplying = true;
+        configContext.settingIndex = 0;
+        res = Config_Parse(filename, ReloadSetting, &configContext) == 0 ? configContext.changeCount : -1;
+    } else {
+        printf("Configuration: %s not reloaded\n", filename);
+    }
+
+    free(configContext.lastIndexes);
+    return res;
+}
+
+/* Changes a single reloadable setting, the same way a reload does */
+int Config_Set(const ConfigField *schema, size_t count, const char *name, const char *value)
+{
+    const ConfigField *field = FindField(schema, count, name);
+    ConfigValue parsed;
+
+    if (field == NULL || !field->isReloadable || value == NULL || ParseValue(field, value, &parsed) != 0) {
+        return -1;
+    }
+
+    return IsEqual(field, &parsed) ? 0 : ApplyValue(field, &parsed);
+}
+
+/* Editors and deployment tools often replace the file rather than write to it, so its directory is watched */
+int Config_Watch(const char *filename)
+{
+    char directory[CONFIG_MAX_PATH_LENGTH];
+    const char *slash = strrchr(filename, '/');
+
+    Config_Unwatch();
+
+    if (strlen(filename) >= sizeof(directory)) {
+        return -1;
+    }
+
+    if (slash) {
+        snprintf(directory, sizeof(directory), "%.*s", slash == filename ? 1 : (int)(slash - filename), filename);
+        snprintf(mWatchName, sizeof(mWatchName), "%s", slash + 1);
+    } else {
+        snprintf(directory, sizeof(directory), ".");
+        snprintf(mWatchName, sizeof(mWatchName), "%s", filename);
+    }
+
+    mWatchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (mWatchFd < 0) {
+        return -1;
+    }
+
+    if (inotify_add_watch(mWatchFd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        Config_Unwatch();
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Returns true once after the watched file was written or replaced, however many events that took */
+bool Config_IsChanged(void)
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool isChanged = false;
+    ssize_t len;
+
+    if (mWatchFd < 0) {
+        return false;
+    }
+
+    while ((len = read(mWatchFd, buffer, sizeof(buffer))) > 0) {
+        const struct inotify_event *event;
+
+        for (char *p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *)p;
+            isChanged |= event->len > 0 && strcmp(event->name, mWatchName) == 0;
+        }
+    }
+
+    return isChanged;
+}
+
+void Config_Unwatch(void)
+{
+    if (mWatchFd >= 0) {
+        close(mWatchFd);
+    }
+
+    mWatchFd = -1;
+    mWatchName[0] = '\0';
+}
+
+static int LoadSetting(ConfigurationSetting *setting, void *context)
+{
+    ConfigContext *configContext = (ConfigContext *)context;
+    const ConfigField *field = FindField(configContext->schema, configContext->count, setting->name);
+    ConfigValue value;
+
+    if (field == NULL) {
+        return configContext->handler ? configContext->handler(setting, configContext->handlerContext) : 0;
+    }
+
+    if (ParseValue(field, setting->value, &value) != 0) {
+        printf("Invalid value for %s: %s\n", setting->name, setting->value);
+        return -1;
+    }
+
+    StoreValue(field, &value);
+    return 0;
+}
+
+/* Settings outside the schema, such as credentials and file names, are only read at start */
+static int ReloadSetting(ConfigurationSetting *setting, void *context)
+{
+    ConfigContext *configContext = (ConfigContext *)context;
+    const ConfigField *field = FindField(configContext->schema, configContext->count, setting->name);
+    size_t settingIndex = ++configContext->settingIndex;
+    size_t *lastIndex;
+    ConfigValue value;
+
+    if (field == NULL) {
+        return 0;
+    }
+
+    lastIndex = &configContext->lastIndexes[field - configContext->schema];
+
+    if (ParseValue(field, setting->value, &value) != 0) {
+        printf("Invalid value for %s: %s\n", setting->name, setting->value);
+        return -1;
+    }
+
+    if (!configContext->isApplying) {
+        *lastIndex = settingIndex;
+        return 0;
+    }
+
+    if (*lastIndex != settingIndex || IsEqual(field, &value)) {
+        return 0;
+    }
+
+    if (!field->isReloadable) {
+        printf("Configuration: %s takes effect after a restart\n", field->name);
+    } else if (ApplyValue(field, &value) == 0) {
+        printf("Configuration: %s=%s\n", field->name, setting->value);
+        configContext->changeCount++;
+    } else {
+        printf("Configuration: %s=%s rejected\n", field->name, setting->value);
+    }
+
+    return 0;
+}
+
+static const ConfigField *FindField(const ConfigField *schema, size_t count, const char *name)
+{
+    for (size_t i = 0; schema && i < count; i++) {
+        if (strcmp(schema[i].name, name) == 0) {
+            return &schema[i];
+        }
+    }
+
+    return NULL;
+}
+
+static int ParseValue(const ConfigField *field, const char *text, ConfigValue *value)
+{
+    unsigned long long number;
+    char *end = NULL;
+
+    memset(value, 0, sizeof(ConfigValue));
+
+    switch (field->type) {
+        case CONFIG_TYPE_UINT:
+            if (ParseUnsigned(text, UINT_MAX, &number) != 0) {
+                return -1;
+            }
+
+            value->uintValue = (unsigned int)number;
+            return 0;
+
+        case CONFIG_TYPE_ULONG:
+            if (ParseUnsigned(text, ULONG_MAX, &number) != 0) {
+                return -1;
+            }
+
+            value->ulongValue = (unsigned long)number;
+            return 0;
+
+        case CONFIG_TYPE_SIZE:
+            if (ParseUnsigned(text, SIZE_MAX, &number) != 0) {
+                return -1;
+            }
+
+            value->sizeValue = (size_t)number;
+            return 0;
+
+        case CONFIG_TYPE_DOUBLE:
+            value->doubleValue = strtod(text, &end);
+            return (end == text || *end != '\0' || !(value->doubleValue >= 0)) ? -1 : 0;
+
+        case CONFIG_TYPE_SWITCH:
+            if (strcasecmp(text, "true") == 0 || strcasecmp(text, "on") == 0 || strcmp(text, "1") == 0) {
+                value->switchValue = true;
+            } else if (strcasecmp(text, "false") != 0 && strcasecmp(text, "off") != 0 && strcmp(text, "0") != 0) {
+                return -1;
+            }
+
+            return 0;
+
+        case CONFIG_TYPE_STRING:
+            if (strlen(text) >= field->size || strlen(text) >= sizeof(value->stringValue)) {
+                return -1;
+            }
+
+            strcpy(value->stringValue, text);
+            return (field->parse && field->parse(text, NULL) != 0) ? -1 : 0;
+
+        case CONFIG_TYPE_PARSED:
+            if (field->parse == NULL || field->size > sizeof(ConfigValue)) {
+                return -1;
+            }
+
+            return field->parse(text, value) != 0 ? -1 : 0;
+
+        default:
+            return -1;
+    }
+}
+
+static int ParseUnsigned(const char *text, unsigned long long max, unsigned long long *number)
+{
+    char *end = NULL;
+
+    /* strtoull() takes a sign and leading spaces, a count does not */
+    if (*text < '0' || *text > '9') {
+        return -1;
+    }
+
+    errno = 0;
+    *number = strtoull(text, &end, 10);
+    return (errno != 0 || *end != '\0' || *number > max) ? -1 : 0;
+}
+
+static size_t GetValueSize(const ConfigField *field)
+{
+    switch (field->type) {
+        case CONFIG_TYPE_UINT:
+            return sizeof(unsigned int);
+        case CONFIG_TYPE_ULONG:
+            return sizeof(unsigned long);
+        case CONFIG_TYPE_SIZE:
+            return sizeof(size_t);
+        case CONFIG_TYPE_DOUBLE:
+            return sizeof(double);
+        case CONFIG_TYPE_SWITCH:
+            return sizeof(bool);
+        case CONFIG_TYPE_STRING:
+            return strlen((const char *)field->value) + 1;
+        default:
+            return field->size;
+    }
+}
+
+static bool IsEqual(const ConfigField *field, const ConfigValue *value)
+{
+    if (field->type == CONFIG_TYPE_STRING) {
+        return strcmp((const char *)field->value, value->stringValue) == 0;
+    }
+
+    return memcmp(field->value, value, GetValueSize(field)) == 0;
+}
+
+static void StoreValue(const ConfigField *field, const ConfigValue *value)
+{
+    if (field->type == CONFIG_TYPE_STRING) {
+        snprintf((char *)field->value, field->size, "%s", value->stringValue);
+    } else {
+        memcpy(field->value, value, GetValueSize(field));
+    }
+}
+
+/* Stores the value and applies it. When the application rejects it, the previous value is stored and applied again. */
+static int ApplyValue(const ConfigField *field, const ConfigValue *value)
+{
+    ConfigValue previous;
+
+    memset(&previous, 0, sizeof(previous));
+    memcpy(&previous, field->value, GetValueSize(field));
+    StoreValue(field, value);
+
+    if (field->apply == NULL || field->apply() == 0) {
+        return 0;
+    }
+
+    StoreValue(field, &previous);
+    field->apply();
+    return -1;
+}
@@ -0,0 +1,326 @@
+#include "CredentialStore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#define CREDENTIALSTORE_BUCKET_COUNT 64
+#define CREDENTIALSTORE_INITIAL_CAPACITY 8
+#define PEM_BEGIN "-----BEGIN "
+#define PEM_END "-----END "
+
+typedef struct sCredentialBlock {
+    uint64_t hash;
+    size_t refCount;
+    size_t length;
+    struct sCredentialBlock *next;
+    char data[];
+} CredentialBlock;
+
+typedef struct sCredential {
+    size_t refCount;
+    size_t length;
+    size_t blockCount;
+    CredentialBlock *blocks[CREDENTIALSTORE_MAX_BLOCKS];
+} Credential;
+
+static CredentialBlock *mBuckets[CREDENTIALSTORE_BUCKET_COUNT];
+static Credential *mCredentials = NULL;
+static size_t mCapacity = 0;
+
+static Credential *GetCredential(CredentialHandle handle);
+static int AddBlock(Credential *credential, const char *data, size_t length);
+static void ReleaseBlocks(Credential *credential);
+static CredentialHandle Store(const Credential *credential);
+static const char *FindText(const char *start, const char *end, const char *text);
+
+/* Reads the whole file, however long its certificate chain is */
+CredentialHandle CredentialStore_Load(const char *filename)
+{
+    CredentialHandle handle = CREDENTIAL_NONE;
+    struct stat st;
+    FILE *file = fopen(filename, "r");
+
+    if (file == NULL) {
+        printf("Failed to open credential file %s\n", filename);
+        return CREDENTIAL_NONE;
+    }
+
+    if (fstat(fileno(file), &st) != 0 || st.st_size > CREDENTIALSTORE_MAX_FILE_SIZE) {
+        printf("Credential file %s is larger than %d bytes\n", filename, CREDENTIALSTORE_MAX_FILE_SIZE);
+        fclose(file);
+        return CREDENTIAL_NONE;
+    }
+
+    char *data = malloc((size_t)st.st_size + 1);
+
+    if (data) {
+        size_t size = fread(data, 1, (size_t)st.st_size, file);
+        handle = CredentialStore_Add(data, size);
+        explicit_bzero(data, size);
+        free(data);
+    }
+
+    fclose(file);
+    return handle;
+}
+
+/* Splits PEM text into its sections and keeps each one once. Anything around the sections, such as the bag
+ * attributes of an exported chain, is left out; text without sections is kept as one block. A credential made of the
+ * same blocks as one that is held already is that one. */
+CredentialHandle CredentialStore_Add(const char *data, size_t size)
+{
+    Credential credential = {0};
+    const char *end = data + size;
+    const char *begin;
+
+    if (data == NULL || size == 0) {
+        return CREDENTIAL_NONE;
+    }
+
+    if ((begin = FindText(data, end, PEM_BEGIN)) == NULL) {
+        if (AddBlock(&credential, data, size) != 0) {
+            return CREDENTIAL_NONE;
+        }
+    }
+
+    while (begin) {
+        const char *stop = FindText(begin, end, PEM_END);
+
+        if (stop == NULL) {
+            printf("Credential has a PEM section without its end\n");
+            ReleaseBlocks(&credential);
+            return CREDENTIAL_NONE;
+        }
+
+        const char *lineEnd = memchr(stop, '\n', (size_t)(end - stop));
+        const char *blockEnd = lineEnd ? lineEnd + 1 : end;
+
+        if (AddBlock(&credential, begin, (size_t)(blockEnd - begin)) != 0) {
+            ReleaseBlocks(&credential);
+            return CREDENTIAL_NONE;
+        }
+
+        begin = FindText(blockEnd, end, PEM_BEGIN);
+    }
+
+    for (size_t i = 0; i < mCapacity; i++) {
+        Credential *held = &mCredentials[i];
+
+        if (held->refCount && held->blockCount == credential.blockCount &&
+            memcmp(held->blocks, credential.blocks, credential.blockCount * sizeof(credential.blocks[0])) == 0) {
+            ReleaseBlocks(&credential);
+            held->refCount++;
+            return i + 1;
+        }
+    }
+
+    CredentialHandle handle = Store(&credential);
+
+    if (handle == CREDENTIAL_NONE) {
+        ReleaseBlocks(&credential);
+    }
+
+    return handle;
+}
+
+CredentialHandle CredentialStore_Retain(CredentialHandle handle)
+{
+    Credential *credential = GetCredential(handle);
+
+    if (credential == NULL) {
+        return CREDENTIAL_NONE;
+    }
+
+    credential->refCount++;
+    return handle;
+}
+
+void CredentialStore_Release(CredentialHandle handle)
+{
+    Credential *credential = GetCredential(handle);
+
+    if (credential && --credential->refCount == 0) {
+        ReleaseBlocks(credential);
+        memset(credential, 0, sizeof(Credential));
+    }
+}
+
+/* The length of the text without its terminator, 0 for no credential */
+size_t CredentialStore_GetLength(CredentialHandle handle)
+{
+    Credential *credential = GetCredential(handle);
+    return credential ? credential->length : 0;
+}
+
+/* Puts the blocks together into one string for the caller to free with CredentialStore_Free, as the IoT Hub client
+ * takes a credential as a string and copies it. Returns NULL for no credential. */
+char *CredentialStore_Compose(CredentialHandle handle)
+{
+    Credential *credential = GetCredential(handle);
+    char *text;
+
+    if (credential == NULL || (text = malloc(credential->length + 1)) == NULL) {
+        return NULL;
+    }
+
+    char *next = text;
+
+    for (size_t i = 0; i < credential->blockCount; i++) {
+        memcpy(next, credential->blocks[i]->data, credential->blocks[i]->length);
+        next += credential->blocks[i]->length;
+    }
+
+    *next = '\0';
+    return text;
+}
+
+/* A composed private key or connection string is cleared, so the freed memory does not keep the secret */
+void CredentialStore_Free(char *text)
+{
+    if (text) {
+        explicit_bzero(text, strlen(text));
+        free(text);
+    }
+}
+
+/* sharedBytes are the bytes that copies for every holder would take on top */
+void CredentialStore_GetStats(CredentialStoreStats *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(CredentialStoreStats));
+
+    for (size_t i = 0; i < mCapacity; i++) {
+        if (mCredentials[i].refCount) {
+            stats->credentialCount++;
+            stats->sharedBytes += (mCredentials[i].refCount - 1) * mCredentials[i].length;
+        }
+    }
+
+    for (size_t i = 0; i < CREDENTIALSTORE_BUCKET_COUNT; i++) {
+        for (CredentialBlock *block = mBuckets[i]; block; block = block->next) {
+            stats->blockCount++;
+            stats->blockBytes += block->length;
+            stats->sharedBytes += (block->refCount - 1) * block->length;
+        }
+    }
+}
+
+static Credential *GetCredential(CredentialHandle handle)
+{
+    if (handle == CREDENTIAL_NONE || handle > mCapacity || mCredentials[handle - 1].refCount == 0) {
+        return NULL;
+    }
+
+    return &mCredentials[handle - 1];
+}
+
+/* FNV-1a over the block, blocks with the same hash are compared in full */
+static int AddBlock(Credential *credential, const char *data, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    if (credential->blockCount == CREDENTIALSTORE_MAX_BLOCKS) {
+        printf("Credential has more than %d PEM sections\n", CREDENTIALSTORE_MAX_BLOCKS);
+        return -1;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+    }
+
+    CredentialBlock **bucket = &mBuckets[hash % CREDENTIALSTORE_BUCKET_COUNT];
+    CredentialBlock *block = *bucket;
+
+    while (block && (block->hash != hash || block->length != length || memcmp(block->data, data, length) != 0)) {
+        block = block->next;
+    }
+
+    if (block == NULL) {
+        if ((block = malloc(sizeof(CredentialBlock) + length + 1)) == NULL) {
+            return -1;
+        }
+
+        block->hash = hash;
+        block->refCount = 0;
+        block->length = length;
+        memcpy(block->data, data, length);
+        block->data[length] = '\0';
+        block->next = *bucket;
+        *bucket = block;
+    }
+
+    block->refCount++;
+    credential->blocks[credential->blockCount++] = block;
+    credential->length += length;
+    return 0;
+}
+
+static void ReleaseBlocks(Credential *credential)
+{
+    for (size_t i = 0; i < credential->blockCount; i++) {
+        CredentialBlock *block = credential->blocks[i];
+
+        if (--block->refCount) {
+            continue;
+        }
+
+        CredentialBlock **link = &mBuckets[block->hash % CREDENTIALSTORE_BUCKET_COUNT];
+
+        while (*link != block) {
+            link = &(*link)->next;
+        }
+
+        *link = block->next;
+        explicit_bzero(block->data, block->length);
+        free(block);
+    }
+
+    credential->blockCount = 0;
+    credential->length = 0;
+}
+
+/* Takes a free slot, the table grows as identities are added */
+static CredentialHandle Store(const Credential *credential)
+{
+    size_t index = 0;
+
+    while (index < mCapacity && mCredentials[index].refCount) {
+        index++;
+    }
+
+    if (index == mCapacity) {
+        size_t capacity = mCapacity ? 2 * mCapacity : CREDENTIALSTORE_INITIAL_CAPACITY;
+        Credential *credentials = realloc(mCredentials, capacity * sizeof(Credential));
+
+        if (credentials == NULL) {
+            return CREDENTIAL_NONE;
+        }
+
+        memset(&credentials[mCapacity], 0, (capacity - mCapacity) * sizeof(Credential));
+        mCredentials = credentials;
+        mCapacity = capacity;
+    }
+
+    mCredentials[index] = *credential;
+    mCredentials[index].refCount = 1;
+    return index + 1;
+}
+
+static const char *FindText(const char *start, const char *end, const char *text)
+{
+    size_t length = strlen(text);
+
+    for (const char *next = start; next + length <= end; next++) {
+        if (memcmp(next, text, length) == 0) {
+            return next;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,137 @@
+#include "MessagePool.h"
+#include <stdlib.h>
+#include <string.h>
+
+static PoolMessage *mMessages = NULL;
+static PoolMessage *mFreeList = NULL;
+static size_t mMessageCount = 0;
+static char *mInterned[MESSAGEPOOL_MAX_INTERNED_STRINGS];
+static size_t mInternedCount = 0;
+static MessagePoolStats mStats;
+
+static void ResetMessage(PoolMessage *msg);
+
+int MessagePool_Initialize(size_t messageCount)
+{
+    if (mMessages != NULL || messageCount == 0) {
+        return -1;
+    }
+
+    mMessages = calloc(messageCount, sizeof(PoolMessage));
+
+    if (mMessages == NULL) {
+        return -1;
+    }
+
+    mMessageCount = messageCount;
+    mFreeList = NULL;
+
+    /* Build the free list back to front so the first acquire returns the first slot */
+    for (size_t i = messageCount; i > 0; i--) {
+        mMessages[i - 1].next = mFreeList;
+        mFreeList = &mMessages[i - 1];
+    }
+
+    memset(&mStats, 0, sizeof(mStats));
+    mStats.capacity = messageCount;
+    return 0;
+}
+
+void MessagePool_Deinitialize(void)
+{
+    free(mMessages);
+
+    for (size_t i = 0; i < mInternedCount; i++) {
+        free(mInterned[i]);
+        mInterned[i] = NULL;
+    }
+
+    mMessages = NULL;
+    mFreeList = NULL;
+    mMessageCount = 0;
+    mInternedCount = 0;
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+PoolMessage *MessagePool_Acquire(void)
+{
+    PoolMessage *msg = mFreeList;
+
+    if (msg == NULL) {
+        mStats.acquireFailCount++;
+        return NULL;
+    }
+
+    mFreeList = msg->next;
+    ResetMessage(msg);
+    msg->inUse = true;
+
+    mStats.acquireCount++;
+    mStats.inUse++;
+
+    if (mStats.inUse > mStats.peakInUse) {
+        mStats.peakInUse = mStats.inUse;
+    }
+
+    return msg;
+}
+
+void MessagePool_Release(PoolMessage *msg)
+{
+    if (msg == NULL || !msg->inUse) {
+        return;
+    }
+
+    ResetMessage(msg);
+    msg->next = mFreeList;
+    mFreeList = msg;
+    mStats.inUse--;
+}
+
+const char *MessagePool_Intern(const char *str)
+{
+    if (str == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < mInternedCount; i++) {
+        if (strcmp(mInterned[i], str) == 0) {
+            return mInterned[i];
+        }
+    }
+
+    if (mInternedCount == MESSAGEPOOL_MAX_INTERNED_STRINGS) {
+        return NULL;
+    }
+
+    char *s = strdup(str);
+
+    if (s) {
+        mInterned[mInternedCount++] = s;
+        mStats.internedCount = mInternedCount;
+    }
+
+    return s;
+}
+
+void MessagePool_GetStats(MessagePoolStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+    }
+}
+
+static void ResetMessage(PoolMessage *msg)
+{
+    msg->handle = NULL;
+    msg->size = 0;
+    msg->contentType = NULL;
+    msg->contextData = NULL;
+    msg->sendTimeMs = 0;
+    msg->firstSendTimeMs = 0;
+    msg->sequence = 0;
+    msg->resendCount = 0;
+    msg->priority = 0;
+    msg->inUse = false;
+    msg->next = NULL;
+}
@@ -0,0 +1,254 @@
+#define _GNU_SOURCE
+#include "Metrics.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+/* The socket is looked at a few times a second rather than on every pass of the event loop */
+#define METRICS_SOCKET_POLL_MS 100
+#define METRICS_SOCKET_BACKLOG 8
+#define METRICS_SEND_TIMEOUT_MS 100
+#define METRICS_BUFFER_SIZE 16384
+
+typedef struct sMetric {
+    char name[METRICS_MAX_NAME_LENGTH];
+    const char *help;
+    MetricsType type;
+    double value;
+} Metric;
+
+static MetricsParams mParams;
+static Metric mMetrics[METRICS_MAX_METRICS];
+static size_t mMetricCount = 0;
+static Metrics_Collector mCollectors[METRICS_MAX_COLLECTORS];
+static size_t mCollectorCount = 0;
+static int mListenFd = -1;
+static uint64_t mLastWriteMs = 0;
+static uint64_t mLastPollMs = 0;
+static bool mIsInit = false;
+static char mBuffer[METRICS_BUFFER_SIZE];
+
+static int OpenSocket(const char *path);
+static void ServeClients(void);
+static void Collect(void);
+
+int Metrics_Initialize(const MetricsParams *params)
+{
+    mParams = *params;
+    mMetricCount = 0;
+    mCollectorCount = 0;
+    mLastWriteMs = 0;
+    mLastPollMs = 0;
+    mListenFd = -1;
+
+    if (mParams.intervalSeconds == 0) {
+        mParams.intervalSeconds = METRICS_DEFAULT_INTERVAL_SECONDS;
+    }
+
+    if (mParams.socketPath[0] && (mListenFd = OpenSocket(mParams.socketPath)) < 0) {
+        printf("Failed to open the metrics socket %s\n", mParams.socketPath);
+        return -1;
+    }
+
+    mIsInit = true;
+    return 0;
+}
+
+/* The text file keeps the final values, so a run that ended is seen with what it did */
+void Metrics_Deinitialize(void)
+{
+    if (!mIsInit) {
+        return;
+    }
+
+    if (mParams.textFile[0]) {
+        Metrics_WriteTextFile();
+    }
+
+    if (mListenFd >= 0) {
+        close(mListenFd);
+        unlink(mParams.socketPath);
+        mListenFd = -1;
+    }
+
+    mIsInit = false;
+}
+
+int Metrics_AddCollector(Metrics_Collector collector)
+{
+    if (collector == NULL || mCollectorCount == METRICS_MAX_COLLECTORS) {
+        return -1;
+    }
+
+    mCollectors[mCollectorCount++] = collector;
+    return 0;
+}
+
+/* Metrics are exported in the order they were first set. The help text is not copied and has to stay valid. */
+int Metrics_Set(const char *name, MetricsType type, const char *help, double value)
+{
+    for (size_t i = 0; i < mMetricCount; i++) {
+        if (strcmp(mMetrics[i].name, name) == 0) {
+            mMetrics[i].value = value;
+            return 0;
+        }
+    }
+
+    if (mMetricCount == METRICS_MAX_METRICS || strlen(name) >= METRICS_MAX_NAME_LENGTH) {
+        return -1;
+    }
+
+    Metric *metric = &mMetrics[mMetricCount++];
+    snprintf(metric->name, sizeof(metric->name), "%s", name);
+    metric->help = help;
+    metric->type = type;
+    metric->value = value;
+    return 0;
+}
+
+void Metrics_Task(uint64_t nowMs)
+{
+    if (!mIsInit) {
+        return;
+    }
+
+    if (mListenFd >= 0 && nowMs - mLastPollMs >= METRICS_SOCKET_POLL_MS) {
+        mLastPollMs = nowMs;
+        ServeClients();
+    }
+
+    if (mParams.textFile[0] && (mLastWriteMs == 0 || nowMs - mLastWriteMs >= mParams.intervalSeconds * 1000ull)) {
+        mLastWriteMs = nowMs;
+        Metrics_WriteTextFile();
+    }
+}
+
+/* The file is written next to the target and renamed over it, so a scrape never sees half of it. The textfile
+ * collector of node_exporter only reads files ending in .prom, which the temporary file does not. */
+int Metrics_WriteTextFile(void)
+{
+    char tmpPath[METRICS_MAX_PATH_LENGTH + 8];
+
+    Collect();
+    size_t length = Metrics_Format(mBuffer, sizeof(mBuffer));
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", mParams.textFile);
+
+    FILE *fptr = fopen(tmpPath, "w");
+
+    if (fptr == NULL) {
+        printf("Failed to write metrics to %s\n", mParams.textFile);
+        return -1;
+    }
+
+    bool isWritten = fwrite(mBuffer, 1, length, fptr) == length;
+    isWritten &= fclose(fptr) == 0;
+
+    if (!isWritten || rename(tmpPath, mParams.textFile) != 0) {
+        printf("Failed to write metrics to %s\n", mParams.textFile);
+        unlink(tmpPath);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Prometheus text exposition format. Returns the length, which is cut short at the last complete metric when the
+ * buffer is too small. */
+size_t Metrics_Format(char *buffer, size_t size)
+{
+    size_t length = 0;
+    const char *labelsStart = mParams.labels[0] ? "{" : "";
+    const char *labelsEnd = mParams.labels[0] ? "}" : "";
+
+    if (size) {
+        buffer[0] = '\0';
+    }
+
+    for (size_t i = 0; i < mMetricCount; i++) {
+        const Metric *metric = &mMetrics[i];
+        int written = snprintf(buffer + length, size - length, "# HELP %s %s\n# TYPE %s %s\n%s%s%s%s %.15g\n",
+                               metric->name, metric->help ? metric->help : "", metric->name,
+                               metric->type == METRICS_TYPE_COUNTER ? "counter" : "gauge", metric->name,
+                               labelsStart, mParams.labels, labelsEnd, metric->value);
+
+        if (written < 0 || (size_t)written >= size - length) {
+            buffer[length] = '\0';
+            break;
+        }
+
+        length += (size_t)written;
+    }
+
+    return length;
+}
+
+static int OpenSocket(const char *path)
+{
+    struct sockaddr_un address = {0};
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* A socket left behind by a previous run that did not exit cleanly */
+    unlink(path);
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, METRICS_SOCKET_BACKLOG) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* A client connects and reads the metrics until the socket is closed, e.g. socat - UNIX-CONNECT:PATH */
+static void ServeClients(void)
+{
+    struct timeval timeout = {0, METRICS_SEND_TIMEOUT_MS * 1000};
+    int fd;
+
+    while ((fd = accept4(mListenFd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+        /* A client that does not read must not hold up sending */
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        Collect();
+        size_t length = Metrics_Format(mBuffer, sizeof(mBuffer));
+        size_t sent = 0;
+
+        while (sent < length) {
+            ssize_t res = send(fd, mBuffer + sent, length - sent, MSG_NOSIGNAL);
+
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (res <= 0) {
+                break;
+            }
+
+            sent += (size_t)res;
+        }
+
+        close(fd);
+    }
+}
+
+static void Collect(void)
+{
+    for (size_t i = 0; i < mCollectorCount; i++) {
+        mCollectors[i]();
+    }
+}
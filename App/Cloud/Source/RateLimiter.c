@@ -0,0 +1,326 @@
+#include "RateLimiter.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+/* IoT Hub meters device-to-cloud messages in 4 KB blocks (0.5 KB on the free tier) */
+#define DEFAULT_METER_SIZE 4096
+#define FREE_TIER_METER_SIZE 512
+#define SECONDS_PER_DAY 86400
+
+/* Adaptive rate control: halve the rate on a throttling signal, then add back a fraction of the configured rate for
+ * every second without one. */
+#define MIN_RATE_SCALE 0.05
+#define RATE_SCALE_DECREASE 0.5
+#define RATE_SCALE_INCREASE 0.05
+#define RATE_INCREASE_INTERVAL_MS 1000
+#define THROTTLE_COOLDOWN_MS 5000
+#define THROTTLE_SIGNAL_HOLDOFF_MS 1000
+
+/* An ack that takes this many times longer than the fastest ack seen is treated as a throttling signal, since the
+ * hub delays acknowledgements before it starts rejecting operations. */
+#define ACK_LATENCY_FACTOR 4
+#define ACK_LATENCY_FLOOR_MS 1000
+
+typedef struct sTierInfo {
+    const char *name;
+    double baseMessagesPerSecond;
+    double messagesPerSecondPerUnit;
+    unsigned long messagesPerDayPerUnit;
+    size_t meterSize;
+} TierInfo;
+
+/* clang-format off */
+static const TierInfo mTiers[] = {
+    {"F1", 100, 0, 8000, FREE_TIER_METER_SIZE},
+    {"B1", 100, 12, 400000, DEFAULT_METER_SIZE},
+    {"B2", 120, 120, 6000000, DEFAULT_METER_SIZE},
+    {"B3", 6000, 6000, 300000000, DEFAULT_METER_SIZE},
+    {"S1", 100, 12, 400000, DEFAULT_METER_SIZE},
+    {"S2", 120, 120, 6000000, DEFAULT_METER_SIZE},
+    {"S3", 6000, 6000, 300000000, DEFAULT_METER_SIZE},
+};
+/* clang-format on */
+
+static RateLimiterParams mParams;
+static RateLimiterStats mStats;
+static double mScale = 1.0;
+static double mMessageTokens = 0;
+static double mByteTokens = 0;
+static uint64_t mLastRefillMs = 0;
+static uint64_t mLastThrottleMs = 0;
+static uint64_t mLastIncreaseMs = 0;
+static uint64_t mMinAckLatencyMs = 0;
+static long mBudgetDay = -1;
+static bool mIsConfigured = false;
+
+static void Refill(uint64_t nowMs);
+static void UpdateBudgetDay(void);
+static void LoadState(void);
+static double MessageCapacity(void);
+static double ByteCapacity(void);
+
+int RateLimiter_GetTierParams(const char *tier, unsigned int units, RateLimiterParams *params)
+{
+    if (tier == NULL || params == NULL) {
+        return -1;
+    }
+
+    if (units == 0) {
+        units = 1;
+    }
+
+    for (size_t i = 0; i < sizeof(mTiers) / sizeof(mTiers[0]); i++) {
+        const TierInfo *info = &mTiers[i];
+
+        if (strcasecmp(info->name, tier) == 0) {
+            double perUnit = info->messagesPerSecondPerUnit * units;
+            params->messagesPerSecond = perUnit > info->baseMessagesPerSecond ? perUnit : info->baseMessagesPerSecond;
+            params->dailyMessageBudget = info->messagesPerDayPerUnit * units;
+            params->messageMeterSize = info->meterSize;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* Configuring a limiter that is already running, e.g. when the configuration is reloaded, changes its rates but keeps
+ * its statistics, what was used of the daily budget and the backoff after throttling. The buckets keep their tokens up
+ * to the new capacity, so a change of rate does not allow a burst. */
+void RateLimiter_Configure(const RateLimiterParams *params)
+{
+    bool wasConfigured = mIsConfigured;
+
+    if (!wasConfigured) {
+        memset(&mStats, 0, sizeof(mStats));
+        mBudgetDay = -1;
+    }
+
+    memset(&mParams, 0, sizeof(mParams));
+
+    if (params) {
+        mParams = *params;
+    }
+
+    if (mParams.messageMeterSize == 0) {
+        mParams.messageMeterSize = DEFAULT_METER_SIZE;
+    }
+
+    if (wasConfigured) {
+        mMessageTokens = mMessageTokens < MessageCapacity() ? mMessageTokens : MessageCapacity();
+        mByteTokens = mByteTokens < ByteCapacity() ? mByteTokens : ByteCapacity();
+    } else {
+        mScale = 1.0;
+        mMessageTokens = MessageCapacity();
+        mByteTokens = ByteCapacity();
+        mLastRefillMs = 0;
+        mLastThrottleMs = 0;
+        mLastIncreaseMs = 0;
+        mMinAckLatencyMs = 0;
+    }
+
+    mIsConfigured = (mParams.messagesPerSecond > 0 || mParams.bytesPerSecond > 0 || mParams.dailyMessageBudget > 0);
+
+    if (!wasConfigured) {
+        LoadState();
+    }
+}
+
+RateLimiterResult RateLimiter_Acquire(size_t size, uint64_t nowMs)
+{
+    if (!mIsConfigured) {
+        return RATELIMITER_OK;
+    }
+
+    Refill(nowMs);
+
+    unsigned long units = 1;
+
+    if (mParams.dailyMessageBudget) {
+        UpdateBudgetDay();
+        units = size > mParams.messageMeterSize ? (size + mParams.messageMeterSize - 1) / mParams.messageMeterSize : 1;
+
+        if (mStats.dailyMessagesUsed + units > mParams.dailyMessageBudget) {
+            mStats.budgetRejectCount++;
+            return RATELIMITER_BUDGET_EXHAUSTED;
+        }
+    }
+
+    if (mParams.messagesPerSecond > 0 && mMessageTokens < 1.0) {
+        mStats.waitCount++;
+        return RATELIMITER_WAIT;
+    }
+
+    /* A message larger than the byte bucket is let through once the bucket is full, otherwise it would never go */
+    if (mParams.bytesPerSecond > 0 && mByteTokens < (double)size && mByteTokens < ByteCapacity()) {
+        mStats.waitCount++;
+        return RATELIMITER_WAIT;
+    }
+
+    if (mParams.messagesPerSecond > 0) {
+        mMessageTokens -= 1.0;
+    }
+
+    if (mParams.bytesPerSecond > 0) {
+        mByteTokens -= (double)size;
+    }
+
+    mStats.dailyMessagesUsed += units;
+    return RATELIMITER_OK;
+}
+
+void RateLimiter_ReportThrottle(uint64_t nowMs)
+{
+    if (!mIsConfigured) {
+        return;
+    }
+
+    /* A burst of failures caused by the same event only counts once */
+    if (mLastThrottleMs && nowMs - mLastThrottleMs < THROTTLE_SIGNAL_HOLDOFF_MS) {
+        return;
+    }
+
+    mScale *= RATE_SCALE_DECREASE;
+
+    if (mScale < MIN_RATE_SCALE) {
+        mScale = MIN_RATE_SCALE;
+    }
+
+    /* Drain the buckets so the lower rate applies immediately instead of after the burst allowance */
+    mMessageTokens = 0;
+    mByteTokens = 0;
+    mLastThrottleMs = nowMs;
+    mLastIncreaseMs = nowMs;
+    mStats.throttleSignalCount++;
+}
+
+void RateLimiter_ReportAck(uint64_t latencyMs, uint64_t nowMs)
+{
+    if (!mIsConfigured) {
+        return;
+    }
+
+    if (mMinAckLatencyMs == 0 || latencyMs < mMinAckLatencyMs) {
+        mMinAckLatencyMs = latencyMs ? latencyMs : 1;
+    }
+
+    uint64_t threshold = mMinAckLatencyMs * ACK_LATENCY_FACTOR;
+
+    if (threshold < ACK_LATENCY_FLOOR_MS) {
+        threshold = ACK_LATENCY_FLOOR_MS;
+    }
+
+    if (latencyMs > threshold) {
+        RateLimiter_ReportThrottle(nowMs);
+        return;
+    }
+
+    if (mScale < 1.0 && nowMs - mLastThrottleMs >= THROTTLE_COOLDOWN_MS &&
+        nowMs - mLastIncreaseMs >= RATE_INCREASE_INTERVAL_MS) {
+        mScale += RATE_SCALE_INCREASE;
+
+        if (mScale > 1.0) {
+            mScale = 1.0;
+        }
+
+        mLastIncreaseMs = nowMs;
+    }
+}
+
+void RateLimiter_Save(void)
+{
+    if (!mIsConfigured || mParams.dailyMessageBudget == 0 || mParams.stateFile[0] == '\0') {
+        return;
+    }
+
+    FILE *fptr = fopen(mParams.stateFile, "w");
+
+    if (fptr == NULL) {
+        return;
+    }
+
+    fprintf(fptr, "%ld %lu\n", mBudgetDay, mStats.dailyMessagesUsed);
+    fclose(fptr);
+}
+
+void RateLimiter_GetStats(RateLimiterStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+        stats->effectiveMessagesPerSecond = mParams.messagesPerSecond * mScale;
+        stats->effectiveBytesPerSecond = mParams.bytesPerSecond * mScale;
+    }
+}
+
+static void Refill(uint64_t nowMs)
+{
+    if (mLastRefillMs == 0 || nowMs < mLastRefillMs) {
+        mLastRefillMs = nowMs;
+        return;
+    }
+
+    double seconds = (double)(nowMs - mLastRefillMs) / 1000.0;
+    mLastRefillMs = nowMs;
+
+    mMessageTokens += seconds * mParams.messagesPerSecond * mScale;
+    mByteTokens += seconds * mParams.bytesPerSecond * mScale;
+
+    if (mMessageTokens > MessageCapacity()) {
+        mMessageTokens = MessageCapacity();
+    }
+
+    if (mByteTokens > ByteCapacity()) {
+        mByteTokens = ByteCapacity();
+    }
+}
+
+static void UpdateBudgetDay(void)
+{
+    /* The hub resets its daily quota at 00:00 UTC */
+    long day = (long)(time(NULL) / SECONDS_PER_DAY);
+
+    if (day != mBudgetDay) {
+        if (mBudgetDay != -1) {
+            mStats.dailyMessagesUsed = 0;
+        }
+
+        mBudgetDay = day;
+    }
+}
+
+static void LoadState(void)
+{
+    if (!mIsConfigured || mParams.dailyMessageBudget == 0 || mParams.stateFile[0] == '\0') {
+        return;
+    }
+
+    FILE *fptr = fopen(mParams.stateFile, "r");
+    long day;
+    unsigned long used;
+
+    if (fptr == NULL) {
+        return;
+    }
+
+    if (fscanf(fptr, "%ld %lu", &day, &used) == 2 && day == (long)(time(NULL) / SECONDS_PER_DAY)) {
+        mBudgetDay = day;
+        mStats.dailyMessagesUsed = used;
+    }
+
+    fclose(fptr);
+}
+
+/* One second worth of tokens, so a short burst is allowed but never more than the hub accepts per second */
+static double MessageCapacity(void)
+{
+    double capacity = mParams.messagesPerSecond * mScale;
+    return capacity < 1.0 ? 1.0 : capacity;
+}
+
+static double ByteCapacity(void)
+{
+    return mParams.bytesPerSecond * mScale;
+}
@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include "TlsSession.h"
+#include "Clock.h"
+#include "Metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/ssl.h>
+#include <openssl/evp.h>
+
+#define TLSSESSION_MAX_SIZE 16384
+#define TLSSESSION_MAGIC 0x534c5443u
+#define TLSSESSION_NAME_BYTES 16
+
+/* Stored in front of the DER encoded session */
+typedef struct sTlsSessionHeader {
+    uint32_t magic;
+    uint32_t fullHandshakeMs;
+    uint32_t size;
+} TlsSessionHeader;
+
+static char mDirectory[TLSSESSION_MAX_PATH_LENGTH];
+static unsigned char mIdentityDigest[EVP_MAX_MD_SIZE];
+static bool mIsConfigured = false;
+static TlsSessionStats mStats;
+static SSL *mHandshakeSsl = NULL;
+static uint64_t mHandshakeStartMs = 0;
+static uint64_t mSessionFullMs = 0;
+static int mHandshakeDepth = 0;
+static unsigned char mBuffer[sizeof(TlsSessionHeader) + TLSSESSION_MAX_SIZE];
+
+static SSL *(*mRealNew)(SSL_CTX *ctx) = NULL;
+static int (*mRealConnect)(SSL *ssl) = NULL;
+static int (*mRealDoHandshake)(SSL *ssl) = NULL;
+
+static int Handshake(SSL *ssl, int (*function)(SSL *ssl));
+static void StartHandshake(SSL *ssl);
+static void FinishHandshake(SSL *ssl);
+static int GetPath(SSL *ssl, char *path, size_t size);
+static void LoadSession(SSL *ssl);
+static int SaveSession(SSL *ssl, SSL_SESSION *session);
+
+/* Keeps the TLS sessions of the connections in directory, one file per server and identity, so that the next run
+ * resumes the session instead of making a full handshake with the client certificate. The identity, e.g. the device
+ * certificate, is only stored as part of a digest. A NULL or empty directory turns the cache off. */
+int TlsSession_Configure(const char *directory, CredentialHandle identity)
+{
+    char *text;
+    int res;
+
+    mIsConfigured = false;
+
+    if (directory == NULL || directory[0] == '\0') {
+        return 0;
+    }
+
+    if (identity == CREDENTIAL_NONE || strlen(directory) + 2 * TLSSESSION_NAME_BYTES + 6 >= sizeof(mDirectory)) {
+        return -1;
+    }
+
+    /* The sessions hold the secrets to resume them, so the directory is only for the owner */
+    if (mkdir(directory, 0700) != 0 && errno != EEXIST) {
+        printf("Failed to create TLS session directory %s: %s\n", directory, strerror(errno));
+        return -1;
+    }
+
+    if ((text = CredentialStore_Compose(identity)) == NULL) {
+        return -1;
+    }
+
+    res = EVP_Digest(text, strlen(text), mIdentityDigest, NULL, EVP_sha256(), NULL);
+    CredentialStore_Free(text);
+
+    if (res != 1) {
+        return -1;
+    }
+
+    snprintf(mDirectory, sizeof(mDirectory), "%s", directory);
+    mIsConfigured = true;
+    return 0;
+}
+
+void TlsSession_GetStats(TlsSessionStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+    }
+}
+
+/* A metrics collector, see Metrics_AddCollector */
+void TlsSession_CollectMetrics(void)
+{
+    uint64_t savedMs = mStats.resumedFullHandshakeMs > mStats.resumedHandshakeMs
+                           ? mStats.resumedFullHandshakeMs - mStats.resumedHandshakeMs
+                           : 0;
+
+    Metrics_Set("cloud_tls_handshakes_total", METRICS_TYPE_COUNTER, "TLS handshakes completed.",
+                (double)mStats.handshakeCount);
+    Metrics_Set("cloud_tls_resumed_total", METRICS_TYPE_COUNTER, "TLS handshakes that resumed a cached session.",
+                (double)mStats.resumedCount);
+    Metrics_Set("cloud_tls_handshake_seconds_total", METRICS_TYPE_COUNTER, "Time spent in TLS handshakes.",
+                (double)(mStats.fullHandshakeMs + mStats.resumedHandshakeMs) / 1000.0);
+    Metrics_Set("cloud_tls_resumption_saved_seconds_total", METRICS_TYPE_COUNTER,
+                "Handshake time saved by resuming sessions, against their full handshakes.", (double)savedMs / 1000.0);
+}
+
+/* The IoT Hub client makes its TLS connections with OpenSSL and offers no way to resume a session. These functions
+ * take the place of the OpenSSL ones for the whole process and pass every call on. */
+SSL *SSL_new(SSL_CTX *ctx)
+{
+    if (mRealNew == NULL) {
+        mRealNew = (SSL * (*)(SSL_CTX *)) dlsym(RTLD_NEXT, "SSL_new");
+    }
+
+    if (mRealNew == NULL) {
+        return NULL;
+    }
+
+    /* Sessions are only kept on disk, the client context lives no longer than its connection */
+    if (ctx && mIsConfigured) {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, SaveSession);
+    }
+
+    return mRealNew(ctx);
+}
+
+int SSL_connect(SSL *ssl)
+{
+    if (mRealConnect == NULL) {
+        mRealConnect = (int (*)(SSL *))dlsym(RTLD_NEXT, "SSL_connect");
+    }
+
+    return Handshake(ssl, mRealConnect);
+}
+
+int SSL_do_handshake(SSL *ssl)
+{
+    if (mRealDoHandshake == NULL) {
+        mRealDoHandshake = (int (*)(SSL *))dlsym(RTLD_NEXT, "SSL_do_handshake");
+    }
+
+    return Handshake(ssl, mRealDoHandshake);
+}
+
+/* Non-blocking handshakes take many calls, the first one offers the cached session and the successful one ends the
+ * measurement */
+static int Handshake(SSL *ssl, int (*function)(SSL *ssl))
+{
+    int res;
+
+    if (function == NULL) {
+        return -1;
+    }
+
+    /* SSL_connect may go through SSL_do_handshake, the outer call does the bookkeeping */
+    if (mHandshakeDepth > 0) {
+        return function(ssl);
+    }
+
+    if (SSL_in_before(ssl)) {
+        StartHandshake(ssl);
+    }
+
+    mHandshakeDepth++;
+    res = function(ssl);
+    mHandshakeDepth--;
+
+    if (res == 1 && ssl == mHandshakeSsl) {
+        FinishHandshake(ssl);
+    }
+
+    return res;
+}
+
+static void StartHandshake(SSL *ssl)
+{
+    mHandshakeSsl = ssl;
+    mHandshakeStartMs = Clock_GetMs();
+    mSessionFullMs = 0;
+
+    if (mIsConfigured) {
+        LoadSession(ssl);
+    }
+}
+
+static void FinishHandshake(SSL *ssl)
+{
+    uint64_t elapsedMs = Clock_GetMs() - mHandshakeStartMs;
+
+    mStats.handshakeCount++;
+
+    if (SSL_session_reused(ssl)) {
+        mStats.resumedCount++;
+        mStats.resumedHandshakeMs += elapsedMs;
+        mStats.resumedFullHandshakeMs += mSessionFullMs ? mSessionFullMs : elapsedMs;
+    } else {
+        mStats.fullHandshakeMs += elapsedMs;
+        mSessionFullMs = elapsedMs;
+    }
+
+    mHandshakeSsl = NULL;
+}
+
+/* The file name is a digest of the server name and the identity, so neither shows in the directory */
+static int GetPath(SSL *ssl, char *path, size_t size)
+{
+    const char *serverName = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    char name[2 * TLSSESSION_NAME_BYTES + 1];
+    EVP_MD_CTX *context;
+    int res = -1;
+
+    if (serverName == NULL || (context = EVP_MD_CTX_new()) == NULL) {
+        return -1;
+    }
+
+    if (EVP_DigestInit_ex(context, EVP_sha256(), NULL) == 1 &&
+        EVP_DigestUpdate(context, mIdentityDigest, 32) == 1 &&
+        EVP_DigestUpdate(context, serverName, strlen(serverName)) == 1 &&
+        EVP_DigestFinal_ex(context, digest, NULL) == 1) {
+        for (size_t i = 0; i < TLSSESSION_NAME_BYTES; i++) {
+            snprintf(&name[2 * i], 3, "%02x", digest[i]);
+        }
+
+        res = (size_t)snprintf(path, size, "%s/%s.tls", mDirectory, name) < size ? 0 : -1;
+    }
+
+    EVP_MD_CTX_free(context);
+    return res;
+}
+
+/* A file that others could read or change is not used */
+static void LoadSession(SSL *ssl)
+{
+    char path[TLSSESSION_MAX_PATH_LENGTH];
+    TlsSessionHeader header;
+    struct stat st;
+    ssize_t len;
+    int fd;
+
+    if (GetPath(ssl, path, sizeof(path)) != 0 || (fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) < 0) {
+        return;
+    }
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077)) {
+        printf("Ignoring TLS session %s, it is not private to this user\n", path);
+        close(fd);
+        return;
+    }
+
+    len = read(fd, mBuffer, sizeof(mBuffer));
+    close(fd);
+
+    if (len < (ssize_t)sizeof(header)) {
+        return;
+    }
+
+    memcpy(&header, mBuffer, sizeof(header));
+
+    if (header.magic != TLSSESSION_MAGIC || header.size != (size_t)len - sizeof(header)) {
+        return;
+    }
+
+    const unsigned char *data = mBuffer + sizeof(header);
+    SSL_SESSION *session = d2i_SSL_SESSION(NULL, &data, (long)header.size);
+
+    if (session == NULL) {
+        return;
+    }
+
+    /* An expired session would only cost the server a lookup before the full handshake */
+    if (SSL_SESSION_is_resumable(session) &&
+        (time_t)(SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session)) > time(NULL) &&
+        SSL_set_session(ssl, session) == 1) {
+        mSessionFullMs = header.fullHandshakeMs;
+    }
+
+    SSL_SESSION_free(session);
+}
+
+/* Called by OpenSSL for every session the server hands out, with TLS 1.3 after the handshake. The file is replaced
+ * as a whole, so a run that stops halfway leaves the previous session. */
+static int SaveSession(SSL *ssl, SSL_SESSION *session)
+{
+    char path[TLSSESSION_MAX_PATH_LENGTH];
+    char tempPath[TLSSESSION_MAX_PATH_LENGTH + 4];
+    TlsSessionHeader header = {TLSSESSION_MAGIC, 0, 0};
+    int len = i2d_SSL_SESSION(session, NULL);
+    unsigned char *data = mBuffer + sizeof(header);
+    int fd;
+
+    if (!mIsConfigured || !SSL_SESSION_is_resumable(session) || len <= 0 || len > TLSSESSION_MAX_SIZE ||
+        GetPath(ssl, path, sizeof(path)) != 0) {
+        return 0;
+    }
+
+    /* With TLS 1.2 the session comes before the handshake has finished */
+    if (ssl == mHandshakeSsl && !SSL_session_reused(ssl)) {
+        header.fullHandshakeMs = (uint32_t)(Clock_GetMs() - mHandshakeStartMs);
+    } else {
+        header.fullHandshakeMs = (uint32_t)mSessionFullMs;
+    }
+
+    header.size = (uint32_t)i2d_SSL_SESSION(session, &data);
+    memcpy(mBuffer, &header, sizeof(header));
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+
+    fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+
+    if (fd < 0) {
+        return 0;
+    }
+
+    size_t size = sizeof(header) + header.size;
+    bool isWritten = fchmod(fd, 0600) == 0 && write(fd, mBuffer, size) == (ssize_t)size;
+
+    if (close(fd) == 0 && isWritten && rename(tempPath, path) == 0) {
+        mStats.savedCount++;
+    } else {
+        unlink(tempPath);
+    }
+
+    /* The session is not kept, OpenSSL frees it */
+    return 0;
+}
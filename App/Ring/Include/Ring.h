@@ -0,0 +1,70 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Shared memory ring buffer for local producers. The sender creates the ring in a memfd and hands it out over a Unix
+ * socket together with two eventfds; any number of producers reserve space, write a record in place and commit it,
+ * and the sender reads the records straight from the shared memory. */
+
+#define RING_DEFAULT_CAPACITY (4 * 1024 * 1024)
+#define RING_MAX_RECORD_SIZE (64 * 1024)
+#define RING_ALIGNMENT 32
+
+typedef enum eRingRecordType {
+    RING_RECORD_JSON = 1,
+    RING_RECORD_BINARY = 2,
+} RingRecordType;
+
+struct sRingHeader;
+
+/* capacity is the one the ring was mapped with; the copy in the shared header can be changed by any producer */
+typedef struct sRing {
+    struct sRingHeader *header;
+    unsigned char *data;
+    size_t mapSize;
+    size_t capacity;
+    bool isCorrupt;
+    int memFd;
+    int dataEventFd;
+    int spaceEventFd;
+    int listenFd;
+    char socketPath[108];
+} Ring;
+
+typedef struct sRingRecord {
+    const void *data;
+    size_t size;
+    RingRecordType type;
+    uint64_t position;
+    size_t slotSize;
+} RingRecord;
+
+typedef struct sRingStats {
+    uint64_t recordCount;
+    uint64_t byteCount;
+    uint64_t fullCount;
+    uint64_t wakeupCount;
+    size_t used;
+    size_t capacity;
+} RingStats;
+
+/* Producer side */
+int Ring_Connect(Ring *ring, const char *socketPath);
+void *Ring_Reserve(Ring *ring, size_t size, int timeoutMs);
+int Ring_Commit(Ring *ring, void *record, size_t size, RingRecordType type);
+int Ring_Write(Ring *ring, const void *data, size_t size, RingRecordType type, int timeoutMs);
+void Ring_Close(Ring *ring);
+
+/* Sender side */
+int RingServer_Open(Ring *ring, const char *socketPath, size_t capacity);
+void RingServer_Task(Ring *ring);
+void RingServer_Close(Ring *ring);
+bool Ring_Peek(Ring *ring, RingRecord *record);
+void Ring_Release(Ring *ring, const RingRecord *record);
+void Ring_Wait(Ring *ring, int timeoutMs);
+void Ring_GetStats(const Ring *ring, RingStats *stats);
+
+#endif
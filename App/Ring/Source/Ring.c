@@ -0,0 +1,559 @@
+#define _GNU_SOURCE
+#include "Ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#define RING_MAGIC 0x474e4952
+#define RING_VERSION 1
+#define RING_HEADER_SIZE 4096
+#define RING_MIN_CAPACITY (64 * 1024)
+#define RING_FD_COUNT 3
+#define RING_SPACE_POLL_MS 10
+#define RECORD_TYPE_PADDING 0
+#define CACHE_LINE __attribute__((aligned(64)))
+
+/* Lives at the start of the shared memory. Producers only move head, the sender only moves tail, and each sits on its
+ * own cache line so the two sides do not bounce a line between them. */
+typedef struct sRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    CACHE_LINE uint64_t head;
+    CACHE_LINE uint64_t tail;
+    uint64_t recordCount;
+    uint64_t byteCount;
+    uint64_t wakeupCount;
+    CACHE_LINE uint32_t dataWaiting;
+    uint32_t spaceWaiting;
+    uint32_t spaceSignaled;
+    uint64_t fullCount;
+} RingHeader;
+
+/* Every record starts on a RING_ALIGNMENT boundary. A record is visible to the sender once commit holds its position
+ * plus one; the sender zeroes the commit word of every boundary it releases, so space that has not been committed yet
+ * never looks committed, whatever the previous record left in it. */
+typedef struct sRecordHeader {
+    uint64_t commit;
+    uint64_t position;
+    uint32_t slotSize;
+    uint32_t size;
+    uint32_t type;
+    uint32_t reserved;
+} RecordHeader;
+
+static int Map(Ring *ring, int memFd, bool create, size_t capacity);
+static RecordHeader *RecordAt(const Ring *ring, uint64_t position);
+static size_t SlotSize(size_t size);
+static void WaitForSpace(Ring *ring, uint64_t needed, int timeoutMs);
+static void Signal(int fd);
+static void Drain(int fd);
+static int SendFds(int socketFd, const int *fds, size_t count);
+static int ReceiveFds(int socketFd, int *fds, size_t count);
+static void ResetRing(Ring *ring);
+static uint64_t NowMs(void);
+
+int Ring_Connect(Ring *ring, const char *socketPath)
+{
+    struct sockaddr_un addr = {0};
+    int fds[RING_FD_COUNT];
+
+    if (ring == NULL || socketPath == NULL || strlen(socketPath) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+
+    ResetRing(ring);
+
+    int socketFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (socketFd < 0) {
+        return -1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketPath);
+
+    if (connect(socketFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        ReceiveFds(socketFd, fds, RING_FD_COUNT) != 0) {
+        close(socketFd);
+        return -1;
+    }
+
+    close(socketFd);
+    ring->dataEventFd = fds[1];
+    ring->spaceEventFd = fds[2];
+
+    if (Map(ring, fds[0], false, 0) != 0) {
+        Ring_Close(ring);
+        return -1;
+    }
+
+    return 0;
+}
+
+void *Ring_Reserve(Ring *ring, size_t size, int timeoutMs)
+{
+    RingHeader *header = ring->header;
+    uint64_t capacity = ring->capacity;
+    uint64_t slot = SlotSize(size);
+    uint64_t deadline = timeoutMs > 0 ? NowMs() + (uint64_t)timeoutMs : 0;
+    uint64_t head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+    uint64_t padding;
+
+    if (size > RING_MAX_RECORD_SIZE || slot > capacity / 2) {
+        return NULL;
+    }
+
+    for (;;) {
+        uint64_t offset = head & (capacity - 1);
+        padding = offset + slot > capacity ? capacity - offset : 0;
+
+        uint64_t tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+
+        if (head + padding + slot - tail <= capacity) {
+            if (__atomic_compare_exchange_n(&header->head, &head, head + padding + slot, true, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+
+            continue;
+        }
+
+        __atomic_add_fetch(&header->fullCount, 1, __ATOMIC_RELAXED);
+
+        /* A negative timeout waits for as long as the sender takes to make room */
+        int waitMs = RING_SPACE_POLL_MS;
+
+        if (timeoutMs >= 0) {
+            uint64_t now = NowMs();
+
+            if (timeoutMs == 0 || now >= deadline) {
+                return NULL;
+            }
+
+            if (deadline - now < (uint64_t)waitMs) {
+                waitMs = (int)(deadline - now);
+            }
+        }
+
+        WaitForSpace(ring, head + padding + slot - capacity, waitMs);
+        head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+    }
+
+    /* A record never wraps; the rest of the buffer is filled with padding the sender skips */
+    if (padding) {
+        RecordHeader *pad = RecordAt(ring, head);
+        pad->position = head;
+        pad->slotSize = (uint32_t)padding;
+        pad->size = 0;
+        pad->type = RECORD_TYPE_PADDING;
+        __atomic_store_n(&pad->commit, head + 1, __ATOMIC_RELEASE);
+        head += padding;
+    }
+
+    RecordHeader *record = RecordAt(ring, head);
+    record->position = head;
+    record->slotSize = (uint32_t)slot;
+    return record + 1;
+}
+
+int Ring_Commit(Ring *ring, void *data, size_t size, RingRecordType type)
+{
+    if (ring == NULL || data == NULL) {
+        return -1;
+    }
+
+    RecordHeader *record = (RecordHeader *)data - 1;
+
+    if (size > record->slotSize - sizeof(RecordHeader)) {
+        return -1;
+    }
+
+    record->size = (uint32_t)size;
+    record->type = type;
+    __atomic_store_n(&record->commit, record->position + 1, __ATOMIC_SEQ_CST);
+
+    /* The sender only needs a wake up when it went to sleep on an empty ring */
+    if (__atomic_exchange_n(&ring->header->dataWaiting, 0, __ATOMIC_SEQ_CST)) {
+        Signal(ring->dataEventFd);
+    }
+
+    return 0;
+}
+
+int Ring_Write(Ring *ring, const void *data, size_t size, RingRecordType type, int timeoutMs)
+{
+    void *record = Ring_Reserve(ring, size, timeoutMs);
+
+    if (record == NULL) {
+        return -1;
+    }
+
+    memcpy(record, data, size);
+    return Ring_Commit(ring, record, size, type);
+}
+
+void Ring_Close(Ring *ring)
+{
+    if (ring == NULL) {
+        return;
+    }
+
+    if (ring->header) {
+        munmap(ring->header, ring->mapSize);
+    }
+
+    int fds[] = {ring->memFd, ring->dataEventFd, ring->spaceEventFd, ring->listenFd};
+
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+
+    ResetRing(ring);
+}
+
+int RingServer_Open(Ring *ring, const char *socketPath, size_t capacity)
+{
+    struct sockaddr_un addr = {0};
+
+    if (ring == NULL || socketPath == NULL || strlen(socketPath) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+
+    ResetRing(ring);
+
+    int memFd = memfd_create("cloud-send-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    if (memFd < 0 || Map(ring, memFd, true, capacity) != 0) {
+        if (memFd >= 0 && ring->memFd < 0) {
+            close(memFd);
+        }
+
+        Ring_Close(ring);
+        return -1;
+    }
+
+    ring->dataEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ring->spaceEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ring->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketPath);
+
+    /* A socket left behind by an earlier run would make bind fail */
+    unlink(socketPath);
+
+    /* Whoever connects can write records, so only the user of cloud-send may */
+    if (ring->dataEventFd < 0 || ring->spaceEventFd < 0 || ring->listenFd < 0 ||
+        bind(ring->listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || chmod(socketPath, 0600) != 0 ||
+        listen(ring->listenFd, 16) != 0) {
+        Ring_Close(ring);
+        return -1;
+    }
+
+    strcpy(ring->socketPath, socketPath);
+    return 0;
+}
+
+void RingServer_Task(Ring *ring)
+{
+    int fds[RING_FD_COUNT] = {ring->memFd, ring->dataEventFd, ring->spaceEventFd};
+    int clientFd;
+
+    /* Producers only need the file descriptors, the connection is closed right after handing them over */
+    while ((clientFd = accept4(ring->listenFd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+        if (SendFds(clientFd, fds, RING_FD_COUNT) != 0) {
+            printf("Failed to hand the ring to a producer\n");
+        }
+
+        close(clientFd);
+    }
+}
+
+void RingServer_Close(Ring *ring)
+{
+    if (ring && ring->socketPath[0]) {
+        unlink(ring->socketPath);
+    }
+
+    Ring_Close(ring);
+}
+
+/* Producers write the record headers, so every field is checked before the record is used. A record that does not
+ * fit its slot or the ring cannot be skipped, as its slot size tells where the next one starts; the ring is marked
+ * corrupt and yields nothing more. */
+bool Ring_Peek(Ring *ring, RingRecord *record)
+{
+    RingHeader *header = ring->header;
+
+    while (!ring->isCorrupt) {
+        uint64_t tail = header->tail;
+        RecordHeader *entry = RecordAt(ring, tail);
+
+        if (__atomic_load_n(&entry->commit, __ATOMIC_ACQUIRE) != tail + 1) {
+            return false;
+        }
+
+        record->data = entry + 1;
+        record->size = entry->size;
+        record->type = (RingRecordType)entry->type;
+        record->position = tail;
+        record->slotSize = entry->slotSize;
+
+        if (record->slotSize == 0 || record->slotSize % RING_ALIGNMENT != 0 ||
+            record->slotSize > ring->capacity / 2 ||
+            (tail & (ring->capacity - 1)) + record->slotSize > ring->capacity ||
+            record->size > record->slotSize - sizeof(RecordHeader)) {
+            printf("Ring record at %llu is corrupt, slot of %zu bytes holding %zu\n", (unsigned long long)tail,
+                   record->slotSize, record->size);
+            ring->isCorrupt = true;
+            return false;
+        }
+
+        if (entry->type != RECORD_TYPE_PADDING) {
+            return true;
+        }
+
+        Ring_Release(ring, record);
+    }
+
+    return false;
+}
+
+void Ring_Release(Ring *ring, const RingRecord *record)
+{
+    RingHeader *header = ring->header;
+
+    if (record->position != header->tail) {
+        return;
+    }
+
+    for (uint64_t offset = 0; offset < record->slotSize; offset += RING_ALIGNMENT) {
+        __atomic_store_n(&RecordAt(ring, record->position + offset)->commit, 0, __ATOMIC_RELAXED);
+    }
+
+    if (record->type != RECORD_TYPE_PADDING) {
+        header->recordCount++;
+        header->byteCount += record->size;
+    }
+
+    __atomic_store_n(&header->tail, record->position + record->slotSize, __ATOMIC_SEQ_CST);
+
+    /* Waiting producers are woken once half of the ring is free, so a full ring costs one wake up per half ring
+     * instead of one per record, and one pending signal is enough however many producers wait */
+    uint64_t used = __atomic_load_n(&header->head, __ATOMIC_RELAXED) - (record->position + record->slotSize);
+
+    if (used <= ring->capacity / 2 && __atomic_load_n(&header->spaceWaiting, __ATOMIC_SEQ_CST) &&
+        !__atomic_exchange_n(&header->spaceSignaled, 1, __ATOMIC_SEQ_CST)) {
+        Signal(ring->spaceEventFd);
+    }
+}
+
+void Ring_Wait(Ring *ring, int timeoutMs)
+{
+    RingHeader *header = ring->header;
+    struct pollfd pfds[2] = {{ring->dataEventFd, POLLIN, 0}, {ring->listenFd, POLLIN, 0}};
+
+    __atomic_store_n(&header->dataWaiting, 1, __ATOMIC_SEQ_CST);
+
+    /* A record committed before the flag was set would not signal, so check once more before sleeping */
+    if (__atomic_load_n(&RecordAt(ring, header->tail)->commit, __ATOMIC_SEQ_CST) != header->tail + 1) {
+        if (poll(pfds, ring->listenFd >= 0 ? 2 : 1, timeoutMs) > 0 && (pfds[0].revents & POLLIN)) {
+            Drain(ring->dataEventFd);
+            header->wakeupCount++;
+        }
+    }
+
+    __atomic_store_n(&header->dataWaiting, 0, __ATOMIC_RELAXED);
+}
+
+void Ring_GetStats(const Ring *ring, RingStats *stats)
+{
+    if (ring == NULL || ring->header == NULL || stats == NULL) {
+        return;
+    }
+
+    const RingHeader *header = ring->header;
+    stats->recordCount = header->recordCount;
+    stats->byteCount = header->byteCount;
+    stats->wakeupCount = header->wakeupCount;
+    stats->fullCount = __atomic_load_n(&header->fullCount, __ATOMIC_RELAXED);
+    stats->used = (size_t)(__atomic_load_n(&header->head, __ATOMIC_RELAXED) - header->tail);
+    stats->capacity = ring->capacity;
+}
+
+static int Map(Ring *ring, int memFd, bool create, size_t capacity)
+{
+    size_t mapSize;
+    struct stat st;
+
+    if (create) {
+        size_t rounded = RING_MIN_CAPACITY;
+
+        while (rounded < capacity) {
+            rounded <<= 1;
+        }
+
+        mapSize = RING_HEADER_SIZE + rounded;
+
+        /* The size is sealed, a producer that could shrink the memfd would make the sender fault on its mapping */
+        if (ftruncate(memFd, (off_t)mapSize) != 0 ||
+            fcntl(memFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+            return -1;
+        }
+
+        capacity = rounded;
+    } else {
+        if (fstat(memFd, &st) != 0 || (size_t)st.st_size <= RING_HEADER_SIZE) {
+            close(memFd);
+            return -1;
+        }
+
+        mapSize = (size_t)st.st_size;
+    }
+
+    ring->memFd = memFd;
+
+    void *map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    ring->header = map;
+    ring->data = (unsigned char *)map + RING_HEADER_SIZE;
+    ring->mapSize = mapSize;
+    ring->capacity = mapSize - RING_HEADER_SIZE;
+
+    if (create) {
+        /* A new memfd reads as zeroes, which is the empty state of every record */
+        ring->header->magic = RING_MAGIC;
+        ring->header->version = RING_VERSION;
+        ring->header->capacity = capacity;
+    } else if (ring->header->magic != RING_MAGIC || ring->header->version != RING_VERSION ||
+               ring->header->capacity != ring->capacity || (ring->capacity & (ring->capacity - 1)) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static RecordHeader *RecordAt(const Ring *ring, uint64_t position)
+{
+    return (RecordHeader *)(ring->data + (position & (ring->capacity - 1)));
+}
+
+static size_t SlotSize(size_t size)
+{
+    return (sizeof(RecordHeader) + size + RING_ALIGNMENT - 1) & ~(size_t)(RING_ALIGNMENT - 1);
+}
+
+/* Sleeps until the sender released enough space for tail to reach needed, or the timeout passes */
+static void WaitForSpace(Ring *ring, uint64_t needed, int timeoutMs)
+{
+    RingHeader *header = ring->header;
+    struct pollfd pfd = {ring->spaceEventFd, POLLIN, 0};
+
+    __atomic_add_fetch(&header->spaceWaiting, 1, __ATOMIC_SEQ_CST);
+
+    /* Several producers may wait on the same eventfd and only one of them reads it, the others find out at the next
+     * poll interval at the latest */
+    if (__atomic_load_n(&header->head, __ATOMIC_SEQ_CST) - __atomic_load_n(&header->tail, __ATOMIC_SEQ_CST) >
+            ring->capacity / 2 &&
+        __atomic_load_n(&header->tail, __ATOMIC_SEQ_CST) < needed && poll(&pfd, 1, timeoutMs) > 0) {
+        Drain(ring->spaceEventFd);
+        __atomic_store_n(&header->spaceSignaled, 0, __ATOMIC_SEQ_CST);
+    }
+
+    __atomic_sub_fetch(&header->spaceWaiting, 1, __ATOMIC_SEQ_CST);
+}
+
+static void Signal(int fd)
+{
+    uint64_t value = 1;
+    ssize_t res = write(fd, &value, sizeof(value));
+    (void)res;
+}
+
+static void Drain(int fd)
+{
+    uint64_t value;
+    ssize_t res = read(fd, &value, sizeof(value));
+    (void)res;
+}
+
+static int SendFds(int socketFd, const int *fds, size_t count)
+{
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    char control[CMSG_SPACE(sizeof(int) * RING_FD_COUNT)] = {0};
+    struct msghdr msg = {0};
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+    return sendmsg(socketFd, &msg, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+static int ReceiveFds(int socketFd, int *fds, size_t count)
+{
+    char byte;
+    struct iovec iov = {&byte, 1};
+    char control[CMSG_SPACE(sizeof(int) * RING_FD_COUNT)] = {0};
+    struct msghdr msg = {0};
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(socketFd, &msg, MSG_CMSG_CLOEXEC) != 1) {
+        return -1;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int) * count)) {
+        return -1;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+    return 0;
+}
+
+static void ResetRing(Ring *ring)
+{
+    memset(ring, 0, sizeof(Ring));
+    ring->memFd = -1;
+    ring->dataEventFd = -1;
+    ring->spaceEventFd = -1;
+    ring->listenFd = -1;
+}
+
+static uint64_t NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ull + (uint64_t)ts.tv_nsec / 1000000ull;
+}
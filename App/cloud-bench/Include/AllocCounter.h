@@ -0,0 +1,16 @@
+#ifndef ALLOCCOUNTER_H
+#define ALLOCCOUNTER_H
+
+#include <stddef.h>
+
+typedef struct sAllocCounterStats {
+    size_t allocCount;
+    size_t freeCount;
+    size_t allocBytes;
+    size_t liveBytes;
+} AllocCounterStats;
+
+void AllocCounter_Reset(void);
+void AllocCounter_GetStats(AllocCounterStats *stats);
+
+#endif
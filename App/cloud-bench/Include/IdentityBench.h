@@ -0,0 +1,26 @@
+#ifndef IDENTITYBENCH_H
+#define IDENTITYBENCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "Cloud.h"
+
+#define IDENTITYBENCH_HOSTNAME "bench.azure-devices.net"
+
+typedef struct sIdentityBenchResult {
+    CloudTransport transport;
+    bool isShared;
+    size_t identityCount;
+    size_t createdCount;
+    size_t baseBytes;
+    size_t identityBytes;
+    size_t allocCount;
+    uint64_t elapsedNs;
+} IdentityBenchResult;
+
+int IdentityBench_Run(CloudTransport transport, bool isShared, size_t identityCount, IdentityBenchResult *result);
+void IdentityBench_PrintHeader(void);
+void IdentityBench_PrintResult(const IdentityBenchResult *result);
+
+#endif
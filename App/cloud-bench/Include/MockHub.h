@@ -0,0 +1,40 @@
+#ifndef MOCKHUB_H
+#define MOCKHUB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MOCKHUB_MAX_PENDING 65536
+
+/* The mock hub replaces the IoT Hub device client at link time. Every message sent is acknowledged after a latency
+ * drawn from the configured distribution, in the order it was sent, as an MQTT connection would. */
+typedef enum eMockHubLatency {
+    MOCKHUB_LATENCY_FIXED,
+    MOCKHUB_LATENCY_UNIFORM,
+    MOCKHUB_LATENCY_EXPONENTIAL,
+    MOCKHUB_LATENCY_LOGNORMAL,
+} MockHubLatency;
+
+typedef struct sMockHubParams {
+    MockHubLatency latency;
+    double a;
+    double b;
+    double failRate;
+    uint64_t seed;
+} MockHubParams;
+
+typedef struct sMockHubStats {
+    size_t messageCount;
+    size_t ackCount;
+    size_t failCount;
+    size_t rejectCount;
+    size_t maxPending;
+    uint64_t byteCount;
+} MockHubStats;
+
+int MockHub_ParseLatency(const char *spec, MockHubParams *params);
+void MockHub_Configure(const MockHubParams *params);
+void MockHub_GetStats(MockHubStats *stats);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef SYSCALLCOUNTER_H
+#define SYSCALLCOUNTER_H
+
+#include <stdint.h>
+
+typedef void (*SyscallCounter_Function)(void *arg);
+
+int SyscallCounter_Count(SyscallCounter_Function function, void *arg, uint64_t *count);
+
+#endif
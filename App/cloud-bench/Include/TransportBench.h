@@ -0,0 +1,33 @@
+#ifndef TRANSPORTBENCH_H
+#define TRANSPORTBENCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "Cloud.h"
+
+#define TRANSPORTBENCH_DEFAULT_WINDOW 32
+#define TRANSPORTBENCH_TIMEOUT_MS 120000
+
+typedef struct sTransportBenchResult {
+    CloudTransport transport;
+    bool isConnected;
+    size_t messageCount;
+    size_t ackCount;
+    size_t failCount;
+    uint64_t connectMs;
+    uint64_t elapsedNs;
+    double meanAckMs;
+    double p50AckMs;
+    double p99AckMs;
+    double maxAckMs;
+    uint64_t sentBytes;
+    uint64_t receivedBytes;
+} TransportBenchResult;
+
+int TransportBench_Run(CloudConnectParams *params, CloudTransport transport, const char *payload, size_t count,
+                       size_t window, TransportBenchResult *result);
+void TransportBench_PrintHeader(void);
+void TransportBench_PrintResult(const TransportBenchResult *result);
+
+#endif
@@ -0,0 +1,77 @@
+#include "AllocCounter.h"
+#include <malloc.h>
+#include <string.h>
+
+/* glibc exports its allocator under these names, which allows counting wrappers to replace malloc and friends for
+ * the whole process, including allocations made inside the Azure SDK and libc itself. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static AllocCounterStats mStats;
+
+/* Live bytes are counted as the usable size of the blocks, which is what the heap actually hands out */
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+
+    mStats.allocCount++;
+    mStats.allocBytes += size;
+    mStats.liveBytes += ptr ? malloc_usable_size(ptr) : 0;
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    void *ptr = __libc_calloc(count, size);
+
+    mStats.allocCount++;
+    mStats.allocBytes += count * size;
+    mStats.liveBytes += ptr ? malloc_usable_size(ptr) : 0;
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    size_t oldSize = ptr ? malloc_usable_size(ptr) : 0;
+    void *newPtr = __libc_realloc(ptr, size);
+
+    mStats.allocCount++;
+    mStats.allocBytes += size;
+
+    /* A failed realloc keeps the old block, but realloc to zero bytes frees it */
+    if (newPtr) {
+        mStats.liveBytes += malloc_usable_size(newPtr) - oldSize;
+    } else if (size == 0) {
+        mStats.liveBytes -= oldSize;
+    }
+
+    return newPtr;
+}
+
+void free(void *ptr)
+{
+    if (ptr) {
+        mStats.freeCount++;
+        mStats.liveBytes -= malloc_usable_size(ptr);
+    }
+
+    __libc_free(ptr);
+}
+
+/* Live bytes are a level rather than a count, so they are kept; callers compare them before and after */
+void AllocCounter_Reset(void)
+{
+    size_t liveBytes = mStats.liveBytes;
+
+    memset(&mStats, 0, sizeof(mStats));
+    mStats.liveBytes = liveBytes;
+}
+
+void AllocCounter_GetStats(AllocCounterStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+    }
+}
@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "File.h"
+#include "Clock.h"
+#include "Config.h"
+#include "CredentialStore.h"
+#include "AllocCounter.h"
+#include "SyscallCounter.h"
+
+#define DEFAULT_RUN_COUNT 5
+#define TINY_FILE_COUNT 10000
+#define TINY_FILE_SIZE 64
+#define TINY_BUFFER_SIZE 512
+#define LARGE_FILE_COUNT 100
+#define LARGE_FILE_SIZE (64 * 1024)
+#define LIST_LINE_COUNT 100000
+#define CLEAN_FILE_COUNT 10000
+#define CONFIG_PARSE_COUNT 1000
+#define CERT_PEM_SIZE 4000
+#define KEY_PEM_SIZE 3243
+
+typedef struct sFileBenchCase {
+    const char *name;
+    int (*prepare)(void);
+    void (*run)(void *arg);
+    size_t fileCount;
+    uint64_t byteCount;
+} FileBenchCase;
+
+typedef struct sFileBenchResult {
+    const FileBenchCase *benchCase;
+    uint64_t bestNs;
+    uint64_t medianNs;
+    size_t allocCount;
+    uint64_t syscallCount;
+    bool hasSyscallCount;
+} FileBenchResult;
+
+static char mCorpusDirectory[FILE_MAX_STRING_LENGTH] = "/tmp/cloud-bench-file-XXXXXX";
+static bool mIsCorpusCreated = false;
+static size_t mRunCount = DEFAULT_RUN_COUNT;
+static bool mIsJsonOutput = false;
+static FileInfo *mFiles = NULL;
+static char *mBuffer = NULL;
+static CredentialHandle mCert = CREDENTIAL_NONE;
+static CredentialHandle mKey = CREDENTIAL_NONE;
+static char mPath[FILE_MAX_STRING_LENGTH * 2];
+
+static int ParseArguments(int argc, char *argv[]);
+static int CreateCorpus(void);
+static int WriteFile(const char *name, const char *data, size_t size);
+static int WriteFiles(const char *prefix, size_t count, size_t size);
+static int WritePem(const char *name, const char *label, size_t size);
+static int WriteList(const char *name, size_t count, bool isLong);
+static int PrepareCleanList(void);
+static void RunReadTiny(void *arg);
+static void RunReadLarge(void *arg);
+static void RunReadList(void *arg);
+static void RunCleanList(void *arg);
+static void RunParseConfig(void *arg);
+static int HandleConfigurationSetting(ConfigurationSetting *setting, void *context);
+static void RunCase(const FileBenchCase *benchCase, FileBenchResult *result);
+static void PrintResult(const FileBenchResult *result);
+static void RemoveCorpus(void);
+static int CompareU64(const void *a, const void *b);
+
+/* The corpora, each case reading them the way cloud-send and cloud-provision do at startup and per file */
+static FileBenchCase mCases[] = {
+    {"read-tiny", NULL, RunReadTiny, TINY_FILE_COUNT, 0},
+    {"read-large", NULL, RunReadLarge, LARGE_FILE_COUNT, 0},
+    {"read-list", NULL, RunReadList, LIST_LINE_COUNT, 0},
+    {"read-list-long", NULL, RunReadList, LIST_LINE_COUNT, 0},
+    {"clean-list", PrepareCleanList, RunCleanList, CLEAN_FILE_COUNT, 0},
+    {"parse-config", NULL, RunParseConfig, CONFIG_PARSE_COUNT, 0},
+};
+
+/* Measures the File functions on generated corpora. Times are the best and the median of the runs, allocations are
+ * counted in one run and system calls in one more run under ptrace. */
+int main(int argc, char *argv[])
+{
+    FileBenchResult result;
+    int res = 0;
+
+    if (ParseArguments(argc, argv) != 0) {
+        return -1;
+    }
+
+    mFiles = calloc(LIST_LINE_COUNT, sizeof(FileInfo));
+    mBuffer = malloc(LARGE_FILE_SIZE + 1);
+
+    if (mFiles == NULL || mBuffer == NULL || CreateCorpus() != 0) {
+        printf("Failed to create the corpus in %s\n", mCorpusDirectory);
+        RemoveCorpus();
+        return -1;
+    }
+
+    if (!mIsJsonOutput) {
+        printf("%-15s %8s %10s %10s %10s %9s %13s %12s\n", "case", "files", "bytes", "best ms", "median ms", "ns/byte",
+               "syscalls/file", "allocs/file");
+    }
+
+    for (size_t i = 0; i < sizeof(mCases) / sizeof(mCases[0]); i++) {
+        RunCase(&mCases[i], &result);
+        PrintResult(&result);
+        res |= result.bestNs == 0;
+    }
+
+    RemoveCorpus();
+    free(mFiles);
+    free(mBuffer);
+    return res ? -1 : 0;
+}
+
+static void PrintUsage(void)
+{
+    /* clang-format off */
+    static const char *usageString = "Usage: cloud-bench-file [options]\n"
+                                     "\n"
+                                     "Optional options:\n"
+                                     "  -d DIR, --directory DIR  Create the corpus in a new directory in DIR\n"
+                                     "                           (default /tmp), to measure another file system.\n"
+                                     "  -r COUNT, --runs COUNT   Timed runs per case (default 5).\n"
+                                     "  -j, --json               Print each case as one JSON object.\n"
+                                     "  -h, --help               Print this message and exit.\n";
+    /* clang-format on */
+
+    printf("%s", usageString);
+}
+
+static int ParseArguments(int argc, char *argv[])
+{
+    int opt = 0;
+
+    /* clang-format off */
+    static struct option long_options[] = {
+        {"directory", required_argument, 0, 'd'},
+        {"runs", required_argument, 0, 'r'},
+        {"json", no_argument, 0, 'j'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0},
+    };
+    /* clang-format on */
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, "d:r:jh", long_options, &long_index)) != -1) {
+        switch (opt) {
+            case 'd':
+                snprintf(mCorpusDirectory, sizeof(mCorpusDirectory), "%s/cloud-bench-file-XXXXXX", optarg);
+                break;
+
+            case 'r':
+                mRunCount = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'j':
+                mIsJsonOutput = true;
+                break;
+
+            case 'h':
+                PrintUsage();
+                exit(0);
+                break;
+
+            default:
+                PrintUsage();
+                exit(-1);
+                break;
+        }
+    }
+
+    if (mRunCount == 0) {
+        printf("Run count must be positive\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* The long list has paths close to FILE_MAX_STRING_LENGTH behind an annotation, the short one paths as a data logger
+ * writes them. The paths in the lists need not exist, as File_ReadList does not open them. */
+static int CreateCorpus(void)
+{
+    char config[1024];
+
+    if (mkdtemp(mCorpusDirectory) == NULL) {
+        return -1;
+    }
+
+    mIsCorpusCreated = true;
+
+    if (WriteFiles("tiny", TINY_FILE_COUNT, TINY_FILE_SIZE) != 0 ||
+        WriteFiles("large", LARGE_FILE_COUNT, LARGE_FILE_SIZE) != 0 || WriteList("list.txt", LIST_LINE_COUNT, false) ||
+        WriteList("list-long.txt", LIST_LINE_COUNT, true) || WritePem("cert.pem", "CERTIFICATE", CERT_PEM_SIZE) ||
+        WritePem("key.pem", "PRIVATE KEY", KEY_PEM_SIZE)) {
+        return -1;
+    }
+
+    int length = snprintf(config, sizeof(config),
+                          "# Generated by cloud-bench-file\n"
+                          "HostName=bench.azure-devices.net\n"
+                          "DeviceId=bench-device-0001\n"
+                          "CertFile=%s/cert.pem\n"
+                          "KeyFile=%s/key.pem\n"
+                          "\n"
+                          "RetryPolicy=exponential\n"
+                          "RetryTimeoutSeconds=300\n"
+                          "InFlightWindow=32\n"
+                          "LingerMs=200\n"
+                          "BatchMaxReadings=64\n"
+                          "BatchMaxBytes=65536\n"
+                          "HighPriorityPattern=*alarm*, *fault*\n"
+                          "DeadbandFields=temperature:0.5, humidity:2%%\n",
+                          mCorpusDirectory, mCorpusDirectory);
+
+    if (WriteFile("device.conf", config, (size_t)length) != 0) {
+        return -1;
+    }
+
+    mCases[0].byteCount = (uint64_t)TINY_FILE_COUNT * TINY_FILE_SIZE;
+    mCases[1].byteCount = (uint64_t)LARGE_FILE_COUNT * LARGE_FILE_SIZE;
+
+    struct stat st;
+    snprintf(mPath, sizeof(mPath), "%s/list.txt", mCorpusDirectory);
+    mCases[2].byteCount = stat(mPath, &st) == 0 ? (uint64_t)st.st_size : 0;
+    snprintf(mPath, sizeof(mPath), "%s/list-long.txt", mCorpusDirectory);
+    mCases[3].byteCount = stat(mPath, &st) == 0 ? (uint64_t)st.st_size : 0;
+    mCases[4].byteCount = (uint64_t)CLEAN_FILE_COUNT * TINY_FILE_SIZE;
+    mCases[5].byteCount = (uint64_t)CONFIG_PARSE_COUNT * ((size_t)length + CERT_PEM_SIZE + KEY_PEM_SIZE);
+    return 0;
+}
+
+static int WriteFile(const char *name, const char *data, size_t size)
+{
+    snprintf(mPath, sizeof(mPath), "%s/%s", mCorpusDirectory, name);
+
+    FILE *fptr = fopen(mPath, "w");
+
+    if (fptr == NULL) {
+        return -1;
+    }
+
+    size_t written = fwrite(data, 1, size, fptr);
+    return (fclose(fptr) == 0 && written == size) ? 0 : -1;
+}
+
+/* Sensor readings padded to the size */
+static int WriteFiles(const char *prefix, size_t count, size_t size)
+{
+    char name[64];
+
+    for (size_t i = 0; i < count; i++) {
+        int length = snprintf(mBuffer, size + 1, "{\"id\":\"sensor-%zu\",\"seq\":%zu,\"v\":21.5,\"pad\":\"", i % 8, i);
+
+        while ((size_t)length < size - 2) {
+            mBuffer[length++] = 'x';
+        }
+
+        memcpy(mBuffer + length, "\"}", 2);
+        snprintf(name, sizeof(name), "%s-%zu.json", prefix, i);
+
+        if (WriteFile(name, mBuffer, size) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Base64 lines of 64 characters between the armor lines, of about the size of a certificate chain or an RSA 4096 key */
+static int WritePem(const char *name, const char *label, size_t size)
+{
+    static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t length = (size_t)snprintf(mBuffer, LARGE_FILE_SIZE, "-----BEGIN %s-----\n", label);
+    size_t footerLength = strlen(label) + 16;
+    size_t column = 0;
+
+    while (length < size - footerLength - 1) {
+        mBuffer[length] = base64[(length * 7) % 64];
+        length++;
+
+        if (++column == 64) {
+            mBuffer[length++] = '\n';
+            column = 0;
+        }
+    }
+
+    if (column) {
+        mBuffer[length++] = '\n';
+    }
+
+    length += (size_t)snprintf(mBuffer + length, LARGE_FILE_SIZE - length, "-----END %s-----\n", label);
+    return WriteFile(name, mBuffer, length);
+}
+
+static int WriteList(const char *name, size_t count, bool isLong)
+{
+    static const char *annotations[] = {"high", "normal", "low"};
+    char line[FILE_MAX_STRING_LENGTH + FILE_MAX_ANNOTATION_LENGTH + 4];
+
+    snprintf(mPath, sizeof(mPath), "%s/%s", mCorpusDirectory, name);
+
+    FILE *fptr = fopen(mPath, "w");
+
+    if (fptr == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (isLong) {
+            int length = snprintf(line, sizeof(line), "[%s] /var/spool/data-logger/site-0042/building-007/floor-03/",
+                                  annotations[i % 3]);
+
+            /* Pad the directory so that the path ends just below the limit */
+            while (length < FILE_MAX_STRING_LENGTH - 24) {
+                line[length++] = 'd';
+            }
+
+            snprintf(line + length, sizeof(line) - length, "/%08zu.json\n", i);
+        } else {
+            snprintf(line, sizeof(line), "/var/spool/data-logger/%08zu.json\n", i);
+        }
+
+        fputs(line, fptr);
+    }
+
+    return fclose(fptr) == 0 ? 0 : -1;
+}
+
+static int PrepareCleanList(void)
+{
+    if (WriteFiles("clean", CLEAN_FILE_COUNT, TINY_FILE_SIZE) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < CLEAN_FILE_COUNT; i++) {
+        snprintf(mFiles[i].filename, sizeof(mFiles[i].filename), "%s/clean-%zu.json", mCorpusDirectory, i);
+        FileInfo_SetSendStatus(&mFiles[i], true);
+    }
+
+    return 0;
+}
+
+static void RunReadTiny(void *arg)
+{
+    (void)arg;
+
+    for (size_t i = 0; i < TINY_FILE_COUNT; i++) {
+        snprintf(mPath, sizeof(mPath), "%s/tiny-%zu.json", mCorpusDirectory, i);
+        File_Read(mPath, mBuffer, TINY_BUFFER_SIZE);
+    }
+}
+
+static void RunReadLarge(void *arg)
+{
+    (void)arg;
+
+    for (size_t i = 0; i < LARGE_FILE_COUNT; i++) {
+        snprintf(mPath, sizeof(mPath), "%s/large-%zu.json", mCorpusDirectory, i);
+        File_Read(mPath, mBuffer, LARGE_FILE_SIZE + 1);
+    }
+}
+
+static void RunReadList(void *arg)
+{
+    const FileBenchCase *benchCase = (const FileBenchCase *)arg;
+
+    snprintf(mPath, sizeof(mPath), "%s/%s", mCorpusDirectory,
+             strcmp(benchCase->name, "read-list-long") == 0 ? "list-long.txt" : "list.txt");
+    File_ReadList(mPath, mFiles, LIST_LINE_COUNT);
+}
+
+static void RunCleanList(void *arg)
+{
+    (void)arg;
+    File_CleanList(mFiles, CLEAN_FILE_COUNT);
+}
+
+static void RunParseConfig(void *arg)
+{
+    (void)arg;
+    snprintf(mPath, sizeof(mPath), "%s/device.conf", mCorpusDirectory);
+
+    for (size_t i = 0; i < CONFIG_PARSE_COUNT; i++) {
+        Config_Parse(mPath, HandleConfigurationSetting, NULL);
+    }
+}
+
+/* What the applications do with the settings that touch files; the others are only compared by name */
+static int HandleConfigurationSetting(ConfigurationSetting *setting, void *context)
+{
+    (void)context;
+
+    if (strcmp("CertFile", setting->name) == 0) {
+        CredentialStore_Release(mCert);
+        return File_Validate(setting->value) || (mCert = CredentialStore_Load(setting->value)) == CREDENTIAL_NONE;
+    } else if (strcmp("KeyFile", setting->name) == 0) {
+        CredentialStore_Release(mKey);
+        return File_Validate(setting->value) || (mKey = CredentialStore_Load(setting->value)) == CREDENTIAL_NONE;
+    }
+
+    return 0;
+}
+
+static void RunCase(const FileBenchCase *benchCase, FileBenchResult *result)
+{
+    uint64_t *runNs = calloc(mRunCount, sizeof(uint64_t));
+    AllocCounterStats stats;
+
+    memset(result, 0, sizeof(FileBenchResult));
+    result->benchCase = benchCase;
+
+    if (runNs == NULL) {
+        return;
+    }
+
+    /* The first run warms the page cache and is the one allocations are counted in */
+    for (size_t i = 0; i <= mRunCount; i++) {
+        if (benchCase->prepare && benchCase->prepare() != 0) {
+            free(runNs);
+            return;
+        }
+
+        AllocCounter_Reset();
+        uint64_t startNs = Clock_GetNs();
+        benchCase->run((void *)benchCase);
+        uint64_t elapsedNs = Clock_GetNs() - startNs;
+
+        if (i == 0) {
+            AllocCounter_GetStats(&stats);
+            result->allocCount = stats.allocCount;
+        } else {
+            runNs[i - 1] = elapsedNs;
+        }
+    }
+
+    qsort(runNs, mRunCount, sizeof(uint64_t), CompareU64);
+    result->bestNs = runNs[0] ? runNs[0] : 1;
+    result->medianNs = runNs[mRunCount / 2];
+    free(runNs);
+
+    if (benchCase->prepare == NULL || benchCase->prepare() == 0) {
+        result->hasSyscallCount = SyscallCounter_Count(benchCase->run, (void *)benchCase, &result->syscallCount) == 0;
+    }
+}
+
+static void PrintResult(const FileBenchResult *result)
+{
+    const FileBenchCase *benchCase = result->benchCase;
+    double files = (double)benchCase->fileCount;
+    double nsPerByte = benchCase->byteCount ? (double)result->bestNs / (double)benchCase->byteCount : 0.0;
+
+    if (result->bestNs == 0) {
+        printf(mIsJsonOutput ? "{\"case\":\"%s\",\"failed\":true}\n" : "%-15s %8s\n", benchCase->name, "failed");
+        return;
+    }
+
+    if (mIsJsonOutput) {
+        printf("{\"case\":\"%s\",\"files\":%zu,\"bytes\":%llu,\"bestNs\":%llu,\"medianNs\":%llu,\"nsPerByte\":%.3f,"
+               "\"nsPerFile\":%.1f,\"syscallsPerFile\":",
+               benchCase->name, benchCase->fileCount, (unsigned long long)benchCase->byteCount,
+               (unsigned long long)result->bestNs, (unsigned long long)result->medianNs, nsPerByte,
+               (double)result->bestNs / files);
+
+        if (result->hasSyscallCount) {
+            printf("%.2f", (double)result->syscallCount / files);
+        } else {
+            printf("null");
+        }
+
+        printf(",\"allocsPerFile\":%.2f}\n", (double)result->allocCount / files);
+        return;
+    }
+
+    printf("%-15s %8zu %10llu %10.2f %10.2f %9.3f ", benchCase->name, benchCase->fileCount,
+           (unsigned long long)benchCase->byteCount, (double)result->bestNs / 1e6, (double)result->medianNs / 1e6,
+           nsPerByte);
+
+    if (result->hasSyscallCount) {
+        printf("%13.2f", (double)result->syscallCount / files);
+    } else {
+        printf("%13s", "-");
+    }
+
+    printf(" %12.2f\n", (double)result->allocCount / files);
+}
+
+static void RemoveCorpus(void)
+{
+    if (!mIsCorpusCreated) {
+        return;
+    }
+
+    DIR *dir = opendir(mCorpusDirectory);
+    struct dirent *entry;
+
+    while (dir && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            snprintf(mPath, sizeof(mPath), "%s/%s", mCorpusDirectory, entry->d_name);
+            unlink(mPath);
+        }
+    }
+
+    if (dir) {
+        closedir(dir);
+    }
+
+    rmdir(mCorpusDirectory);
+}
+
+static int CompareU64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
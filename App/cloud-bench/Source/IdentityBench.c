@@ -0,0 +1,124 @@
+#include "IdentityBench.h"
+#include "CloudGateway.h"
+#include "CloudSdk.h"
+#include "AllocCounter.h"
+#include "Clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iothub_device_client_ll.h"
+
+/* Identities are never connected, so any key does */
+static const char *BENCH_DEVICE_KEY = "YmVuY2htYXJrLWtleQ==";
+
+static void RunDedicated(IdentityBenchResult *result);
+static void RunShared(IdentityBenchResult *result);
+static size_t GetLiveBytes(void);
+
+/* Creates identityCount device identities, either each with a client of its own or all on one shared transport, and
+ * measures the heap they hold. Nothing is connected, so this is the footprint of the clients and the transport
+ * state; TLS buffers and sockets come on top once per connection, which is once per identity unless shared. */
+int IdentityBench_Run(CloudTransport transport, bool isShared, size_t identityCount, IdentityBenchResult *result)
+{
+    AllocCounterStats stats;
+
+    memset(result, 0, sizeof(IdentityBenchResult));
+    result->transport = transport;
+    result->isShared = isShared;
+    result->identityCount = identityCount;
+
+    AllocCounter_Reset();
+    uint64_t start = Clock_GetNs();
+    isShared ? RunShared(result) : RunDedicated(result);
+    result->elapsedNs = Clock_GetNs() - start;
+    AllocCounter_GetStats(&stats);
+    result->allocCount = stats.allocCount;
+
+    return result->createdCount == identityCount ? 0 : -1;
+}
+
+void IdentityBench_PrintHeader(void)
+{
+    printf("%-15s %-9s %10s %10s %12s %12s %10s %10s\n", "transport", "clients", "identities", "created", "shared B",
+           "B/identity", "allocs/id", "us/id");
+}
+
+void IdentityBench_PrintResult(const IdentityBenchResult *result)
+{
+    double identities = result->createdCount ? (double)result->createdCount : 1.0;
+
+    printf("%-15s %-9s %10zu %10zu %12zu %12.0f %10.1f %10.1f\n", Cloud_GetTransportName(result->transport),
+           result->isShared ? "shared" : "dedicated", result->identityCount, result->createdCount, result->baseBytes,
+           (double)result->identityBytes / identities, (double)result->allocCount / identities,
+           (double)result->elapsedNs / 1e3 / identities);
+}
+
+static void RunDedicated(IdentityBenchResult *result)
+{
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE *clients = calloc(result->identityCount, sizeof(IOTHUB_DEVICE_CLIENT_LL_HANDLE));
+    char connectionString[256];
+
+    if (clients == NULL) {
+        return;
+    }
+
+    size_t before = GetLiveBytes();
+
+    for (size_t i = 0; i < result->identityCount; i++) {
+        snprintf(connectionString, sizeof(connectionString), "HostName=%s;DeviceId=bench%04zu;SharedAccessKey=%s",
+                 IDENTITYBENCH_HOSTNAME, i, BENCH_DEVICE_KEY);
+        clients[i] = IoTHubDeviceClient_LL_CreateFromConnectionString(connectionString,
+                                                                      Cloud_GetTransportProtocol(result->transport));
+
+        if (clients[i] == NULL) {
+            break;
+        }
+
+        result->createdCount++;
+    }
+
+    result->identityBytes = GetLiveBytes() - before;
+
+    for (size_t i = 0; i < result->createdCount; i++) {
+        IoTHubDeviceClient_LL_Destroy(clients[i]);
+    }
+
+    free(clients);
+}
+
+/* The gateway allocates the transport and its message contexts up front, which is reported apart from what each
+ * identity adds */
+static void RunShared(IdentityBenchResult *result)
+{
+    char deviceId[CLOUDGATEWAY_DEVICE_ID_SIZE];
+    size_t before = GetLiveBytes();
+
+    if (CloudGateway_Open(IDENTITYBENCH_HOSTNAME, result->transport, result->identityCount) != 0) {
+        return;
+    }
+
+    size_t opened = GetLiveBytes();
+    result->baseBytes = opened - before;
+
+    for (size_t i = 0; i < result->identityCount; i++) {
+        snprintf(deviceId, sizeof(deviceId), "bench%04zu", i);
+
+        if (CloudGateway_AddDevice(deviceId, BENCH_DEVICE_KEY, NULL) == NULL) {
+            break;
+        }
+
+        result->createdCount++;
+    }
+
+    result->identityBytes = GetLiveBytes() - opened;
+    CloudGateway_Close();
+}
+
+static size_t GetLiveBytes(void)
+{
+    AllocCounterStats stats;
+
+    AllocCounter_GetStats(&stats);
+    return stats.liveBytes;
+}
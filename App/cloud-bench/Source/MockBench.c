@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "Cloud.h"
+#include "Clock.h"
+#include "File.h"
+#include "Scheduler.h"
+#include "Batcher.h"
+#include "Encoder.h"
+#include "AllocCounter.h"
+#include "MockHub.h"
+
+#define DEFAULT_FILE_COUNT 10000
+#define DEFAULT_FILE_SIZE 256
+#define DEFAULT_WINDOW 32
+#define DEFAULT_POLL_US 1000
+#define SCHEDULER_FEED_DEPTH 4
+#define CONNECT_TIMEOUT_MS 5000
+#define READ_BUFFER_SIZE 512
+
+static const char *MOCK_CONNECTION_STRING =
+    "HostName=mock.azure-devices.net;DeviceId=bench;SharedAccessKey=YmVuY2htYXJrLWtleQ==";
+
+/* Hand-off time of the messages in flight, by batch */
+typedef struct sInFlight {
+    const Batch *batch;
+    uint64_t handOffNs;
+} InFlight;
+
+static size_t mFileCount = DEFAULT_FILE_COUNT;
+static size_t mFileSize = DEFAULT_FILE_SIZE;
+static size_t mWindow = DEFAULT_WINDOW;
+static unsigned int mPollUs = DEFAULT_POLL_US;
+static const char *mLatencySpec = "fixed:20";
+static const char *mEncoding = "json";
+static bool mIsJsonOutput = false;
+static MockHubParams mHubParams = {MOCKHUB_LATENCY_FIXED, 20.0, 0.0, 0.0, 1};
+static BatcherParams mBatcherParams;
+static CloudConnectParams mCloudConnectParams;
+static char mSpoolDirectory[] = "/tmp/cloud-bench-mock-XXXXXX";
+static FileInfo *mFiles = NULL;
+static char mStringData[READ_BUFFER_SIZE];
+static InFlight mInFlight[BATCHER_MAX_BATCHES];
+static double *mAckLatenciesMs = NULL;
+static size_t mAckCount = 0;
+static size_t mFileDoneCount = 0;
+static size_t mFileFailCount = 0;
+static bool mIsConnected = false;
+
+static int ParseArguments(int argc, char *argv[]);
+static int WriteSpool(void);
+static int Connect(void);
+static void FeedFiles(void);
+static void BatchFlushHandler(Batch *batch);
+static void CompleteBatch(Batch *batch, bool success);
+static void CloudEventHandler(CloudEvent evt, void *data);
+static uint64_t GetCpuNs(void);
+static int CompareDouble(const void *a, const void *b);
+static double Percentile(double fraction);
+
+/* Runs the cloud-send file pipeline (scheduler, batcher, encoder and the Cloud library) against the mock hub. The loop
+ * polls like cloud-send does, so --poll 1000 matches its 1 ms tick. */
+int main(int argc, char *argv[])
+{
+    AllocCounterStats allocStats;
+    MockHubStats hubStats;
+    struct rusage usage;
+
+    if (ParseArguments(argc, argv) != 0) {
+        return -1;
+    }
+
+    mFiles = calloc(mFileCount, sizeof(FileInfo));
+    mAckLatenciesMs = calloc(mFileCount, sizeof(double));
+
+    if (mFiles == NULL || mAckLatenciesMs == NULL || mkdtemp(mSpoolDirectory) == NULL || WriteSpool() != 0) {
+        printf("Failed to write the spool\n");
+        return -1;
+    }
+
+    MockHub_Configure(&mHubParams);
+
+    if (Cloud_Initialize() != 0 || Scheduler_Initialize(mFileCount) != 0 || Encoder_Initialize() != 0 ||
+        Encoder_SetFormat(mEncoding) != 0 || Batcher_Initialize(&mBatcherParams, BatchFlushHandler) != 0) {
+        return -1;
+    }
+
+    Cloud_RegisterEventHandler(CloudEventHandler);
+    Cloud_SetInFlightWindow(mWindow);
+
+    if (Connect() != 0) {
+        printf("Failed to connect to the mock hub\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < mFileCount; i++) {
+        Scheduler_Enqueue(&mFiles[i], Clock_GetMs());
+    }
+
+    struct timespec ts = {0, (long)mPollUs * 1000};
+    AllocCounter_Reset();
+    uint64_t startCpuNs = GetCpuNs();
+    uint64_t startNs = Clock_GetNs();
+
+    while (mFileDoneCount + mFileFailCount < mFileCount) {
+        FeedFiles();
+        Cloud_Task();
+
+        if (mPollUs) {
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    uint64_t elapsedNs = Clock_GetNs() - startNs;
+    uint64_t cpuNs = GetCpuNs() - startCpuNs;
+    AllocCounter_GetStats(&allocStats);
+    MockHub_GetStats(&hubStats);
+    getrusage(RUSAGE_SELF, &usage);
+
+    qsort(mAckLatenciesMs, mAckCount, sizeof(double), CompareDouble);
+
+    double seconds = (double)elapsedNs / 1e9;
+    double messages = hubStats.messageCount ? (double)hubStats.messageCount : 1.0;
+
+    if (mIsJsonOutput) {
+        printf("{\"files\":%zu,\"fileSize\":%zu,\"latency\":\"%s\",\"window\":%zu,\"encoding\":\"%s\",\"messages\":%zu,"
+               "\"failed\":%zu,\"elapsedS\":%.3f,\"messagesPerSecond\":%.1f,\"filesPerSecond\":%.1f,"
+               "\"ackP50Ms\":%.3f,\"ackP99Ms\":%.3f,\"ackP999Ms\":%.3f,\"cpuUsPerMessage\":%.2f,"
+               "\"allocsPerMessage\":%.2f,\"bytesPerMessage\":%.1f,\"peakRssKb\":%ld}\n",
+               mFileCount, mFileSize, mLatencySpec, mWindow, mEncoding, hubStats.messageCount, mFileFailCount,
+               seconds, (double)hubStats.messageCount / seconds, (double)mFileDoneCount / seconds, Percentile(0.5),
+               Percentile(0.99), Percentile(0.999), (double)cpuNs / 1e3 / messages,
+               (double)allocStats.allocCount / messages, (double)hubStats.byteCount / messages, usage.ru_maxrss);
+    } else {
+        printf("%8s %8s %10s %10s %9s %9s %9s %10s %10s %10s %8s\n", "files", "messages", "msg/s", "files/s",
+               "ack p50", "ack p99", "ack p999", "cpu us/msg", "allocs/msg", "B/msg", "RSS KB");
+        printf("%8zu %8zu %10.1f %10.1f %7.2fms %7.2fms %7.2fms %10.2f %10.2f %10.1f %8ld\n", mFileDoneCount,
+               hubStats.messageCount, (double)hubStats.messageCount / seconds, (double)mFileDoneCount / seconds,
+               Percentile(0.5), Percentile(0.99), Percentile(0.999), (double)cpuNs / 1e3 / messages,
+               (double)allocStats.allocCount / messages, (double)hubStats.byteCount / messages, usage.ru_maxrss);
+    }
+
+    for (size_t i = 0; i < mFileCount; i++) {
+        File_Delete(mFiles[i].filename);
+    }
+
+    rmdir(mSpoolDirectory);
+
+    Cloud_Deinitialize();
+    Batcher_Deinitialize();
+    Scheduler_Deinitialize();
+    Encoder_Deinitialize();
+    free(mFiles);
+    free(mAckLatenciesMs);
+    return mFileFailCount ? -1 : 0;
+}
+
+static void PrintUsage(void)
+{
+    /* clang-format off */
+    static const char *usageString = "Usage: cloud-bench-mock [options]\n"
+                                     "\n"
+                                     "Optional options:\n"
+                                     "  -n COUNT, --files COUNT  Number of files to send (default 10000).\n"
+                                     "  -s BYTES, --size BYTES   Size of each file (default 256, at most 511).\n"
+                                     "  -l DIST, --latency DIST  Ack latency of the mock hub in milliseconds:\n"
+                                     "                           fixed:MS (default fixed:20), uniform:MIN:MAX,\n"
+                                     "                           exponential:MEAN or lognormal:MEDIAN:SIGMA.\n"
+                                     "  -F RATE, --fail-rate RATE\n"
+                                     "                           Fraction of messages the mock hub fails.\n"
+                                     "  -w COUNT, --window COUNT Messages in flight (default 32).\n"
+                                     "  -b COUNT, --batch COUNT  Readings per message (default 64).\n"
+                                     "  -L MS, --linger MS       Time a batch waits for more readings (default 0).\n"
+                                     "  -e NAME, --encoding NAME json (default) or cbor.\n"
+                                     "  -p US, --poll US         Sleep per loop iteration (default 1000, as\n"
+                                     "                           cloud-send).\n"
+                                     "  -j, --json               Print the result as one JSON object.\n"
+                                     "  -h, --help               Print this message and exit.\n";
+    /* clang-format on */
+
+    printf("%s", usageString);
+}
+
+static int ParseArguments(int argc, char *argv[])
+{
+    int opt = 0;
+
+    /* clang-format off */
+    static struct option long_options[] = {
+        {"files", required_argument, 0, 'n'},
+        {"size", required_argument, 0, 's'},
+        {"latency", required_argument, 0, 'l'},
+        {"fail-rate", required_argument, 0, 'F'},
+        {"window", required_argument, 0, 'w'},
+        {"batch", required_argument, 0, 'b'},
+        {"linger", required_argument, 0, 'L'},
+        {"encoding", required_argument, 0, 'e'},
+        {"poll", required_argument, 0, 'p'},
+        {"json", no_argument, 0, 'j'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0},
+    };
+    /* clang-format on */
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, "n:s:l:F:w:b:L:e:p:jh", long_options, &long_index)) != -1) {
+        switch (opt) {
+            case 'n':
+                mFileCount = strtoul(optarg, NULL, 10);
+                break;
+
+            case 's':
+                mFileSize = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'l':
+                mLatencySpec = optarg;
+                break;
+
+            case 'F':
+                mHubParams.failRate = strtod(optarg, NULL);
+                break;
+
+            case 'w':
+                mWindow = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'b':
+                mBatcherParams.maxReadings = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'L':
+                mBatcherParams.lingerMs = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+
+            case 'e':
+                mEncoding = optarg;
+                break;
+
+            case 'p':
+                mPollUs = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+
+            case 'j':
+                mIsJsonOutput = true;
+                break;
+
+            case 'h':
+                PrintUsage();
+                exit(0);
+                break;
+
+            default:
+                PrintUsage();
+                exit(-1);
+                break;
+        }
+    }
+
+    if (mFileCount == 0 || mFileSize < 32 || mFileSize >= READ_BUFFER_SIZE) {
+        printf("File count must be positive and the size between 32 and %d bytes\n", READ_BUFFER_SIZE - 1);
+        return -1;
+    }
+
+    if (MockHub_ParseLatency(mLatencySpec, &mHubParams) != 0) {
+        printf("Invalid latency distribution %s\n", mLatencySpec);
+        return -1;
+    }
+
+    if (mWindow == 0) {
+        printf("Window must be positive\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Readings of a few sensors, padded to the file size */
+static int WriteSpool(void)
+{
+    char reading[READ_BUFFER_SIZE];
+
+    for (size_t i = 0; i < mFileCount; i++) {
+        FileInfo *file = &mFiles[i];
+        int length = snprintf(reading, sizeof(reading), "{\"id\":\"sensor-%zu\",\"seq\":%zu,\"v\":%.2f,\"pad\":\"",
+                              i % 8, i, 20.0 + (double)(i % 100) / 10.0);
+
+        while ((size_t)length < mFileSize - 2) {
+            reading[length++] = 'x';
+        }
+
+        length += snprintf(reading + length, sizeof(reading) - length, "\"}");
+        snprintf(file->filename, sizeof(file->filename), "%s/%zu.json", mSpoolDirectory, i);
+
+        FILE *fptr = fopen(file->filename, "w");
+
+        if (fptr == NULL) {
+            return -1;
+        }
+
+        fwrite(reading, 1, (size_t)length, fptr);
+        fclose(fptr);
+    }
+
+    return 0;
+}
+
+static int Connect(void)
+{
+    CredentialStore_Release(mCloudConnectParams.key);
+    mCloudConnectParams.key = CredentialStore_Add(MOCK_CONNECTION_STRING, strlen(MOCK_CONNECTION_STRING));
+    mCloudConnectParams.isX509 = false;
+
+    if (Cloud_Connect(&mCloudConnectParams) != 0) {
+        return -1;
+    }
+
+    uint64_t startMs = Clock_GetMs();
+
+    while (!mIsConnected && Clock_GetMs() - startMs < CONNECT_TIMEOUT_MS) {
+        Cloud_Task();
+    }
+
+    return mIsConnected ? 0 : -1;
+}
+
+/* The same feeding as cloud-send's SendScheduledFiles, without the filter and the aggregator */
+static void FeedFiles(void)
+{
+    FileInfo *file;
+
+    while (Cloud_GetPendingCount() < SCHEDULER_FEED_DEPTH && Batcher_CanAccept() &&
+           (file = Scheduler_Next(Clock_GetMs())) != NULL) {
+        if (File_Read(file->filename, mStringData, sizeof(mStringData)) != 0 ||
+            Batcher_Add(file->lane, file->lane == SCHEDULER_LANE_HIGH, mStringData, strlen(mStringData), file,
+                        file->enqueueTimeMs, Clock_GetMs()) != 0) {
+            mFileFailCount++;
+        }
+    }
+
+    if (Scheduler_GetQueuedCount() == 0) {
+        Batcher_FlushAll();
+    } else {
+        Batcher_Task(Clock_GetMs());
+    }
+}
+
+static void BatchFlushHandler(Batch *batch)
+{
+    CloudMessageOptions options = {0};
+    const void *data = batch->data;
+    size_t size = batch->size;
+    const void *encoded;
+    size_t encodedSize;
+
+    if (Encoder_Encode(data, size, &encoded, &encodedSize) == 0) {
+        data = encoded;
+        size = encodedSize;
+        options.contentType = Encoder_GetContentType();
+        options.contentEncoding = "";
+    }
+
+    for (size_t i = 0; i < BATCHER_MAX_BATCHES; i++) {
+        if (mInFlight[i].batch == NULL) {
+            mInFlight[i].batch = batch;
+            mInFlight[i].handOffNs = Clock_GetNs();
+            break;
+        }
+    }
+
+    if (Cloud_SendDataEx(data, size, &options, batch) != 0) {
+        CompleteBatch(batch, false);
+    }
+}
+
+static void CompleteBatch(Batch *batch, bool success)
+{
+    uint64_t nowNs = Clock_GetNs();
+
+    for (size_t i = 0; i < BATCHER_MAX_BATCHES; i++) {
+        if (mInFlight[i].batch == batch) {
+            if (success) {
+                mAckLatenciesMs[mAckCount++] = (double)(nowNs - mInFlight[i].handOffNs) / 1e6;
+            }
+
+            mInFlight[i].batch = NULL;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < batch->count; i++) {
+        FileInfo *file = (FileInfo *)batch->contexts[i];
+        FileInfo_SetSendStatus(file, success);
+        Scheduler_Complete(file, success, Clock_GetMs());
+        success ? mFileDoneCount++ : mFileFailCount++;
+    }
+
+    Batcher_Release(batch);
+}
+
+static void CloudEventHandler(CloudEvent evt, void *data)
+{
+    switch (evt) {
+        case CLOUD_EVENT_CONNECTIONSTATUSCHANGED:
+            mIsConnected = (*((CloudConnectionStatus *)data) == CLOUD_CONNECTION_CONNECTED);
+            break;
+
+        case CLOUD_EVENT_SENDDATASUCCEEDED:
+            CompleteBatch((Batch *)data, true);
+            break;
+
+        case CLOUD_EVENT_SENDDATAFAILED:
+            CompleteBatch((Batch *)data, false);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static uint64_t GetCpuNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int CompareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double Percentile(double fraction)
+{
+    if (mAckCount == 0) {
+        return 0.0;
+    }
+
+    size_t index = (size_t)(fraction * (double)mAckCount);
+    return mAckLatenciesMs[index < mAckCount ? index : mAckCount - 1];
+}
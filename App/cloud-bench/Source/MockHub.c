@@ -0,0 +1,290 @@
+#include "MockHub.h"
+#include "Clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "iothub_device_client_ll.h"
+#include "iothub_message.h"
+#include "iothubtransportmqtt.h"
+#include "iothubtransportmqtt_websockets.h"
+#include "iothubtransportamqp.h"
+#include "iothubtransportamqp_websockets.h"
+#include "iothubtransporthttp.h"
+
+typedef struct sMockMessage {
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK callback;
+    void *context;
+    uint64_t dueNs;
+    bool isFailed;
+} MockMessage;
+
+typedef struct sMockClient {
+    IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK statusCallback;
+    void *statusContext;
+    bool isAnnounced;
+} MockClient;
+
+/* Pending messages live in a fixed ring, so the mock adds no allocations to what the benchmark counts */
+static MockMessage mPending[MOCKHUB_MAX_PENDING];
+static size_t mHead = 0;
+static size_t mCount = 0;
+static uint64_t mLastDueNs = 0;
+static MockClient mClient;
+static MockHubParams mParams = {MOCKHUB_LATENCY_FIXED, 20.0, 0.0, 0.0, 1};
+static uint64_t mRandom = 1;
+static MockHubStats mStats;
+
+static double NextUniform(void);
+static double NextNormal(void);
+static uint64_t SampleLatencyNs(void);
+static void CompleteDue(uint64_t nowNs, IOTHUB_CLIENT_CONFIRMATION_RESULT forced, bool isForced);
+
+/* fixed:MS, uniform:MIN:MAX, exponential:MEAN or lognormal:MEDIAN:SIGMA, all in milliseconds except sigma */
+int MockHub_ParseLatency(const char *spec, MockHubParams *params)
+{
+    char name[16];
+    double a = 0;
+    double b = 0;
+    int fields = sscanf(spec, "%15[a-z]:%lf:%lf", name, &a, &b);
+
+    if (fields < 2 || a < 0 || b < 0) {
+        return -1;
+    }
+
+    if (strcmp(name, "fixed") == 0 && fields == 2) {
+        params->latency = MOCKHUB_LATENCY_FIXED;
+    } else if (strcmp(name, "uniform") == 0 && fields == 3 && b >= a) {
+        params->latency = MOCKHUB_LATENCY_UNIFORM;
+    } else if (strcmp(name, "exponential") == 0 && fields == 2) {
+        params->latency = MOCKHUB_LATENCY_EXPONENTIAL;
+    } else if (strcmp(name, "lognormal") == 0 && fields == 3) {
+        params->latency = MOCKHUB_LATENCY_LOGNORMAL;
+    } else {
+        return -1;
+    }
+
+    params->a = a;
+    params->b = b;
+    return 0;
+}
+
+void MockHub_Configure(const MockHubParams *params)
+{
+    mParams = *params;
+    mRandom = params->seed ? params->seed : 1;
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+void MockHub_GetStats(MockHubStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+    }
+}
+
+/* The device client as the Cloud library uses it */
+IOTHUB_DEVICE_CLIENT_LL_HANDLE IoTHubDeviceClient_LL_CreateFromConnectionString(
+    const char *connectionString, IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol)
+{
+    (void)connectionString;
+    (void)protocol;
+    memset(&mClient, 0, sizeof(mClient));
+    mHead = 0;
+    mCount = 0;
+    mLastDueNs = 0;
+    return (IOTHUB_DEVICE_CLIENT_LL_HANDLE)&mClient;
+}
+
+void IoTHubDeviceClient_LL_Destroy(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle)
+{
+    (void)iotHubClientHandle;
+    CompleteDue(UINT64_MAX, IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY, true);
+    memset(&mClient, 0, sizeof(mClient));
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetOption(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle,
+                                                     const char *optionName, const void *value)
+{
+    (void)iotHubClientHandle;
+    (void)optionName;
+    (void)value;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetRetryPolicy(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle,
+                                                          IOTHUB_CLIENT_RETRY_POLICY retryPolicy,
+                                                          size_t retryTimeoutLimitInSeconds)
+{
+    (void)iotHubClientHandle;
+    (void)retryPolicy;
+    (void)retryTimeoutLimitInSeconds;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetConnectionStatusCallback(
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle,
+    IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK connectionStatusCallback, void *userContextCallback)
+{
+    MockClient *client = (MockClient *)iotHubClientHandle;
+    client->statusCallback = connectionStatusCallback;
+    client->statusContext = userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+/* Twin documents are taken and never answered, the benchmarks leave tuning off */
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetDeviceTwinCallback(
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle, IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK deviceTwinCallback,
+    void *userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)deviceTwinCallback;
+    (void)userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SendReportedState(
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle, const unsigned char *reportedState, size_t size,
+    IOTHUB_CLIENT_REPORTED_STATE_CALLBACK reportedStateCallback, void *userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)reportedState;
+    (void)size;
+    (void)reportedStateCallback;
+    (void)userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+/* The message handle is only borrowed for the call, as with the SDK, which keeps a clone */
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SendEventAsync(
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle, IOTHUB_MESSAGE_HANDLE eventMessageHandle,
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventConfirmationCallback, void *userContextCallback)
+{
+    const unsigned char *buffer;
+    size_t size = 0;
+
+    (void)iotHubClientHandle;
+
+    if (mCount == MOCKHUB_MAX_PENDING) {
+        mStats.rejectCount++;
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    (void)IoTHubMessage_GetByteArray(eventMessageHandle, &buffer, &size);
+
+    /* Acknowledgements come back in order, a message is never confirmed before the ones sent ahead of it */
+    uint64_t dueNs = Clock_GetNs() + SampleLatencyNs();
+    mLastDueNs = dueNs > mLastDueNs ? dueNs : mLastDueNs;
+
+    MockMessage *msg = &mPending[(mHead + mCount) % MOCKHUB_MAX_PENDING];
+    msg->callback = eventConfirmationCallback;
+    msg->context = userContextCallback;
+    msg->dueNs = mLastDueNs;
+    msg->isFailed = mParams.failRate > 0 && NextUniform() < mParams.failRate;
+    mCount++;
+
+    mStats.messageCount++;
+    mStats.byteCount += size;
+    mStats.maxPending = mCount > mStats.maxPending ? mCount : mStats.maxPending;
+    return IOTHUB_CLIENT_OK;
+}
+
+void IoTHubDeviceClient_LL_DoWork(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle)
+{
+    MockClient *client = (MockClient *)iotHubClientHandle;
+
+    if (!client->isAnnounced && client->statusCallback) {
+        client->isAnnounced = true;
+        client->statusCallback(IOTHUB_CLIENT_CONNECTION_AUTHENTICATED, IOTHUB_CLIENT_CONNECTION_OK,
+                               client->statusContext);
+    }
+
+    CompleteDue(Clock_GetNs(), IOTHUB_CLIENT_CONFIRMATION_OK, false);
+}
+
+/* Defined here so that none of the network stacks are linked in */
+const TRANSPORT_PROVIDER *MQTT_Protocol(void)
+{
+    return NULL;
+}
+
+const TRANSPORT_PROVIDER *MQTT_WebSocket_Protocol(void)
+{
+    return NULL;
+}
+
+const TRANSPORT_PROVIDER *AMQP_Protocol(void)
+{
+    return NULL;
+}
+
+const TRANSPORT_PROVIDER *AMQP_Protocol_over_WebSocketsTls(void)
+{
+    return NULL;
+}
+
+const TRANSPORT_PROVIDER *HTTP_Protocol(void)
+{
+    return NULL;
+}
+
+static void CompleteDue(uint64_t nowNs, IOTHUB_CLIENT_CONFIRMATION_RESULT forced, bool isForced)
+{
+    /* A callback may send again, which appends behind the messages completed here */
+    while (mCount && mPending[mHead].dueNs <= nowNs) {
+        MockMessage msg = mPending[mHead];
+        IOTHUB_CLIENT_CONFIRMATION_RESULT result = msg.isFailed ? IOTHUB_CLIENT_CONFIRMATION_ERROR
+                                                                : IOTHUB_CLIENT_CONFIRMATION_OK;
+
+        mHead = (mHead + 1) % MOCKHUB_MAX_PENDING;
+        mCount--;
+
+        result = isForced ? forced : result;
+        result == IOTHUB_CLIENT_CONFIRMATION_OK ? mStats.ackCount++ : mStats.failCount++;
+
+        if (msg.callback) {
+            msg.callback(result, msg.context);
+        }
+    }
+}
+
+/* xorshift64*, seeded for runs that can be repeated */
+static double NextUniform(void)
+{
+    mRandom ^= mRandom >> 12;
+    mRandom ^= mRandom << 25;
+    mRandom ^= mRandom >> 27;
+    return (double)((mRandom * 0x2545F4914F6CDD1Dull) >> 11) / 9007199254740992.0;
+}
+
+static double NextNormal(void)
+{
+    double u = NextUniform();
+    double v = NextUniform();
+    return sqrt(-2.0 * log(u > 0 ? u : 1e-300)) * cos(2.0 * M_PI * v);
+}
+
+static uint64_t SampleLatencyNs(void)
+{
+    double ms = mParams.a;
+
+    switch (mParams.latency) {
+        case MOCKHUB_LATENCY_UNIFORM:
+            ms = mParams.a + (mParams.b - mParams.a) * NextUniform();
+            break;
+
+        case MOCKHUB_LATENCY_EXPONENTIAL:
+            ms = -mParams.a * log(1.0 - NextUniform());
+            break;
+
+        case MOCKHUB_LATENCY_LOGNORMAL:
+            ms = mParams.a * exp(mParams.b * NextNormal());
+            break;
+
+        default:
+            break;
+    }
+
+    return (uint64_t)(ms * 1e6);
+}
@@ -0,0 +1,61 @@
+#include "SyscallCounter.h"
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <linux/ptrace.h>
+
+/* Counts the system calls the function makes, the way strace -c does: the function runs once in a child that the
+ * caller traces with PTRACE_SYSCALL. Tracing makes each system call several times slower, so this is for counting
+ * only and never for timing. The child's exit_group is not counted. Fails where ptrace is not permitted, as in some
+ * containers. */
+int SyscallCounter_Count(SyscallCounter_Function function, void *arg, uint64_t *count)
+{
+    int status;
+    uint64_t entryCount = 0;
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        return -1;
+    }
+
+    if (pid == 0) {
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0) {
+            _exit(1);
+        }
+
+        /* Wait for the parent to start tracing system calls */
+        kill(getpid(), SIGSTOP);
+        function(arg);
+        _exit(0);
+    }
+
+    if (waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status) ||
+        ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL)) != 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return -1;
+    }
+
+    while (ptrace(PTRACE_SYSCALL, pid, NULL, NULL) == 0 && waitpid(pid, &status, 0) == pid) {
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            break;
+        }
+
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            struct ptrace_syscall_info info;
+
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, (void *)sizeof(info), &info) > 0 &&
+                info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+                entryCount++;
+            }
+        }
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+
+    *count = entryCount ? entryCount - 1 : 0;
+    return 0;
+}
@@ -0,0 +1,250 @@
+#include "TransportBench.h"
+#include "Clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+
+#define MAX_TRACKED_FDS 256
+#define WIRE_SAMPLE_INTERVAL_MS 10
+#define POLL_INTERVAL_NS 200000
+
+/* Bytes of a TCP socket as the kernel counts them, which includes TLS records and protocol framing */
+typedef struct sSocketBytes {
+    ino_t inode;
+    uint64_t sentBytes;
+    uint64_t receivedBytes;
+} SocketBytes;
+
+static SocketBytes mSockets[MAX_TRACKED_FDS];
+static uint64_t mClosedSentBytes = 0;
+static uint64_t mClosedReceivedBytes = 0;
+static uint64_t mLastSampleMs = 0;
+static CloudConnectionStatus mConnectionStatus = CLOUD_CONNECTION_DISCONNECTED_UNKNOWN;
+static uint64_t *mSendTimesNs = NULL;
+static double *mAckLatenciesMs = NULL;
+static size_t mAckCount = 0;
+static size_t mFailCount = 0;
+
+static void EventHandler(CloudEvent evt, void *data);
+static void SampleWireBytes(uint64_t *sentBytes, uint64_t *receivedBytes);
+static void Poll(void);
+static int CompareDouble(const void *a, const void *b);
+
+/* Sends the same payload count times over the transport, keeping up to window messages in flight. Messages are only
+ * handed over while the Cloud pending queue is empty, so the ack latency is measured from the SDK and not from a
+ * queue in front of it. */
+int TransportBench_Run(CloudConnectParams *params, CloudTransport transport, const char *payload, size_t count,
+                       size_t window, TransportBenchResult *result)
+{
+    size_t size = strlen(payload);
+    uint64_t sentBytes;
+    uint64_t receivedBytes;
+
+    memset(result, 0, sizeof(TransportBenchResult));
+    result->transport = transport;
+
+    mSendTimesNs = calloc(count, sizeof(uint64_t));
+    mAckLatenciesMs = calloc(count, sizeof(double));
+    mAckCount = 0;
+    mFailCount = 0;
+    mConnectionStatus = CLOUD_CONNECTION_DISCONNECTED_UNKNOWN;
+
+    if (mSendTimesNs == NULL || mAckLatenciesMs == NULL) {
+        free(mSendTimesNs);
+        free(mAckLatenciesMs);
+        return -1;
+    }
+
+    params->transport = transport;
+    Cloud_RegisterEventHandler(EventHandler);
+    Cloud_SetInFlightWindow(window);
+
+    uint64_t startMs = Clock_GetMs();
+    int res = Cloud_Connect(params);
+
+    while (res == 0 && mConnectionStatus != CLOUD_CONNECTION_CONNECTED &&
+           Clock_GetMs() - startMs < TRANSPORTBENCH_TIMEOUT_MS) {
+        Poll();
+    }
+
+    if (res == 0 && mConnectionStatus == CLOUD_CONNECTION_CONNECTED) {
+        result->isConnected = true;
+        result->connectMs = Clock_GetMs() - startMs;
+
+        /* The handshake is not part of the workload */
+        mLastSampleMs = 0;
+        SampleWireBytes(&sentBytes, &receivedBytes);
+
+        uint64_t startNs = Clock_GetNs();
+        size_t submitted = 0;
+
+        while (mAckCount + mFailCount < count && (Clock_GetNs() - startNs) / 1000000 < TRANSPORTBENCH_TIMEOUT_MS) {
+            while (submitted < count && submitted - mAckCount - mFailCount < window && Cloud_GetPendingCount() == 0) {
+                mSendTimesNs[submitted] = Clock_GetNs();
+
+                if (Cloud_SendDataEx(payload, size, NULL, (void *)(uintptr_t)(submitted + 1)) != 0) {
+                    break;
+                }
+
+                submitted++;
+            }
+
+            Poll();
+        }
+
+        result->elapsedNs = Clock_GetNs() - startNs;
+        result->messageCount = submitted;
+
+        uint64_t endSentBytes;
+        uint64_t endReceivedBytes;
+        mLastSampleMs = 0;
+        SampleWireBytes(&endSentBytes, &endReceivedBytes);
+        result->sentBytes = endSentBytes - sentBytes;
+        result->receivedBytes = endReceivedBytes - receivedBytes;
+    }
+
+    Cloud_Disconnect();
+    Cloud_RegisterEventHandler(NULL);
+
+    result->ackCount = mAckCount;
+    result->failCount = mFailCount;
+
+    if (mAckCount) {
+        double total = 0;
+
+        for (size_t i = 0; i < mAckCount; i++) {
+            total += mAckLatenciesMs[i];
+        }
+
+        qsort(mAckLatenciesMs, mAckCount, sizeof(double), CompareDouble);
+        result->meanAckMs = total / (double)mAckCount;
+        result->p50AckMs = mAckLatenciesMs[mAckCount / 2];
+        result->p99AckMs = mAckLatenciesMs[(mAckCount * 99) / 100];
+        result->maxAckMs = mAckLatenciesMs[mAckCount - 1];
+    }
+
+    free(mSendTimesNs);
+    free(mAckLatenciesMs);
+    mSendTimesNs = NULL;
+    mAckLatenciesMs = NULL;
+    return result->isConnected ? 0 : -1;
+}
+
+void TransportBench_PrintHeader(void)
+{
+    printf("%-15s %8s %9s %9s %9s %9s %9s %10s %10s %7s\n", "transport", "messages", "msg/s", "connect", "ack mean",
+           "ack p50", "ack p99", "tx B/msg", "rx B/msg", "failed");
+}
+
+void TransportBench_PrintResult(const TransportBenchResult *result)
+{
+    const char *name = Cloud_GetTransportName(result->transport);
+
+    if (!result->isConnected) {
+        printf("%-15s %8s\n", name, "not connected");
+        return;
+    }
+
+    double seconds = (double)result->elapsedNs / 1e9;
+    double messages = result->messageCount ? (double)result->messageCount : 1.0;
+
+    printf("%-15s %8zu %9.1f %7llums %7.1fms %7.1fms %7.1fms %10.1f %10.1f %7zu\n", name, result->messageCount,
+           seconds > 0 ? (double)result->ackCount / seconds : 0.0, (unsigned long long)result->connectMs,
+           result->meanAckMs, result->p50AckMs, result->p99AckMs, (double)result->sentBytes / messages,
+           (double)result->receivedBytes / messages, result->failCount);
+}
+
+static void EventHandler(CloudEvent evt, void *data)
+{
+    switch (evt) {
+        case CLOUD_EVENT_CONNECTIONSTATUSCHANGED:
+            mConnectionStatus = *((CloudConnectionStatus *)data);
+            break;
+
+        case CLOUD_EVENT_SENDDATASUCCEEDED: {
+            size_t index = (size_t)(uintptr_t)data - 1;
+            mAckLatenciesMs[mAckCount++] = (double)(Clock_GetNs() - mSendTimesNs[index]) / 1e6;
+            break;
+        }
+
+        case CLOUD_EVENT_SENDDATAFAILED:
+            mFailCount++;
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* Sums the bytes of all TCP sockets of the process, including the ones closed since they were last seen. A socket
+ * is told apart from a later one on the same descriptor by its inode. */
+static void SampleWireBytes(uint64_t *sentBytes, uint64_t *receivedBytes)
+{
+    static uint64_t sent = 0;
+    static uint64_t received = 0;
+    uint64_t nowMs = Clock_GetMs();
+
+    if (mLastSampleMs && nowMs - mLastSampleMs < WIRE_SAMPLE_INTERVAL_MS) {
+        *sentBytes = sent;
+        *receivedBytes = received;
+        return;
+    }
+
+    mLastSampleMs = nowMs;
+    sent = mClosedSentBytes;
+    received = mClosedReceivedBytes;
+
+    for (int fd = 0; fd < MAX_TRACKED_FDS; fd++) {
+        SocketBytes *socketBytes = &mSockets[fd];
+        struct stat st;
+        struct tcp_info info;
+        socklen_t length = sizeof(info);
+
+        memset(&info, 0, sizeof(info));
+        bool isTcp = fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode) &&
+                     getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &length) == 0;
+
+        if (socketBytes->inode && (!isTcp || st.st_ino != socketBytes->inode)) {
+            mClosedSentBytes += socketBytes->sentBytes;
+            mClosedReceivedBytes += socketBytes->receivedBytes;
+            sent += socketBytes->sentBytes;
+            received += socketBytes->receivedBytes;
+            memset(socketBytes, 0, sizeof(SocketBytes));
+        }
+
+        if (isTcp) {
+            socketBytes->inode = st.st_ino;
+            socketBytes->sentBytes = info.tcpi_bytes_acked;
+            socketBytes->receivedBytes = info.tcpi_bytes_received;
+            sent += socketBytes->sentBytes;
+            received += socketBytes->receivedBytes;
+        }
+    }
+
+    *sentBytes = sent;
+    *receivedBytes = received;
+}
+
+static void Poll(void)
+{
+    struct timespec ts = {0, POLL_INTERVAL_NS};
+    uint64_t sentBytes;
+    uint64_t receivedBytes;
+
+    Cloud_Task();
+    SampleWireBytes(&sentBytes, &receivedBytes);
+    nanosleep(&ts, NULL);
+}
+
+static int CompareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
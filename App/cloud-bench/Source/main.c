@@ -0,0 +1,589 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "Cloud.h"
+#include "MessagePool.h"
+#include "AllocCounter.h"
+#include "File.h"
+#include "Ring.h"
+#include "TransportBench.h"
+#include "IdentityBench.h"
+
+#include "iothub_device_client_ll.h"
+#include "iothub_message.h"
+#include "iothubtransportmqtt.h"
+
+#define DEFAULT_MESSAGE_COUNT 10000
+#define DEFAULT_MESSAGE_SIZE 256
+#define SPOOL_READ_BUFFER_SIZE (64 * 1024)
+
+/* The client is never driven with DoWork, so messages are only queued. This isolates the cost of the send path from
+ * network I/O. */
+static const char *BENCH_CONNECTION_STRING =
+    "HostName=bench.azure-devices.net;DeviceId=bench;SharedAccessKey=YmVuY2htYXJrLWtleQ==";
+
+typedef struct sBenchResult {
+    const char *name;
+    size_t messageCount;
+    uint64_t elapsedNs;
+    size_t allocCount;
+    uint64_t ioCallCount;
+    uint64_t copyBytes;
+} BenchResult;
+
+/* Read and write system calls and the bytes they moved between the process and the kernel, for all threads */
+typedef struct sProcessIo {
+    uint64_t callCount;
+    uint64_t byteCount;
+} ProcessIo;
+
+static size_t mMessageCount = DEFAULT_MESSAGE_COUNT;
+static size_t mMessageSize = DEFAULT_MESSAGE_SIZE;
+static char *mPayload = NULL;
+static char mSpoolDirectory[] = "/tmp/cloud-bench-XXXXXX";
+static CloudConnectParams mCloudConnectParams;
+static const char *mConnectionStringFile = NULL;
+static const char *mTransportList = NULL;
+static size_t mWindow = TRANSPORTBENCH_DEFAULT_WINDOW;
+static bool mIsIdentityBench = false;
+
+/* Identity counts of the shared transport comparison */
+static const size_t mIdentityCounts[] = {10, 100, 1000};
+
+static int ParseArguments(int argc, char *argv[]);
+static char *CreatePayload(size_t size);
+static void BenchLegacySendPath(BenchResult *result);
+static void BenchPooledSendPath(BenchResult *result);
+static void BenchSpoolPath(BenchResult *result);
+static void BenchRingPath(BenchResult *result);
+static int BenchTransports(void);
+static int BenchIdentities(void);
+static int ParseTransportList(CloudTransport *transports, size_t *transportCount);
+static void *RingProducer(void *arg);
+static void ReadProcessIo(ProcessIo *io);
+static void PrintResult(const BenchResult *result);
+static uint64_t GetTimeNs(void);
+
+int main(int argc, char *argv[])
+{
+    BenchResult legacy = {"legacy", 0, 0, 0, 0, 0};
+    BenchResult pooled = {"pooled", 0, 0, 0, 0, 0};
+    BenchResult spool = {"spool", 0, 0, 0, 0, 0};
+    BenchResult ring = {"ring", 0, 0, 0, 0, 0};
+
+    if (ParseArguments(argc, argv) != 0) {
+        return -1;
+    }
+
+    mPayload = CreatePayload(mMessageSize);
+
+    if (mPayload == NULL || Cloud_Initialize() != 0) {
+        return -1;
+    }
+
+    /* With a connection string the transports are compared against a real hub instead of the local send paths */
+    if (mConnectionStringFile) {
+        int res = BenchTransports();
+        Cloud_Deinitialize();
+        free(mPayload);
+        return res;
+    }
+
+    if (mIsIdentityBench) {
+        int res = BenchIdentities();
+        Cloud_Deinitialize();
+        free(mPayload);
+        return res;
+    }
+
+    mCloudConnectParams.key = CredentialStore_Add(BENCH_CONNECTION_STRING, strlen(BENCH_CONNECTION_STRING));
+    mCloudConnectParams.isX509 = false;
+
+    BenchLegacySendPath(&legacy);
+    BenchPooledSendPath(&pooled);
+
+    /* Both ingestion paths send through the pooled path, after it has warmed up */
+    if (mkdtemp(mSpoolDirectory)) {
+        BenchSpoolPath(&spool);
+        BenchRingPath(&ring);
+        rmdir(mSpoolDirectory);
+    }
+
+    printf("%-8s %10s %12s %12s %12s %12s\n", "path", "messages", "ns/send", "allocs/msg", "io-calls/msg",
+           "copied B/msg");
+    PrintResult(&legacy);
+    PrintResult(&pooled);
+    PrintResult(&spool);
+    PrintResult(&ring);
+
+    Cloud_Deinitialize();
+    free(mPayload);
+    return 0;
+}
+
+static void PrintUsage(void)
+{
+    /* clang-format off */
+    static const char *usageString = "Usage: cloud-bench [options]\n"
+                                     "\n"
+                                     "Optional options:\n"
+                                     "  -n COUNT, --messages COUNT\n"
+                                     "                           Number of messages per path (default 10000).\n"
+                                     "  -s BYTES, --size BYTES   Payload size in bytes (default 256).\n"
+                                     "  -c FILE, --connection-string FILE\n"
+                                     "                           Send to the IoT Hub of this connection string and\n"
+                                     "                           compare the transports instead of the send paths.\n"
+                                     "  -t LIST, --transports LIST\n"
+                                     "                           Comma separated transports to compare (default all):\n"
+                                     "                           mqtt, mqtt_websocket, amqp, amqp_websocket, http.\n"
+                                     "  -w COUNT, --window COUNT Messages in flight while comparing transports\n"
+                                     "                           (default 32).\n"
+                                     "  -i, --identities         Compare the heap held by 10, 100 and 1000 device\n"
+                                     "                           identities with a client each and on one shared\n"
+                                     "                           transport (default transports amqp,\n"
+                                     "                           amqp_websocket, http).\n"
+                                     "  -h, --help               Print this message and exit.\n";
+    /* clang-format on */
+
+    printf("%s", usageString);
+}
+
+static int ParseArguments(int argc, char *argv[])
+{
+    int opt = 0;
+
+    /* clang-format off */
+    static struct option long_options[] = {
+        {"messages", required_argument, 0, 'n'},
+        {"size", required_argument, 0, 's'},
+        {"connection-string", required_argument, 0, 'c'},
+        {"transports", required_argument, 0, 't'},
+        {"window", required_argument, 0, 'w'},
+        {"identities", no_argument, 0, 'i'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0},
+    };
+    /* clang-format on */
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, "n:s:c:t:w:ih", long_options, &long_index)) != -1) {
+        switch (opt) {
+            case 'n':
+                mMessageCount = strtoul(optarg, NULL, 10);
+                break;
+
+            case 's':
+                mMessageSize = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'c':
+                mConnectionStringFile = optarg;
+                break;
+
+            case 't':
+                mTransportList = optarg;
+                break;
+
+            case 'w':
+                mWindow = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'i':
+                mIsIdentityBench = true;
+                break;
+
+            case 'h':
+                PrintUsage();
+                exit(0);
+                break;
+
+            default:
+                PrintUsage();
+                exit(-1);
+                break;
+        }
+    }
+
+    if (mMessageCount == 0 || mMessageSize < 2) {
+        printf("Message count and size must be positive\n");
+        return -1;
+    }
+
+    if (mWindow == 0) {
+        printf("Window must be positive\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static char *CreatePayload(size_t size)
+{
+    char *payload = malloc(size + 1);
+
+    if (payload) {
+        memset(payload, 'x', size);
+        payload[0] = '"';
+        payload[size - 1] = '"';
+        payload[size] = '\0';
+    }
+
+    return payload;
+}
+
+/* Replicates the send path as it was before the message pool: one message handle per send with the system
+ * properties set from string literals. */
+static void BenchLegacySendPath(BenchResult *result)
+{
+    size_t remaining = mMessageCount;
+    AllocCounterStats stats;
+
+    while (remaining) {
+        size_t batch = remaining < MESSAGEPOOL_MAX_MESSAGES ? remaining : MESSAGEPOOL_MAX_MESSAGES;
+        IOTHUB_DEVICE_CLIENT_LL_HANDLE client =
+            IoTHubDeviceClient_LL_CreateFromConnectionString(BENCH_CONNECTION_STRING, MQTT_Protocol);
+
+        if (client == NULL) {
+            return;
+        }
+
+        AllocCounter_Reset();
+        uint64_t start = GetTimeNs();
+
+        for (size_t i = 0; i < batch; i++) {
+            IOTHUB_MESSAGE_HANDLE msgHandle = IoTHubMessage_CreateFromString(mPayload);
+            (void)IoTHubMessage_SetContentTypeSystemProperty(msgHandle, "application/json");
+            (void)IoTHubMessage_SetContentEncodingSystemProperty(msgHandle, "utf-8");
+            (void)IoTHubDeviceClient_LL_SendEventAsync(client, msgHandle, NULL, NULL);
+            IoTHubMessage_Destroy(msgHandle);
+        }
+
+        result->elapsedNs += GetTimeNs() - start;
+        AllocCounter_GetStats(&stats);
+        result->allocCount += stats.allocCount;
+        result->messageCount += batch;
+        remaining -= batch;
+
+        IoTHubDeviceClient_LL_Destroy(client);
+    }
+}
+
+static void BenchPooledSendPath(BenchResult *result)
+{
+    size_t remaining = mMessageCount;
+    AllocCounterStats stats;
+    bool warmUp = true;
+
+    while (remaining) {
+        size_t batch = remaining < MESSAGEPOOL_MAX_MESSAGES ? remaining : MESSAGEPOOL_MAX_MESSAGES;
+
+        if (Cloud_Connect(&mCloudConnectParams) != 0) {
+            return;
+        }
+
+        AllocCounter_Reset();
+        uint64_t start = GetTimeNs();
+
+        for (size_t i = 0; i < batch; i++) {
+            (void)Cloud_SendData(mPayload, NULL);
+        }
+
+        uint64_t elapsed = GetTimeNs() - start;
+        AllocCounter_GetStats(&stats);
+
+        /* The first batch fills the table of interned strings; steady state is what the pool is meant to deliver */
+        if (!warmUp) {
+            result->elapsedNs += elapsed;
+            result->allocCount += stats.allocCount;
+            result->messageCount += batch;
+            remaining -= batch;
+        }
+
+        warmUp = false;
+        Cloud_Disconnect();
+    }
+}
+
+/* Replicates a data logger that writes one file per reading and cloud-send reading it back and deleting it */
+static void BenchSpoolPath(BenchResult *result)
+{
+    size_t remaining = mMessageCount;
+    char *buffer = malloc(SPOOL_READ_BUFFER_SIZE);
+    char path[FILE_MAX_STRING_LENGTH];
+    AllocCounterStats stats;
+    ProcessIo before;
+    ProcessIo after;
+
+    while (buffer && remaining) {
+        size_t batch = remaining < MESSAGEPOOL_MAX_MESSAGES ? remaining : MESSAGEPOOL_MAX_MESSAGES;
+
+        if (Cloud_Connect(&mCloudConnectParams) != 0) {
+            break;
+        }
+
+        ReadProcessIo(&before);
+        AllocCounter_Reset();
+        uint64_t start = GetTimeNs();
+
+        for (size_t i = 0; i < batch; i++) {
+            snprintf(path, sizeof(path), "%s/%zu.json", mSpoolDirectory, i);
+            int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+            if (fd < 0 || write(fd, mPayload, mMessageSize) != (ssize_t)mMessageSize) {
+                printf("Failed to write %s\n", path);
+                exit(-1);
+            }
+
+            close(fd);
+
+            if (File_Read(path, buffer, SPOOL_READ_BUFFER_SIZE) == 0) {
+                (void)Cloud_SendData(buffer, NULL);
+            }
+
+            File_Delete(path);
+        }
+
+        result->elapsedNs += GetTimeNs() - start;
+        AllocCounter_GetStats(&stats);
+        ReadProcessIo(&after);
+        result->allocCount += stats.allocCount;
+        result->ioCallCount += after.callCount - before.callCount;
+        result->copyBytes += after.byteCount - before.byteCount;
+        result->messageCount += batch;
+        remaining -= batch;
+
+        Cloud_Disconnect();
+    }
+
+    free(buffer);
+}
+
+/* A producer thread writes the readings into the shared memory ring while the main thread sends them from it */
+static void BenchRingPath(BenchResult *result)
+{
+    Ring ring;
+    char socketPath[FILE_MAX_STRING_LENGTH];
+    pthread_t producer;
+    RingRecord record;
+    AllocCounterStats stats;
+    ProcessIo before;
+    ProcessIo after;
+
+    snprintf(socketPath, sizeof(socketPath), "%s/ring.sock", mSpoolDirectory);
+
+    if (RingServer_Open(&ring, socketPath, RING_DEFAULT_CAPACITY) != 0) {
+        return;
+    }
+
+    ReadProcessIo(&before);
+
+    if (pthread_create(&producer, NULL, RingProducer, socketPath) != 0) {
+        RingServer_Close(&ring);
+        return;
+    }
+
+    size_t remaining = mMessageCount;
+
+    while (remaining) {
+        size_t batch = remaining < MESSAGEPOOL_MAX_MESSAGES ? remaining : MESSAGEPOOL_MAX_MESSAGES;
+        size_t sent = 0;
+
+        if (Cloud_Connect(&mCloudConnectParams) != 0) {
+            break;
+        }
+
+        AllocCounter_Reset();
+        uint64_t start = GetTimeNs();
+
+        while (sent < batch) {
+            RingServer_Task(&ring);
+
+            if (!Ring_Peek(&ring, &record)) {
+                Ring_Wait(&ring, 1);
+                continue;
+            }
+
+            (void)Cloud_SendDataEx(record.data, record.size, NULL, NULL);
+            Ring_Release(&ring, &record);
+            sent++;
+        }
+
+        result->elapsedNs += GetTimeNs() - start;
+        AllocCounter_GetStats(&stats);
+        result->allocCount += stats.allocCount;
+        result->messageCount += batch;
+        remaining -= batch;
+
+        Cloud_Disconnect();
+    }
+
+    pthread_join(producer, NULL);
+    ReadProcessIo(&after);
+    result->ioCallCount = after.callCount - before.callCount;
+    result->copyBytes = after.byteCount - before.byteCount;
+    RingServer_Close(&ring);
+}
+
+/* Every transport sends the same payloads over a fresh connection, one transport after the other */
+static int BenchTransports(void)
+{
+    CloudTransport transports[CLOUD_TRANSPORT_COUNT];
+    size_t transportCount = 0;
+    TransportBenchResult result;
+    int res = 0;
+
+    CredentialStore_Release(mCloudConnectParams.key);
+
+    if ((mCloudConnectParams.key = CredentialStore_Load(mConnectionStringFile)) == CREDENTIAL_NONE) {
+        printf("Failed to read connection string file %s\n", mConnectionStringFile);
+        return -1;
+    }
+
+    mCloudConnectParams.isX509 = false;
+    mCloudConnectParams.retryPolicy = CLOUD_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER;
+
+    if (mTransportList == NULL) {
+        for (size_t i = 0; i < CLOUD_TRANSPORT_COUNT; i++) {
+            transports[transportCount++] = (CloudTransport)i;
+        }
+    } else if (ParseTransportList(transports, &transportCount) != 0) {
+        return -1;
+    }
+
+    TransportBench_PrintHeader();
+
+    for (size_t i = 0; i < transportCount; i++) {
+        res |= TransportBench_Run(&mCloudConnectParams, transports[i], mPayload, mMessageCount, mWindow, &result);
+        TransportBench_PrintResult(&result);
+    }
+
+    return res ? -1 : 0;
+}
+
+/* MQTT carries one identity per connection, so only the transports that can be shared are compared */
+static int BenchIdentities(void)
+{
+    CloudTransport transports[CLOUD_TRANSPORT_COUNT] = {CLOUD_TRANSPORT_AMQP, CLOUD_TRANSPORT_AMQP_WEBSOCKET,
+                                                        CLOUD_TRANSPORT_HTTP};
+    size_t transportCount = 3;
+    IdentityBenchResult result;
+    int res = 0;
+
+    if (mTransportList && ParseTransportList(transports, &transportCount) != 0) {
+        return -1;
+    }
+
+    IdentityBench_PrintHeader();
+
+    for (size_t i = 0; i < transportCount; i++) {
+        for (size_t j = 0; j < sizeof(mIdentityCounts) / sizeof(mIdentityCounts[0]); j++) {
+            res |= IdentityBench_Run(transports[i], false, mIdentityCounts[j], &result);
+            IdentityBench_PrintResult(&result);
+
+            if (transports[i] != CLOUD_TRANSPORT_MQTT && transports[i] != CLOUD_TRANSPORT_MQTT_WEBSOCKET) {
+                res |= IdentityBench_Run(transports[i], true, mIdentityCounts[j], &result);
+                IdentityBench_PrintResult(&result);
+            }
+        }
+    }
+
+    return res ? -1 : 0;
+}
+
+static int ParseTransportList(CloudTransport *transports, size_t *transportCount)
+{
+    char list[256];
+    char *saveptr = NULL;
+
+    *transportCount = 0;
+    snprintf(list, sizeof(list), "%s", mTransportList);
+
+    for (char *token = strtok_r(list, ", ", &saveptr); token; token = strtok_r(NULL, ", ", &saveptr)) {
+        if (*transportCount == CLOUD_TRANSPORT_COUNT ||
+            Cloud_ParseTransport(token, &transports[*transportCount]) != 0) {
+            printf("Unknown transport %s\n", token);
+            return -1;
+        }
+
+        (*transportCount)++;
+    }
+
+    return 0;
+}
+
+static void *RingProducer(void *arg)
+{
+    Ring ring;
+
+    if (Ring_Connect(&ring, (const char *)arg) != 0) {
+        printf("Failed to connect to the ring\n");
+        exit(-1);
+    }
+
+    /* A real producer formats the reading into the reserved space; copying the payload stands in for that */
+    for (size_t i = 0; i < mMessageCount; i++) {
+        void *data = Ring_Reserve(&ring, mMessageSize, -1);
+
+        if (data == NULL) {
+            break;
+        }
+
+        memcpy(data, mPayload, mMessageSize);
+        Ring_Commit(&ring, data, mMessageSize, RING_RECORD_JSON);
+    }
+
+    Ring_Close(&ring);
+    return NULL;
+}
+
+static void ReadProcessIo(ProcessIo *io)
+{
+    FILE *fptr = fopen("/proc/self/io", "r");
+    char name[32];
+    unsigned long long value;
+
+    memset(io, 0, sizeof(ProcessIo));
+
+    if (fptr == NULL) {
+        return;
+    }
+
+    while (fscanf(fptr, "%31[^:]: %llu ", name, &value) == 2) {
+        if (strcmp(name, "syscr") == 0 || strcmp(name, "syscw") == 0) {
+            io->callCount += value;
+        } else if (strcmp(name, "rchar") == 0 || strcmp(name, "wchar") == 0) {
+            io->byteCount += value;
+        }
+    }
+
+    fclose(fptr);
+}
+
+static void PrintResult(const BenchResult *result)
+{
+    if (result->messageCount == 0) {
+        printf("%-8s %10s\n", result->name, "failed");
+        return;
+    }
+
+    printf("%-8s %10zu %12.1f %12.2f %12.2f %12.1f\n", result->name, result->messageCount,
+           (double)result->elapsedNs / (double)result->messageCount,
+           (double)result->allocCount / (double)result->messageCount,
+           (double)result->ioCallCount / (double)result->messageCount,
+           (double)result->copyBytes / (double)result->messageCount);
+}
+
+static uint64_t GetTimeNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,20 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define DECODER_MAX_DEPTH 32
+#define DECODER_MAX_READINGS (1024 * 1024)
+
+typedef struct sDecoderStats {
+    size_t messageCount;
+    size_t columnarCount;
+    size_t readingCount;
+} DecoderStats;
+
+long Decoder_Decode(const uint8_t *data, size_t size, FILE *out);
+void Decoder_GetStats(DecoderStats *stats);
+
+#endif
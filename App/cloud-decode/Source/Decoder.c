@@ -0,0 +1,632 @@
+#include "Decoder.h"
+#include "Encoder.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+
+#define CBOR_MAJOR_UNSIGNED 0
+#define CBOR_MAJOR_NEGATIVE 1
+#define CBOR_MAJOR_BYTES 2
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+#define CBOR_MAJOR_TAG 6
+#define CBOR_MAJOR_SIMPLE 7
+#define CBOR_SIMPLE_FALSE 20
+#define CBOR_SIMPLE_TRUE 21
+#define CBOR_FLOAT16 25
+#define CBOR_FLOAT32 26
+#define CBOR_FLOAT64 27
+#define CBOR_MAX_VARINT_SIZE 10
+#define TIME_TEXT_SIZE 32
+
+typedef struct sCursor {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool failed;
+} Cursor;
+
+typedef struct sColumn {
+    const uint8_t *name;
+    size_t nameLength;
+    int64_t kind;
+    int64_t scale;
+    const uint8_t *constant;
+    const uint8_t **items;
+    int64_t *integers;
+} Column;
+
+static DecoderStats mStats;
+
+static bool Fail(Cursor *cursor);
+static bool ReadHead(Cursor *cursor, int *major, uint64_t *value, int *info);
+static bool ReadInteger(Cursor *cursor, int64_t *value);
+static bool ReadText(Cursor *cursor, const uint8_t **text, size_t *length);
+static bool ReadDeltas(Cursor *cursor, int64_t *values, size_t count);
+static bool SkipItem(Cursor *cursor, int depth);
+static void WriteItem(Cursor *cursor, FILE *out);
+static void WriteText(const uint8_t *text, size_t length, FILE *out);
+static void WriteDouble(double value, FILE *out);
+static void WriteTime(int64_t timeMs, int digits, FILE *out);
+static double HalfToDouble(uint16_t half);
+static bool DecodeColumnar(Cursor *cursor, FILE *out);
+static bool ReadColumn(Cursor *cursor, Column *column, size_t count);
+static void WriteRow(const Column *columns, size_t columnCount, size_t row, const uint8_t *end, FILE *out);
+
+/* Decodes one message from the start of the data and writes each reading in it as a line of JSON. Returns the number
+ * of bytes the message took, or -1 when it is not valid. Nothing is written for an invalid message. */
+long Decoder_Decode(const uint8_t *data, size_t size, FILE *out)
+{
+    Cursor cursor = {data, data + size, false};
+    Cursor check = cursor;
+    int major;
+    uint64_t value;
+    int info;
+
+    if (size == 0) {
+        return -1;
+    }
+
+    if ((data[0] >> 5) == CBOR_MAJOR_TAG && ReadHead(&check, &major, &value, &info) &&
+        value == ENCODER_COLUMNAR_TAG) {
+        if (!DecodeColumnar(&check, out)) {
+            return -1;
+        }
+
+        mStats.messageCount++;
+        mStats.columnarCount++;
+        return (long)(check.p - data);
+    }
+
+    check = cursor;
+
+    if (!SkipItem(&check, 0)) {
+        return -1;
+    }
+
+    /* A batch that could not be written in columns is a plain array of readings */
+    if ((data[0] >> 5) == CBOR_MAJOR_ARRAY) {
+        ReadHead(&cursor, &major, &value, &info);
+
+        for (uint64_t i = 0; i < value; i++) {
+            WriteItem(&cursor, out);
+            fputc('\n', out);
+        }
+
+        mStats.readingCount += value;
+    } else {
+        WriteItem(&cursor, out);
+        fputc('\n', out);
+        mStats.readingCount++;
+    }
+
+    mStats.messageCount++;
+    return (long)(cursor.p - data);
+}
+
+void Decoder_GetStats(DecoderStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+    }
+}
+
+static bool Fail(Cursor *cursor)
+{
+    cursor->failed = true;
+    return false;
+}
+
+static bool ReadHead(Cursor *cursor, int *major, uint64_t *value, int *info)
+{
+    if (cursor->failed || cursor->p >= cursor->end) {
+        return Fail(cursor);
+    }
+
+    uint8_t initial = *cursor->p++;
+    *major = initial >> 5;
+    *info = initial & 0x1f;
+    *value = (uint64_t)*info;
+
+    if (*info < 24) {
+        return true;
+    }
+
+    /* Indefinite lengths are never written by the encoder */
+    if (*info > 27) {
+        return Fail(cursor);
+    }
+
+    size_t length = (size_t)1 << (*info - 24);
+
+    if ((size_t)(cursor->end - cursor->p) < length) {
+        return Fail(cursor);
+    }
+
+    *value = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        *value = (*value << 8) | *cursor->p++;
+    }
+
+    return true;
+}
+
+static bool ReadInteger(Cursor *cursor, int64_t *value)
+{
+    int major;
+    uint64_t raw;
+    int info;
+
+    if (!ReadHead(cursor, &major, &raw, &info) || raw > INT64_MAX ||
+        (major != CBOR_MAJOR_UNSIGNED && major != CBOR_MAJOR_NEGATIVE)) {
+        return Fail(cursor);
+    }
+
+    *value = major == CBOR_MAJOR_UNSIGNED ? (int64_t)raw : -1 - (int64_t)raw;
+    return true;
+}
+
+static bool ReadText(Cursor *cursor, const uint8_t **text, size_t *length)
+{
+    int major;
+    uint64_t value;
+    int info;
+
+    if (!ReadHead(cursor, &major, &value, &info) || major != CBOR_MAJOR_TEXT ||
+        value > (uint64_t)(cursor->end - cursor->p)) {
+        return Fail(cursor);
+    }
+
+    *text = cursor->p;
+    *length = (size_t)value;
+    cursor->p += value;
+    return true;
+}
+
+static bool ReadDeltas(Cursor *cursor, int64_t *values, size_t count)
+{
+    int major;
+    uint64_t length;
+    int info;
+
+    if (!ReadHead(cursor, &major, &length, &info) || major != CBOR_MAJOR_BYTES ||
+        length > (uint64_t)(cursor->end - cursor->p)) {
+        return Fail(cursor);
+    }
+
+    const uint8_t *p = cursor->p;
+    const uint8_t *end = p + length;
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t zigzag = 0;
+        int shift = 0;
+
+        do {
+            if (p == end || shift >= 7 * CBOR_MAX_VARINT_SIZE) {
+                return Fail(cursor);
+            }
+
+            zigzag |= (uint64_t)(*p & 0x7f) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+
+        /* Sums wrap around like the encoder's differences do */
+        sum += (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+        values[i] = (int64_t)sum;
+    }
+
+    if (p != end) {
+        return Fail(cursor);
+    }
+
+    cursor->p = end;
+    return true;
+}
+
+static bool SkipItem(Cursor *cursor, int depth)
+{
+    int major;
+    uint64_t value;
+    int info;
+
+    if (depth > DECODER_MAX_DEPTH || !ReadHead(cursor, &major, &value, &info)) {
+        return Fail(cursor);
+    }
+
+    switch (major) {
+        case CBOR_MAJOR_BYTES:
+        case CBOR_MAJOR_TEXT:
+            if (value > (uint64_t)(cursor->end - cursor->p)) {
+                return Fail(cursor);
+            }
+
+            cursor->p += value;
+            return true;
+
+        case CBOR_MAJOR_ARRAY:
+            for (uint64_t i = 0; i < value; i++) {
+                if (!SkipItem(cursor, depth + 1)) {
+                    return false;
+                }
+            }
+
+            return true;
+
+        case CBOR_MAJOR_MAP:
+            /* JSON only has text keys */
+            for (uint64_t i = 0; i < value; i++) {
+                if (cursor->p >= cursor->end || (*cursor->p >> 5) != CBOR_MAJOR_TEXT) {
+                    return Fail(cursor);
+                }
+
+                if (!SkipItem(cursor, depth + 1) || !SkipItem(cursor, depth + 1)) {
+                    return false;
+                }
+            }
+
+            return true;
+
+        case CBOR_MAJOR_TAG:
+            return SkipItem(cursor, depth + 1);
+
+        default:
+            return true;
+    }
+}
+
+/* Writes an item that has already been checked with SkipItem */
+static void WriteItem(Cursor *cursor, FILE *out)
+{
+    int major;
+    uint64_t value;
+    int info;
+
+    ReadHead(cursor, &major, &value, &info);
+
+    switch (major) {
+        case CBOR_MAJOR_UNSIGNED:
+            fprintf(out, "%" PRIu64, value);
+            break;
+
+        case CBOR_MAJOR_NEGATIVE:
+            if (value == UINT64_MAX) {
+                fputs("-18446744073709551616", out);
+            } else {
+                fprintf(out, "-%" PRIu64, value + 1);
+            }
+            break;
+
+        case CBOR_MAJOR_BYTES:
+            fputc('"', out);
+
+            for (uint64_t i = 0; i < value; i++) {
+                fprintf(out, "%02x", *cursor->p++);
+            }
+
+            fputc('"', out);
+            break;
+
+        case CBOR_MAJOR_TEXT:
+            WriteText(cursor->p, (size_t)value, out);
+            cursor->p += value;
+            break;
+
+        case CBOR_MAJOR_ARRAY:
+            fputc('[', out);
+
+            for (uint64_t i = 0; i < value; i++) {
+                if (i) {
+                    fputc(',', out);
+                }
+
+                WriteItem(cursor, out);
+            }
+
+            fputc(']', out);
+            break;
+
+        case CBOR_MAJOR_MAP:
+            fputc('{', out);
+
+            for (uint64_t i = 0; i < value; i++) {
+                if (i) {
+                    fputc(',', out);
+                }
+
+                WriteItem(cursor, out);
+                fputc(':', out);
+                WriteItem(cursor, out);
+            }
+
+            fputc('}', out);
+            break;
+
+        case CBOR_MAJOR_TAG:
+            WriteItem(cursor, out);
+            break;
+
+        default:
+            if (info == CBOR_SIMPLE_FALSE || info == CBOR_SIMPLE_TRUE) {
+                fputs(info == CBOR_SIMPLE_TRUE ? "true" : "false", out);
+            } else if (info == CBOR_FLOAT16) {
+                WriteDouble(HalfToDouble((uint16_t)value), out);
+            } else if (info == CBOR_FLOAT32) {
+                uint32_t bits = (uint32_t)value;
+                float single;
+                memcpy(&single, &bits, sizeof(single));
+                WriteDouble(single, out);
+            } else if (info == CBOR_FLOAT64) {
+                double number;
+                memcpy(&number, &value, sizeof(number));
+                WriteDouble(number, out);
+            } else {
+                fputs("null", out);
+            }
+            break;
+    }
+}
+
+static void WriteText(const uint8_t *text, size_t length, FILE *out)
+{
+    fputc('"', out);
+
+    for (size_t i = 0; i < length; i++) {
+        uint8_t c = text[i];
+
+        if (c == '"' || c == '\\') {
+            fputc('\\', out);
+            fputc(c, out);
+        } else if (c == '\n') {
+            fputs("\\n", out);
+        } else if (c == '\r') {
+            fputs("\\r", out);
+        } else if (c == '\t') {
+            fputs("\\t", out);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+
+    fputc('"', out);
+}
+
+/* Shortest text that reads back as the same double */
+static void WriteDouble(double value, FILE *out)
+{
+    char text[32];
+
+    if (!isfinite(value)) {
+        fputs("null", out);
+        return;
+    }
+
+    for (int precision = 1; precision <= 17; precision++) {
+        snprintf(text, sizeof(text), "%.*g", precision, value);
+
+        if (strtod(text, NULL) == value) {
+            break;
+        }
+    }
+
+    /* Keep it a fraction so it reads back as the same JSON type */
+    if (strpbrk(text, ".eE") == NULL) {
+        strcat(text, ".0");
+    }
+
+    fputs(text, out);
+}
+
+static void WriteTime(int64_t timeMs, int digits, FILE *out)
+{
+    int64_t seconds = timeMs >= 0 ? timeMs / 1000 : -((-timeMs + 999) / 1000);
+    time_t t = (time_t)seconds;
+    struct tm tm;
+    char text[TIME_TEXT_SIZE];
+
+    if (gmtime_r(&t, &tm) == NULL) {
+        fputs("null", out);
+        return;
+    }
+
+    size_t length = strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    if (digits) {
+        snprintf(text + length, sizeof(text) - length, ".%03dZ", (int)(timeMs - seconds * 1000));
+    } else {
+        snprintf(text + length, sizeof(text) - length, "Z");
+    }
+
+    fprintf(out, "\"%s\"", text);
+}
+
+static double HalfToDouble(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1f;
+    int mantissa = half & 0x3ff;
+    double value;
+
+    if (exponent == 0) {
+        value = ldexp(mantissa, -24);
+    } else if (exponent != 31) {
+        value = ldexp(mantissa + 1024, exponent - 25);
+    } else {
+        value = mantissa == 0 ? INFINITY : NAN;
+    }
+
+    return half & 0x8000 ? -value : value;
+}
+
+static bool DecodeColumnar(Cursor *cursor, FILE *out)
+{
+    int major;
+    uint64_t entryCount;
+    int info;
+    int64_t version = 0;
+    int64_t count = 0;
+    Cursor columnCursor = {NULL, NULL, true};
+
+    if (!ReadHead(cursor, &major, &entryCount, &info) || major != CBOR_MAJOR_MAP) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < entryCount; i++) {
+        const uint8_t *key;
+        size_t keyLength;
+
+        if (!ReadText(cursor, &key, &keyLength)) {
+            return false;
+        }
+
+        if (keyLength == 1 && key[0] == 'v') {
+            ReadInteger(cursor, &version);
+        } else if (keyLength == 1 && key[0] == 'n') {
+            ReadInteger(cursor, &count);
+        } else if (keyLength == 1 && key[0] == 'c') {
+            columnCursor = *cursor;
+            SkipItem(cursor, 0);
+        } else {
+            SkipItem(cursor, 0);
+        }
+
+        if (cursor->failed) {
+            return false;
+        }
+    }
+
+    uint64_t columnCount;
+
+    if (version != 1 || count <= 0 || count > DECODER_MAX_READINGS || columnCursor.failed ||
+        !ReadHead(&columnCursor, &major, &columnCount, &info) || major != CBOR_MAJOR_ARRAY ||
+        columnCount > (uint64_t)(columnCursor.end - columnCursor.p)) {
+        return false;
+    }
+
+    Column *columns = calloc((size_t)columnCount + 1, sizeof(Column));
+    bool res = columns != NULL;
+
+    for (uint64_t i = 0; res && i < columnCount; i++) {
+        res = ReadColumn(&columnCursor, &columns[i], (size_t)count);
+    }
+
+    /* Columns are complete before the first row is written, so a damaged message writes nothing */
+    for (int64_t row = 0; res && row < count; row++) {
+        WriteRow(columns, (size_t)columnCount, (size_t)row, cursor->end, out);
+    }
+
+    if (res) {
+        mStats.readingCount += (size_t)count;
+    }
+
+    for (uint64_t i = 0; columns && i < columnCount; i++) {
+        free(columns[i].items);
+        free(columns[i].integers);
+    }
+
+    free(columns);
+    return res;
+}
+
+static bool ReadColumn(Cursor *cursor, Column *column, size_t count)
+{
+    int major;
+    uint64_t length;
+    int info;
+
+    if (!ReadHead(cursor, &major, &length, &info) || major != CBOR_MAJOR_ARRAY ||
+        !ReadText(cursor, &column->name, &column->nameLength) || !ReadInteger(cursor, &column->kind)) {
+        return false;
+    }
+
+    switch (column->kind) {
+        case ENCODER_COLUMN_CONSTANT:
+            column->constant = cursor->p;
+            return length == 3 && SkipItem(cursor, 0);
+
+        case ENCODER_COLUMN_DECIMAL:
+        case ENCODER_COLUMN_TIME:
+            if (length != 4 || !ReadInteger(cursor, &column->scale) || column->scale < 0 ||
+                column->scale > ENCODER_MAX_SCALE ||
+                (column->kind == ENCODER_COLUMN_TIME && column->scale != 0 && column->scale != 3)) {
+                return false;
+            }
+
+            /* fall through */
+        case ENCODER_COLUMN_INTEGER:
+            column->integers = malloc(count * sizeof(int64_t));
+            return column->integers && length == (column->kind == ENCODER_COLUMN_INTEGER ? 3 : 4) &&
+                   ReadDeltas(cursor, column->integers, count);
+
+        case ENCODER_COLUMN_VALUES:
+            if (length != 3 || !ReadHead(cursor, &major, &length, &info) || major != CBOR_MAJOR_ARRAY ||
+                length != count) {
+                return false;
+            }
+
+            column->items = malloc(count * sizeof(uint8_t *));
+
+            for (size_t i = 0; column->items && i < count; i++) {
+                column->items[i] = cursor->p;
+
+                if (!SkipItem(cursor, 0)) {
+                    return false;
+                }
+            }
+
+            return column->items != NULL;
+
+        default:
+            return false;
+    }
+}
+
+static void WriteRow(const Column *columns, size_t columnCount, size_t row, const uint8_t *end, FILE *out)
+{
+    fputc('{', out);
+
+    for (size_t i = 0; i < columnCount; i++) {
+        const Column *column = &columns[i];
+        Cursor cursor = {NULL, end, false};
+
+        if (i) {
+            fputc(',', out);
+        }
+
+        WriteText(column->name, column->nameLength, out);
+        fputc(':', out);
+
+        switch (column->kind) {
+            case ENCODER_COLUMN_CONSTANT:
+                cursor.p = column->constant;
+                WriteItem(&cursor, out);
+                break;
+
+            case ENCODER_COLUMN_INTEGER:
+                fprintf(out, "%" PRId64, column->integers[row]);
+                break;
+
+            case ENCODER_COLUMN_DECIMAL: {
+                static const double powersOfTen[ENCODER_MAX_SCALE + 1] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6};
+                WriteDouble((double)column->integers[row] / powersOfTen[column->scale], out);
+                break;
+            }
+
+            case ENCODER_COLUMN_TIME:
+                WriteTime(column->integers[row], (int)column->scale, out);
+                break;
+
+            default:
+                cursor.p = column->items[row];
+                WriteItem(&cursor, out);
+                break;
+        }
+    }
+
+    fputs("}\n", out);
+}
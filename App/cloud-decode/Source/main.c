@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include "Decoder.h"
+
+#define READ_BUFFER_SIZE (64 * 1024)
+
+static bool mOptionStatsSpecified = false;
+
+static int ParseArguments(int argc, char *argv[]);
+static int DecodeFile(const char *filename);
+static uint8_t *ReadAll(FILE *fptr, size_t *size);
+
+int main(int argc, char *argv[])
+{
+    int res = 0;
+
+    if (ParseArguments(argc, argv) != 0) {
+        return -1;
+    }
+
+    /* Without file arguments the messages are read from standard input */
+    if (optind == argc) {
+        res = DecodeFile("-");
+    }
+
+    for (int i = optind; i < argc; i++) {
+        res |= DecodeFile(argv[i]);
+    }
+
+    if (mOptionStatsSpecified) {
+        DecoderStats stats;
+        Decoder_GetStats(&stats);
+        fprintf(stderr, "Decoded %zu messages (%zu columnar), %zu readings\n", stats.messageCount,
+                stats.columnarCount, stats.readingCount);
+    }
+
+    return res;
+}
+
+static void PrintUsage(void)
+{
+    /* clang-format off */
+    static const char *usageString = "Usage: cloud-decode [options] [FILE...]\n"
+                                     "\n"
+                                     "Decodes messages sent by cloud-send with Encoding=cbor and prints every reading\n"
+                                     "as one line of JSON. A file may hold several messages back to back. Standard\n"
+                                     "input is read when no file, or -, is given.\n"
+                                     "\n"
+                                     "Optional options:\n"
+                                     "  -s, --stats              Print message and reading counts to standard error.\n"
+                                     "  -h, --help               Print this message and exit.\n";
+    /* clang-format on */
+
+    printf("%s", usageString);
+}
+
+static int ParseArguments(int argc, char *argv[])
+{
+    int opt = 0;
+
+    /* clang-format off */
+    static struct option long_options[] = {
+        {"stats", no_argument, 0, 's'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0},
+    };
+    /* clang-format on */
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, "sh", long_options, &long_index)) != -1) {
+        switch (opt) {
+            case 's':
+                mOptionStatsSpecified = true;
+                break;
+
+            case 'h':
+                PrintUsage();
+                exit(0);
+                break;
+
+            default:
+                PrintUsage();
+                exit(-1);
+                break;
+        }
+    }
+
+    return 0;
+}
+
+static int DecodeFile(const char *filename)
+{
+    bool isStdin = strcmp(filename, "-") == 0;
+    FILE *fptr = isStdin ? stdin : fopen(filename, "rb");
+    size_t size = 0;
+
+    if (fptr == NULL) {
+        fprintf(stderr, "Failed to open %s\n", filename);
+        return -1;
+    }
+
+    uint8_t *data = ReadAll(fptr, &size);
+
+    if (!isStdin) {
+        fclose(fptr);
+    }
+
+    if (data == NULL) {
+        fprintf(stderr, "Failed to read %s\n", filename);
+        return -1;
+    }
+
+    size_t offset = 0;
+    int res = 0;
+
+    while (offset < size) {
+        long length = Decoder_Decode(data + offset, size - offset, stdout);
+
+        if (length <= 0) {
+            fprintf(stderr, "Invalid message in %s at offset %zu\n", filename, offset);
+            res = -1;
+            break;
+        }
+
+        offset += (size_t)length;
+    }
+
+    free(data);
+    return res;
+}
+
+static uint8_t *ReadAll(FILE *fptr, size_t *size)
+{
+    size_t capacity = READ_BUFFER_SIZE;
+    uint8_t *data = malloc(capacity);
+    size_t count;
+
+    *size = 0;
+
+    while (data && (count = fread(data + *size, 1, capacity - *size, fptr)) > 0) {
+        *size += count;
+
+        if (*size == capacity) {
+            uint8_t *buffer = realloc(data, capacity * 2);
+
+            if (buffer == NULL) {
+                free(data);
+                return NULL;
+            }
+
+            data = buffer;
+            capacity *= 2;
+        }
+    }
+
+    if (data && ferror(fptr)) {
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
@@ -0,0 +1,53 @@
+#ifndef FLEET_H
+#define FLEET_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FLEET_MAX_DEVICES 10000
+#define FLEET_LATENCY_BUCKETS 128
+
+typedef enum eFleetDeviceState {
+    FLEET_DEVICE_IDLE,
+    FLEET_DEVICE_CONNECTING,
+    FLEET_DEVICE_CONNECTED,
+    FLEET_DEVICE_DISCONNECTED,
+    FLEET_DEVICE_EXITED,
+    FLEET_DEVICE_FAILED,
+} FleetDeviceState;
+
+/* Written by the device process while it runs, read by the coordinator. Every field is a 64 bit word, so a snapshot
+ * can be taken word by word without locking. */
+typedef struct sFleetDeviceStats {
+    uint64_t state;
+    uint64_t sentCount;
+    uint64_t ackCount;
+    uint64_t failCount;
+    uint64_t rejectCount;
+    uint64_t reconnectCount;
+    uint64_t sentBytes;
+    uint64_t cpuUs;
+    uint64_t rssKb;
+    uint64_t privateKb;
+    uint64_t latencyBuckets[FLEET_LATENCY_BUCKETS];
+} FleetDeviceStats;
+
+/* Runs in the device process and returns its exit code */
+typedef int (*Fleet_DeviceMain)(size_t index, FleetDeviceStats *stats, void *context);
+
+int Fleet_Initialize(size_t deviceCount);
+void Fleet_Deinitialize(void);
+int Fleet_StartDevice(size_t index, Fleet_DeviceMain deviceMain, void *context);
+size_t Fleet_GetStartedCount(void);
+bool Fleet_IsStopping(void);
+void Fleet_Stop(void);
+void Fleet_Wait(void);
+void Fleet_GetDeviceStats(size_t index, FleetDeviceStats *stats);
+void Fleet_Add(uint64_t *counter, uint64_t value);
+void Fleet_Store(uint64_t *value, uint64_t newValue);
+void Fleet_RecordLatency(FleetDeviceStats *stats, uint64_t latencyUs);
+uint64_t Fleet_GetBucketLatencyUs(size_t bucket);
+void Fleet_UpdateUsage(FleetDeviceStats *stats);
+
+#endif
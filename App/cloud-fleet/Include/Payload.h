@@ -0,0 +1,29 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PAYLOAD_MAX_SIZE (256 * 1024)
+#define PAYLOAD_MAX_FIELDS 256
+
+typedef enum ePayloadType {
+    PAYLOAD_TYPE_JSON,
+    PAYLOAD_TYPE_BINARY,
+    PAYLOAD_TYPE_FILE,
+} PayloadType;
+
+typedef struct sPayloadShape {
+    PayloadType type;
+    size_t fieldCount;
+    size_t size;
+    char *data;
+} PayloadShape;
+
+int Payload_Parse(const char *text, PayloadShape *shape);
+void Payload_Free(PayloadShape *shape);
+size_t Payload_Build(const PayloadShape *shape, const char *deviceId, uint64_t sequence, uint64_t *randomState,
+                     char *buffer, size_t size);
+const char *Payload_GetContentType(const PayloadShape *shape);
+
+#endif
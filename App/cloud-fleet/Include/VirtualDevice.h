@@ -0,0 +1,21 @@
+#ifndef VIRTUALDEVICE_H
+#define VIRTUALDEVICE_H
+
+#include <stdbool.h>
+#include "Cloud.h"
+#include "Fleet.h"
+#include "Payload.h"
+
+typedef struct sVirtualDeviceParams {
+    const char *connectionString;
+    const char *deviceId;
+    const char *trustedCert;
+    const PayloadShape *payload;
+    double readingsPerSecond;
+    CloudTransport transport;
+    uint64_t seed;
+} VirtualDeviceParams;
+
+int VirtualDevice_Run(const VirtualDeviceParams *params, FleetDeviceStats *stats);
+
+#endif
@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+#include "Fleet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* The Cloud library holds one connection per process, so every virtual device is a process of its own, as the
+ * workers of cloud-send --parallel are. They share their statistics with the coordinator through anonymous shared
+ * memory, which survives fork. */
+typedef struct sFleetState {
+    uint64_t isStopping;
+    FleetDeviceStats devices[];
+} FleetState;
+
+static FleetState *mState = NULL;
+static size_t mMapSize = 0;
+static size_t mDeviceCount = 0;
+static pid_t *mPids = NULL;
+static size_t mStartedCount = 0;
+
+int Fleet_Initialize(size_t deviceCount)
+{
+    if (deviceCount == 0 || deviceCount > FLEET_MAX_DEVICES) {
+        return -1;
+    }
+
+    mMapSize = sizeof(FleetState) + deviceCount * sizeof(FleetDeviceStats);
+    void *map = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    mPids = calloc(deviceCount, sizeof(pid_t));
+
+    if (map == MAP_FAILED || mPids == NULL) {
+        if (map != MAP_FAILED) {
+            munmap(map, mMapSize);
+        }
+
+        free(mPids);
+        mPids = NULL;
+        return -1;
+    }
+
+    /* Fresh anonymous pages are zero, every device starts out idle */
+    mState = (FleetState *)map;
+    mDeviceCount = deviceCount;
+    mStartedCount = 0;
+    return 0;
+}
+
+void Fleet_Deinitialize(void)
+{
+    if (mState) {
+        munmap(mState, mMapSize);
+        mState = NULL;
+    }
+
+    free(mPids);
+    mPids = NULL;
+    mDeviceCount = 0;
+    mStartedCount = 0;
+}
+
+/* Devices are started in order of their index */
+int Fleet_StartDevice(size_t index, Fleet_DeviceMain deviceMain, void *context)
+{
+    if (mState == NULL || index != mStartedCount || index >= mDeviceCount) {
+        return -1;
+    }
+
+    FleetDeviceStats *stats = &mState->devices[index];
+    Fleet_Store(&stats->state, FLEET_DEVICE_CONNECTING);
+
+    /* Anything still buffered would otherwise be printed once per device */
+    fflush(stdout);
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        Fleet_Store(&stats->state, FLEET_DEVICE_FAILED);
+        return -1;
+    }
+
+    if (pid == 0) {
+        /* The coordinator stops the devices; one that loses its coordinator stops by itself */
+        signal(SIGINT, SIG_IGN);
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        free(mPids);
+        mPids = NULL;
+
+        int res = deviceMain(index, stats, context);
+        Fleet_UpdateUsage(stats);
+        Fleet_Store(&stats->state, res == 0 ? FLEET_DEVICE_EXITED : FLEET_DEVICE_FAILED);
+        fflush(stdout);
+        _exit(res == 0 ? 0 : 1);
+    }
+
+    mPids[mStartedCount++] = pid;
+    return 0;
+}
+
+size_t Fleet_GetStartedCount(void)
+{
+    return mStartedCount;
+}
+
+bool Fleet_IsStopping(void)
+{
+    return mState && __atomic_load_n(&mState->isStopping, __ATOMIC_RELAXED);
+}
+
+/* Only stores a flag, so this is safe from a signal handler */
+void Fleet_Stop(void)
+{
+    if (mState) {
+        __atomic_store_n(&mState->isStopping, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Waits for all started devices. A device that did not exit by itself is marked as failed. */
+void Fleet_Wait(void)
+{
+    for (size_t i = 0; i < mStartedCount; i++) {
+        int status = 0;
+
+        while (waitpid(mPids[i], &status, 0) < 0) {
+            if (errno != EINTR) {
+                status = -1;
+                break;
+            }
+        }
+
+        if (!WIFEXITED(status)) {
+            Fleet_Store(&mState->devices[i].state, FLEET_DEVICE_FAILED);
+        }
+    }
+}
+
+void Fleet_GetDeviceStats(size_t index, FleetDeviceStats *stats)
+{
+    if (mState == NULL || index >= mDeviceCount || stats == NULL) {
+        return;
+    }
+
+    const uint64_t *source = (const uint64_t *)&mState->devices[index];
+    uint64_t *target = (uint64_t *)stats;
+
+    for (size_t i = 0; i < sizeof(FleetDeviceStats) / sizeof(uint64_t); i++) {
+        target[i] = __atomic_load_n(&source[i], __ATOMIC_RELAXED);
+    }
+}
+
+/* Each counter has a single writer, the device, so a relaxed add is enough for the coordinator to read it whole */
+void Fleet_Add(uint64_t *counter, uint64_t value)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+void Fleet_Store(uint64_t *value, uint64_t newValue)
+{
+    __atomic_store_n(value, newValue, __ATOMIC_RELAXED);
+}
+
+/* Four buckets per power of two, which keeps the percentiles within about 12% of the actual latency */
+void Fleet_RecordLatency(FleetDeviceStats *stats, uint64_t latencyUs)
+{
+    size_t bucket = (size_t)latencyUs;
+
+    if (latencyUs >= 4) {
+        int exponent = 63 - __builtin_clzll(latencyUs);
+        bucket = 4 * (size_t)(exponent - 1) + (size_t)((latencyUs >> (exponent - 2)) & 3);
+    }
+
+    if (bucket >= FLEET_LATENCY_BUCKETS) {
+        bucket = FLEET_LATENCY_BUCKETS - 1;
+    }
+
+    Fleet_Add(&stats->latencyBuckets[bucket], 1);
+}
+
+/* The middle of the bucket */
+uint64_t Fleet_GetBucketLatencyUs(size_t bucket)
+{
+    if (bucket < 4) {
+        return bucket;
+    }
+
+    unsigned int shift = (unsigned int)(bucket / 4 - 1);
+    uint64_t width = 1ull << shift;
+    return ((4 + (uint64_t)(bucket % 4)) << shift) + width / 2;
+}
+
+/* CPU time of the process, and its resident memory with and without the pages it shares, mostly the code of the
+ * libraries */
+void Fleet_UpdateUsage(FleetDeviceStats *stats)
+{
+    struct rusage usage;
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    unsigned long shared = 0;
+    FILE *fptr = fopen("/proc/self/statm", "r");
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        Fleet_Store(&stats->cpuUs, (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ull +
+                                       (uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec));
+    }
+
+    if (fptr == NULL) {
+        return;
+    }
+
+    if (fscanf(fptr, "%lu %lu %lu", &size, &resident, &shared) == 3) {
+        uint64_t pageKb = (uint64_t)sysconf(_SC_PAGESIZE) / 1024;
+        Fleet_Store(&stats->rssKb, resident * pageKb);
+        Fleet_Store(&stats->privateKb, (resident - shared) * pageKb);
+    }
+
+    fclose(fptr);
+}
@@ -0,0 +1,120 @@
+#include "Payload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t NextRandom(uint64_t *state);
+
+/* json:FIELDS, a JSON reading with that many numeric fields; binary:BYTES, random bytes; file:PATH, the content of a
+ * file, sent as it is */
+int Payload_Parse(const char *text, PayloadShape *shape)
+{
+    char *end = NULL;
+
+    memset(shape, 0, sizeof(PayloadShape));
+
+    if (strncmp(text, "json:", 5) == 0) {
+        shape->type = PAYLOAD_TYPE_JSON;
+        shape->fieldCount = strtoul(text + 5, &end, 10);
+        return (end == text + 5 || *end != '\0' || shape->fieldCount > PAYLOAD_MAX_FIELDS) ? -1 : 0;
+    }
+
+    if (strncmp(text, "binary:", 7) == 0) {
+        shape->type = PAYLOAD_TYPE_BINARY;
+        shape->size = strtoul(text + 7, &end, 10);
+        return (end == text + 7 || *end != '\0' || shape->size == 0 || shape->size > PAYLOAD_MAX_SIZE) ? -1 : 0;
+    }
+
+    if (strncmp(text, "file:", 5) != 0) {
+        return -1;
+    }
+
+    FILE *fptr = fopen(text + 5, "rb");
+
+    if (fptr == NULL) {
+        printf("Failed to open %s\n", text + 5);
+        return -1;
+    }
+
+    shape->type = PAYLOAD_TYPE_FILE;
+    shape->data = malloc(PAYLOAD_MAX_SIZE);
+    shape->size = shape->data ? fread(shape->data, 1, PAYLOAD_MAX_SIZE, fptr) : 0;
+    fclose(fptr);
+
+    if (shape->size == 0) {
+        Payload_Free(shape);
+        return -1;
+    }
+
+    return 0;
+}
+
+void Payload_Free(PayloadShape *shape)
+{
+    free(shape->data);
+    shape->data = NULL;
+    shape->size = 0;
+}
+
+/* Returns the size of the payload, or 0 if it does not fit */
+size_t Payload_Build(const PayloadShape *shape, const char *deviceId, uint64_t sequence, uint64_t *randomState,
+                     char *buffer, size_t size)
+{
+    if (shape->type == PAYLOAD_TYPE_FILE) {
+        if (shape->size > size) {
+            return 0;
+        }
+
+        memcpy(buffer, shape->data, shape->size);
+        return shape->size;
+    }
+
+    if (shape->type == PAYLOAD_TYPE_BINARY) {
+        if (shape->size > size) {
+            return 0;
+        }
+
+        for (size_t i = 0; i < shape->size; i += sizeof(uint64_t)) {
+            uint64_t value = NextRandom(randomState);
+            memcpy(buffer + i, &value, shape->size - i < sizeof(value) ? shape->size - i : sizeof(value));
+        }
+
+        return shape->size;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    int length = snprintf(buffer, size, "{\"deviceId\":\"%s\",\"sequence\":%llu,\"timestamp\":%llu", deviceId,
+                          (unsigned long long)sequence,
+                          (unsigned long long)ts.tv_sec * 1000ull + (unsigned long long)(ts.tv_nsec / 1000000));
+
+    for (size_t i = 0; i < shape->fieldCount && length > 0 && (size_t)length < size; i++) {
+        uint64_t value = NextRandom(randomState) % 100000;
+        length += snprintf(buffer + length, size - (size_t)length, ",\"f%zu\":%llu.%02llu", i,
+                           (unsigned long long)(value / 100), (unsigned long long)(value % 100));
+    }
+
+    if (length <= 0 || (size_t)length + 1 >= size) {
+        return 0;
+    }
+
+    buffer[length++] = '}';
+    buffer[length] = '\0';
+    return (size_t)length;
+}
+
+const char *Payload_GetContentType(const PayloadShape *shape)
+{
+    return shape->type == PAYLOAD_TYPE_BINARY ? "application/octet-stream" : "application/json";
+}
+
+/* xorshift64*, each device starts from a seed of its own */
+static uint64_t NextRandom(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
@@ -0,0 +1,179 @@
+#include "VirtualDevice.h"
+#include "Clock.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* As many readings can be outstanding as the message pool of the Cloud library holds */
+#define VIRTUALDEVICE_MAX_OUTSTANDING 1024
+#define VIRTUALDEVICE_IN_FLIGHT_WINDOW 32
+#define VIRTUALDEVICE_MAX_SLEEP_US 10000
+#define VIRTUALDEVICE_USAGE_INTERVAL_US 1000000
+#define VIRTUALDEVICE_MAX_BACKLOG_US 1000000
+
+typedef struct sSentReading {
+    uint64_t sendUs;
+    bool inUse;
+} SentReading;
+
+static FleetDeviceStats *mStats = NULL;
+static CloudConnectParams mConnectParams;
+static SentReading mReadings[VIRTUALDEVICE_MAX_OUTSTANDING];
+static size_t mNextReading = 0;
+static bool mIsConnected = false;
+static bool mHasConnected = false;
+static bool mIsFailed = false;
+static char mBuffer[PAYLOAD_MAX_SIZE + 1];
+
+static void SendReading(const VirtualDeviceParams *params, uint64_t sequence, uint64_t *randomState, uint64_t nowUs);
+static void CloudEventHandler(CloudEvent evt, void *data);
+static void ReleaseCredentials(void);
+static void SleepUs(uint64_t us);
+
+/* Connects, then sends readings at the configured rate until the fleet stops. The first reading is sent at a random
+ * point of the first interval, so devices started together do not send in lockstep. */
+int VirtualDevice_Run(const VirtualDeviceParams *params, FleetDeviceStats *stats)
+{
+    uint64_t randomState = params->seed ? params->seed : 1;
+    uint64_t intervalUs = (uint64_t)(1000000.0 / params->readingsPerSecond);
+    uint64_t nextSendUs = 0;
+    uint64_t lastUsageUs = 0;
+    uint64_t sequence = 0;
+
+    mStats = stats;
+    memset(&mConnectParams, 0, sizeof(mConnectParams));
+    mConnectParams.key = CredentialStore_Add(params->connectionString, strlen(params->connectionString));
+    mConnectParams.trustedCert =
+        params->trustedCert ? CredentialStore_Add(params->trustedCert, strlen(params->trustedCert)) : CREDENTIAL_NONE;
+    mConnectParams.transport = params->transport;
+    mConnectParams.retryPolicy = CLOUD_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER;
+
+    if (Cloud_Initialize() != 0) {
+        ReleaseCredentials();
+        return -1;
+    }
+
+    Cloud_RegisterEventHandler(CloudEventHandler);
+    Cloud_SetInFlightWindow(VIRTUALDEVICE_IN_FLIGHT_WINDOW);
+
+    if (Cloud_Connect(&mConnectParams) != 0) {
+        Cloud_Deinitialize();
+        ReleaseCredentials();
+        return -1;
+    }
+
+    while (!Fleet_IsStopping() && !mIsFailed) {
+        Cloud_Task();
+
+        uint64_t nowUs = Clock_GetNs() / 1000;
+
+        if (mHasConnected && nextSendUs == 0) {
+            nextSendUs = nowUs + (intervalUs ? randomState % intervalUs : 0);
+        }
+
+        while (nextSendUs && nowUs >= nextSendUs) {
+            SendReading(params, ++sequence, &randomState, nowUs);
+            nextSendUs += intervalUs ? intervalUs : 1;
+
+            /* After a stall the device carries on at its rate rather than sending what it missed all at once */
+            if (nowUs - nextSendUs > VIRTUALDEVICE_MAX_BACKLOG_US && nowUs > nextSendUs) {
+                nextSendUs = nowUs;
+            }
+        }
+
+        if (nowUs - lastUsageUs >= VIRTUALDEVICE_USAGE_INTERVAL_US) {
+            CloudSendStats sendStats;
+            Cloud_GetSendStats(&sendStats);
+            Fleet_Store(&mStats->reconnectCount, sendStats.reconnectCount);
+            Fleet_UpdateUsage(mStats);
+            lastUsageUs = nowUs;
+        }
+
+        /* The client needs its work done regularly even when no reading is due */
+        uint64_t sleepUs = (nextSendUs > nowUs) ? nextSendUs - nowUs : (nextSendUs ? 0 : VIRTUALDEVICE_MAX_SLEEP_US);
+        SleepUs(sleepUs < VIRTUALDEVICE_MAX_SLEEP_US ? sleepUs : VIRTUALDEVICE_MAX_SLEEP_US);
+    }
+
+    /* Readings still outstanding are completed as failed */
+    Cloud_Deinitialize();
+    ReleaseCredentials();
+    return mIsFailed ? -1 : 0;
+}
+
+static void ReleaseCredentials(void)
+{
+    CredentialStore_Release(mConnectParams.key);
+    CredentialStore_Release(mConnectParams.trustedCert);
+    mConnectParams.key = CREDENTIAL_NONE;
+    mConnectParams.trustedCert = CREDENTIAL_NONE;
+}
+
+static void SendReading(const VirtualDeviceParams *params, uint64_t sequence, uint64_t *randomState, uint64_t nowUs)
+{
+    SentReading *reading = &mReadings[mNextReading];
+    CloudMessageOptions options = {0};
+
+    if (reading->inUse) {
+        Fleet_Add(&mStats->rejectCount, 1);
+        return;
+    }
+
+    size_t size = Payload_Build(params->payload, params->deviceId, sequence, randomState, mBuffer, sizeof(mBuffer));
+    options.contentType = Payload_GetContentType(params->payload);
+    options.contentEncoding = "";
+    reading->sendUs = nowUs;
+    reading->inUse = true;
+
+    if (size == 0 || Cloud_SendDataEx(mBuffer, size, &options, reading) != 0) {
+        reading->inUse = false;
+        Fleet_Add(&mStats->rejectCount, 1);
+        return;
+    }
+
+    mNextReading = (mNextReading + 1) % VIRTUALDEVICE_MAX_OUTSTANDING;
+    Fleet_Add(&mStats->sentCount, 1);
+    Fleet_Add(&mStats->sentBytes, size);
+}
+
+static void CloudEventHandler(CloudEvent evt, void *data)
+{
+    SentReading *reading = (SentReading *)data;
+    CloudConnectionStatus status;
+
+    switch (evt) {
+        case CLOUD_EVENT_CONNECTIONSTATUSCHANGED:
+            status = *(CloudConnectionStatus *)data;
+            mIsConnected = status == CLOUD_CONNECTION_CONNECTED;
+            mHasConnected |= mIsConnected;
+            Fleet_Store(&mStats->state, mIsConnected ? FLEET_DEVICE_CONNECTED : FLEET_DEVICE_DISCONNECTED);
+
+            /* The same conditions that end cloud-send end a virtual device */
+            mIsFailed |= status == CLOUD_CONNECTION_DISCONNECTED_BAD_CREDENTIAL ||
+                         status == CLOUD_CONNECTION_DISCONNECTED_DEVICE_DISABLED ||
+                         status == CLOUD_CONNECTION_DISCONNECTED_RETRY_EXPIRED;
+            break;
+
+        case CLOUD_EVENT_SENDDATASUCCEEDED:
+            Fleet_RecordLatency(mStats, Clock_GetNs() / 1000 - reading->sendUs);
+            Fleet_Add(&mStats->ackCount, 1);
+            reading->inUse = false;
+            break;
+
+        case CLOUD_EVENT_SENDDATAFAILED:
+            Fleet_Add(&mStats->failCount, 1);
+            reading->inUse = false;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void SleepUs(uint64_t us)
+{
+    struct timespec timeToSleep = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000};
+
+    if (us) {
+        nanosleep(&timeToSleep, NULL);
+    }
+}
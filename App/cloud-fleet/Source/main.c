@@ -0,0 +1,693 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include "Cloud.h"
+#include "Clock.h"
+#include "Fleet.h"
+#include "Payload.h"
+#include "VirtualDevice.h"
+
+#define DEFAULT_DEVICE_COUNT 100
+#define DEFAULT_RATE 1.0
+#define DEFAULT_PAYLOAD "json:8"
+#define DEFAULT_HOST "localhost"
+#define DEFAULT_KEY "Y2xvdWQtZmxlZXQtc2ltdWxhdGVkLWRldmljZS1rZXk="
+#define DEFAULT_INTERVAL_SECONDS 10
+#define DEFAULT_HOLD_SECONDS 30
+#define MAX_RATE 10000.0
+#define MAX_CONNECTION_STRING_LENGTH 1024
+#define MAX_DEVICE_ID_LENGTH 256
+#define TRUSTED_CERT_SIZE 4096
+#define POLL_INTERVAL_MS 100
+
+/* An interval in which the devices had at least this much of their offered readings acknowledged kept up */
+#define SUSTAINED_ACK_RATIO 0.95
+
+typedef void (*SignalHandler_t)(int);
+
+/* Sums over all devices at one point in time */
+typedef struct sFleetTotals {
+    size_t startedCount;
+    size_t connectedCount;
+    size_t runningCount;
+    size_t failedCount;
+    double offeredRate;
+    uint64_t sentCount;
+    uint64_t ackCount;
+    uint64_t failCount;
+    uint64_t rejectCount;
+    uint64_t reconnectCount;
+    uint64_t sentBytes;
+    uint64_t cpuUs;
+    uint64_t rssKb;
+    uint64_t privateKb;
+    uint64_t latencyBuckets[FLEET_LATENCY_BUCKETS];
+} FleetTotals;
+
+static volatile sig_atomic_t mExit = false;
+static size_t mDeviceCount = DEFAULT_DEVICE_COUNT;
+static double mMinRate = DEFAULT_RATE;
+static double mMaxRate = DEFAULT_RATE;
+static double *mRates = NULL;
+static const char *mPayloadSetting = DEFAULT_PAYLOAD;
+static PayloadShape mPayload;
+static const char *mConnectionStringFile = NULL;
+static char **mConnectionStrings = NULL;
+static size_t mConnectionStringCount = 0;
+static const char *mHost = DEFAULT_HOST;
+static const char *mKey = DEFAULT_KEY;
+static const char *mTrustedCertFile = NULL;
+static char mTrustedCert[TRUSTED_CERT_SIZE];
+static size_t mRampStep = 0;
+static unsigned int mIntervalSeconds = DEFAULT_INTERVAL_SECONDS;
+static unsigned int mHoldSeconds = DEFAULT_HOLD_SECONDS;
+static CloudTransport mTransport = CLOUD_TRANSPORT_MQTT;
+static unsigned long long mSeed = 1;
+static const char *mStatsFile = NULL;
+static bool mIsVerbose = false;
+
+/* The interval with the highest acknowledged rate that still kept up with the offered load */
+static double mSustainedAckRate = 0.0;
+static size_t mSustainedDeviceCount = 0;
+static uint64_t mSustainedP99Us = 0;
+
+static int ParseArguments(int argc, char *argv[]);
+static int ParseRate(const char *text);
+static int ParseRamp(const char *text);
+static int ReadConnectionStrings(const char *filename);
+static int ReadTrustedCert(const char *filename);
+static void FreeConnectionStrings(void);
+static int AssignRates(void);
+static int RunDevice(size_t index, FleetDeviceStats *stats, void *context);
+static void GetDeviceId(const char *connectionString, char *deviceId, size_t size);
+static void CollectTotals(FleetTotals *totals);
+static uint64_t GetPercentileUs(const uint64_t *buckets, uint64_t count, double fraction);
+static void PrintInterval(const FleetTotals *previous, const FleetTotals *current, uint64_t elapsedMs,
+                          uint64_t intervalMs);
+static void PrintSummary(const FleetTotals *totals, uint64_t elapsedMs);
+static int WriteStatsFile(const FleetTotals *totals, uint64_t elapsedMs);
+static void RegisterSignalHandler(SignalHandler_t signalHandler);
+static void SignalHandler(int signum);
+static void SleepMs(unsigned int ms);
+
+/* Starts a fleet of virtual devices, each a process with a connection of its own, adds devices step by step and
+ * reports throughput, acknowledgement latency and resource use for every interval */
+int main(int argc, char *argv[])
+{
+    static FleetTotals previous;
+    static FleetTotals current;
+
+    if (ParseArguments(argc, argv) != 0) {
+        return -1;
+    }
+
+    if (Payload_Parse(mPayloadSetting, &mPayload) != 0) {
+        printf("Invalid payload %s\n", mPayloadSetting);
+        return -1;
+    }
+
+    if ((mConnectionStringFile && ReadConnectionStrings(mConnectionStringFile) != 0) ||
+        (mTrustedCertFile && ReadTrustedCert(mTrustedCertFile) != 0) || AssignRates() != 0) {
+        FreeConnectionStrings();
+        Payload_Free(&mPayload);
+        return -1;
+    }
+
+    if (Fleet_Initialize(mDeviceCount) != 0) {
+        printf("Failed to set up %zu devices\n", mDeviceCount);
+        FreeConnectionStrings();
+        Payload_Free(&mPayload);
+        free(mRates);
+        return -1;
+    }
+
+    RegisterSignalHandler(SignalHandler);
+    printf("Starting %zu devices over %s, %zu every %u s, holding for %u s\n", mDeviceCount,
+           Cloud_GetTransportName(mTransport), mRampStep ? mRampStep : mDeviceCount, mIntervalSeconds,
+           mHoldSeconds);
+    fflush(stdout);
+
+    uint64_t intervalMs = (uint64_t)mIntervalSeconds * 1000;
+    uint64_t startMs = Clock_GetMs();
+    uint64_t nextStepMs = startMs;
+    uint64_t lastReportMs = startMs;
+    uint64_t holdEndMs = 0;
+    size_t step = mRampStep ? mRampStep : mDeviceCount;
+
+    while (!mExit) {
+        uint64_t nowMs = Clock_GetMs();
+
+        if (Fleet_GetStartedCount() < mDeviceCount && nowMs >= nextStepMs) {
+            for (size_t i = 0; i < step && Fleet_GetStartedCount() < mDeviceCount; i++) {
+                if (Fleet_StartDevice(Fleet_GetStartedCount(), RunDevice, NULL) != 0) {
+                    printf("Failed to start device %zu\n", Fleet_GetStartedCount());
+                    mExit = true;
+                    break;
+                }
+            }
+
+            nextStepMs += intervalMs;
+
+            if (Fleet_GetStartedCount() == mDeviceCount) {
+                holdEndMs = nowMs + (uint64_t)mHoldSeconds * 1000;
+            }
+        }
+
+        if (nowMs - lastReportMs >= intervalMs) {
+            CollectTotals(&current);
+            PrintInterval(&previous, &current, nowMs - startMs, nowMs - lastReportMs);
+            previous = current;
+            lastReportMs = nowMs;
+        }
+
+        if (holdEndMs && nowMs >= holdEndMs) {
+            break;
+        }
+
+        SleepMs(POLL_INTERVAL_MS);
+    }
+
+    Fleet_Stop();
+    Fleet_Wait();
+
+    uint64_t elapsedMs = Clock_GetMs() - startMs;
+    CollectTotals(&current);
+    PrintSummary(&current, elapsedMs);
+    int res = mStatsFile ? WriteStatsFile(&current, elapsedMs) : 0;
+
+    Fleet_Deinitialize();
+    FreeConnectionStrings();
+    Payload_Free(&mPayload);
+    free(mRates);
+    return res;
+}
+
+static void PrintUsage(void)
+{
+    /* clang-format off */
+    static const char *usageString = "Usage: cloud-fleet [options]\n"
+                                     "\n"
+                                     "Optional options:\n"
+                                     "  -n COUNT, --devices COUNT\n"
+                                     "                           Number of virtual devices (default 100).\n"
+                                     "  -r RATE, --rate RATE     Readings per second of each device, or MIN-MAX\n"
+                                     "                           for a rate picked at random per device\n"
+                                     "                           (default 1).\n"
+                                     "  -p SHAPE, --payload SHAPE\n"
+                                     "                           json:FIELDS, binary:BYTES or file:PATH\n"
+                                     "                           (default json:8).\n"
+                                     "  -c FILE, --connection-strings FILE\n"
+                                     "                           Device connection strings, one per line. Without\n"
+                                     "                           it the devices are sim-0000, sim-0001, ... with\n"
+                                     "                           the key of -k.\n"
+                                     "  -H HOST, --host HOST     Hub of the generated devices (default localhost).\n"
+                                     "  -k KEY, --key KEY        Base64 key of the generated devices.\n"
+                                     "  -T FILE, --trusted-cert FILE\n"
+                                     "                           Certificate of the hub to trust, PEM.\n"
+                                     "  -R STEP:SECONDS, --ramp STEP:SECONDS\n"
+                                     "                           Start STEP more devices every SECONDS (default\n"
+                                     "                           all devices at once, reporting every 10 s).\n"
+                                     "  -d SECONDS, --hold SECONDS\n"
+                                     "                           Keep running after the last step (default 30).\n"
+                                     "  -t NAME, --transport NAME\n"
+                                     "                           mqtt, mqtt_websocket, amqp, amqp_websocket or\n"
+                                     "                           http (default mqtt). cloud-hub speaks MQTT\n"
+                                     "                           only.\n"
+                                     "  -S SEED, --seed SEED     Seed for rates, payloads and start times\n"
+                                     "                           (default 1).\n"
+                                     "  -o FILE, --stats-file FILE\n"
+                                     "                           Write the final statistics as JSON to FILE.\n"
+                                     "  -v, --verbose            Keep the output of the devices.\n"
+                                     "  -h, --help               Print this message and exit.\n";
+    /* clang-format on */
+
+    printf("%s", usageString);
+}
+
+static int ParseArguments(int argc, char *argv[])
+{
+    int opt = 0;
+
+    /* clang-format off */
+    static struct option long_options[] = {
+        {"devices", required_argument, 0, 'n'},
+        {"rate", required_argument, 0, 'r'},
+        {"payload", required_argument, 0, 'p'},
+        {"connection-strings", required_argument, 0, 'c'},
+        {"host", required_argument, 0, 'H'},
+        {"key", required_argument, 0, 'k'},
+        {"trusted-cert", required_argument, 0, 'T'},
+        {"ramp", required_argument, 0, 'R'},
+        {"hold", required_argument, 0, 'd'},
+        {"transport", required_argument, 0, 't'},
+        {"seed", required_argument, 0, 'S'},
+        {"stats-file", required_argument, 0, 'o'},
+        {"verbose", no_argument, 0, 'v'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0},
+    };
+    /* clang-format on */
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, "n:r:p:c:H:k:T:R:d:t:S:o:vh", long_options, &long_index)) != -1) {
+        switch (opt) {
+            case 'n':
+                mDeviceCount = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'r':
+                if (ParseRate(optarg) != 0) {
+                    printf("Invalid rate %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+
+            case 'p':
+                mPayloadSetting = optarg;
+                break;
+
+            case 'c':
+                mConnectionStringFile = optarg;
+                break;
+
+            case 'H':
+                mHost = optarg;
+                break;
+
+            case 'k':
+                mKey = optarg;
+                break;
+
+            case 'T':
+                mTrustedCertFile = optarg;
+                break;
+
+            case 'R':
+                if (ParseRamp(optarg) != 0) {
+                    printf("Invalid ramp %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+
+            case 'd':
+                mHoldSeconds = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+
+            case 't':
+                if (Cloud_ParseTransport(optarg, &mTransport) != 0) {
+                    printf("Unknown transport %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+
+            case 'S':
+                mSeed = strtoull(optarg, NULL, 10);
+                break;
+
+            case 'o':
+                mStatsFile = optarg;
+                break;
+
+            case 'v':
+                mIsVerbose = true;
+                break;
+
+            case 'h':
+                PrintUsage();
+                exit(0);
+                break;
+
+            default:
+                PrintUsage();
+                exit(-1);
+                break;
+        }
+    }
+
+    if (mDeviceCount == 0 || mDeviceCount > FLEET_MAX_DEVICES) {
+        printf("The number of devices must be between 1 and %d\n", FLEET_MAX_DEVICES);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* RATE or MIN-MAX, in readings per second */
+static int ParseRate(const char *text)
+{
+    char *end = NULL;
+
+    mMinRate = strtod(text, &end);
+    mMaxRate = mMinRate;
+
+    if (end != text && *end == '-') {
+        const char *max = end + 1;
+        mMaxRate = strtod(max, &end);
+
+        if (end == max) {
+            return -1;
+        }
+    }
+
+    if (end == text || *end != '\0' || mMinRate <= 0.0 || mMaxRate < mMinRate || mMaxRate > MAX_RATE) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int ParseRamp(const char *text)
+{
+    char *end = NULL;
+
+    mRampStep = strtoul(text, &end, 10);
+
+    if (end == text || *end != ':' || mRampStep == 0) {
+        return -1;
+    }
+
+    const char *seconds = end + 1;
+    mIntervalSeconds = (unsigned int)strtoul(seconds, &end, 10);
+    return (end == seconds || *end != '\0' || mIntervalSeconds == 0) ? -1 : 0;
+}
+
+/* Blank lines and lines starting with # are skipped. Devices take the connection strings in turn, so a file with
+ * fewer lines than devices connects some devices more than once, which the hub resolves by dropping the older
+ * connection. */
+static int ReadConnectionStrings(const char *filename)
+{
+    char line[MAX_CONNECTION_STRING_LENGTH];
+    FILE *fptr = fopen(filename, "r");
+
+    if (fptr == NULL) {
+        printf("Failed to open %s\n", filename);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fptr)) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+
+        char **connectionStrings = realloc(mConnectionStrings, (mConnectionStringCount + 1) * sizeof(char *));
+
+        if (connectionStrings == NULL) {
+            fclose(fptr);
+            return -1;
+        }
+
+        mConnectionStrings = connectionStrings;
+        mConnectionStrings[mConnectionStringCount] = strdup(line);
+
+        if (mConnectionStrings[mConnectionStringCount] == NULL) {
+            fclose(fptr);
+            return -1;
+        }
+
+        mConnectionStringCount++;
+    }
+
+    fclose(fptr);
+
+    if (mConnectionStringCount == 0) {
+        printf("No connection strings in %s\n", filename);
+        return -1;
+    }
+
+    if (mConnectionStringCount < mDeviceCount) {
+        printf("%zu connection strings for %zu devices, some devices share one\n", mConnectionStringCount,
+               mDeviceCount);
+    }
+
+    return 0;
+}
+
+static int ReadTrustedCert(const char *filename)
+{
+    FILE *fptr = fopen(filename, "r");
+
+    if (fptr == NULL) {
+        printf("Failed to open %s\n", filename);
+        return -1;
+    }
+
+    size_t size = fread(mTrustedCert, 1, sizeof(mTrustedCert) - 1, fptr);
+    fclose(fptr);
+    mTrustedCert[size] = '\0';
+
+    if (size == 0 || size == sizeof(mTrustedCert) - 1) {
+        printf("%s is empty or larger than %zu bytes\n", filename, sizeof(mTrustedCert) - 1);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void FreeConnectionStrings(void)
+{
+    for (size_t i = 0; i < mConnectionStringCount; i++) {
+        free(mConnectionStrings[i]);
+    }
+
+    free(mConnectionStrings);
+    mConnectionStrings = NULL;
+    mConnectionStringCount = 0;
+}
+
+/* The rates are picked up front, so the coordinator knows the load it offers */
+static int AssignRates(void)
+{
+    mRates = calloc(mDeviceCount, sizeof(double));
+
+    if (mRates == NULL) {
+        return -1;
+    }
+
+    srand48((long)mSeed);
+
+    for (size_t i = 0; i < mDeviceCount; i++) {
+        mRates[i] = mMinRate + (mMaxRate - mMinRate) * drand48();
+    }
+
+    return 0;
+}
+
+/* Runs in the process of the device */
+static int RunDevice(size_t index, FleetDeviceStats *stats, void *context)
+{
+    char connectionString[MAX_CONNECTION_STRING_LENGTH];
+    char deviceId[MAX_DEVICE_ID_LENGTH];
+    VirtualDeviceParams params;
+
+    (void)context;
+
+    /* The client library traces every connection, which buries the reports of the coordinator */
+    if (!mIsVerbose && freopen("/dev/null", "w", stdout) == NULL) {
+        return -1;
+    }
+
+    if (mConnectionStringCount) {
+        snprintf(connectionString, sizeof(connectionString), "%s",
+                 mConnectionStrings[index % mConnectionStringCount]);
+    } else {
+        snprintf(connectionString, sizeof(connectionString), "HostName=%s;DeviceId=sim-%04zu;SharedAccessKey=%s",
+                 mHost, index, mKey);
+    }
+
+    GetDeviceId(connectionString, deviceId, sizeof(deviceId));
+
+    params.connectionString = connectionString;
+    params.deviceId = deviceId;
+    params.trustedCert = mTrustedCertFile ? mTrustedCert : NULL;
+    params.payload = &mPayload;
+    params.readingsPerSecond = mRates[index];
+    params.transport = mTransport;
+    params.seed = (uint64_t)mSeed ^ (((uint64_t)index + 1) * 0x9E3779B97F4A7C15ull);
+
+    return VirtualDevice_Run(&params, stats);
+}
+
+static void GetDeviceId(const char *connectionString, char *deviceId, size_t size)
+{
+    const char *start = strstr(connectionString, "DeviceId=");
+
+    if (start == NULL) {
+        snprintf(deviceId, size, "unknown");
+        return;
+    }
+
+    start += strlen("DeviceId=");
+    snprintf(deviceId, size, "%.*s", (int)strcspn(start, ";"), start);
+}
+
+static void CollectTotals(FleetTotals *totals)
+{
+    FleetDeviceStats stats;
+
+    memset(totals, 0, sizeof(FleetTotals));
+    totals->startedCount = Fleet_GetStartedCount();
+
+    for (size_t i = 0; i < totals->startedCount; i++) {
+        Fleet_GetDeviceStats(i, &stats);
+
+        if (stats.state == FLEET_DEVICE_CONNECTED) {
+            totals->connectedCount++;
+            totals->offeredRate += mRates[i];
+        }
+
+        if (stats.state == FLEET_DEVICE_FAILED) {
+            totals->failedCount++;
+        } else if (stats.state != FLEET_DEVICE_EXITED) {
+            totals->runningCount++;
+            totals->rssKb += stats.rssKb;
+            totals->privateKb += stats.privateKb;
+        }
+
+        totals->sentCount += stats.sentCount;
+        totals->ackCount += stats.ackCount;
+        totals->failCount += stats.failCount;
+        totals->rejectCount += stats.rejectCount;
+        totals->reconnectCount += stats.reconnectCount;
+        totals->sentBytes += stats.sentBytes;
+        totals->cpuUs += stats.cpuUs;
+
+        for (size_t j = 0; j < FLEET_LATENCY_BUCKETS; j++) {
+            totals->latencyBuckets[j] += stats.latencyBuckets[j];
+        }
+    }
+}
+
+static uint64_t GetPercentileUs(const uint64_t *buckets, uint64_t count, double fraction)
+{
+    uint64_t target = (uint64_t)((double)count * fraction);
+    uint64_t seen = 0;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < FLEET_LATENCY_BUCKETS; i++) {
+        seen += buckets[i];
+
+        if (seen > target || seen == count) {
+            return Fleet_GetBucketLatencyUs(i);
+        }
+    }
+
+    return Fleet_GetBucketLatencyUs(FLEET_LATENCY_BUCKETS - 1);
+}
+
+static void PrintInterval(const FleetTotals *previous, const FleetTotals *current, uint64_t elapsedMs,
+                          uint64_t intervalMs)
+{
+    uint64_t buckets[FLEET_LATENCY_BUCKETS];
+    uint64_t ackCount = current->ackCount - previous->ackCount;
+    double seconds = (double)intervalMs / 1000.0;
+    double sentRate = (double)(current->sentCount - previous->sentCount) / seconds;
+    double ackRate = (double)ackCount / seconds;
+    size_t runningCount = current->runningCount ? current->runningCount : 1;
+
+    for (size_t i = 0; i < FLEET_LATENCY_BUCKETS; i++) {
+        buckets[i] = current->latencyBuckets[i] - previous->latencyBuckets[i];
+    }
+
+    uint64_t p99Us = GetPercentileUs(buckets, ackCount, 0.99);
+
+    /* A device counts its CPU time when it reports its memory, about once a second, so a short interval is noisy */
+    double cpuPercent = (double)(current->cpuUs - previous->cpuUs) / ((double)intervalMs * 10.0) / (double)runningCount;
+
+    printf("[%llu s] devices: %zu (%zu connected, %zu failed), offered: %.1f/s, sent: %.1f/s, acked: %.1f/s, "
+           "ack p50/p99/p999: %.1f/%.1f/%.1f ms, failed: %llu, rejected: %llu, reconnects: %llu, "
+           "cpu: %.2f%%/device, rss: %llu KB/device (%llu KB private)\n",
+           (unsigned long long)(elapsedMs / 1000), current->startedCount, current->connectedCount,
+           current->failedCount, current->offeredRate, sentRate, ackRate,
+           (double)GetPercentileUs(buckets, ackCount, 0.50) / 1000.0, (double)p99Us / 1000.0,
+           (double)GetPercentileUs(buckets, ackCount, 0.999) / 1000.0,
+           (unsigned long long)(current->failCount - previous->failCount),
+           (unsigned long long)(current->rejectCount - previous->rejectCount),
+           (unsigned long long)(current->reconnectCount - previous->reconnectCount), cpuPercent,
+           (unsigned long long)(current->rssKb / runningCount),
+           (unsigned long long)(current->privateKb / runningCount));
+    fflush(stdout);
+
+    if (current->offeredRate > 0.0 && ackRate >= current->offeredRate * SUSTAINED_ACK_RATIO &&
+        ackRate > mSustainedAckRate) {
+        mSustainedAckRate = ackRate;
+        mSustainedDeviceCount = current->connectedCount;
+        mSustainedP99Us = p99Us;
+    }
+}
+
+static void PrintSummary(const FleetTotals *totals, uint64_t elapsedMs)
+{
+    printf("Sent %llu readings (%llu bytes) from %zu devices in %llu.%03llu s: %llu acked, %llu failed, %llu "
+           "rejected, %llu reconnects, %zu devices failed\n",
+           (unsigned long long)totals->sentCount, (unsigned long long)totals->sentBytes, totals->startedCount,
+           (unsigned long long)(elapsedMs / 1000), (unsigned long long)(elapsedMs % 1000),
+           (unsigned long long)totals->ackCount, (unsigned long long)totals->failCount,
+           (unsigned long long)totals->rejectCount, (unsigned long long)totals->reconnectCount, totals->failedCount);
+    printf("Ack latency p50: %.1f ms, p99: %.1f ms, p999: %.1f ms\n",
+           (double)GetPercentileUs(totals->latencyBuckets, totals->ackCount, 0.50) / 1000.0,
+           (double)GetPercentileUs(totals->latencyBuckets, totals->ackCount, 0.99) / 1000.0,
+           (double)GetPercentileUs(totals->latencyBuckets, totals->ackCount, 0.999) / 1000.0);
+
+    if (mSustainedDeviceCount) {
+        printf("Sustained: %.1f acked/s with %zu devices, ack p99 %.1f ms\n", mSustainedAckRate,
+               mSustainedDeviceCount, (double)mSustainedP99Us / 1000.0);
+    } else {
+        printf("Sustained: no interval kept up with the offered load\n");
+    }
+}
+
+static int WriteStatsFile(const FleetTotals *totals, uint64_t elapsedMs)
+{
+    FILE *fptr = fopen(mStatsFile, "w");
+
+    if (fptr == NULL) {
+        printf("Failed to write %s\n", mStatsFile);
+        return -1;
+    }
+
+    fprintf(fptr,
+            "{\"elapsedMs\":%llu,\"devices\":%zu,\"failedDevices\":%zu,\"sent\":%llu,\"sentBytes\":%llu,"
+            "\"acked\":%llu,\"failed\":%llu,\"rejected\":%llu,\"reconnects\":%llu,\"p50Us\":%llu,\"p99Us\":%llu,"
+            "\"p999Us\":%llu,\"sustainedAckRate\":%.1f,\"sustainedDevices\":%zu,\"sustainedP99Us\":%llu}\n",
+            (unsigned long long)elapsedMs, totals->startedCount, totals->failedCount,
+            (unsigned long long)totals->sentCount, (unsigned long long)totals->sentBytes,
+            (unsigned long long)totals->ackCount, (unsigned long long)totals->failCount,
+            (unsigned long long)totals->rejectCount, (unsigned long long)totals->reconnectCount,
+            (unsigned long long)GetPercentileUs(totals->latencyBuckets, totals->ackCount, 0.50),
+            (unsigned long long)GetPercentileUs(totals->latencyBuckets, totals->ackCount, 0.99),
+            (unsigned long long)GetPercentileUs(totals->latencyBuckets, totals->ackCount, 0.999), mSustainedAckRate,
+            mSustainedDeviceCount, (unsigned long long)mSustainedP99Us);
+    fclose(fptr);
+    return 0;
+}
+
+static void RegisterSignalHandler(SignalHandler_t signalHandler)
+{
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+}
+
+/* Only sets flags. The devices inherit the handler, so a device that receives SIGTERM stops the fleet as well. */
+static void SignalHandler(int signum)
+{
+    (void)signum;
+    mExit = true;
+    Fleet_Stop();
+}
+
+static void SleepMs(unsigned int ms)
+{
+    struct timespec timeToSleep = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000};
+    nanosleep(&timeToSleep, NULL);
+}
@@ -0,0 +1,38 @@
+#ifndef FAULT_H
+#define FAULT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FAULT_MAX_STEPS 64
+
+/* Network and hub conditions, changed over time by a script */
+typedef struct sFaultParams {
+    unsigned int latencyMs;
+    unsigned int jitterMs;
+    uint64_t bandwidth;
+    double dropRate;
+    unsigned int throttleRate;
+    bool isAuthFailing;
+} FaultParams;
+
+typedef struct sFaultStats {
+    size_t stepCount;
+    size_t dropCount;
+    size_t disconnectCount;
+} FaultStats;
+
+int Fault_Initialize(uint64_t seed);
+void Fault_Deinitialize(void);
+int Fault_Apply(const char *settings);
+int Fault_LoadScript(const char *path);
+bool Fault_Task(uint64_t elapsedMs);
+const FaultParams *Fault_GetParams(void);
+unsigned int Fault_GetDelayMs(void);
+bool Fault_ShouldDrop(void);
+size_t Fault_GetBandwidth(uint64_t nowMs, size_t wanted);
+void Fault_UseBandwidth(size_t size);
+void Fault_GetStats(FaultStats *stats);
+
+#endif
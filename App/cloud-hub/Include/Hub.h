@@ -0,0 +1,44 @@
+#ifndef HUB_H
+#define HUB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HUB_DEFAULT_PORT 8883
+/* Enough for a fleet of virtual devices from cloud-fleet, as far as the open file limit allows */
+#define HUB_MAX_CONNECTIONS 4096
+#define HUB_MAX_MESSAGE_IDS (1 << 20)
+
+typedef struct sHubParams {
+    const char *address;
+    uint16_t port;
+    bool isPlain;
+    const char *certFile;
+    const char *keyFile;
+} HubParams;
+
+typedef struct sHubStats {
+    size_t connectionCount;
+    size_t sessionCount;
+    size_t refusedCount;
+    size_t activeCount;
+    size_t messageCount;
+    size_t uniqueCount;
+    size_t duplicateCount;
+    size_t dropCount;
+    size_t throttleCount;
+    size_t faultDisconnectCount;
+    size_t twinCount;
+    uint64_t payloadBytes;
+    uint64_t receivedBytes;
+    uint64_t sentBytes;
+} HubStats;
+
+int Hub_Initialize(const HubParams *params);
+void Hub_Deinitialize(void);
+void Hub_Task(int timeoutMs);
+void Hub_DisconnectAll(void);
+void Hub_GetStats(HubStats *stats);
+
+#endif
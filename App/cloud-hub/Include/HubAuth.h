@@ -0,0 +1,28 @@
+#ifndef HUBAUTH_H
+#define HUBAUTH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "MqttPacket.h"
+
+#define HUBAUTH_MAX_DEVICES 1024
+#define HUBAUTH_MAX_ID_LENGTH 128
+#define HUBAUTH_MAX_KEY_LENGTH 128
+
+typedef struct sHubAuthStats {
+    size_t acceptCount;
+    size_t badIdentityCount;
+    size_t unknownDeviceCount;
+    size_t badSignatureCount;
+    size_t expiredCount;
+} HubAuthStats;
+
+int HubAuth_Initialize(void);
+void HubAuth_Deinitialize(void);
+int HubAuth_LoadDevices(const char *path);
+size_t HubAuth_GetDeviceCount(void);
+MqttConnectReturnCode HubAuth_Check(const MqttConnect *connect, bool hasClientCert, uint64_t nowSeconds);
+void HubAuth_GetStats(HubAuthStats *stats);
+
+#endif
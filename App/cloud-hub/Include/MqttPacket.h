@@ -0,0 +1,95 @@
+#ifndef MQTTPACKET_H
+#define MQTTPACKET_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* IoT Hub accepts device-to-cloud messages of up to 256 KiB, the rest is room for the topic and its properties */
+#define MQTT_MAX_PACKET_SIZE (256 * 1024 + 16 * 1024)
+#define MQTT_MAX_HEADER_SIZE 5
+#define MQTT_MAX_SUBSCRIPTIONS 16
+
+typedef enum eMqttPacketType {
+    MQTT_PACKET_CONNECT = 1,
+    MQTT_PACKET_CONNACK,
+    MQTT_PACKET_PUBLISH,
+    MQTT_PACKET_PUBACK,
+    MQTT_PACKET_PUBREC,
+    MQTT_PACKET_PUBREL,
+    MQTT_PACKET_PUBCOMP,
+    MQTT_PACKET_SUBSCRIBE,
+    MQTT_PACKET_SUBACK,
+    MQTT_PACKET_UNSUBSCRIBE,
+    MQTT_PACKET_UNSUBACK,
+    MQTT_PACKET_PINGREQ,
+    MQTT_PACKET_PINGRESP,
+    MQTT_PACKET_DISCONNECT,
+} MqttPacketType;
+
+typedef enum eMqttConnectReturnCode {
+    MQTT_CONNACK_ACCEPTED,
+    MQTT_CONNACK_REFUSED_PROTOCOL_VERSION,
+    MQTT_CONNACK_REFUSED_IDENTIFIER,
+    MQTT_CONNACK_REFUSED_SERVER_UNAVAILABLE,
+    MQTT_CONNACK_REFUSED_BAD_CREDENTIALS,
+    MQTT_CONNACK_REFUSED_NOT_AUTHORIZED,
+} MqttConnectReturnCode;
+
+/* Strings point into the packet and are not terminated */
+typedef struct sMqttString {
+    const char *data;
+    size_t length;
+} MqttString;
+
+typedef struct sMqttPacket {
+    MqttPacketType type;
+    uint8_t flags;
+    const uint8_t *body;
+    size_t bodySize;
+    size_t size;
+} MqttPacket;
+
+typedef struct sMqttConnect {
+    uint8_t protocolLevel;
+    bool isCleanSession;
+    uint16_t keepAliveSeconds;
+    MqttString clientId;
+    MqttString username;
+    MqttString password;
+    bool hasPassword;
+} MqttConnect;
+
+typedef struct sMqttPublish {
+    MqttString topic;
+    uint8_t qos;
+    bool isRetained;
+    bool isDuplicate;
+    uint16_t packetId;
+    const uint8_t *payload;
+    size_t payloadSize;
+} MqttPublish;
+
+typedef struct sMqttSubscribe {
+    uint16_t packetId;
+    MqttString topics[MQTT_MAX_SUBSCRIPTIONS];
+    uint8_t qos[MQTT_MAX_SUBSCRIPTIONS];
+    size_t count;
+} MqttSubscribe;
+
+int MqttPacket_Parse(const uint8_t *data, size_t size, MqttPacket *packet);
+int MqttPacket_ParseConnect(const MqttPacket *packet, MqttConnect *connect);
+int MqttPacket_ParsePublish(const MqttPacket *packet, MqttPublish *publish);
+int MqttPacket_ParseSubscribe(const MqttPacket *packet, MqttSubscribe *subscribe);
+int MqttPacket_ParsePacketId(const MqttPacket *packet, uint16_t *packetId);
+size_t MqttPacket_WriteConnack(uint8_t *buffer, bool isSessionPresent, MqttConnectReturnCode code);
+size_t MqttPacket_WriteAck(uint8_t *buffer, MqttPacketType type, uint16_t packetId);
+size_t MqttPacket_WriteSuback(uint8_t *buffer, uint16_t packetId, const uint8_t *codes, size_t count);
+size_t MqttPacket_WritePingresp(uint8_t *buffer);
+size_t MqttPacket_GetPublishSize(size_t topicLength, size_t payloadSize, uint8_t qos);
+size_t MqttPacket_WritePublish(uint8_t *buffer, const char *topic, size_t topicLength, const void *payload,
+                               size_t payloadSize, uint8_t qos, uint16_t packetId);
+bool MqttString_Equals(const MqttString *string, const char *text);
+bool MqttString_StartsWith(const MqttString *string, const char *prefix);
+
+#endif
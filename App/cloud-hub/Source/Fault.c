@@ -0,0 +1,275 @@
+#include "Fault.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FAULT_MAX_SETTINGS_LENGTH 256
+#define FAULT_MIN_BURST_BYTES 1500
+
+typedef struct sFaultStep {
+    uint64_t atMs;
+    char settings[FAULT_MAX_SETTINGS_LENGTH];
+} FaultStep;
+
+static FaultParams mParams;
+static FaultStep mSteps[FAULT_MAX_STEPS];
+static size_t mStepCount = 0;
+static size_t mNextStep = 0;
+static bool mIsDisconnectPending = false;
+static uint64_t mRandomState = 1;
+static double mBandwidthTokens = 0;
+static uint64_t mBandwidthUpdateMs = 0;
+static FaultStats mStats;
+
+static int ParseSettings(const char *settings, FaultParams *params, bool *isDisconnect);
+static uint64_t NextRandom(void);
+
+int Fault_Initialize(uint64_t seed)
+{
+    memset(&mParams, 0, sizeof(mParams));
+    memset(&mStats, 0, sizeof(mStats));
+    mStepCount = 0;
+    mNextStep = 0;
+    mIsDisconnectPending = false;
+    mRandomState = seed ? seed : 1;
+    mBandwidthTokens = 0;
+    mBandwidthUpdateMs = 0;
+    return 0;
+}
+
+void Fault_Deinitialize(void)
+{
+    mStepCount = 0;
+}
+
+/* Settings are space separated: latency=MS jitter=MS bandwidth=BYTES drop=RATE throttle=N auth=fail|ok and the
+ * action disconnect */
+int Fault_Apply(const char *settings)
+{
+    FaultParams params = mParams;
+    bool isDisconnect = false;
+
+    if (ParseSettings(settings, &params, &isDisconnect) != 0) {
+        printf("Invalid fault settings: %s\n", settings);
+        return -1;
+    }
+
+    mParams = params;
+    mIsDisconnectPending |= isDisconnect;
+    return 0;
+}
+
+/* One step per line, "SECONDS settings", in order of time. Lines starting with '#' are comments. */
+int Fault_LoadScript(const char *path)
+{
+    FILE *fptr = fopen(path, "r");
+    char line[FAULT_MAX_SETTINGS_LENGTH + 32];
+    int lineNumber = 0;
+    int res = 0;
+
+    if (fptr == NULL) {
+        printf("Failed to open fault script %s\n", path);
+        return -1;
+    }
+
+    while (res == 0 && fgets(line, sizeof(line), fptr)) {
+        char *end;
+        lineNumber++;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+
+        double seconds = strtod(line, &end);
+        FaultParams params = mParams;
+        bool isDisconnect;
+
+        while (*end == ' ' || *end == '\t') {
+            end++;
+        }
+
+        uint64_t atMs = (uint64_t)(seconds * 1000.0);
+
+        if (end == line || seconds < 0 || mStepCount == FAULT_MAX_STEPS ||
+            (mStepCount && atMs < mSteps[mStepCount - 1].atMs) || ParseSettings(end, &params, &isDisconnect) != 0) {
+            printf("Invalid fault script line %d: %s\n", lineNumber, line);
+            res = -1;
+            break;
+        }
+
+        mSteps[mStepCount].atMs = atMs;
+        snprintf(mSteps[mStepCount].settings, FAULT_MAX_SETTINGS_LENGTH, "%s", end);
+        mStepCount++;
+    }
+
+    fclose(fptr);
+    return res;
+}
+
+/* Applies the steps that are due and returns true when connections are to be dropped */
+bool Fault_Task(uint64_t elapsedMs)
+{
+    while (mNextStep < mStepCount && mSteps[mNextStep].atMs <= elapsedMs) {
+        printf("[%llu.%03llu] Fault: %s\n", (unsigned long long)(elapsedMs / 1000),
+               (unsigned long long)(elapsedMs % 1000), mSteps[mNextStep].settings);
+        Fault_Apply(mSteps[mNextStep].settings);
+        mNextStep++;
+        mStats.stepCount++;
+    }
+
+    bool isDisconnect = mIsDisconnectPending;
+
+    if (isDisconnect) {
+        mIsDisconnectPending = false;
+        mStats.disconnectCount++;
+    }
+
+    return isDisconnect;
+}
+
+const FaultParams *Fault_GetParams(void)
+{
+    return &mParams;
+}
+
+/* The delay of a packet sent by the hub, one way */
+unsigned int Fault_GetDelayMs(void)
+{
+    unsigned int delayMs = mParams.latencyMs;
+
+    if (mParams.jitterMs) {
+        delayMs += (unsigned int)(NextRandom() % (2 * (uint64_t)mParams.jitterMs + 1));
+        delayMs = delayMs > mParams.jitterMs ? delayMs - mParams.jitterMs : 0;
+    }
+
+    return delayMs;
+}
+
+bool Fault_ShouldDrop(void)
+{
+    if (mParams.dropRate <= 0.0 || (double)(NextRandom() >> 11) / 9007199254740992.0 >= mParams.dropRate) {
+        return false;
+    }
+
+    mStats.dropCount++;
+    return true;
+}
+
+/* A token bucket shared by both directions of all connections, as one link would be. It holds up to 100 ms of
+ * traffic, so a burst after an idle period stays short. Returns how much of wanted may be moved now. */
+size_t Fault_GetBandwidth(uint64_t nowMs, size_t wanted)
+{
+    if (mParams.bandwidth == 0) {
+        return wanted;
+    }
+
+    double burst = (double)mParams.bandwidth / 10.0;
+
+    if (burst < FAULT_MIN_BURST_BYTES) {
+        burst = FAULT_MIN_BURST_BYTES;
+    }
+
+    if (mBandwidthUpdateMs == 0) {
+        mBandwidthTokens = burst;
+    } else {
+        mBandwidthTokens += (double)mParams.bandwidth * (double)(nowMs - mBandwidthUpdateMs) / 1000.0;
+    }
+
+    mBandwidthUpdateMs = nowMs;
+
+    if (mBandwidthTokens > burst) {
+        mBandwidthTokens = burst;
+    }
+
+    return mBandwidthTokens < (double)wanted ? (size_t)mBandwidthTokens : wanted;
+}
+
+void Fault_UseBandwidth(size_t size)
+{
+    if (mParams.bandwidth) {
+        mBandwidthTokens -= (double)size;
+    }
+}
+
+void Fault_GetStats(FaultStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+    }
+}
+
+static int ParseSettings(const char *settings, FaultParams *params, bool *isDisconnect)
+{
+    char copy[FAULT_MAX_SETTINGS_LENGTH];
+    char *savePtr = NULL;
+
+    *isDisconnect = false;
+    snprintf(copy, sizeof(copy), "%s", settings);
+
+    for (char *token = strtok_r(copy, " \t", &savePtr); token; token = strtok_r(NULL, " \t", &savePtr)) {
+        char *value = strchr(token, '=');
+        char *end = NULL;
+
+        if (strcmp(token, "disconnect") == 0) {
+            *isDisconnect = true;
+            continue;
+        }
+
+        if (value == NULL) {
+            return -1;
+        }
+
+        *value++ = '\0';
+
+        if (strcmp(token, "auth") == 0) {
+            if (strcmp(value, "fail") != 0 && strcmp(value, "ok") != 0) {
+                return -1;
+            }
+
+            params->isAuthFailing = strcmp(value, "fail") == 0;
+            continue;
+        }
+
+        double number = strtod(value, &end);
+
+        if (end == value || number < 0) {
+            return -1;
+        }
+
+        /* Bandwidth may be given in kB/s or MB/s */
+        if (strcmp(token, "bandwidth") == 0 && (*end == 'k' || *end == 'm')) {
+            number *= *end == 'k' ? 1000.0 : 1000000.0;
+            end++;
+        }
+
+        if (*end != '\0') {
+            return -1;
+        }
+
+        if (strcmp(token, "latency") == 0) {
+            params->latencyMs = (unsigned int)number;
+        } else if (strcmp(token, "jitter") == 0) {
+            params->jitterMs = (unsigned int)number;
+        } else if (strcmp(token, "bandwidth") == 0) {
+            params->bandwidth = (uint64_t)number;
+        } else if (strcmp(token, "drop") == 0 && number <= 1.0) {
+            params->dropRate = number;
+        } else if (strcmp(token, "throttle") == 0) {
+            params->throttleRate = (unsigned int)number;
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* xorshift64*, reproducible for a given seed */
+static uint64_t NextRandom(void)
+{
+    mRandomState ^= mRandomState >> 12;
+    mRandomState ^= mRandomState << 25;
+    mRandomState ^= mRandomState >> 27;
+    return mRandomState * 2685821657736338717ull;
+}
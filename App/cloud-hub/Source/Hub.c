@@ -0,0 +1,771 @@
+#define _GNU_SOURCE
+#include "Hub.h"
+#include "HubAuth.h"
+#include "MqttPacket.h"
+#include "Fault.h"
+#include "Clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#define HUB_READ_CHUNK_SIZE 16384
+#define HUB_EVENTS_TOPIC "/messages/events/"
+#define HUB_TWIN_GET_TOPIC "$iothub/twin/GET/"
+#define HUB_TWIN_PATCH_TOPIC "$iothub/twin/PATCH/properties/reported/"
+#define HUB_METHOD_RESPONSE_TOPIC "$iothub/methods/res/"
+#define HUB_MAX_TOPIC_LENGTH 512
+
+/* A packet the hub sends, held back until the latency of the link has passed */
+typedef struct sHubPacket {
+    struct sHubPacket *next;
+    uint64_t dueMs;
+    size_t size;
+    size_t offset;
+    uint8_t data[];
+} HubPacket;
+
+typedef struct sHubConnection {
+    int fd;
+    SSL *ssl;
+    bool isSession;
+    bool isClosing;
+    char deviceId[HUBAUTH_MAX_ID_LENGTH + 1];
+    uint8_t *input;
+    size_t inputSize;
+    size_t inputCapacity;
+    HubPacket *head;
+    HubPacket *tail;
+    uint64_t lastDueMs;
+    size_t pendingWriteSize;
+    uint64_t lastReceiveMs;
+    uint16_t keepAliveSeconds;
+    uint64_t throttleWindowMs;
+    unsigned int throttleCount;
+    unsigned int twinVersion;
+} HubConnection;
+
+static int mListenFd = -1;
+static SSL_CTX *mSslContext = NULL;
+static HubConnection *mConnections[HUB_MAX_CONNECTIONS];
+static uint64_t *mMessageIds = NULL;
+static size_t mMessageIdCount = 0;
+static HubStats mStats;
+
+static int CreateSslContext(const HubParams *params);
+static int VerifyClientCert(int isPreverified, X509_STORE_CTX *context);
+static void Accept(uint64_t nowMs);
+static void Close(size_t index);
+static bool Receive(HubConnection *connection, uint64_t nowMs);
+static bool Transmit(HubConnection *connection, uint64_t nowMs);
+static bool HandlePacket(HubConnection *connection, const MqttPacket *packet, uint64_t nowMs);
+static bool HandleConnect(HubConnection *connection, const MqttPacket *packet);
+static bool HandlePublish(HubConnection *connection, const MqttPacket *packet, uint64_t nowMs);
+static bool HandleSubscribe(HubConnection *connection, const MqttPacket *packet);
+static void HandleTwin(HubConnection *connection, const MqttPublish *publish, bool isPatch);
+static bool IsTelemetryTopic(const HubConnection *connection, const MqttString *topic);
+static void CountMessageId(const MqttString *topic);
+static bool GetTopicProperty(const MqttString *topic, const char *name, char *value, size_t valueSize);
+static int Send(HubConnection *connection, const uint8_t *data, size_t size);
+static void SendPublish(HubConnection *connection, const char *topic, const char *payload);
+
+int Hub_Initialize(const HubParams *params)
+{
+    struct sockaddr_in address;
+    int enable = 1;
+
+    memset(&mStats, 0, sizeof(mStats));
+    memset(mConnections, 0, sizeof(mConnections));
+    mMessageIds = calloc(HUB_MAX_MESSAGE_IDS, sizeof(uint64_t));
+    mMessageIdCount = 0;
+
+    if (mMessageIds == NULL || (!params->isPlain && CreateSslContext(params) != 0)) {
+        Hub_Deinitialize();
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(params->port);
+
+    if (inet_pton(AF_INET, params->address, &address.sin_addr) != 1) {
+        printf("Invalid listen address %s\n", params->address);
+        Hub_Deinitialize();
+        return -1;
+    }
+
+    mListenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (mListenFd < 0 || setsockopt(mListenFd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) != 0 ||
+        bind(mListenFd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(mListenFd, SOMAXCONN) != 0) {
+        printf("Failed to listen on %s:%u: %s\n", params->address, params->port, strerror(errno));
+        Hub_Deinitialize();
+        return -1;
+    }
+
+    return 0;
+}
+
+void Hub_Deinitialize(void)
+{
+    for (size_t i = 0; i < HUB_MAX_CONNECTIONS; i++) {
+        Close(i);
+    }
+
+    if (mListenFd >= 0) {
+        close(mListenFd);
+        mListenFd = -1;
+    }
+
+    if (mSslContext) {
+        SSL_CTX_free(mSslContext);
+        mSslContext = NULL;
+    }
+
+    free(mMessageIds);
+    mMessageIds = NULL;
+}
+
+/* Waits up to timeoutMs for the sockets, or less when a held back packet becomes due */
+void Hub_Task(int timeoutMs)
+{
+    static struct pollfd fds[HUB_MAX_CONNECTIONS + 1];
+    static size_t indexes[HUB_MAX_CONNECTIONS + 1];
+    size_t count = 1;
+    uint64_t nowMs = Clock_GetMs();
+
+    fds[0].fd = mListenFd;
+    fds[0].events = POLLIN;
+
+    for (size_t i = 0; i < HUB_MAX_CONNECTIONS; i++) {
+        HubConnection *connection = mConnections[i];
+
+        if (connection == NULL) {
+            continue;
+        }
+
+        fds[count].fd = connection->fd;
+        fds[count].events = POLLIN;
+        fds[count].revents = 0;
+        indexes[count] = i;
+
+        if (connection->head) {
+            if (connection->head->dueMs <= nowMs) {
+                fds[count].events |= POLLOUT;
+            } else if (connection->head->dueMs - nowMs < (uint64_t)timeoutMs) {
+                timeoutMs = (int)(connection->head->dueMs - nowMs);
+            }
+        }
+
+        count++;
+    }
+
+    /* With the bandwidth used up the sockets are ready but may not be served, so poll again soon */
+    if (Fault_GetParams()->bandwidth && timeoutMs > 5) {
+        timeoutMs = 5;
+    }
+
+    if (poll(fds, count, timeoutMs) < 0) {
+        return;
+    }
+
+    nowMs = Clock_GetMs();
+
+    if (fds[0].revents & POLLIN) {
+        Accept(nowMs);
+    }
+
+    for (size_t i = 1; i < count; i++) {
+        HubConnection *connection = mConnections[indexes[i]];
+        bool isOpen = true;
+
+        /* Replaced by a newer connection of the same device */
+        if (connection == NULL) {
+            continue;
+        }
+
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+            isOpen = Receive(connection, nowMs);
+        }
+
+        if (isOpen) {
+            isOpen = Transmit(connection, nowMs);
+        }
+
+        if (isOpen && connection->isSession && connection->keepAliveSeconds &&
+            nowMs - connection->lastReceiveMs > (uint64_t)connection->keepAliveSeconds * 1500) {
+            isOpen = false;
+        }
+
+        if (!isOpen || (connection->isClosing && connection->head == NULL)) {
+            Close(indexes[i]);
+        }
+    }
+}
+
+/* Drops all connections without a word, as a broken link would */
+void Hub_DisconnectAll(void)
+{
+    for (size_t i = 0; i < HUB_MAX_CONNECTIONS; i++) {
+        if (mConnections[i]) {
+            mStats.faultDisconnectCount++;
+            Close(i);
+        }
+    }
+}
+
+void Hub_GetStats(HubStats *stats)
+{
+    if (stats) {
+        mStats.activeCount = 0;
+
+        for (size_t i = 0; i < HUB_MAX_CONNECTIONS; i++) {
+            mStats.activeCount += mConnections[i] != NULL;
+        }
+
+        *stats = mStats;
+    }
+}
+
+static int CreateSslContext(const HubParams *params)
+{
+    mSslContext = SSL_CTX_new(TLS_server_method());
+
+    if (mSslContext == NULL || SSL_CTX_set_min_proto_version(mSslContext, TLS1_2_VERSION) != 1 ||
+        SSL_CTX_use_certificate_chain_file(mSslContext, params->certFile) != 1 ||
+        SSL_CTX_use_PrivateKey_file(mSslContext, params->keyFile, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(mSslContext) != 1) {
+        printf("Failed to load the server certificate %s and key %s\n", params->certFile, params->keyFile);
+        ERR_print_errors_fp(stdout);
+        return -1;
+    }
+
+    /* Client certificates are asked for but not required, the device decides how it authenticates */
+    SSL_CTX_set_verify(mSslContext, SSL_VERIFY_PEER, VerifyClientCert);
+    SSL_CTX_set_mode(mSslContext, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    return 0;
+}
+
+/* Any client certificate is accepted; which device it belongs to is not checked */
+static int VerifyClientCert(int isPreverified, X509_STORE_CTX *context)
+{
+    (void)isPreverified;
+    (void)context;
+    return 1;
+}
+
+static void Accept(uint64_t nowMs)
+{
+    int fd;
+    int enable = 1;
+
+    while ((fd = accept4(mListenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        size_t index = 0;
+
+        while (index < HUB_MAX_CONNECTIONS && mConnections[index]) {
+            index++;
+        }
+
+        HubConnection *connection = index < HUB_MAX_CONNECTIONS ? calloc(1, sizeof(HubConnection)) : NULL;
+
+        if (connection == NULL) {
+            close(fd);
+            continue;
+        }
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        connection->fd = fd;
+        connection->lastReceiveMs = nowMs;
+
+        if (mSslContext) {
+            connection->ssl = SSL_new(mSslContext);
+
+            if (connection->ssl == NULL || SSL_set_fd(connection->ssl, fd) != 1) {
+                SSL_free(connection->ssl);
+                free(connection);
+                close(fd);
+                continue;
+            }
+
+            SSL_set_accept_state(connection->ssl);
+        }
+
+        mConnections[index] = connection;
+        mStats.connectionCount++;
+    }
+}
+
+static void Close(size_t index)
+{
+    HubConnection *connection = mConnections[index];
+
+    if (connection == NULL) {
+        return;
+    }
+
+    while (connection->head) {
+        HubPacket *packet = connection->head;
+        connection->head = packet->next;
+        free(packet);
+    }
+
+    if (connection->ssl) {
+        SSL_free(connection->ssl);
+    }
+
+    close(connection->fd);
+    free(connection->input);
+    free(connection);
+    mConnections[index] = NULL;
+}
+
+/* Reads what the bandwidth allows and handles the complete packets. Returns false when the connection is to be
+ * closed. */
+static bool Receive(HubConnection *connection, uint64_t nowMs)
+{
+    for (;;) {
+        size_t wanted = Fault_GetBandwidth(nowMs, HUB_READ_CHUNK_SIZE);
+
+        if (wanted == 0) {
+            break;
+        }
+
+        if (connection->inputCapacity - connection->inputSize < wanted) {
+            size_t capacity = connection->inputSize + wanted;
+            uint8_t *input = realloc(connection->input, capacity);
+
+            if (input == NULL) {
+                return false;
+            }
+
+            connection->input = input;
+            connection->inputCapacity = capacity;
+        }
+
+        uint8_t *buffer = connection->input + connection->inputSize;
+        ssize_t length;
+
+        if (connection->ssl) {
+            ERR_clear_error();
+            length = SSL_read(connection->ssl, buffer, (int)wanted);
+
+            if (length <= 0) {
+                int error = SSL_get_error(connection->ssl, (int)length);
+                return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE;
+            }
+        } else {
+            length = recv(connection->fd, buffer, wanted, MSG_DONTWAIT);
+
+            if (length <= 0) {
+                return length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+            }
+        }
+
+        Fault_UseBandwidth((size_t)length);
+        connection->inputSize += (size_t)length;
+        connection->lastReceiveMs = nowMs;
+        mStats.receivedBytes += (uint64_t)length;
+
+        MqttPacket packet;
+        size_t offset = 0;
+        int res;
+
+        while ((res = MqttPacket_Parse(connection->input + offset, connection->inputSize - offset, &packet)) == 1) {
+            if (!HandlePacket(connection, &packet, nowMs)) {
+                return false;
+            }
+
+            offset += packet.size;
+        }
+
+        if (res < 0) {
+            return false;
+        }
+
+        memmove(connection->input, connection->input + offset, connection->inputSize - offset);
+        connection->inputSize -= offset;
+
+        /* A connection that is refused reads no further */
+        if (connection->isClosing) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+/* Writes the packets that are due, as far as the bandwidth and the socket allow */
+static bool Transmit(HubConnection *connection, uint64_t nowMs)
+{
+    while (connection->head && connection->head->dueMs <= nowMs) {
+        HubPacket *packet = connection->head;
+        size_t size = connection->pendingWriteSize;
+
+        /* A TLS write that could not complete is repeated with the same length */
+        if (size == 0) {
+            size = Fault_GetBandwidth(nowMs, packet->size - packet->offset);
+        }
+
+        if (size == 0) {
+            break;
+        }
+
+        ssize_t length;
+
+        if (connection->ssl) {
+            ERR_clear_error();
+            length = SSL_write(connection->ssl, packet->data + packet->offset, (int)size);
+
+            if (length <= 0) {
+                int error = SSL_get_error(connection->ssl, (int)length);
+                connection->pendingWriteSize = size;
+                return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE;
+            }
+        } else {
+            length = send(connection->fd, packet->data + packet->offset, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+            if (length < 0) {
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+        }
+
+        connection->pendingWriteSize = 0;
+        Fault_UseBandwidth((size_t)length);
+        mStats.sentBytes += (uint64_t)length;
+        packet->offset += (size_t)length;
+
+        if (packet->offset == packet->size) {
+            connection->head = packet->next;
+            connection->tail = connection->head ? connection->tail : NULL;
+            free(packet);
+        }
+    }
+
+    return true;
+}
+
+static bool HandlePacket(HubConnection *connection, const MqttPacket *packet, uint64_t nowMs)
+{
+    uint8_t response[8];
+    uint16_t packetId;
+
+    if (!connection->isSession) {
+        return packet->type == MQTT_PACKET_CONNECT && !connection->isClosing && HandleConnect(connection, packet);
+    }
+
+    switch (packet->type) {
+        case MQTT_PACKET_PUBLISH:
+            return HandlePublish(connection, packet, nowMs);
+
+        case MQTT_PACKET_SUBSCRIBE:
+        case MQTT_PACKET_UNSUBSCRIBE:
+            return HandleSubscribe(connection, packet);
+
+        case MQTT_PACKET_PINGREQ:
+            return Send(connection, response, MqttPacket_WritePingresp(response)) == 0;
+
+        case MQTT_PACKET_PUBACK:
+            return true;
+
+        case MQTT_PACKET_PUBREL:
+            return MqttPacket_ParsePacketId(packet, &packetId) == 0 &&
+                   Send(connection, response, MqttPacket_WriteAck(response, MQTT_PACKET_PUBCOMP, packetId)) == 0;
+
+        default:
+            /* DISCONNECT, a second CONNECT or anything a client does not send */
+            return false;
+    }
+}
+
+static bool HandleConnect(HubConnection *connection, const MqttPacket *packet)
+{
+    MqttConnect connect;
+    MqttConnectReturnCode code;
+    uint8_t response[4];
+
+    if (MqttPacket_ParseConnect(packet, &connect) != 0) {
+        return false;
+    }
+
+    bool hasClientCert = false;
+
+    if (connection->ssl) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        hasClientCert = SSL_get0_peer_certificate(connection->ssl) != NULL;
+#else
+        X509 *cert = SSL_get_peer_certificate(connection->ssl);
+        hasClientCert = cert != NULL;
+        X509_free(cert);
+#endif
+    }
+
+    if (connect.protocolLevel != 4) {
+        code = MQTT_CONNACK_REFUSED_PROTOCOL_VERSION;
+    } else if (Fault_GetParams()->isAuthFailing) {
+        code = MQTT_CONNACK_REFUSED_NOT_AUTHORIZED;
+    } else {
+        code = HubAuth_Check(&connect, hasClientCert, (uint64_t)time(NULL));
+    }
+
+    if (code != MQTT_CONNACK_ACCEPTED) {
+        mStats.refusedCount++;
+        connection->isClosing = true;
+        return Send(connection, response, MqttPacket_WriteConnack(response, false, code)) == 0;
+    }
+
+    snprintf(connection->deviceId, sizeof(connection->deviceId), "%.*s", (int)connect.clientId.length,
+             connect.clientId.data);
+
+    /* One connection per device identity, a new one replaces the old one */
+    for (size_t i = 0; i < HUB_MAX_CONNECTIONS; i++) {
+        if (mConnections[i] && mConnections[i] != connection && mConnections[i]->isSession &&
+            strcmp(mConnections[i]->deviceId, connection->deviceId) == 0) {
+            Close(i);
+        }
+    }
+
+    connection->isSession = true;
+    connection->keepAliveSeconds = connect.keepAliveSeconds;
+    mStats.sessionCount++;
+    return Send(connection, response, MqttPacket_WriteConnack(response, false, MQTT_CONNACK_ACCEPTED)) == 0;
+}
+
+static bool HandlePublish(HubConnection *connection, const MqttPacket *packet, uint64_t nowMs)
+{
+    MqttPublish publish;
+    uint8_t response[4];
+
+    if (MqttPacket_ParsePublish(packet, &publish) != 0 || publish.qos > 1) {
+        return false;
+    }
+
+    if (IsTelemetryTopic(connection, &publish.topic)) {
+        const FaultParams *params = Fault_GetParams();
+
+        /* Over the rate the hub drops the connection, as IoT Hub does when a device exceeds its quota */
+        if (params->throttleRate) {
+            if (nowMs - connection->throttleWindowMs >= 1000) {
+                connection->throttleWindowMs = nowMs;
+                connection->throttleCount = 0;
+            }
+
+            if (++connection->throttleCount > params->throttleRate) {
+                mStats.throttleCount++;
+                return false;
+            }
+        }
+
+        /* A lost message is never confirmed, so the device has to send it again */
+        if (Fault_ShouldDrop()) {
+            mStats.dropCount++;
+            return true;
+        }
+
+        mStats.messageCount++;
+        mStats.payloadBytes += publish.payloadSize;
+        CountMessageId(&publish.topic);
+    } else if (MqttString_StartsWith(&publish.topic, HUB_TWIN_GET_TOPIC)) {
+        HandleTwin(connection, &publish, false);
+    } else if (MqttString_StartsWith(&publish.topic, HUB_TWIN_PATCH_TOPIC)) {
+        HandleTwin(connection, &publish, true);
+    } else if (!MqttString_StartsWith(&publish.topic, HUB_METHOD_RESPONSE_TOPIC)) {
+        /* IoT Hub closes the connection of a device that publishes to any other topic */
+        return false;
+    }
+
+    if (publish.qos == 1) {
+        return Send(connection, response, MqttPacket_WriteAck(response, MQTT_PACKET_PUBACK, publish.packetId)) == 0;
+    }
+
+    return true;
+}
+
+/* Devices may subscribe to their own cloud-to-device messages, twin responses and updates and direct methods */
+static bool HandleSubscribe(HubConnection *connection, const MqttPacket *packet)
+{
+    static const char *topics[] = {"$iothub/twin/res/#", "$iothub/twin/PATCH/properties/desired/#",
+                                   "$iothub/methods/POST/#"};
+    MqttSubscribe subscribe;
+    uint8_t codes[MQTT_MAX_SUBSCRIPTIONS];
+    uint8_t response[MQTT_MAX_HEADER_SIZE + 2 + MQTT_MAX_SUBSCRIPTIONS];
+    char deviceTopic[HUBAUTH_MAX_ID_LENGTH + 64];
+
+    if (MqttPacket_ParseSubscribe(packet, &subscribe) != 0) {
+        return false;
+    }
+
+    if (packet->type == MQTT_PACKET_UNSUBSCRIBE) {
+        return Send(connection, response, MqttPacket_WriteAck(response, MQTT_PACKET_UNSUBACK, subscribe.packetId)) == 0;
+    }
+
+    snprintf(deviceTopic, sizeof(deviceTopic), "devices/%s/messages/devicebound/", connection->deviceId);
+
+    for (size_t i = 0; i < subscribe.count; i++) {
+        bool isAllowed = MqttString_StartsWith(&subscribe.topics[i], deviceTopic);
+
+        for (size_t j = 0; j < sizeof(topics) / sizeof(topics[0]); j++) {
+            isAllowed |= MqttString_Equals(&subscribe.topics[i], topics[j]);
+        }
+
+        codes[i] = isAllowed ? (subscribe.qos[i] ? 1 : 0) : 0x80;
+    }
+
+    return Send(connection, response, MqttPacket_WriteSuback(response, subscribe.packetId, codes, subscribe.count)) ==
+           0;
+}
+
+/* The twin has no desired properties and keeps only the version of the reported ones */
+static void HandleTwin(HubConnection *connection, const MqttPublish *publish, bool isPatch)
+{
+    char requestId[64];
+    char topic[HUB_MAX_TOPIC_LENGTH];
+    char document[128];
+
+    if (!GetTopicProperty(&publish->topic, "$rid", requestId, sizeof(requestId))) {
+        return;
+    }
+
+    mStats.twinCount++;
+
+    if (isPatch) {
+        connection->twinVersion++;
+        snprintf(topic, sizeof(topic), "$iothub/twin/res/204/?$rid=%s&$version=%u", requestId,
+                 connection->twinVersion + 1);
+        SendPublish(connection, topic, "");
+    } else {
+        snprintf(topic, sizeof(topic), "$iothub/twin/res/200/?$rid=%s", requestId);
+        snprintf(document, sizeof(document), "{\"desired\":{\"$version\":1},\"reported\":{\"$version\":%u}}",
+                 connection->twinVersion + 1);
+        SendPublish(connection, topic, document);
+    }
+}
+
+static bool IsTelemetryTopic(const HubConnection *connection, const MqttString *topic)
+{
+    size_t idLength = strlen(connection->deviceId);
+    size_t eventsLength = strlen(HUB_EVENTS_TOPIC);
+
+    return topic->length >= 8 + idLength + eventsLength && memcmp(topic->data, "devices/", 8) == 0 &&
+           memcmp(topic->data + 8, connection->deviceId, idLength) == 0 &&
+           memcmp(topic->data + 8 + idLength, HUB_EVENTS_TOPIC, eventsLength) == 0;
+}
+
+/* Messages are told apart by their message identifier, so a message sent again after a lost acknowledgement counts
+ * as a duplicate. The set is open addressed on a hash of the identifier and stops growing when it is half full. */
+static void CountMessageId(const MqttString *topic)
+{
+    char messageId[128];
+    uint64_t hash = 14695981039346656037ull;
+
+    if (!GetTopicProperty(topic, "$.mid", messageId, sizeof(messageId)) || mMessageIdCount >= HUB_MAX_MESSAGE_IDS / 2) {
+        mStats.uniqueCount++;
+        return;
+    }
+
+    for (const char *c = messageId; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 1099511628211ull;
+    }
+
+    hash = hash ? hash : 1;
+
+    for (size_t i = hash % HUB_MAX_MESSAGE_IDS;; i = (i + 1) % HUB_MAX_MESSAGE_IDS) {
+        if (mMessageIds[i] == hash) {
+            mStats.duplicateCount++;
+            return;
+        }
+
+        if (mMessageIds[i] == 0) {
+            mMessageIds[i] = hash;
+            mMessageIdCount++;
+            mStats.uniqueCount++;
+            return;
+        }
+    }
+}
+
+/* Properties follow the last '/' or '?' of a topic as URL encoded "name=value" pairs separated by '&' */
+static bool GetTopicProperty(const MqttString *topic, const char *name, char *value, size_t valueSize)
+{
+    char encodedName[64];
+    size_t start = topic->length;
+
+    while (start > 0 && topic->data[start - 1] != '/' && topic->data[start - 1] != '?') {
+        start--;
+    }
+
+    /* "$" may be encoded as "%24" */
+    snprintf(encodedName, sizeof(encodedName), "%%24%s", name[0] == '$' ? name + 1 : name);
+
+    while (start < topic->length) {
+        const char *pair = topic->data + start;
+        const char *end = memchr(pair, '&', topic->length - start);
+        size_t pairLength = end ? (size_t)(end - pair) : topic->length - start;
+        const char *equals = memchr(pair, '=', pairLength);
+
+        if (equals) {
+            size_t nameLength = (size_t)(equals - pair);
+            bool isMatch = (nameLength == strlen(name) && memcmp(pair, name, nameLength) == 0) ||
+                           (nameLength == strlen(encodedName) && memcmp(pair, encodedName, nameLength) == 0);
+            size_t valueLength = pairLength - nameLength - 1;
+
+            if (isMatch && valueLength < valueSize) {
+                memcpy(value, equals + 1, valueLength);
+                value[valueLength] = '\0';
+                return true;
+            }
+        }
+
+        start += pairLength + 1;
+    }
+
+    return false;
+}
+
+/* Queues a packet behind the others; jitter never reorders packets on one connection, as TCP would not */
+static int Send(HubConnection *connection, const uint8_t *data, size_t size)
+{
+    HubPacket *packet = malloc(sizeof(HubPacket) + size);
+
+    if (packet == NULL) {
+        return -1;
+    }
+
+    uint64_t dueMs = Clock_GetMs() + Fault_GetDelayMs();
+
+    packet->next = NULL;
+    packet->dueMs = dueMs > connection->lastDueMs ? dueMs : connection->lastDueMs;
+    packet->size = size;
+    packet->offset = 0;
+    memcpy(packet->data, data, size);
+    connection->lastDueMs = packet->dueMs;
+
+    if (connection->tail) {
+        connection->tail->next = packet;
+    } else {
+        connection->head = packet;
+    }
+
+    connection->tail = packet;
+    return 0;
+}
+
+static void SendPublish(HubConnection *connection, const char *topic, const char *payload)
+{
+    size_t topicLength = strlen(topic);
+    size_t payloadSize = strlen(payload);
+    uint8_t *buffer = malloc(MqttPacket_GetPublishSize(topicLength, payloadSize, 0));
+
+    if (buffer) {
+        Send(connection, buffer, MqttPacket_WritePublish(buffer, topic, topicLength, payload, payloadSize, 0, 0));
+        free(buffer);
+    }
+}
@@ -0,0 +1,299 @@
+#include "HubAuth.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#define HUBAUTH_MAX_TOKEN_LENGTH 1024
+#define HUBAUTH_X509 "x509"
+
+typedef struct sHubDevice {
+    char id[HUBAUTH_MAX_ID_LENGTH + 1];
+    unsigned char key[HUBAUTH_MAX_KEY_LENGTH];
+    size_t keyLength;
+    bool isX509;
+} HubDevice;
+
+static HubDevice *mDevices = NULL;
+static size_t mDeviceCount = 0;
+static HubAuthStats mStats;
+
+static const HubDevice *FindDevice(const MqttString *id);
+static bool IsUsernameValid(const MqttConnect *connect, char *hostname, size_t hostnameSize);
+static MqttConnectReturnCode CheckToken(const HubDevice *device, const MqttConnect *connect, const char *hostname,
+                                        uint64_t nowSeconds);
+static int GetTokenField(const char *token, const char *name, char *value, size_t valueSize);
+static size_t UrlDecode(const char *text, char *decoded, size_t decodedSize);
+static int DecodeBase64(const char *text, unsigned char *data, size_t dataSize, size_t *length);
+
+int HubAuth_Initialize(void)
+{
+    mDevices = calloc(HUBAUTH_MAX_DEVICES, sizeof(HubDevice));
+    mDeviceCount = 0;
+    memset(&mStats, 0, sizeof(mStats));
+    return mDevices ? 0 : -1;
+}
+
+void HubAuth_Deinitialize(void)
+{
+    free(mDevices);
+    mDevices = NULL;
+    mDeviceCount = 0;
+}
+
+/* One device per line, "DEVICE_ID KEY" with the base64 shared access key of the device, or "DEVICE_ID x509" for a
+ * device that authenticates with a client certificate. Without devices any device is let in. */
+int HubAuth_LoadDevices(const char *path)
+{
+    FILE *fptr = fopen(path, "r");
+    char line[512];
+    char id[HUBAUTH_MAX_ID_LENGTH + 1];
+    char key[HUBAUTH_MAX_KEY_LENGTH * 2];
+    int res = 0;
+
+    if (fptr == NULL) {
+        printf("Failed to open devices file %s\n", path);
+        return -1;
+    }
+
+    while (res == 0 && fgets(line, sizeof(line), fptr)) {
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+
+        HubDevice *device = &mDevices[mDeviceCount];
+
+        if (mDeviceCount == HUBAUTH_MAX_DEVICES || sscanf(line, "%128s %255s", id, key) != 2) {
+            res = -1;
+        } else if (strcmp(key, HUBAUTH_X509) == 0) {
+            device->isX509 = true;
+        } else if (DecodeBase64(key, device->key, sizeof(device->key), &device->keyLength) != 0) {
+            res = -1;
+        }
+
+        if (res == 0) {
+            snprintf(device->id, sizeof(device->id), "%s", id);
+            mDeviceCount++;
+        } else {
+            printf("Invalid device line: %s", line);
+        }
+    }
+
+    fclose(fptr);
+    return res;
+}
+
+size_t HubAuth_GetDeviceCount(void)
+{
+    return mDeviceCount;
+}
+
+/* The client identifier is the device identifier, the user name "HOSTNAME/DEVICE_ID/?api-version=..." and the
+ * password a shared access signature, unless the device uses a client certificate */
+MqttConnectReturnCode HubAuth_Check(const MqttConnect *connect, bool hasClientCert, uint64_t nowSeconds)
+{
+    char hostname[256];
+    MqttConnectReturnCode code = MQTT_CONNACK_ACCEPTED;
+
+    if (connect->clientId.length == 0 || connect->clientId.length > HUBAUTH_MAX_ID_LENGTH ||
+        !IsUsernameValid(connect, hostname, sizeof(hostname))) {
+        mStats.badIdentityCount++;
+        return MQTT_CONNACK_REFUSED_IDENTIFIER;
+    }
+
+    const HubDevice *device = FindDevice(&connect->clientId);
+
+    if (mDeviceCount && device == NULL) {
+        mStats.unknownDeviceCount++;
+        code = MQTT_CONNACK_REFUSED_NOT_AUTHORIZED;
+    } else if (device && device->isX509) {
+        code = hasClientCert ? MQTT_CONNACK_ACCEPTED : MQTT_CONNACK_REFUSED_NOT_AUTHORIZED;
+        mStats.badSignatureCount += hasClientCert ? 0 : 1;
+    } else if (connect->hasPassword) {
+        code = CheckToken(device, connect, hostname, nowSeconds);
+    } else if (!hasClientCert) {
+        mStats.badSignatureCount++;
+        code = MQTT_CONNACK_REFUSED_BAD_CREDENTIALS;
+    }
+
+    mStats.acceptCount += code == MQTT_CONNACK_ACCEPTED;
+    return code;
+}
+
+void HubAuth_GetStats(HubAuthStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+    }
+}
+
+static const HubDevice *FindDevice(const MqttString *id)
+{
+    for (size_t i = 0; i < mDeviceCount; i++) {
+        if (MqttString_Equals(id, mDevices[i].id)) {
+            return &mDevices[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool IsUsernameValid(const MqttConnect *connect, char *hostname, size_t hostnameSize)
+{
+    const char *username = connect->username.data;
+    size_t length = connect->username.length;
+    const char *slash = username ? memchr(username, '/', length) : NULL;
+
+    if (slash == NULL || (size_t)(slash - username) >= hostnameSize) {
+        return false;
+    }
+
+    size_t hostnameLength = (size_t)(slash - username);
+    size_t rest = length - hostnameLength - 1;
+    memcpy(hostname, username, hostnameLength);
+    hostname[hostnameLength] = '\0';
+
+    return rest > connect->clientId.length &&
+           memcmp(slash + 1, connect->clientId.data, connect->clientId.length) == 0 &&
+           slash[1 + connect->clientId.length] == '/';
+}
+
+/* SharedAccessSignature sr=HOSTNAME%2Fdevices%2FDEVICE_ID&sig=SIGNATURE&se=EXPIRY, where the signature is the
+ * HMAC-SHA256 of "sr\nse" with the device key. The token is checked even for a device that is not listed, so an
+ * expired token is refused in any case. */
+static MqttConnectReturnCode CheckToken(const HubDevice *device, const MqttConnect *connect, const char *hostname,
+                                        uint64_t nowSeconds)
+{
+    const MqttString *password = &connect->password;
+    char token[HUBAUTH_MAX_TOKEN_LENGTH];
+    char resource[512];
+    char resourceDecoded[512];
+    char signature[256];
+    char signatureDecoded[256];
+    char expiry[32];
+    char expected[512];
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned char encoded[EVP_MAX_MD_SIZE * 2];
+    unsigned int digestLength = 0;
+
+    if (password->length >= sizeof(token)) {
+        mStats.badSignatureCount++;
+        return MQTT_CONNACK_REFUSED_BAD_CREDENTIALS;
+    }
+
+    memcpy(token, password->data, password->length);
+    token[password->length] = '\0';
+
+    if (strncmp(token, "SharedAccessSignature ", 22) != 0 || GetTokenField(token, "sr", resource, sizeof(resource)) ||
+        GetTokenField(token, "sig", signature, sizeof(signature)) ||
+        GetTokenField(token, "se", expiry, sizeof(expiry))) {
+        mStats.badSignatureCount++;
+        return MQTT_CONNACK_REFUSED_BAD_CREDENTIALS;
+    }
+
+    if (strtoull(expiry, NULL, 10) <= nowSeconds) {
+        mStats.expiredCount++;
+        return MQTT_CONNACK_REFUSED_NOT_AUTHORIZED;
+    }
+
+    UrlDecode(resource, resourceDecoded, sizeof(resourceDecoded));
+    snprintf(expected, sizeof(expected), "%s/devices/%.*s", hostname, (int)connect->clientId.length,
+             connect->clientId.data);
+
+    if (strcasecmp(resourceDecoded, expected) != 0) {
+        mStats.badSignatureCount++;
+        return MQTT_CONNACK_REFUSED_NOT_AUTHORIZED;
+    }
+
+    if (device == NULL) {
+        return MQTT_CONNACK_ACCEPTED;
+    }
+
+    /* The resource is signed as it appears in the token, URL encoded */
+    int length = snprintf(expected, sizeof(expected), "%s\n%s", resource, expiry);
+    HMAC(EVP_sha256(), device->key, (int)device->keyLength, (const unsigned char *)expected, (size_t)length, digest,
+         &digestLength);
+    EVP_EncodeBlock(encoded, digest, (int)digestLength);
+    UrlDecode(signature, signatureDecoded, sizeof(signatureDecoded));
+
+    if (strcmp((const char *)encoded, signatureDecoded) != 0) {
+        mStats.badSignatureCount++;
+        return MQTT_CONNACK_REFUSED_NOT_AUTHORIZED;
+    }
+
+    return MQTT_CONNACK_ACCEPTED;
+}
+
+static int GetTokenField(const char *token, const char *name, char *value, size_t valueSize)
+{
+    size_t nameLength = strlen(name);
+    const char *field = token + 22;
+
+    while (field && *field) {
+        if (strncmp(field, name, nameLength) == 0 && field[nameLength] == '=') {
+            const char *start = field + nameLength + 1;
+            size_t length = strcspn(start, "&");
+
+            if (length >= valueSize) {
+                return -1;
+            }
+
+            memcpy(value, start, length);
+            value[length] = '\0';
+            return 0;
+        }
+
+        field = strchr(field, '&');
+        field = field ? field + 1 : NULL;
+    }
+
+    return -1;
+}
+
+static size_t UrlDecode(const char *text, char *decoded, size_t decodedSize)
+{
+    size_t length = 0;
+
+    while (*text && length + 1 < decodedSize) {
+        if (text[0] == '%' && isxdigit((unsigned char)text[1]) && isxdigit((unsigned char)text[2])) {
+            char hex[3] = {text[1], text[2], '\0'};
+            decoded[length++] = (char)strtol(hex, NULL, 16);
+            text += 3;
+        } else {
+            decoded[length++] = *text++;
+        }
+    }
+
+    decoded[length] = '\0';
+    return length;
+}
+
+static int DecodeBase64(const char *text, unsigned char *data, size_t dataSize, size_t *length)
+{
+    size_t textLength = strlen(text);
+    unsigned char decoded[HUBAUTH_MAX_KEY_LENGTH * 2];
+
+    if (textLength == 0 || textLength % 4 || textLength / 4 * 3 > sizeof(decoded)) {
+        return -1;
+    }
+
+    int decodedLength = EVP_DecodeBlock(decoded, (const unsigned char *)text, (int)textLength);
+
+    if (decodedLength < 0) {
+        return -1;
+    }
+
+    /* EVP_DecodeBlock counts the padding as zero bytes */
+    decodedLength -= (text[textLength - 1] == '=') + (text[textLength - 2] == '=');
+
+    if ((size_t)decodedLength > dataSize) {
+        return -1;
+    }
+
+    memcpy(data, decoded, (size_t)decodedLength);
+    *length = (size_t)decodedLength;
+    return 0;
+}
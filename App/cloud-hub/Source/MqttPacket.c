@@ -0,0 +1,273 @@
+#include "MqttPacket.h"
+#include <string.h>
+
+/* MQTT 3.1.1 as IoT Hub speaks it to devices: QoS 0 and 1, no retained messages, no will */
+
+static size_t WriteRemainingLength(uint8_t *buffer, size_t length);
+static int ReadString(const uint8_t **data, const uint8_t *end, MqttString *string);
+static int ReadU16(const uint8_t **data, const uint8_t *end, uint16_t *value);
+
+/* Returns 1 with a complete packet, 0 if more data is needed and -1 for a malformed or oversized packet */
+int MqttPacket_Parse(const uint8_t *data, size_t size, MqttPacket *packet)
+{
+    size_t length = 0;
+    size_t multiplier = 1;
+    size_t index = 1;
+
+    if (size < 2) {
+        return 0;
+    }
+
+    /* The remaining length is a varint of at most four bytes */
+    for (;;) {
+        if (index >= size) {
+            return 0;
+        }
+
+        if (index > 4) {
+            return -1;
+        }
+
+        uint8_t byte = data[index++];
+        length += (size_t)(byte & 0x7f) * multiplier;
+        multiplier *= 128;
+
+        if ((byte & 0x80) == 0) {
+            break;
+        }
+    }
+
+    if (length > MQTT_MAX_PACKET_SIZE) {
+        return -1;
+    }
+
+    if (size < index + length) {
+        return 0;
+    }
+
+    packet->type = (MqttPacketType)(data[0] >> 4);
+    packet->flags = data[0] & 0x0f;
+    packet->body = data + index;
+    packet->bodySize = length;
+    packet->size = index + length;
+
+    return (packet->type >= MQTT_PACKET_CONNECT && packet->type <= MQTT_PACKET_DISCONNECT) ? 1 : -1;
+}
+
+int MqttPacket_ParseConnect(const MqttPacket *packet, MqttConnect *connect)
+{
+    const uint8_t *data = packet->body;
+    const uint8_t *end = data + packet->bodySize;
+    MqttString protocol;
+    MqttString ignored;
+
+    memset(connect, 0, sizeof(MqttConnect));
+
+    if (ReadString(&data, end, &protocol) != 0 || !MqttString_Equals(&protocol, "MQTT") || end - data < 4) {
+        return -1;
+    }
+
+    connect->protocolLevel = data[0];
+    uint8_t flags = data[1];
+    data += 2;
+    connect->isCleanSession = (flags & 0x02) != 0;
+
+    if (ReadU16(&data, end, &connect->keepAliveSeconds) != 0 || ReadString(&data, end, &connect->clientId) != 0) {
+        return -1;
+    }
+
+    /* Will topic and message */
+    if ((flags & 0x04) && (ReadString(&data, end, &ignored) != 0 || ReadString(&data, end, &ignored) != 0)) {
+        return -1;
+    }
+
+    if ((flags & 0x80) && ReadString(&data, end, &connect->username) != 0) {
+        return -1;
+    }
+
+    if (flags & 0x40) {
+        if (ReadString(&data, end, &connect->password) != 0) {
+            return -1;
+        }
+
+        connect->hasPassword = true;
+    }
+
+    return 0;
+}
+
+int MqttPacket_ParsePublish(const MqttPacket *packet, MqttPublish *publish)
+{
+    const uint8_t *data = packet->body;
+    const uint8_t *end = data + packet->bodySize;
+
+    memset(publish, 0, sizeof(MqttPublish));
+    publish->qos = (packet->flags >> 1) & 0x03;
+    publish->isRetained = (packet->flags & 0x01) != 0;
+    publish->isDuplicate = (packet->flags & 0x08) != 0;
+
+    if (publish->qos > 2 || ReadString(&data, end, &publish->topic) != 0) {
+        return -1;
+    }
+
+    if (publish->qos && ReadU16(&data, end, &publish->packetId) != 0) {
+        return -1;
+    }
+
+    publish->payload = data;
+    publish->payloadSize = (size_t)(end - data);
+    return 0;
+}
+
+int MqttPacket_ParseSubscribe(const MqttPacket *packet, MqttSubscribe *subscribe)
+{
+    const uint8_t *data = packet->body;
+    const uint8_t *end = data + packet->bodySize;
+
+    memset(subscribe, 0, sizeof(MqttSubscribe));
+
+    if (ReadU16(&data, end, &subscribe->packetId) != 0) {
+        return -1;
+    }
+
+    /* Unsubscribe carries the same list without the QoS bytes */
+    bool hasQos = packet->type == MQTT_PACKET_SUBSCRIBE;
+
+    while (data < end) {
+        if (subscribe->count == MQTT_MAX_SUBSCRIPTIONS ||
+            ReadString(&data, end, &subscribe->topics[subscribe->count]) != 0) {
+            return -1;
+        }
+
+        if (hasQos) {
+            if (data == end) {
+                return -1;
+            }
+
+            subscribe->qos[subscribe->count] = *data++;
+        }
+
+        subscribe->count++;
+    }
+
+    return subscribe->count ? 0 : -1;
+}
+
+int MqttPacket_ParsePacketId(const MqttPacket *packet, uint16_t *packetId)
+{
+    const uint8_t *data = packet->body;
+    return ReadU16(&data, data + packet->bodySize, packetId);
+}
+
+size_t MqttPacket_WriteConnack(uint8_t *buffer, bool isSessionPresent, MqttConnectReturnCode code)
+{
+    buffer[0] = MQTT_PACKET_CONNACK << 4;
+    buffer[1] = 2;
+    buffer[2] = isSessionPresent ? 1 : 0;
+    buffer[3] = (uint8_t)code;
+    return 4;
+}
+
+/* PUBACK, PUBREC, PUBCOMP and UNSUBACK, which only carry the packet identifier */
+size_t MqttPacket_WriteAck(uint8_t *buffer, MqttPacketType type, uint16_t packetId)
+{
+    buffer[0] = (uint8_t)(type << 4);
+    buffer[1] = 2;
+    buffer[2] = (uint8_t)(packetId >> 8);
+    buffer[3] = (uint8_t)packetId;
+    return 4;
+}
+
+size_t MqttPacket_WriteSuback(uint8_t *buffer, uint16_t packetId, const uint8_t *codes, size_t count)
+{
+    size_t length = 1 + WriteRemainingLength(buffer + 1, 2 + count);
+
+    buffer[0] = MQTT_PACKET_SUBACK << 4;
+    buffer[length++] = (uint8_t)(packetId >> 8);
+    buffer[length++] = (uint8_t)packetId;
+    memcpy(buffer + length, codes, count);
+    return length + count;
+}
+
+size_t MqttPacket_WritePingresp(uint8_t *buffer)
+{
+    buffer[0] = MQTT_PACKET_PINGRESP << 4;
+    buffer[1] = 0;
+    return 2;
+}
+
+size_t MqttPacket_GetPublishSize(size_t topicLength, size_t payloadSize, uint8_t qos)
+{
+    return MQTT_MAX_HEADER_SIZE + 2 + topicLength + (qos ? 2 : 0) + payloadSize;
+}
+
+/* The buffer must hold MqttPacket_GetPublishSize bytes */
+size_t MqttPacket_WritePublish(uint8_t *buffer, const char *topic, size_t topicLength, const void *payload,
+                               size_t payloadSize, uint8_t qos, uint16_t packetId)
+{
+    size_t length = 1 + WriteRemainingLength(buffer + 1, 2 + topicLength + (qos ? 2 : 0) + payloadSize);
+
+    buffer[0] = (uint8_t)((MQTT_PACKET_PUBLISH << 4) | (qos << 1));
+    buffer[length++] = (uint8_t)(topicLength >> 8);
+    buffer[length++] = (uint8_t)topicLength;
+    memcpy(buffer + length, topic, topicLength);
+    length += topicLength;
+
+    if (qos) {
+        buffer[length++] = (uint8_t)(packetId >> 8);
+        buffer[length++] = (uint8_t)packetId;
+    }
+
+    memcpy(buffer + length, payload, payloadSize);
+    return length + payloadSize;
+}
+
+bool MqttString_Equals(const MqttString *string, const char *text)
+{
+    size_t length = strlen(text);
+    return string->length == length && memcmp(string->data, text, length) == 0;
+}
+
+bool MqttString_StartsWith(const MqttString *string, const char *prefix)
+{
+    size_t length = strlen(prefix);
+    return string->length >= length && memcmp(string->data, prefix, length) == 0;
+}
+
+static size_t WriteRemainingLength(uint8_t *buffer, size_t length)
+{
+    size_t count = 0;
+
+    do {
+        uint8_t byte = length % 128;
+        length /= 128;
+        buffer[count++] = length ? (byte | 0x80) : byte;
+    } while (length);
+
+    return count;
+}
+
+static int ReadString(const uint8_t **data, const uint8_t *end, MqttString *string)
+{
+    uint16_t length;
+
+    if (ReadU16(data, end, &length) != 0 || end - *data < length) {
+        return -1;
+    }
+
+    string->data = (const char *)*data;
+    string->length = length;
+    *data += length;
+    return 0;
+}
+
+static int ReadU16(const uint8_t **data, const uint8_t *end, uint16_t *value)
+{
+    if (end - *data < 2) {
+        return -1;
+    }
+
+    *value = (uint16_t)(((*data)[0] << 8) | (*data)[1]);
+    *data += 2;
+    return 0;
+}
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include "Hub.h"
+#include "HubAuth.h"
+#include "Fault.h"
+#include "Clock.h"
+
+#define DEFAULT_ADDRESS "127.0.0.1"
+#define POLL_TIMEOUT_MS 100
+#define STATS_INTERVAL_MS 10000
+
+typedef void (*SignalHandler_t)(int);
+
+static volatile sig_atomic_t mExit = false;
+static HubParams mHubParams = {DEFAULT_ADDRESS, HUB_DEFAULT_PORT, false, NULL, NULL};
+static const char *mDevicesFile = NULL;
+static const char *mScriptFile = NULL;
+static const char *mFaultSettings = NULL;
+static const char *mStatsFile = NULL;
+static unsigned int mDurationSeconds = 0;
+static unsigned long long mSeed = 1;
+static bool mIsQuiet = false;
+
+static int ParseArguments(int argc, char *argv[]);
+static void RaiseFileLimit(void);
+static void RegisterSignalHandler(SignalHandler_t signalHandler);
+static void SignalHandler(int signum);
+static void PrintStats(uint64_t elapsedMs);
+static int WriteStatsFile(uint64_t elapsedMs);
+
+/* A stand-in for IoT Hub on the local machine: devices connect with MQTT over TLS or plain TCP, send telemetry and
+ * use their twin, while the network and the hub misbehave as a fault script says */
+int main(int argc, char *argv[])
+{
+    if (ParseArguments(argc, argv) != 0) {
+        return -1;
+    }
+
+    RaiseFileLimit();
+
+    if (HubAuth_Initialize() != 0 || Fault_Initialize(mSeed) != 0) {
+        return -1;
+    }
+
+    if ((mDevicesFile && HubAuth_LoadDevices(mDevicesFile) != 0) ||
+        (mFaultSettings && Fault_Apply(mFaultSettings) != 0) || (mScriptFile && Fault_LoadScript(mScriptFile) != 0)) {
+        HubAuth_Deinitialize();
+        return -1;
+    }
+
+    if (Hub_Initialize(&mHubParams) != 0) {
+        HubAuth_Deinitialize();
+        return -1;
+    }
+
+    RegisterSignalHandler(SignalHandler);
+    printf("Listening on %s:%u (%s), %zu devices\n", mHubParams.address, mHubParams.port,
+           mHubParams.isPlain ? "plain" : "TLS", HubAuth_GetDeviceCount());
+    fflush(stdout);
+
+    uint64_t startMs = Clock_GetMs();
+    uint64_t lastStatsMs = startMs;
+
+    while (!mExit) {
+        uint64_t nowMs = Clock_GetMs();
+
+        if (Fault_Task(nowMs - startMs)) {
+            Hub_DisconnectAll();
+        }
+
+        Hub_Task(POLL_TIMEOUT_MS);
+
+        if (!mIsQuiet && nowMs - lastStatsMs >= STATS_INTERVAL_MS) {
+            lastStatsMs = nowMs;
+            PrintStats(nowMs - startMs);
+        }
+
+        if (mDurationSeconds && nowMs - startMs >= (uint64_t)mDurationSeconds * 1000) {
+            break;
+        }
+    }
+
+    uint64_t elapsedMs = Clock_GetMs() - startMs;
+    PrintStats(elapsedMs);
+    int res = mStatsFile ? WriteStatsFile(elapsedMs) : 0;
+
+    Hub_Deinitialize();
+    Fault_Deinitialize();
+    HubAuth_Deinitialize();
+    return res;
+}
+
+static void PrintUsage(void)
+{
+    /* clang-format off */
+    static const char *usageString = "Usage: cloud-hub [options]\n"
+                                     "\n"
+                                     "Optional options:\n"
+                                     "  -a ADDRESS, --address ADDRESS\n"
+                                     "                           Address to listen on (default 127.0.0.1).\n"
+                                     "  -P PORT, --port PORT     Port to listen on (default 8883).\n"
+                                     "  -C FILE, --cert FILE     Server certificate chain, PEM.\n"
+                                     "  -K FILE, --key FILE      Server private key, PEM.\n"
+                                     "  -n, --plain              Plain TCP instead of TLS, for MQTT clients other\n"
+                                     "                           than the SDK, which always uses TLS.\n"
+                                     "  -d FILE, --devices FILE  Devices that may connect, one \"DEVICE_ID KEY\" or\n"
+                                     "                           \"DEVICE_ID x509\" per line. Without it any device\n"
+                                     "                           with a well-formed, unexpired token may connect.\n"
+                                     "  -F SETTINGS, --fault SETTINGS\n"
+                                     "                           Faults from the start, e.g.\n"
+                                     "                           \"latency=50 drop=0.01\".\n"
+                                     "  -s FILE, --script FILE   Fault script, one \"SECONDS SETTINGS\" per line.\n"
+                                     "  -S SEED, --seed SEED     Seed for jitter and drops (default 1).\n"
+                                     "  -t SECONDS, --duration SECONDS\n"
+                                     "                           Exit after this time (default until interrupted).\n"
+                                     "  -o FILE, --stats-file FILE\n"
+                                     "                           Write the final statistics as JSON to FILE.\n"
+                                     "  -q, --quiet              Only print the final statistics.\n"
+                                     "  -h, --help               Print this message and exit.\n"
+                                     "\n"
+                                     "Fault settings:\n"
+                                     "  latency=MS               Delay of every packet the hub sends.\n"
+                                     "  jitter=MS                Random extra delay of up to +/- MS.\n"
+                                     "  bandwidth=BYTES          Bytes per second in both directions together,\n"
+                                     "                           with k or m for thousands or millions, 0 for no\n"
+                                     "                           limit.\n"
+                                     "  drop=RATE                Fraction of telemetry messages lost before the\n"
+                                     "                           hub confirms them.\n"
+                                     "  throttle=N               Messages per second per device, above which the\n"
+                                     "                           hub drops the connection, 0 for no limit.\n"
+                                     "  auth=fail|ok             Refuse every connection, or check them again.\n"
+                                     "  disconnect               Drop all connections at once.\n";
+    /* clang-format on */
+
+    printf("%s", usageString);
+}
+
+static int ParseArguments(int argc, char *argv[])
+{
+    int opt = 0;
+
+    /* clang-format off */
+    static struct option long_options[] = {
+        {"address", required_argument, 0, 'a'},
+        {"port", required_argument, 0, 'P'},
+        {"cert", required_argument, 0, 'C'},
+        {"key", required_argument, 0, 'K'},
+        {"plain", no_argument, 0, 'n'},
+        {"devices", required_argument, 0, 'd'},
+        {"fault", required_argument, 0, 'F'},
+        {"script", required_argument, 0, 's'},
+        {"seed", required_argument, 0, 'S'},
+        {"duration", required_argument, 0, 't'},
+        {"stats-file", required_argument, 0, 'o'},
+        {"quiet", no_argument, 0, 'q'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0},
+    };
+    /* clang-format on */
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, "a:P:C:K:nd:F:s:S:t:o:qh", long_options, &long_index)) != -1) {
+        switch (opt) {
+            case 'a':
+                mHubParams.address = optarg;
+                break;
+
+            case 'P':
+                mHubParams.port = (uint16_t)strtoul(optarg, NULL, 10);
+                break;
+
+            case 'C':
+                mHubParams.certFile = optarg;
+                break;
+
+            case 'K':
+                mHubParams.keyFile = optarg;
+                break;
+
+            case 'n':
+                mHubParams.isPlain = true;
+                break;
+
+            case 'd':
+                mDevicesFile = optarg;
+                break;
+
+            case 'F':
+                mFaultSettings = optarg;
+                break;
+
+            case 's':
+                mScriptFile = optarg;
+                break;
+
+            case 'S':
+                mSeed = strtoull(optarg, NULL, 10);
+                break;
+
+            case 't':
+                mDurationSeconds = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+
+            case 'o':
+                mStatsFile = optarg;
+                break;
+
+            case 'q':
+                mIsQuiet = true;
+                break;
+
+            case 'h':
+                PrintUsage();
+                exit(0);
+                break;
+
+            default:
+                PrintUsage();
+                exit(-1);
+                break;
+        }
+    }
+
+    if (!mHubParams.isPlain && (mHubParams.certFile == NULL || mHubParams.keyFile == NULL)) {
+        printf("A certificate (-C) and a key (-K) are required for TLS, or --plain\n");
+        return -1;
+    }
+
+    if (mHubParams.port == 0) {
+        printf("Invalid port\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Each device holds a socket, and the soft limit is often only 1024 */
+static void RaiseFileLimit(void)
+{
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        (void)setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+static void RegisterSignalHandler(SignalHandler_t signalHandler)
+{
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+
+    /* A device that goes away while the hub writes to it must not end the hub */
+    signal(SIGPIPE, SIG_IGN);
+}
+
+static void SignalHandler(int signum)
+{
+    (void)signum;
+    mExit = true;
+}
+
+static void PrintStats(uint64_t elapsedMs)
+{
+    HubStats stats;
+    HubAuthStats authStats;
+    FaultStats faultStats;
+
+    Hub_GetStats(&stats);
+    HubAuth_GetStats(&authStats);
+    Fault_GetStats(&faultStats);
+
+    double seconds = elapsedMs ? (double)elapsedMs / 1000.0 : 1.0;
+
+    printf("[%llu.%03llu] connections: %zu (%zu active), sessions: %zu, refused: %zu (%zu expired, %zu bad "
+           "signature), messages: %zu (%zu unique, %zu duplicate, %.1f/s), dropped: %zu, throttled: %zu, "
+           "disconnected: %zu, twin: %zu\n",
+           (unsigned long long)(elapsedMs / 1000), (unsigned long long)(elapsedMs % 1000), stats.connectionCount,
+           stats.activeCount, stats.sessionCount, stats.refusedCount, authStats.expiredCount,
+           authStats.badSignatureCount, stats.messageCount, stats.uniqueCount, stats.duplicateCount,
+           (double)stats.messageCount / seconds, stats.dropCount, stats.throttleCount, stats.faultDisconnectCount,
+           stats.twinCount);
+    fflush(stdout);
+}
+
+static int WriteStatsFile(uint64_t elapsedMs)
+{
+    HubStats stats;
+    HubAuthStats authStats;
+    FILE *fptr = fopen(mStatsFile, "w");
+
+    if (fptr == NULL) {
+        printf("Failed to write %s\n", mStatsFile);
+        return -1;
+    }
+
+    Hub_GetStats(&stats);
+    HubAuth_GetStats(&authStats);
+
+    fprintf(fptr,
+            "{\"elapsedMs\":%llu,\"connections\":%zu,\"sessions\":%zu,\"refused\":%zu,\"expired\":%zu,"
+            "\"badSignature\":%zu,\"messages\":%zu,\"unique\":%zu,\"duplicates\":%zu,\"dropped\":%zu,"
+            "\"throttled\":%zu,\"disconnected\":%zu,\"twin\":%zu,\"payloadBytes\":%llu,\"receivedBytes\":%llu,"
+            "\"sentBytes\":%llu}\n",
+            (unsigned long long)elapsedMs, stats.connectionCount, stats.sessionCount, stats.refusedCount,
+            authStats.expiredCount, authStats.badSignatureCount, stats.messageCount, stats.uniqueCount,
+            stats.duplicateCount, stats.dropCount, stats.throttleCount, stats.faultDisconnectCount, stats.twinCount,
+            (unsigned long long)stats.payloadBytes, (unsigned long long)stats.receivedBytes,
+            (unsigned long long)stats.sentBytes);
+    fclose(fptr);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#!/bin/bash
+
+# Sends a list of files with cloud-send to cloud-hub on this machine and checks that every message arrived once.
+#
+# Usage: e2e.sh CLOUD_HUB CLOUD_SEND
+#
+# E2E_FILES      Number of files to send (default 1000, at most 1024).
+# E2E_SIZE       Size of each file in bytes (default 256).
+# E2E_FAULTS     Faults from the start, as cloud-hub --fault, e.g. "latency=20 drop=0.01".
+# E2E_SCRIPT     Fault script, as cloud-hub --script.
+# E2E_SEND_ARGS  More cloud-send options, e.g. "-j 4".
+#
+# The device client always connects to port 8883, so nothing else may listen on it.
+
+set -e
+
+hub=$1
+send=$2
+files=${E2E_FILES:-1000}
+size=${E2E_SIZE:-256}
+
+if [ ! -x "$hub" ] || [ ! -x "$send" ]; then
+    echo "Usage: $0 CLOUD_HUB CLOUD_SEND"
+    exit 1
+fi
+
+dir=$(mktemp -d)
+hub_pid=
+
+clean_up() {
+    if [ -n "$hub_pid" ]; then
+        kill "$hub_pid" 2>/dev/null || true
+    fi
+
+    rm -rf "$dir"
+}
+
+trap clean_up EXIT
+
+# A certificate for localhost, which cloud-send trusts through TrustedCertFile
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj "/CN=localhost" \
+    -addext "subjectAltName=DNS:localhost,IP:127.0.0.1" \
+    -keyout "$dir/hub-key.pem" -out "$dir/hub-cert.pem" 2>/dev/null
+
+key=$(openssl rand -base64 32)
+echo "e2e $key" > "$dir/devices.txt"
+printf "HostName=localhost;DeviceId=e2e;SharedAccessKey=%s" "$key" > "$dir/connection-string.txt"
+echo "TrustedCertFile=$dir/hub-cert.pem" > "$dir/cloud-send.conf"
+
+mkdir "$dir/spool"
+
+for ((i = 0; i < files; i++)); do
+    printf '{"sensorId":"e2e","sequence":%d,"data":"%s"}' "$i" "$(head -c "$size" /dev/zero | tr '\0' 'x')" \
+        > "$dir/spool/$i.json"
+    echo "$dir/spool/$i.json"
+done > "$dir/list.txt"
+
+hub_args=(-C "$dir/hub-cert.pem" -K "$dir/hub-key.pem" -d "$dir/devices.txt" -o "$dir/stats.json" -q)
+
+if [ -n "$E2E_FAULTS" ]; then
+    hub_args+=(-F "$E2E_FAULTS")
+fi
+
+if [ -n "$E2E_SCRIPT" ]; then
+    hub_args+=(-s "$E2E_SCRIPT")
+fi
+
+"$hub" "${hub_args[@]}" &
+hub_pid=$!
+sleep 0.5
+
+start=$(date +%s%N)
+# shellcheck disable=SC2086
+"$send" -c "$dir/connection-string.txt" -C "$dir/cloud-send.conf" -l "$dir/list.txt" $E2E_SEND_ARGS
+end=$(date +%s%N)
+
+kill -INT "$hub_pid"
+wait "$hub_pid" || true
+hub_pid=
+
+unique=$(sed -n 's/.*"unique":\([0-9]*\).*/\1/p' "$dir/stats.json")
+duplicates=$(sed -n 's/.*"duplicates":\([0-9]*\).*/\1/p' "$dir/stats.json")
+ms=$(((end - start) / 1000000))
+
+echo "Files: $files, unique messages: $unique, duplicates: $duplicates, time: $ms ms," \
+    "$((files * 1000 / (ms > 0 ? ms : 1))) msg/s"
+
+if [ "$unique" != "$files" ]; then
+    echo "FAILED: $files files sent, $unique arrived"
+    exit 1
+fi
+
+echo "PASSED"
@@ -10,30 +10,39 @@
 #include <dirent.h>
 #include "Cloud.h"
 #include "File.h"
+#include "Config.h"
+#include "Metrics.h"
+#include "Clock.h"
 
 #define MAX_FILE_COUNT 1024
 
 typedef void (*SignalHandler_t)(int);
 
-typedef struct sConfigurationSetting {
-    char *name;
-    char *value;
-} ConfigurationSetting;
-
 static bool mExit = false;
 static int mExitCode;
 static char mStringData[512];
 static bool mInProgress;
 static bool mRegistrationResult;
 static CloudConnectParams mCloudConnectParams;
+static MetricsParams mMetricsParams;
+static uint64_t mRegisterStartMs;
+static uint64_t mRegisterEndMs;
+static size_t mRegisterFailCount;
+
+/* Settings with a plain type, the others are handled by ValidateConfigurationSetting() */
+static const ConfigField mConfigSchema[] = {
+    {"MetricsIntervalSeconds", CONFIG_TYPE_UINT, &mMetricsParams.intervalSeconds, 0, NULL, NULL, false},
+};
 
 static int ParseArguments(int argc, char *argv[]);
 static int ParseConfigFile(const char *filename);
+static int HandleConfigurationSetting(ConfigurationSetting *setting, void *context);
 static int ValidateConfigurationSetting(ConfigurationSetting *setting);
 static void ProcessConfigurationSetting(ConfigurationSetting *setting, CloudConnectParams *params);
 static void RegisterSignalHandler(SignalHandler_t signalHandler);
 static void SignalHandler(int signum);
 static void CloudEventHandler(CloudEvent evt, void *data);
+static void CollectMetrics(void);
 static void msleep(unsigned int milliseconds);
 
 typedef enum eAppState {
@@ -59,6 +68,17 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    if (mMetricsParams.textFile[0] || mMetricsParams.socketPath[0]) {
+        snprintf(mMetricsParams.labels, sizeof(mMetricsParams.labels), "app=\"cloud-provision\"");
+
+        if (Metrics_Initialize(&mMetricsParams) != 0) {
+            Cloud_Deinitialize();
+            return -1;
+        }
+
+        Metrics_AddCollector(CollectMetrics);
+    }
+
     Cloud_RegisterEventHandler(CloudEventHandler);
 
     mExitCode = 0;
@@ -66,10 +86,12 @@ int main(int argc, char *argv[])
     while (!mExit) {
         AppStateMachine();
         Cloud_Task();
+        Metrics_Task(Clock_GetMs());
         msleep(1);
     }
 
     Cloud_Deinitialize();
+    Metrics_Deinitialize();
 
     return mExitCode;
 }
@@ -140,79 +162,21 @@ static int ParseArguments(int argc, char *argv[])
 
 static int ParseConfigFile(const char *filename)
 {
-    FILE *file = fopen(filename, "r");
-    int res = 0;
-
-    if (file == NULL) {
-        perror("Error opening file");
-        return -1;
-    }
-
-    char line[512];
-
-    while (fgets(line, sizeof(line), file)) {
-        /* Remove trailing newline character */
-        line[strcspn(line, "\n")] = '\0';
-
-        /* Ignore empty lines and lines starting with '#' */
-        if (line[0] == '\0' || line[0] == '#') {
-            continue;
-        }
-
-        /* Find the '=' character to split setting name and value */
-        char *delimiter = strchr(line, '=');
-
-        if (delimiter == NULL) {
-            fprintf(stderr, "Invalid line format: %s\n", line);
-            fclose(file);
-            return -1;
-        }
-
-        /* Extract setting name and value */
-        /* Replace '=' with '\0' to split string */
-        *delimiter = '\0';
-        char *name = line;
-        char *value = delimiter + 1;
-
-        /* Trim leading and trailing spaces from setting value */
-        while (*value && (*value == ' ' || *value == '\t')) {
-            value++;
-        }
-
-        size_t len = strlen(value);
-
-        while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t')) {
-            value[--len] = '\0';
-        }
-
-        /* Allocate memory for configuration setting and store values */
-        ConfigurationSetting *setting = malloc(sizeof(ConfigurationSetting));
-        if (setting == NULL) {
-            perror("Memory allocation failed");
-            fclose(file);
-            return -1;
-        }
-
-        setting->name = strdup(name);
-        setting->value = strdup(value);
-        res = ValidateConfigurationSetting(setting);
-
-        if (res == 0) {
-            ProcessConfigurationSetting(setting, &mCloudConnectParams);
-        }
+    int res = Config_Load(filename, mConfigSchema, sizeof(mConfigSchema) / sizeof(mConfigSchema[0]),
+                          HandleConfigurationSetting, &mCloudConnectParams);
+    mCloudConnectParams.isX509 =
+        CredentialStore_GetLength(mCloudConnectParams.cert) && CredentialStore_GetLength(mCloudConnectParams.key);
+    return res;
+}
 
-        /* Don't forget to free memory for name and value */
-        free(setting->name);
-        free(setting->value);
-        free(setting);
+static int HandleConfigurationSetting(ConfigurationSetting *setting, void *context)
+{
+    int res = ValidateConfigurationSetting(setting);
 
-        if (res != 0) {
-            break;
-        }
+    if (res == 0) {
+        ProcessConfigurationSetting(setting, (CloudConnectParams *)context);
     }
 
-    fclose(file);
-    mCloudConnectParams.isX509 = strlen(mCloudConnectParams.cert) && strlen(mCloudConnectParams.key);
     return res;
 }
 
@@ -224,18 +188,25 @@ static int ValidateConfigurationSetting(ConfigurationSetting *setting)
 
     if (strcmp("HostName", setting->name) == 0) {
         res |= strlen(setting->value) == 0;
+        res |= strlen(setting->value) >= CLOUD_MAX_HOSTNAME_LENGTH;
     } else if (strcmp("DPSEndPoint", setting->name) == 0) {
         res |= strlen(setting->value) == 0;
+        res |= strlen(setting->value) >= CLOUD_MAX_HOSTNAME_LENGTH;
     } else if (strcmp("DPSIdScope", setting->name) == 0) {
         res |= strlen(setting->value) == 0;
+        res |= strlen(setting->value) >= CLOUD_MAX_ID_SCOPE_LENGTH;
     } else if (strcmp("DeviceId", setting->name) == 0) {
         res |= strlen(setting->value) == 0;
+        res |= strlen(setting->value) > CLOUD_MAX_DEVICE_ID_LENGTH;
     } else if (strcmp("CertFile", setting->name) == 0) {
         res |= strlen(setting->value) == 0;
         res |= File_Validate(setting->value);
     } else if (strcmp("KeyFile", setting->name) == 0) {
         res |= strlen(setting->value) == 0;
         res |= File_Validate(setting->value);
+    } else if (strcmp("MetricsFile", setting->name) == 0 || strcmp("MetricsSocket", setting->name) == 0) {
+        res |= strlen(setting->value) == 0;
+        res |= strlen(setting->value) >= METRICS_MAX_PATH_LENGTH;
     } else {
         printf("Ignoring unknown configuration: %s\n", setting->name);
     }
@@ -246,17 +217,23 @@ static int ValidateConfigurationSetting(ConfigurationSetting *setting)
 static void ProcessConfigurationSetting(ConfigurationSetting *setting, CloudConnectParams *params)
 {
     if (strcmp("HostName", setting->name) == 0) {
-        strcpy(params->hostname, setting->value);
+        snprintf(params->hostname, sizeof(params->hostname), "%s", setting->value);
     } else if (strcmp("DPSEndPoint", setting->name) == 0) {
-        strcpy(params->dpsEndPoint, setting->value);
+        snprintf(params->dpsEndPoint, sizeof(params->dpsEndPoint), "%s", setting->value);
     } else if (strcmp("DPSIdScope", setting->name) == 0) {
-        strcpy(params->dpsIdScope, setting->value);
+        snprintf(params->dpsIdScope, sizeof(params->dpsIdScope), "%s", setting->value);
     } else if (strcmp("DeviceId", setting->name) == 0) {
-        strcpy(params->deviceId, setting->value);
+        snprintf(params->deviceId, sizeof(params->deviceId), "%s", setting->value);
     } else if (strcmp("CertFile", setting->name) == 0) {
-        File_Read(setting->value, params->cert, 4096);
+        CredentialStore_Release(params->cert);
+        params->cert = CredentialStore_Load(setting->value);
     } else if (strcmp("KeyFile", setting->name) == 0) {
-        File_Read(setting->value, params->key, 4096);
+        CredentialStore_Release(params->key);
+        params->key = CredentialStore_Load(setting->value);
+    } else if (strcmp("MetricsFile", setting->name) == 0) {
+        snprintf(mMetricsParams.textFile, sizeof(mMetricsParams.textFile), "%s", setting->value);
+    } else if (strcmp("MetricsSocket", setting->name) == 0) {
+        snprintf(mMetricsParams.socketPath, sizeof(mMetricsParams.socketPath), "%s", setting->value);
     }
 }
 
@@ -275,10 +252,14 @@ static void CloudEventHandler(CloudEvent evt, void *data)
 {
     switch (evt) {
         case CLOUD_EVENT_REGISTRATIONSUCCEEDED:
+            mRegistrationResult = true;
+            mRegisterEndMs = Clock_GetMs();
             ExitAction(0);
             break;
 
         case CLOUD_EVENT_REGISTRATIONFAILED:
+            mRegisterFailCount++;
+            mRegisterEndMs = Clock_GetMs();
             ExitAction(-1);
             break;
 
@@ -295,13 +276,31 @@ void msleep(unsigned int milliseconds)
     nanosleep(&timeToSleep, NULL);
 }
 
+/* The registration takes until it succeeds or fails, the duration grows while it is in progress */
+static void CollectMetrics(void)
+{
+    uint64_t endMs = mRegisterEndMs ? mRegisterEndMs : Clock_GetMs();
+
+    Metrics_Set("cloud_provision_registering", METRICS_TYPE_GAUGE, "1 while the registration is in progress.",
+                mState == APP_STATE_REGISTERING ? 1 : 0);
+    Metrics_Set("cloud_provision_registered", METRICS_TYPE_GAUGE, "1 once the device is registered.",
+                mRegistrationResult ? 1 : 0);
+    Metrics_Set("cloud_provision_failures_total", METRICS_TYPE_COUNTER, "Registrations that failed.",
+                (double)mRegisterFailCount);
+    Metrics_Set("cloud_provision_duration_seconds", METRICS_TYPE_GAUGE, "Time the registration took.",
+                mRegisterStartMs ? (double)(endMs - mRegisterStartMs) / 1000.0 : 0);
+}
+
 static void AppStateMachine(void)
 {
     switch (mState) {
         case APP_STATE_IDLE:
+            mRegisterStartMs = Clock_GetMs();
+
             if (Cloud_Register(&mCloudConnectParams) == 0) {
                 mState = APP_STATE_REGISTERING;
             } else {
+                mRegisterFailCount++;
                 ExitAction(-1);
             }
             break;
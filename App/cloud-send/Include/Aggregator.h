@@ -0,0 +1,48 @@
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define AGGREGATOR_MAX_FIELDS 16
+#define AGGREGATOR_MAX_FIELD_LENGTH 64
+#define AGGREGATOR_MAX_SERIES 8192
+#define AGGREGATOR_MAX_SENSORS 4096
+#define AGGREGATOR_KEY_ARENA_SIZE (64 * 1024)
+#define AGGREGATOR_DEFAULT_WINDOW_SECONDS 60
+
+typedef enum eAggregatorStat {
+    AGGREGATOR_STAT_MIN = 0x01,
+    AGGREGATOR_STAT_MAX = 0x02,
+    AGGREGATOR_STAT_MEAN = 0x04,
+    AGGREGATOR_STAT_COUNT = 0x08,
+    AGGREGATOR_STAT_LAST = 0x10,
+    AGGREGATOR_STAT_ALL = 0x1f,
+} AggregatorStat;
+
+typedef struct sAggregatorStats {
+    size_t readingCount;
+    size_t valueCount;
+    size_t windowCount;
+    size_t summaryCount;
+    size_t sensorCount;
+    size_t overflowCount;
+    size_t stateBytes;
+} AggregatorStats;
+
+int Aggregator_Initialize(void);
+void Aggregator_Deinitialize(void);
+int Aggregator_AddFields(const char *spec);
+int Aggregator_SetKeyFields(const char *fields);
+void Aggregator_SetWindow(unsigned int seconds);
+bool Aggregator_IsEnabled(void);
+bool Aggregator_Add(const char *payload, size_t size, uint64_t timeMs);
+void Aggregator_Task(uint64_t timeMs);
+void Aggregator_FlushAll(void);
+bool Aggregator_Next(const char **summary, size_t *size);
+void Aggregator_Pop(void);
+bool Aggregator_HasPending(void);
+void Aggregator_GetStats(AggregatorStats *stats);
+
+#endif
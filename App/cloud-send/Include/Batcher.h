@@ -0,0 +1,69 @@
+#ifndef BATCHER_H
+#define BATCHER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BATCHER_MAX_BATCHES 64
+#define BATCHER_MAX_READINGS 64
+#define BATCHER_MAX_LANES 3
+#define BATCHER_MAX_BYTES (256 * 1024)
+
+typedef enum eBatcherFlushReason {
+    BATCHER_FLUSH_SIZE,
+    BATCHER_FLUSH_COUNT,
+    BATCHER_FLUSH_LINGER,
+    BATCHER_FLUSH_BUDGET,
+    BATCHER_FLUSH_IMMEDIATE,
+    BATCHER_FLUSH_FORCED,
+    BATCHER_FLUSH_REASON_COUNT,
+} BatcherFlushReason;
+
+typedef struct sBatcherParams {
+    unsigned int lingerMs;
+    size_t maxBytes;
+    size_t maxReadings;
+    unsigned int latencyBudgetMs;
+} BatcherParams;
+
+typedef struct sBatch {
+    char *data;
+    size_t size;
+    size_t capacity;
+    void *contexts[BATCHER_MAX_READINGS];
+    size_t offsets[BATCHER_MAX_READINGS];
+    size_t sizes[BATCHER_MAX_READINGS];
+    size_t count;
+    int lane;
+    uint64_t openTimeMs;
+    uint64_t oldestTimeMs;
+    bool inUse;
+} Batch;
+
+typedef struct sBatcherStats {
+    size_t batchCount;
+    size_t readingCount;
+    size_t maxReadings;
+    size_t histogram[4];
+    size_t flushReasons[BATCHER_FLUSH_REASON_COUNT];
+} BatcherStats;
+
+typedef void (*Batcher_FlushHandler)(Batch *batch);
+
+int Batcher_Initialize(const BatcherParams *params, Batcher_FlushHandler flushHandler);
+int Batcher_Configure(const BatcherParams *params);
+void Batcher_Deinitialize(void);
+bool Batcher_CanAccept(void);
+int Batcher_Add(int lane, bool urgent, const char *reading, size_t size, void *context, uint64_t arrivalMs,
+                uint64_t nowMs);
+void Batcher_Task(uint64_t nowMs);
+void Batcher_FlushAll(void);
+size_t Batcher_GetOpenCount(void);
+void Batcher_Release(Batch *batch);
+bool Batcher_IsBatch(const void *context);
+int Batcher_GetReading(const Batch *batch, size_t index, const char **reading, size_t *size);
+void Batcher_GetStats(BatcherStats *stats);
+const char *Batcher_GetFlushReasonName(BatcherFlushReason reason);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef CLAIM_H
+#define CLAIM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "File.h"
+
+#define CLAIM_DIRECTORY_NAME ".cloud-send"
+#define CLAIM_MAX_DIRECTORIES 16
+#define CLAIM_DEFAULT_LEASE_SECONDS 300
+
+typedef struct sClaimStats {
+    size_t claimCount;
+    size_t missCount;
+    size_t finalizeCount;
+    size_t releaseCount;
+    size_t expiredCount;
+    size_t recoverCount;
+} ClaimStats;
+
+int Claim_Initialize(unsigned int leaseSeconds);
+void Claim_Deinitialize(void);
+int Claim_Acquire(FileInfo *file);
+void Claim_Finalize(FileInfo *file);
+void Claim_Release(FileInfo *file);
+void Claim_Task(uint64_t nowMs);
+void Claim_GetStats(ClaimStats *stats);
+
+#endif
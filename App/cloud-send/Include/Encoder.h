@@ -0,0 +1,60 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ENCODER_MAX_COLUMNS 32
+#define ENCODER_MAX_SCALE 6
+#define ENCODER_CONTENT_TYPE_CBOR "application/cbor"
+
+/* A batch of readings that are JSON objects with the same fields is encoded column by column, wrapped in this tag:
+ *
+ *   tag(ENCODER_COLUMNAR_TAG) {"v": 1, "n": <reading count>, "c": [<column>, ...]}
+ *
+ * Each column is an array starting with the field name and the column kind:
+ *
+ *   [name, ENCODER_COLUMN_CONSTANT, value]          the same value in every reading
+ *   [name, ENCODER_COLUMN_INTEGER, bytes]           integers
+ *   [name, ENCODER_COLUMN_DECIMAL, scale, bytes]    numbers, each an integer divided by 10^scale
+ *   [name, ENCODER_COLUMN_TIME, digits, bytes]      UTC times "YYYY-MM-DDTHH:MM:SS[.fff]Z" as milliseconds since
+ *                                                   the epoch, with digits (0 or 3) fraction digits
+ *   [name, ENCODER_COLUMN_VALUES, [value, ...]]     anything else, one plain value per reading
+ *
+ * The bytes of a column are the differences of consecutive integers, the first one to 0, each zigzag mapped and
+ * written as an unsigned LEB128 varint. Any other message is the plain CBOR equivalent of its JSON. */
+#define ENCODER_COLUMNAR_TAG 27001
+
+typedef enum eEncoderColumnKind {
+    ENCODER_COLUMN_CONSTANT,
+    ENCODER_COLUMN_INTEGER,
+    ENCODER_COLUMN_DECIMAL,
+    ENCODER_COLUMN_TIME,
+    ENCODER_COLUMN_VALUES,
+} EncoderColumnKind;
+
+typedef enum eEncoderFormat {
+    ENCODER_FORMAT_JSON,
+    ENCODER_FORMAT_CBOR,
+} EncoderFormat;
+
+typedef struct sEncoderStats {
+    size_t messageCount;
+    size_t columnarCount;
+    size_t readingCount;
+    size_t passThroughCount;
+    uint64_t jsonBytes;
+    uint64_t encodedBytes;
+} EncoderStats;
+
+int Encoder_Initialize(void);
+void Encoder_Deinitialize(void);
+int Encoder_ParseFormat(const char *name, EncoderFormat *format);
+int Encoder_SetFormat(const char *name);
+EncoderFormat Encoder_GetFormat(void);
+const char *Encoder_GetContentType(void);
+int Encoder_Encode(const char *json, size_t size, const void **data, size_t *encodedSize);
+void Encoder_GetStats(EncoderStats *stats);
+
+#endif
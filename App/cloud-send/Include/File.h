@@ -3,12 +3,19 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #define FILE_MAX_STRING_LENGTH 256
+#define FILE_MAX_ANNOTATION_LENGTH 16
 
 typedef struct sFileInfo {
     char filename[FILE_MAX_STRING_LENGTH];
+    char annotation[FILE_MAX_ANNOTATION_LENGTH];
+    char origin[FILE_MAX_STRING_LENGTH];
     bool sendStatus;
+    int lane;
+    uint64_t enqueueTimeMs;
+    uint64_t dispatchTimeMs;
 } FileInfo;
 
 int File_Validate(const char *file);
@@ -0,0 +1,36 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FILTER_MAX_FIELDS 16
+#define FILTER_MAX_SENSORS 1024
+#define FILTER_MAX_FIELD_LENGTH 64
+
+typedef enum eFilterResult {
+    FILTER_RESULT_SEND,
+    FILTER_RESULT_SUPPRESS,
+} FilterResult;
+
+typedef struct sFilterStats {
+    size_t readingCount;
+    size_t suppressedCount;
+    size_t heartbeatCount;
+    size_t passThroughCount;
+    size_t sensorCount;
+    size_t sensorOverflowCount;
+    uint64_t suppressedBytes;
+} FilterStats;
+
+int Filter_Initialize(void);
+void Filter_Deinitialize(void);
+int Filter_SetKeyFields(const char *fields);
+int Filter_AddDeadbands(const char *spec);
+void Filter_SetHeartbeat(unsigned int seconds);
+bool Filter_IsEnabled(void);
+FilterResult Filter_Check(const char *payload, size_t size, uint64_t nowMs);
+void Filter_GetStats(FilterStats *stats);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef KEYFIELDS_H
+#define KEYFIELDS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KEYFIELDS_MAX_COUNT 4
+#define KEYFIELDS_MAX_LENGTH 64
+#define KEYFIELDS_HASH_SEED 0xcbf29ce484222325ull
+
+/* The reading members that tell one sensor from another, shared by the filter and the aggregator */
+typedef struct sKeyFields {
+    char names[KEYFIELDS_MAX_COUNT][KEYFIELDS_MAX_LENGTH];
+    size_t count;
+} KeyFields;
+
+int KeyFields_Parse(KeyFields *keyFields, const char *fields);
+uint64_t KeyFields_Hash(uint64_t hash, const char *data, size_t size);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PARALLEL_MAX_WORKERS 64
+
+typedef enum eParallelRole {
+    PARALLEL_ROLE_COORDINATOR,
+    PARALLEL_ROLE_WORKER,
+    PARALLEL_ROLE_FAILED,
+} ParallelRole;
+
+/* Written by each worker into its own slot, read by the coordinator once the worker has exited */
+typedef struct sParallelWorkerStats {
+    size_t claimCount;
+    size_t stolenCount;
+    size_t successCount;
+    size_t failCount;
+    size_t absorbCount;
+    size_t messageCount;
+    size_t resendCount;
+    size_t reconnectCount;
+    uint64_t elapsedMs;
+    int exitCode;
+    bool isReported;
+} ParallelWorkerStats;
+
+int Parallel_Initialize(size_t workerCount, size_t itemCount);
+void Parallel_Deinitialize(void);
+ParallelRole Parallel_Start(void);
+size_t Parallel_GetWorkerCount(void);
+size_t Parallel_GetWorkerIndex(void);
+bool Parallel_IsWorker(void);
+bool Parallel_Claim(size_t *item);
+void Parallel_Report(const ParallelWorkerStats *stats);
+int Parallel_Wait(void);
+void Parallel_Stop(void);
+void Parallel_Signal(int signum);
+void Parallel_GetWorkerStats(size_t worker, ParallelWorkerStats *stats);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "File.h"
+
+#define SCHEDULER_MAX_RULES 16
+
+typedef enum eSchedulerLane {
+    SCHEDULER_LANE_HIGH,
+    SCHEDULER_LANE_NORMAL,
+    SCHEDULER_LANE_LOW,
+    SCHEDULER_LANE_COUNT,
+} SchedulerLane;
+
+typedef struct sSchedulerLaneStats {
+    size_t enqueueCount;
+    size_t successCount;
+    size_t failCount;
+    uint64_t totalQueueMs;
+    uint64_t maxQueueMs;
+    uint64_t totalLatencyMs;
+    uint64_t maxLatencyMs;
+} SchedulerLaneStats;
+
+int Scheduler_Initialize(size_t capacity);
+void Scheduler_Deinitialize(void);
+int Scheduler_SetWeights(const char *weights);
+int Scheduler_AddPatterns(SchedulerLane lane, const char *patterns);
+int Scheduler_AddDirectory(SchedulerLane lane, const char *directory);
+int Scheduler_ParseLane(const char *name, SchedulerLane *lane);
+const char *Scheduler_GetLaneName(SchedulerLane lane);
+SchedulerLane Scheduler_Classify(const FileInfo *file);
+int Scheduler_Enqueue(FileInfo *file, uint64_t nowMs);
+FileInfo *Scheduler_Next(uint64_t nowMs);
+size_t Scheduler_GetQueuedCount(void);
+void Scheduler_Complete(FileInfo *file, bool success, uint64_t nowMs);
+void Scheduler_GetLaneStats(SchedulerLane lane, SchedulerLaneStats *stats);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STREAM_BUFFER_SIZE (256 * 1024)
+
+typedef enum eStreamResult {
+    STREAM_RESULT_RECORD,
+    STREAM_RESULT_AGAIN,
+    STREAM_RESULT_END,
+    STREAM_RESULT_ERROR,
+} StreamResult;
+
+typedef struct sStreamStats {
+    size_t recordCount;
+    size_t droppedCount;
+    size_t readCount;
+    uint64_t byteCount;
+} StreamStats;
+
+int Stream_Open(const char *path);
+void Stream_Close(void);
+StreamResult Stream_Next(const char **record, size_t *size);
+StreamResult Stream_NextBuffered(const char **record, size_t *size);
+bool Stream_IsFifo(void);
+void Stream_GetStats(StreamStats *stats);
+
+#endif
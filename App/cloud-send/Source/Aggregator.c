@@ -0,0 +1,540 @@
+#include "Aggregator.h"
+#include "KeyFields.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <json-c/json.h>
+
+#define NO_WINDOW UINT64_MAX
+#define MAX_KEY_LENGTH 512
+
+typedef struct sField {
+    char name[AGGREGATOR_MAX_FIELD_LENGTH];
+    unsigned int stats;
+} Field;
+
+/* One entry per sensor and field, 32 bytes. Minimum, maximum and last value are kept in single precision, which is
+ * more than any sensor resolves, so several thousand series fit in a few hundred KB. */
+typedef struct sSeries {
+    double sum;
+    float min;
+    float max;
+    float last;
+    uint32_t count;
+    uint64_t window;
+} Series;
+
+/* The key of a sensor is stored once, as the JSON members it is copied into every summary with */
+typedef struct sSensor {
+    uint64_t hash;
+    uint32_t keyOffset;
+    uint16_t keyLength;
+    uint16_t index;
+    bool inUse;
+} Sensor;
+
+static Field mFields[AGGREGATOR_MAX_FIELDS];
+static size_t mFieldCount = 0;
+static KeyFields mKeyFields;
+static uint64_t mWindowMs = AGGREGATOR_DEFAULT_WINDOW_SECONDS * 1000ull;
+static uint64_t mOpenWindow = NO_WINDOW;
+
+static Series *mSeries = NULL;
+static Sensor *mSensors = NULL;
+static uint16_t *mSensorTable = NULL;
+static char *mKeyArena = NULL;
+static size_t mKeyArenaUsed = 0;
+static size_t mSensorCount = 0;
+static json_tokener *mTokener = NULL;
+
+static char *mOutbox = NULL;
+static size_t mOutboxSize = 0;
+static size_t mOutboxCapacity = 0;
+static size_t mOutboxRead = 0;
+
+static AggregatorStats mStats;
+
+static int ParseStats(const char *spec, unsigned int *stats);
+static size_t BuildKey(json_object *obj, char *key, size_t keySize);
+static Sensor *FindSensor(const char *key, size_t length);
+static size_t GetSensorCapacity(void);
+static void CloseWindow(uint64_t window);
+static void AppendSummary(const Sensor *sensor, uint64_t window);
+static int OutboxPrintf(const char *format, ...);
+
+int Aggregator_Initialize(void)
+{
+    Aggregator_Deinitialize();
+
+    mSeries = calloc(AGGREGATOR_MAX_SERIES, sizeof(Series));
+    mSensors = calloc(AGGREGATOR_MAX_SENSORS, sizeof(Sensor));
+    mSensorTable = calloc(AGGREGATOR_MAX_SENSORS, sizeof(uint16_t));
+    mKeyArena = malloc(AGGREGATOR_KEY_ARENA_SIZE);
+    mTokener = json_tokener_new();
+
+    if (mSeries == NULL || mSensors == NULL || mSensorTable == NULL || mKeyArena == NULL || mTokener == NULL) {
+        Aggregator_Deinitialize();
+        return -1;
+    }
+
+    mStats.stateBytes = AGGREGATOR_MAX_SERIES * sizeof(Series) + AGGREGATOR_MAX_SENSORS * sizeof(Sensor) +
+                        AGGREGATOR_MAX_SENSORS * sizeof(uint16_t) + AGGREGATOR_KEY_ARENA_SIZE;
+    return 0;
+}
+
+void Aggregator_Deinitialize(void)
+{
+    free(mSeries);
+    free(mSensors);
+    free(mSensorTable);
+    free(mKeyArena);
+    free(mOutbox);
+
+    if (mTokener) {
+        json_tokener_free(mTokener);
+    }
+
+    mSeries = NULL;
+    mSensors = NULL;
+    mSensorTable = NULL;
+    mKeyArena = NULL;
+    mOutbox = NULL;
+    mTokener = NULL;
+    mKeyArenaUsed = 0;
+    mSensorCount = 0;
+    mOutboxSize = 0;
+    mOutboxCapacity = 0;
+    mOutboxRead = 0;
+    mOpenWindow = NO_WINDOW;
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+int Aggregator_AddFields(const char *spec)
+{
+    char buffer[AGGREGATOR_MAX_FIELDS * AGGREGATOR_MAX_FIELD_LENGTH];
+    char *saveptr = NULL;
+
+    if (spec == NULL || strlen(spec) >= sizeof(buffer)) {
+        return -1;
+    }
+
+    strcpy(buffer, spec);
+
+    /* Entries are "field" for all statistics or "field:min|max|mean|count|last" for a selection */
+    for (char *token = strtok_r(buffer, ", ", &saveptr); token; token = strtok_r(NULL, ", ", &saveptr)) {
+        char *colon = strchr(token, ':');
+        Field field = {{0}, AGGREGATOR_STAT_ALL};
+
+        if (colon) {
+            *colon = '\0';
+
+            if (ParseStats(colon + 1, &field.stats) != 0) {
+                return -1;
+            }
+        }
+
+        if (mFieldCount == AGGREGATOR_MAX_FIELDS || *token == '\0' || strlen(token) >= AGGREGATOR_MAX_FIELD_LENGTH) {
+            return -1;
+        }
+
+        strcpy(field.name, token);
+        mFields[mFieldCount++] = field;
+    }
+
+    return 0;
+}
+
+int Aggregator_SetKeyFields(const char *fields)
+{
+    return KeyFields_Parse(&mKeyFields, fields);
+}
+
+/* The open window is numbered by the old length, so it is closed with that length before the new one applies */
+void Aggregator_SetWindow(unsigned int seconds)
+{
+    uint64_t windowMs = (uint64_t)(seconds ? seconds : AGGREGATOR_DEFAULT_WINDOW_SECONDS) * 1000;
+
+    if (windowMs != mWindowMs) {
+        Aggregator_FlushAll();
+        mWindowMs = windowMs;
+    }
+}
+
+bool Aggregator_IsEnabled(void)
+{
+    return mFieldCount > 0 && mSeries != NULL;
+}
+
+bool Aggregator_Add(const char *payload, size_t size, uint64_t timeMs)
+{
+    double values[AGGREGATOR_MAX_FIELDS];
+    bool present[AGGREGATOR_MAX_FIELDS];
+    size_t presentCount = 0;
+    char key[MAX_KEY_LENGTH];
+
+    if (!Aggregator_IsEnabled() || payload == NULL) {
+        return false;
+    }
+
+    json_tokener_reset(mTokener);
+    json_object *obj = json_tokener_parse_ex(mTokener, payload, (int)size);
+
+    if (obj == NULL || !json_object_is_type(obj, json_type_object)) {
+        json_object_put(obj);
+        return false;
+    }
+
+    for (size_t i = 0; i < mFieldCount; i++) {
+        json_object *member = NULL;
+        present[i] = json_object_object_get_ex(obj, mFields[i].name, &member) &&
+                     (json_object_is_type(member, json_type_double) || json_object_is_type(member, json_type_int));
+
+        if (present[i]) {
+            values[i] = json_object_get_double(member);
+            presentCount++;
+        }
+    }
+
+    size_t keyLength = presentCount ? BuildKey(obj, key, sizeof(key)) : 0;
+    json_object_put(obj);
+
+    /* Readings without an aggregated field are not folded and go out as they are */
+    if (presentCount == 0) {
+        return false;
+    }
+
+    Sensor *sensor = FindSensor(key, keyLength);
+
+    /* Once the table is full, readings of new sensors are sent raw rather than dropped */
+    if (sensor == NULL) {
+        mStats.overflowCount++;
+        return false;
+    }
+
+    uint64_t window = timeMs / mWindowMs;
+
+    if (mOpenWindow != NO_WINDOW && window != mOpenWindow) {
+        CloseWindow(mOpenWindow);
+    }
+
+    mOpenWindow = window;
+
+    for (size_t i = 0; i < mFieldCount; i++) {
+        if (!present[i]) {
+            continue;
+        }
+
+        Series *series = &mSeries[(size_t)sensor->index * mFieldCount + i];
+        float value = (float)values[i];
+
+        /* Series are reset lazily, by the first value of a new window */
+        if (series->window != window || series->count == 0) {
+            series->window = window;
+            series->count = 0;
+            series->sum = 0;
+            series->min = value;
+            series->max = value;
+        }
+
+        series->sum += values[i];
+        series->count++;
+        series->last = value;
+
+        if (value < series->min) {
+            series->min = value;
+        }
+
+        if (value > series->max) {
+            series->max = value;
+        }
+
+        mStats.valueCount++;
+    }
+
+    mStats.readingCount++;
+    return true;
+}
+
+void Aggregator_Task(uint64_t timeMs)
+{
+    if (mOpenWindow != NO_WINDOW && timeMs / mWindowMs != mOpenWindow) {
+        CloseWindow(mOpenWindow);
+        mOpenWindow = NO_WINDOW;
+    }
+}
+
+void Aggregator_FlushAll(void)
+{
+    if (mOpenWindow != NO_WINDOW) {
+        CloseWindow(mOpenWindow);
+        mOpenWindow = NO_WINDOW;
+    }
+}
+
+bool Aggregator_Next(const char **summary, size_t *size)
+{
+    if (mOutboxRead >= mOutboxSize) {
+        return false;
+    }
+
+    *summary = mOutbox + mOutboxRead;
+    *size = strlen(*summary);
+    return true;
+}
+
+void Aggregator_Pop(void)
+{
+    if (mOutboxRead < mOutboxSize) {
+        mOutboxRead += strlen(mOutbox + mOutboxRead) + 1;
+    }
+
+    if (mOutboxRead >= mOutboxSize) {
+        mOutboxRead = 0;
+        mOutboxSize = 0;
+    }
+}
+
+/* True while a window is open or summaries wait to be sent */
+bool Aggregator_HasPending(void)
+{
+    return mOpenWindow != NO_WINDOW || mOutboxRead < mOutboxSize;
+}
+
+void Aggregator_GetStats(AggregatorStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+        stats->sensorCount = mSensorCount;
+    }
+}
+
+static int ParseStats(const char *spec, unsigned int *stats)
+{
+    static const struct {
+        const char *name;
+        AggregatorStat stat;
+    } names[] = {
+        {"min", AGGREGATOR_STAT_MIN},     {"max", AGGREGATOR_STAT_MAX},   {"mean", AGGREGATOR_STAT_MEAN},
+        {"count", AGGREGATOR_STAT_COUNT}, {"last", AGGREGATOR_STAT_LAST},
+    };
+
+    *stats = 0;
+
+    while (*spec) {
+        size_t len = strcspn(spec, "|");
+        size_t i;
+
+        for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            if (strlen(names[i].name) == len && strncmp(names[i].name, spec, len) == 0) {
+                *stats |= names[i].stat;
+                break;
+            }
+        }
+
+        if (i == sizeof(names) / sizeof(names[0])) {
+            return -1;
+        }
+
+        spec += len + (spec[len] == '|');
+    }
+
+    return *stats ? 0 : -1;
+}
+
+/* The key is the JSON members of the key fields, e.g. "sensorId":"a1", ready to be copied into a summary */
+static size_t BuildKey(json_object *obj, char *key, size_t keySize)
+{
+    size_t length = 0;
+
+    key[0] = '\0';
+
+    for (size_t i = 0; i < mKeyFields.count; i++) {
+        json_object *member = NULL;
+
+        if (!json_object_object_get_ex(obj, mKeyFields.names[i], &member)) {
+            continue;
+        }
+
+        int n = snprintf(key + length, keySize - length, "%s\"%s\":%s", length ? "," : "", mKeyFields.names[i],
+                         json_object_to_json_string_ext(member, JSON_C_TO_STRING_PLAIN));
+
+        if (n < 0 || (size_t)n >= keySize - length) {
+            key[length] = '\0';
+            break;
+        }
+
+        length += (size_t)n;
+    }
+
+    return length;
+}
+
+static Sensor *FindSensor(const char *key, size_t length)
+{
+    uint64_t hash = KeyFields_Hash(KEYFIELDS_HASH_SEED, key, length);
+    size_t index = (size_t)(hash % AGGREGATOR_MAX_SENSORS);
+
+    for (size_t i = 0; i < AGGREGATOR_MAX_SENSORS; i++) {
+        Sensor *sensor = &mSensors[(index + i) % AGGREGATOR_MAX_SENSORS];
+
+        if (sensor->inUse) {
+            if (sensor->hash == hash && sensor->keyLength == length &&
+                memcmp(mKeyArena + sensor->keyOffset, key, length) == 0) {
+                return sensor;
+            }
+
+            continue;
+        }
+
+        if (mSensorCount >= GetSensorCapacity() || mKeyArenaUsed + length > AGGREGATOR_KEY_ARENA_SIZE) {
+            return NULL;
+        }
+
+        memcpy(mKeyArena + mKeyArenaUsed, key, length);
+        sensor->hash = hash;
+        sensor->keyOffset = (uint32_t)mKeyArenaUsed;
+        sensor->keyLength = (uint16_t)length;
+        sensor->index = (uint16_t)mSensorCount;
+        sensor->inUse = true;
+        mSensorTable[mSensorCount++] = (uint16_t)((index + i) % AGGREGATOR_MAX_SENSORS);
+        mKeyArenaUsed += length;
+        return sensor;
+    }
+
+    return NULL;
+}
+
+/* Every sensor has a series per field, and the hash table is kept at most three quarters full */
+static size_t GetSensorCapacity(void)
+{
+    size_t bySeries = AGGREGATOR_MAX_SERIES / mFieldCount;
+    size_t byTable = AGGREGATOR_MAX_SENSORS * 3 / 4;
+    return bySeries < byTable ? bySeries : byTable;
+}
+
+static void CloseWindow(uint64_t window)
+{
+    bool hasData = false;
+
+    for (size_t i = 0; i < mSensorCount; i++) {
+        const Sensor *sensor = &mSensors[mSensorTable[i]];
+
+        for (size_t f = 0; f < mFieldCount; f++) {
+            const Series *series = &mSeries[(size_t)sensor->index * mFieldCount + f];
+
+            if (series->window == window && series->count) {
+                AppendSummary(sensor, window);
+                hasData = true;
+                break;
+            }
+        }
+    }
+
+    mStats.windowCount += hasData;
+}
+
+/* {"sensorId":"a1","windowStart":"2026-01-01T12:00:00Z","windowSeconds":60,"temperature":{"min":20.5,...}} */
+static void AppendSummary(const Sensor *sensor, uint64_t window)
+{
+    time_t start = (time_t)(window * mWindowMs / 1000);
+    struct tm tm;
+    char timestamp[32];
+    size_t begin = mOutboxSize;
+    int res = 0;
+
+    gmtime_r(&start, &tm);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    res |= OutboxPrintf("{%.*s%s\"windowStart\":\"%s\",\"windowSeconds\":%llu", (int)sensor->keyLength,
+                        mKeyArena + sensor->keyOffset, sensor->keyLength ? "," : "", timestamp,
+                        (unsigned long long)(mWindowMs / 1000));
+
+    for (size_t f = 0; f < mFieldCount; f++) {
+        const Series *series = &mSeries[(size_t)sensor->index * mFieldCount + f];
+        unsigned int stats = mFields[f].stats;
+        const char *separator = "";
+
+        if (series->window != window || series->count == 0) {
+            continue;
+        }
+
+        res |= OutboxPrintf(",\"%s\":{", mFields[f].name);
+
+        if (stats & AGGREGATOR_STAT_MIN) {
+            res |= OutboxPrintf("%s\"min\":%.7g", separator, series->min);
+            separator = ",";
+        }
+
+        if (stats & AGGREGATOR_STAT_MAX) {
+            res |= OutboxPrintf("%s\"max\":%.7g", separator, series->max);
+            separator = ",";
+        }
+
+        if (stats & AGGREGATOR_STAT_MEAN) {
+            res |= OutboxPrintf("%s\"mean\":%.9g", separator, series->sum / series->count);
+            separator = ",";
+        }
+
+        if (stats & AGGREGATOR_STAT_COUNT) {
+            res |= OutboxPrintf("%s\"count\":%u", separator, series->count);
+            separator = ",";
+        }
+
+        if (stats & AGGREGATOR_STAT_LAST) {
+            res |= OutboxPrintf("%s\"last\":%.7g", separator, series->last);
+        }
+
+        res |= OutboxPrintf("}");
+    }
+
+    res |= OutboxPrintf("}");
+
+    if (res != 0) {
+        mOutboxSize = begin;
+        return;
+    }
+
+    /* Summaries are kept back to back, each with its terminator */
+    mOutboxSize++;
+    mStats.summaryCount++;
+}
+
+/* Appends to the outbox and leaves it terminated, without counting the terminator */
+static int OutboxPrintf(const char *format, ...)
+{
+    va_list args;
+
+    for (;;) {
+        size_t room = mOutboxCapacity - mOutboxSize;
+
+        va_start(args, format);
+        int n = room ? vsnprintf(mOutbox + mOutboxSize, room, format, args) : 0;
+        va_end(args);
+
+        if (n < 0) {
+            return -1;
+        }
+
+        if (room && (size_t)n < room) {
+            mOutboxSize += (size_t)n;
+            return 0;
+        }
+
+        size_t capacity = mOutboxCapacity ? mOutboxCapacity * 2 : 4096;
+
+        while (capacity < mOutboxSize + (size_t)n + 1) {
+            capacity *= 2;
+        }
+
+        char *outbox = realloc(mOutbox, capacity);
+
+        if (outbox == NULL) {
+            return -1;
+        }
+
+        mOutbox = outbox;
+        mOutboxCapacity = capacity;
+    }
+}
@@ -0,0 +1,316 @@
+#include "Batcher.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_MAX_BYTES 4096
+
+static const char *mFlushReasonNames[BATCHER_FLUSH_REASON_COUNT] = {
+    "size", "count", "linger", "budget", "immediate", "forced",
+};
+
+static Batch mBatches[BATCHER_MAX_BATCHES];
+static Batch *mOpenBatches[BATCHER_MAX_LANES];
+static size_t mFreeCount = 0;
+static BatcherParams mParams;
+static BatcherStats mStats;
+static Batcher_FlushHandler mFlushHandler = NULL;
+
+static Batch *OpenBatch(int lane, uint64_t nowMs);
+static int AppendReading(Batch *batch, const char *reading, size_t size);
+static void FlushBatch(Batch *batch, BatcherFlushReason reason);
+static bool IsDue(const Batch *batch, uint64_t nowMs, BatcherFlushReason *reason);
+
+int Batcher_Initialize(const BatcherParams *params, Batcher_FlushHandler flushHandler)
+{
+    Batcher_Deinitialize();
+
+    if (params) {
+        mParams = *params;
+    }
+
+    if (mParams.maxBytes == 0 || mParams.maxBytes > BATCHER_MAX_BYTES) {
+        mParams.maxBytes = mParams.maxBytes ? BATCHER_MAX_BYTES : DEFAULT_MAX_BYTES;
+    }
+
+    if (mParams.maxReadings == 0 || mParams.maxReadings > BATCHER_MAX_READINGS) {
+        mParams.maxReadings = BATCHER_MAX_READINGS;
+    }
+
+    /* Batch buffers are allocated once at the configured size and reused for every message */
+    for (size_t i = 0; i < BATCHER_MAX_BATCHES; i++) {
+        mBatches[i].data = malloc(mParams.maxBytes + 2);
+
+        if (mBatches[i].data == NULL) {
+            Batcher_Deinitialize();
+            return -1;
+        }
+
+        mBatches[i].capacity = mParams.maxBytes + 2;
+    }
+
+    mFreeCount = BATCHER_MAX_BATCHES;
+    mFlushHandler = flushHandler;
+    return 0;
+}
+
+/* Changes the limits while batches are open, which meet the new ones when the next reading is added. The buffers keep
+ * the size they were allocated with, so the byte limit cannot be raised above the one given at initialization. */
+int Batcher_Configure(const BatcherParams *params)
+{
+    BatcherParams newParams = *params;
+    size_t byteLimit = mBatches[0].capacity ? mBatches[0].capacity - 2 : 0;
+
+    if (byteLimit == 0 || newParams.maxBytes > byteLimit) {
+        return -1;
+    }
+
+    if (newParams.maxBytes == 0) {
+        newParams.maxBytes = byteLimit;
+    }
+
+    if (newParams.maxReadings == 0 || newParams.maxReadings > BATCHER_MAX_READINGS) {
+        newParams.maxReadings = BATCHER_MAX_READINGS;
+    }
+
+    mParams = newParams;
+    return 0;
+}
+
+void Batcher_Deinitialize(void)
+{
+    for (size_t i = 0; i < BATCHER_MAX_BATCHES; i++) {
+        free(mBatches[i].data);
+    }
+
+    memset(mBatches, 0, sizeof(mBatches));
+    memset(mOpenBatches, 0, sizeof(mOpenBatches));
+    memset(&mStats, 0, sizeof(mStats));
+    mFreeCount = 0;
+}
+
+bool Batcher_CanAccept(void)
+{
+    /* Adding a reading may close the open batch of its lane and open a new one */
+    return mFreeCount > 0;
+}
+
+int Batcher_Add(int lane, bool urgent, const char *reading, size_t size, void *context, uint64_t arrivalMs,
+                uint64_t nowMs)
+{
+    if (lane < 0 || lane >= BATCHER_MAX_LANES || reading == NULL) {
+        return -1;
+    }
+
+    /* Trailing new lines of a reading are not part of the record */
+    while (size > 0 && (reading[size - 1] == '\n' || reading[size - 1] == '\r')) {
+        size--;
+    }
+
+    Batch *batch = mOpenBatches[lane];
+
+    /* Separator, reading and the closing bracket have to fit */
+    if (batch && (batch->size + size + 2 > mParams.maxBytes)) {
+        FlushBatch(batch, BATCHER_FLUSH_SIZE);
+        batch = NULL;
+    }
+
+    if (batch == NULL) {
+        batch = OpenBatch(lane, nowMs);
+
+        if (batch == NULL) {
+            return -1;
+        }
+    }
+
+    if (AppendReading(batch, reading, size) != 0) {
+        return -1;
+    }
+
+    batch->contexts[batch->count++] = context;
+
+    if (arrivalMs < batch->oldestTimeMs) {
+        batch->oldestTimeMs = arrivalMs;
+    }
+
+    BatcherFlushReason reason;
+
+    if (mParams.lingerMs == 0 || urgent) {
+        FlushBatch(batch, BATCHER_FLUSH_IMMEDIATE);
+    } else if (batch->count >= mParams.maxReadings) {
+        FlushBatch(batch, BATCHER_FLUSH_COUNT);
+    } else if (IsDue(batch, nowMs, &reason)) {
+        FlushBatch(batch, reason);
+    }
+
+    return 0;
+}
+
+void Batcher_Task(uint64_t nowMs)
+{
+    BatcherFlushReason reason;
+
+    for (size_t i = 0; i < BATCHER_MAX_LANES; i++) {
+        if (mOpenBatches[i] && IsDue(mOpenBatches[i], nowMs, &reason)) {
+            FlushBatch(mOpenBatches[i], reason);
+        }
+    }
+}
+
+void Batcher_FlushAll(void)
+{
+    for (size_t i = 0; i < BATCHER_MAX_LANES; i++) {
+        if (mOpenBatches[i]) {
+            FlushBatch(mOpenBatches[i], BATCHER_FLUSH_FORCED);
+        }
+    }
+}
+
+size_t Batcher_GetOpenCount(void)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < BATCHER_MAX_LANES; i++) {
+        count += mOpenBatches[i] != NULL;
+    }
+
+    return count;
+}
+
+void Batcher_Release(Batch *batch)
+{
+    if (batch && batch->inUse) {
+        batch->inUse = false;
+        batch->count = 0;
+        batch->size = 0;
+        mFreeCount++;
+    }
+}
+
+/* Tells a batch apart from the other contexts of the messages that come back through the same callbacks */
+bool Batcher_IsBatch(const void *context)
+{
+    uintptr_t address = (uintptr_t)context;
+
+    return address >= (uintptr_t)mBatches && address < (uintptr_t)&mBatches[BATCHER_MAX_BATCHES];
+}
+
+/* Readings keep their place in the message, so each one can be taken out again, e.g. to keep it when the message
+ * cannot be sent */
+int Batcher_GetReading(const Batch *batch, size_t index, const char **reading, size_t *size)
+{
+    if (batch == NULL || index >= batch->count || reading == NULL || size == NULL) {
+        return -1;
+    }
+
+    *reading = batch->data + batch->offsets[index];
+    *size = batch->sizes[index];
+    return 0;
+}
+
+void Batcher_GetStats(BatcherStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+    }
+}
+
+const char *Batcher_GetFlushReasonName(BatcherFlushReason reason)
+{
+    return reason < BATCHER_FLUSH_REASON_COUNT ? mFlushReasonNames[reason] : "unknown";
+}
+
+static Batch *OpenBatch(int lane, uint64_t nowMs)
+{
+    for (size_t i = 0; i < BATCHER_MAX_BATCHES; i++) {
+        Batch *batch = &mBatches[i];
+
+        if (!batch->inUse) {
+            batch->inUse = true;
+            batch->lane = lane;
+            batch->count = 0;
+            batch->openTimeMs = nowMs;
+            batch->oldestTimeMs = nowMs;
+
+            /* Readings are collected as a JSON array, a batch of one is sent without the brackets */
+            batch->data[0] = '[';
+            batch->size = 1;
+
+            mOpenBatches[lane] = batch;
+            mFreeCount--;
+            return batch;
+        }
+    }
+
+    return NULL;
+}
+
+static int AppendReading(Batch *batch, const char *reading, size_t size)
+{
+    size_t needed = batch->size + size + 3;
+
+    /* A single reading larger than the batch size still has to go out, in a message of its own */
+    if (needed > batch->capacity) {
+        char *data = realloc(batch->data, needed);
+
+        if (data == NULL) {
+            return -1;
+        }
+
+        batch->data = data;
+        batch->capacity = needed;
+    }
+
+    if (batch->count) {
+        batch->data[batch->size++] = ',';
+    }
+
+    batch->offsets[batch->count] = batch->size;
+    batch->sizes[batch->count] = size;
+    memcpy(batch->data + batch->size, reading, size);
+    batch->size += size;
+    return 0;
+}
+
+static void FlushBatch(Batch *batch, BatcherFlushReason reason)
+{
+    mOpenBatches[batch->lane] = NULL;
+
+    if (batch->count == 1) {
+        memmove(batch->data, batch->data + 1, batch->size - 1);
+        batch->size--;
+        batch->offsets[0] = 0;
+    } else {
+        batch->data[batch->size++] = ']';
+    }
+
+    batch->data[batch->size] = '\0';
+
+    mStats.batchCount++;
+    mStats.readingCount += batch->count;
+    mStats.flushReasons[reason]++;
+    mStats.histogram[batch->count == 1 ? 0 : batch->count <= 4 ? 1 : batch->count <= 16 ? 2 : 3]++;
+
+    if (batch->count > mStats.maxReadings) {
+        mStats.maxReadings = batch->count;
+    }
+
+    if (mFlushHandler) {
+        mFlushHandler(batch);
+    }
+}
+
+static bool IsDue(const Batch *batch, uint64_t nowMs, BatcherFlushReason *reason)
+{
+    /* The latency budget counts from when the oldest reading arrived, which may be before the batch was opened */
+    if (mParams.latencyBudgetMs && nowMs >= batch->oldestTimeMs + mParams.latencyBudgetMs) {
+        *reason = BATCHER_FLUSH_BUDGET;
+        return true;
+    }
+
+    if (nowMs >= batch->openTimeMs + mParams.lingerMs) {
+        *reason = BATCHER_FLUSH_LINGER;
+        return true;
+    }
+
+    return false;
+}
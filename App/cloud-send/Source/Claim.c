@@ -0,0 +1,309 @@
+#include "Claim.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* A file is claimed by renaming it into a directory of this process next to it. Only one rename of the same name can
+ * succeed, so no two processes send the same file and no lock is needed. The modification time of the claim directory
+ * is the lease: it is renewed while the process runs, and a directory whose lease has expired belongs to a process
+ * that died, whose files are moved back for the next one to claim. */
+typedef struct sClaimDirectory {
+    char spool[FILE_MAX_STRING_LENGTH];
+    char path[FILE_MAX_STRING_LENGTH];
+} ClaimDirectory;
+
+static ClaimDirectory mDirectories[CLAIM_MAX_DIRECTORIES];
+static size_t mDirectoryCount = 0;
+static char mOwner[96];
+static unsigned int mLeaseSeconds = CLAIM_DEFAULT_LEASE_SECONDS;
+static uint64_t mRenewMs = 0;
+static ClaimStats mStats;
+
+static ClaimDirectory *OpenDirectory(const char *spool);
+static void RecoverExpired(const char *spool, const char *claims);
+static void RecoverDirectory(const char *spool, const char *directory);
+static bool IsOwnDirectory(const char *name);
+static int MoveNoReplace(const char *from, const char *to);
+static const char *SplitPath(const char *path, char *directory, size_t size);
+
+/* Call after the process is started for good, the claim directories are named after it */
+int Claim_Initialize(unsigned int leaseSeconds)
+{
+    char host[64];
+
+    if (gethostname(host, sizeof(host)) != 0) {
+        snprintf(host, sizeof(host), "localhost");
+    }
+
+    host[sizeof(host) - 1] = '\0';
+    snprintf(mOwner, sizeof(mOwner), "%s-%d", host, (int)getpid());
+    mLeaseSeconds = leaseSeconds ? leaseSeconds : CLAIM_DEFAULT_LEASE_SECONDS;
+    mDirectoryCount = 0;
+    mRenewMs = 0;
+    memset(&mStats, 0, sizeof(mStats));
+    return 0;
+}
+
+/* Claim directories that still hold files were left by a failed release, they expire like those of a dead process */
+void Claim_Deinitialize(void)
+{
+    for (size_t i = 0; i < mDirectoryCount; i++) {
+        rmdir(mDirectories[i].path);
+    }
+
+    mDirectoryCount = 0;
+}
+
+int Claim_Acquire(FileInfo *file)
+{
+    char spool[FILE_MAX_STRING_LENGTH];
+    char claimPath[FILE_MAX_STRING_LENGTH];
+
+    if (file->origin[0]) {
+        return 0;
+    }
+
+    const char *name = SplitPath(file->filename, spool, sizeof(spool));
+    ClaimDirectory *directory = OpenDirectory(spool);
+
+    if (directory == NULL ||
+        snprintf(claimPath, sizeof(claimPath), "%s/%s", directory->path, name) >= (int)sizeof(claimPath)) {
+        printf("Cannot claim %s\n", file->filename);
+        return -1;
+    }
+
+    if (rename(file->filename, claimPath) != 0) {
+        /* Another instance claimed the file first, or has already sent it */
+        if (errno == ENOENT) {
+            mStats.missCount++;
+        } else {
+            printf("Cannot claim %s: %s\n", file->filename, strerror(errno));
+        }
+
+        return -1;
+    }
+
+    snprintf(file->origin, sizeof(file->origin), "%s", file->filename);
+    snprintf(file->filename, sizeof(file->filename), "%s", claimPath);
+    mStats.claimCount++;
+    return 0;
+}
+
+void Claim_Finalize(FileInfo *file)
+{
+    if (file->origin[0] == '\0') {
+        return;
+    }
+
+    if (File_Delete(file->filename) == 0) {
+        mStats.finalizeCount++;
+    } else {
+        printf("Failed to delete %s\n", file->filename);
+    }
+
+    snprintf(file->filename, sizeof(file->filename), "%s", file->origin);
+    file->origin[0] = '\0';
+}
+
+void Claim_Release(FileInfo *file)
+{
+    if (file->origin[0] == '\0') {
+        return;
+    }
+
+    if (MoveNoReplace(file->filename, file->origin) != 0) {
+        printf("Failed to return %s to %s, it is recovered once the claim expires\n", file->filename, file->origin);
+        return;
+    }
+
+    snprintf(file->filename, sizeof(file->filename), "%s", file->origin);
+    file->origin[0] = '\0';
+    mStats.releaseCount++;
+}
+
+void Claim_Task(uint64_t nowMs)
+{
+    if (mRenewMs && nowMs - mRenewMs < (uint64_t)mLeaseSeconds * 1000 / 4) {
+        return;
+    }
+
+    mRenewMs = nowMs;
+
+    for (size_t i = 0; i < mDirectoryCount; i++) {
+        utimensat(AT_FDCWD, mDirectories[i].path, NULL, 0);
+    }
+}
+
+void Claim_GetStats(ClaimStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+    }
+}
+
+/* The claim directory of a spool is created on its first file, which is also when expired claims there are
+ * recovered */
+static ClaimDirectory *OpenDirectory(const char *spool)
+{
+    char claims[FILE_MAX_STRING_LENGTH];
+
+    for (size_t i = 0; i < mDirectoryCount; i++) {
+        if (strcmp(mDirectories[i].spool, spool) == 0) {
+            return &mDirectories[i];
+        }
+    }
+
+    if (mDirectoryCount == CLAIM_MAX_DIRECTORIES) {
+        return NULL;
+    }
+
+    ClaimDirectory *directory = &mDirectories[mDirectoryCount];
+
+    if (snprintf(claims, sizeof(claims), "%s/%s", spool, CLAIM_DIRECTORY_NAME) >= (int)sizeof(claims) ||
+        snprintf(directory->path, sizeof(directory->path), "%s/%s", claims, mOwner) >= (int)sizeof(directory->path)) {
+        return NULL;
+    }
+
+    if (mkdir(claims, 0755) != 0 && errno != EEXIST) {
+        return NULL;
+    }
+
+    RecoverExpired(spool, claims);
+
+    /* A directory of the same name was left by an earlier process with the same id, its files are not ours */
+    if (mkdir(directory->path, 0700) != 0) {
+        if (errno != EEXIST) {
+            return NULL;
+        }
+
+        RecoverDirectory(spool, directory->path);
+    }
+
+    snprintf(directory->spool, sizeof(directory->spool), "%s", spool);
+    mDirectoryCount++;
+    return directory;
+}
+
+static void RecoverExpired(const char *spool, const char *claims)
+{
+    char path[FILE_MAX_STRING_LENGTH];
+    char recoverPath[FILE_MAX_STRING_LENGTH];
+    time_t now = time(NULL);
+    struct dirent *entry;
+    struct stat st;
+    DIR *dir = opendir(claims);
+
+    if (dir == NULL) {
+        return;
+    }
+
+    snprintf(recoverPath, sizeof(recoverPath), "%s/%s.recover", claims, mOwner);
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || IsOwnDirectory(entry->d_name) ||
+            snprintf(path, sizeof(path), "%s/%s", claims, entry->d_name) >= (int)sizeof(path)) {
+            continue;
+        }
+
+        if (lstat(path, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_mtime + (time_t)mLeaseSeconds > now) {
+            continue;
+        }
+
+        /* Renaming the whole directory first means only one process recovers it. The rename keeps the expired
+         * time, which is renewed so that no other process takes it over while the files are moved. */
+        if (rename(path, recoverPath) != 0) {
+            continue;
+        }
+
+        utimensat(AT_FDCWD, recoverPath, NULL, 0);
+        mStats.expiredCount++;
+        RecoverDirectory(spool, recoverPath);
+        rmdir(recoverPath);
+    }
+
+    closedir(dir);
+}
+
+/* The claims of this process and the one it is recovering. Owners may be prefixes of each other, e.g. host-12 and
+ * host-123, so the rest of the name must match as well. */
+static bool IsOwnDirectory(const char *name)
+{
+    size_t ownerLength = strlen(mOwner);
+
+    return strncmp(name, mOwner, ownerLength) == 0 &&
+           (name[ownerLength] == '\0' || strcmp(&name[ownerLength], ".recover") == 0);
+}
+
+static void RecoverDirectory(const char *spool, const char *directory)
+{
+    char from[FILE_MAX_STRING_LENGTH];
+    char to[FILE_MAX_STRING_LENGTH];
+    struct dirent *entry;
+    DIR *dir = opendir(directory);
+
+    if (dir == NULL) {
+        return;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            snprintf(from, sizeof(from), "%s/%s", directory, entry->d_name) >= (int)sizeof(from) ||
+            snprintf(to, sizeof(to), "%s/%s", spool, entry->d_name) >= (int)sizeof(to)) {
+            continue;
+        }
+
+        if (MoveNoReplace(from, to) == 0) {
+            mStats.recoverCount++;
+        } else {
+            printf("Cannot recover %s, %s exists\n", from, to);
+        }
+    }
+
+    closedir(dir);
+}
+
+/* A plain rename would replace a newer file of the same name that was written meanwhile */
+static int MoveNoReplace(const char *from, const char *to)
+{
+    struct stat fromStat;
+    struct stat toStat;
+
+    if (link(from, to) == 0) {
+        return unlink(from);
+    }
+
+    /* A move that was cut short between link and unlink leaves both names of the same file */
+    if (errno == EEXIST) {
+        if (stat(from, &fromStat) == 0 && stat(to, &toStat) == 0 && fromStat.st_dev == toStat.st_dev &&
+            fromStat.st_ino == toStat.st_ino) {
+            return unlink(from);
+        }
+
+        return -1;
+    }
+
+    /* Some file systems have no hard links */
+    if (errno == EPERM || errno == ENOTSUP) {
+        return (access(to, F_OK) != 0) ? rename(from, to) : -1;
+    }
+
+    return -1;
+}
+
+static const char *SplitPath(const char *path, char *directory, size_t size)
+{
+    const char *slash = strrchr(path, '/');
+
+    if (slash == NULL) {
+        snprintf(directory, size, ".");
+        return path;
+    }
+
+    snprintf(directory, size, "%.*s", slash == path ? 1 : (int)(slash - path), path);
+    return slash + 1;
+}
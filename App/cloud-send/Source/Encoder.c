@@ -0,0 +1,651 @@
+#include "Encoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include <json-c/json.h>
+
+#define CBOR_MAJOR_UNSIGNED 0
+#define CBOR_MAJOR_NEGATIVE 1
+#define CBOR_MAJOR_BYTES 2
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+#define CBOR_MAJOR_TAG 6
+#define CBOR_FALSE 0xf4
+#define CBOR_TRUE 0xf5
+#define CBOR_NULL 0xf6
+#define CBOR_FLOAT32 0xfa
+#define CBOR_FLOAT64 0xfb
+
+#define COLUMNAR_VERSION 1
+#define INITIAL_CAPACITY 4096
+#define TIME_TEXT_LENGTH 20
+#define TIME_TEXT_LENGTH_MS 24
+
+/* Decimal columns are only used while the scaled values stay exact integers in a double */
+#define MAX_EXACT_INTEGER 9007199254740992.0
+
+static const double mPowersOfTen[ENCODER_MAX_SCALE + 1] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6};
+
+static EncoderFormat mFormat = ENCODER_FORMAT_JSON;
+static json_tokener *mTokener = NULL;
+static unsigned char *mBuffer = NULL;
+static size_t mSize = 0;
+static size_t mCapacity = 0;
+static bool mFailed = false;
+static json_object **mCells = NULL;
+static int64_t *mIntegers = NULL;
+static size_t mCellCapacity = 0;
+static EncoderStats mStats;
+
+static bool Reserve(size_t size);
+static void PutByte(uint8_t byte);
+static void PutHead(int major, uint64_t value);
+static void PutInteger(int64_t value);
+static void PutDouble(double value);
+static void PutText(const char *text, size_t length);
+static void PutValue(json_object *value);
+static void PutDeltas(const int64_t *values, size_t count);
+static bool PutColumnar(json_object *readings);
+static void PutColumn(const char *name, json_object **cells, size_t count);
+static bool IsConstant(json_object **cells, size_t count);
+static bool ToIntegers(json_object **cells, size_t count);
+static bool ToDecimals(json_object **cells, size_t count, int *scale);
+static bool ToTimes(json_object **cells, size_t count, int *digits);
+static bool ParseTime(const char *text, size_t length, int digits, int64_t *timeMs);
+static void FormatTime(int64_t timeMs, int digits, char *text, size_t size);
+
+int Encoder_Initialize(void)
+{
+    Encoder_Deinitialize();
+
+    mTokener = json_tokener_new();
+
+    if (mTokener == NULL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void Encoder_Deinitialize(void)
+{
+    if (mTokener) {
+        json_tokener_free(mTokener);
+        mTokener = NULL;
+    }
+
+    free(mBuffer);
+    free(mCells);
+    free(mIntegers);
+    mBuffer = NULL;
+    mCells = NULL;
+    mIntegers = NULL;
+    mSize = 0;
+    mCapacity = 0;
+    mCellCapacity = 0;
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+/* Checks the name of a format, and converts it when format is not NULL */
+int Encoder_ParseFormat(const char *name, EncoderFormat *format)
+{
+    EncoderFormat result;
+
+    if (name && strcasecmp(name, "json") == 0) {
+        result = ENCODER_FORMAT_JSON;
+    } else if (name && strcasecmp(name, "cbor") == 0) {
+        result = ENCODER_FORMAT_CBOR;
+    } else {
+        return -1;
+    }
+
+    if (format) {
+        *format = result;
+    }
+
+    return 0;
+}
+
+int Encoder_SetFormat(const char *name)
+{
+    return Encoder_ParseFormat(name, &mFormat);
+}
+
+EncoderFormat Encoder_GetFormat(void)
+{
+    return mFormat;
+}
+
+const char *Encoder_GetContentType(void)
+{
+    return mFormat == ENCODER_FORMAT_CBOR ? ENCODER_CONTENT_TYPE_CBOR : "application/json";
+}
+
+/* Encodes a JSON reading or an array of readings. The result stays valid until the next call. Returns -1 when the
+ * message is to be sent as it is, because no encoding is configured or it is not valid JSON. */
+int Encoder_Encode(const char *json, size_t size, const void **data, size_t *encodedSize)
+{
+    if (mFormat == ENCODER_FORMAT_JSON || mTokener == NULL || json == NULL) {
+        return -1;
+    }
+
+    json_tokener_reset(mTokener);
+    json_object *obj = json_tokener_parse_ex(mTokener, json, (int)size);
+
+    if (obj == NULL) {
+        mStats.passThroughCount++;
+        return -1;
+    }
+
+    bool isBatch = json_object_is_type(obj, json_type_array);
+    mSize = 0;
+    mFailed = false;
+
+    if (isBatch && PutColumnar(obj)) {
+        mStats.columnarCount++;
+    } else {
+        mSize = 0;
+        PutValue(obj);
+    }
+
+    size_t readingCount = isBatch ? json_object_array_length(obj) : 1;
+    json_object_put(obj);
+
+    if (mFailed) {
+        mStats.passThroughCount++;
+        return -1;
+    }
+
+    mStats.messageCount++;
+    mStats.readingCount += readingCount;
+    mStats.jsonBytes += size;
+    mStats.encodedBytes += mSize;
+
+    *data = mBuffer;
+    *encodedSize = mSize;
+    return 0;
+}
+
+void Encoder_GetStats(EncoderStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+    }
+}
+
+static bool Reserve(size_t size)
+{
+    if (mFailed) {
+        return false;
+    }
+
+    if (mSize + size > mCapacity) {
+        size_t capacity = mCapacity ? mCapacity : INITIAL_CAPACITY;
+
+        while (capacity < mSize + size) {
+            capacity *= 2;
+        }
+
+        unsigned char *buffer = realloc(mBuffer, capacity);
+
+        if (buffer == NULL) {
+            mFailed = true;
+            return false;
+        }
+
+        mBuffer = buffer;
+        mCapacity = capacity;
+    }
+
+    return true;
+}
+
+static void PutByte(uint8_t byte)
+{
+    if (Reserve(1)) {
+        mBuffer[mSize++] = byte;
+    }
+}
+
+static void PutHead(int major, uint64_t value)
+{
+    uint8_t type = (uint8_t)(major << 5);
+    int length;
+
+    if (value < 24) {
+        PutByte(type | (uint8_t)value);
+        return;
+    } else if (value <= UINT8_MAX) {
+        PutByte(type | 24);
+        length = 1;
+    } else if (value <= UINT16_MAX) {
+        PutByte(type | 25);
+        length = 2;
+    } else if (value <= UINT32_MAX) {
+        PutByte(type | 26);
+        length = 4;
+    } else {
+        PutByte(type | 27);
+        length = 8;
+    }
+
+    if (Reserve((size_t)length)) {
+        for (int i = length - 1; i >= 0; i--) {
+            mBuffer[mSize++] = (uint8_t)(value >> (8 * i));
+        }
+    }
+}
+
+static void PutInteger(int64_t value)
+{
+    if (value >= 0) {
+        PutHead(CBOR_MAJOR_UNSIGNED, (uint64_t)value);
+    } else {
+        PutHead(CBOR_MAJOR_NEGATIVE, (uint64_t)(-(value + 1)));
+    }
+}
+
+static void PutDouble(double value)
+{
+    /* Most sensor values survive the round trip through single precision, which halves their size */
+    float single = (float)value;
+    uint64_t bits;
+    int length;
+
+    if ((double)single == value) {
+        uint32_t singleBits;
+        memcpy(&singleBits, &single, sizeof(singleBits));
+        bits = singleBits;
+        length = 4;
+        PutByte(CBOR_FLOAT32);
+    } else {
+        memcpy(&bits, &value, sizeof(bits));
+        length = 8;
+        PutByte(CBOR_FLOAT64);
+    }
+
+    if (Reserve((size_t)length)) {
+        for (int i = length - 1; i >= 0; i--) {
+            mBuffer[mSize++] = (uint8_t)(bits >> (8 * i));
+        }
+    }
+}
+
+static void PutText(const char *text, size_t length)
+{
+    PutHead(CBOR_MAJOR_TEXT, length);
+
+    if (Reserve(length)) {
+        memcpy(mBuffer + mSize, text, length);
+        mSize += length;
+    }
+}
+
+static void PutValue(json_object *value)
+{
+    switch (json_object_get_type(value)) {
+        case json_type_boolean:
+            PutByte(json_object_get_boolean(value) ? CBOR_TRUE : CBOR_FALSE);
+            break;
+
+        case json_type_int:
+            PutInteger(json_object_get_int64(value));
+            break;
+
+        case json_type_double:
+            PutDouble(json_object_get_double(value));
+            break;
+
+        case json_type_string:
+            PutText(json_object_get_string(value), (size_t)json_object_get_string_len(value));
+            break;
+
+        case json_type_array: {
+            size_t length = json_object_array_length(value);
+            PutHead(CBOR_MAJOR_ARRAY, length);
+
+            for (size_t i = 0; i < length; i++) {
+                PutValue(json_object_array_get_idx(value, i));
+            }
+
+            break;
+        }
+
+        case json_type_object: {
+            PutHead(CBOR_MAJOR_MAP, (uint64_t)json_object_object_length(value));
+
+            json_object_object_foreach(value, key, member)
+            {
+                PutText(key, strlen(key));
+                PutValue(member);
+            }
+
+            break;
+        }
+
+        default:
+            PutByte(CBOR_NULL);
+            break;
+    }
+}
+
+static void PutDeltas(const int64_t *values, size_t count)
+{
+    uint64_t previous = 0;
+    size_t length = 0;
+
+    /* Differences wrap around like the decoder's sums do, so even extreme integers survive */
+    for (int pass = 0; pass < 2; pass++) {
+        previous = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            uint64_t delta = (uint64_t)values[i] - previous;
+            uint64_t zigzag = (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+            previous = (uint64_t)values[i];
+
+            do {
+                if (pass == 0) {
+                    length++;
+                } else {
+                    PutByte((uint8_t)((zigzag & 0x7f) | (zigzag > 0x7f ? 0x80 : 0)));
+                }
+
+                zigzag >>= 7;
+            } while (zigzag);
+        }
+
+        if (pass == 0) {
+            PutHead(CBOR_MAJOR_BYTES, length);
+        }
+    }
+}
+
+static bool PutColumnar(json_object *readings)
+{
+    size_t count = json_object_array_length(readings);
+    json_object *first = count ? json_object_array_get_idx(readings, 0) : NULL;
+
+    if (count < 2 || !json_object_is_type(first, json_type_object)) {
+        return false;
+    }
+
+    size_t columnCount = (size_t)json_object_object_length(first);
+
+    if (columnCount == 0 || columnCount > ENCODER_MAX_COLUMNS) {
+        return false;
+    }
+
+    /* Both arrays are kept at the same capacity, which is never less than the reading count */
+    if (columnCount * count > mCellCapacity) {
+        json_object **cells = realloc(mCells, columnCount * count * sizeof(json_object *));
+        int64_t *integers = realloc(mIntegers, columnCount * count * sizeof(int64_t));
+
+        mCells = cells ? cells : mCells;
+        mIntegers = integers ? integers : mIntegers;
+
+        if (cells == NULL || integers == NULL) {
+            return false;
+        }
+
+        mCellCapacity = columnCount * count;
+    }
+
+    /* Every reading has to be an object with exactly the fields of the first one, in any order */
+    for (size_t i = 0; i < count; i++) {
+        json_object *reading = json_object_array_get_idx(readings, i);
+        size_t column = 0;
+
+        if (!json_object_is_type(reading, json_type_object) ||
+            (size_t)json_object_object_length(reading) != columnCount) {
+            return false;
+        }
+
+        json_object_object_foreach(first, key, member)
+        {
+            (void)member;
+
+            if (!json_object_object_get_ex(reading, key, &mCells[column * count + i])) {
+                return false;
+            }
+
+            column++;
+        }
+    }
+
+    PutHead(CBOR_MAJOR_TAG, ENCODER_COLUMNAR_TAG);
+    PutHead(CBOR_MAJOR_MAP, 3);
+    PutText("v", 1);
+    PutInteger(COLUMNAR_VERSION);
+    PutText("n", 1);
+    PutInteger((int64_t)count);
+    PutText("c", 1);
+    PutHead(CBOR_MAJOR_ARRAY, columnCount);
+
+    size_t column = 0;
+
+    json_object_object_foreach(first, name, value)
+    {
+        (void)value;
+        PutColumn(name, &mCells[column * count], count);
+        column++;
+    }
+
+    return true;
+}
+
+static void PutColumn(const char *name, json_object **cells, size_t count)
+{
+    int scale;
+    int digits;
+
+    if (IsConstant(cells, count)) {
+        PutHead(CBOR_MAJOR_ARRAY, 3);
+        PutText(name, strlen(name));
+        PutInteger(ENCODER_COLUMN_CONSTANT);
+        PutValue(cells[0]);
+    } else if (ToIntegers(cells, count)) {
+        PutHead(CBOR_MAJOR_ARRAY, 3);
+        PutText(name, strlen(name));
+        PutInteger(ENCODER_COLUMN_INTEGER);
+        PutDeltas(mIntegers, count);
+    } else if (ToDecimals(cells, count, &scale)) {
+        PutHead(CBOR_MAJOR_ARRAY, 4);
+        PutText(name, strlen(name));
+        PutInteger(ENCODER_COLUMN_DECIMAL);
+        PutInteger(scale);
+        PutDeltas(mIntegers, count);
+    } else if (ToTimes(cells, count, &digits)) {
+        PutHead(CBOR_MAJOR_ARRAY, 4);
+        PutText(name, strlen(name));
+        PutInteger(ENCODER_COLUMN_TIME);
+        PutInteger(digits);
+        PutDeltas(mIntegers, count);
+    } else {
+        PutHead(CBOR_MAJOR_ARRAY, 3);
+        PutText(name, strlen(name));
+        PutInteger(ENCODER_COLUMN_VALUES);
+        PutHead(CBOR_MAJOR_ARRAY, count);
+
+        for (size_t i = 0; i < count; i++) {
+            PutValue(cells[i]);
+        }
+    }
+}
+
+static bool IsConstant(json_object **cells, size_t count)
+{
+    json_type type = json_object_get_type(cells[0]);
+
+    for (size_t i = 1; i < count; i++) {
+        if (json_object_get_type(cells[i]) != type) {
+            return false;
+        }
+
+        switch (type) {
+            case json_type_null:
+                break;
+
+            case json_type_boolean:
+                if (json_object_get_boolean(cells[i]) != json_object_get_boolean(cells[0])) {
+                    return false;
+                }
+                break;
+
+            case json_type_int:
+                if (json_object_get_int64(cells[i]) != json_object_get_int64(cells[0])) {
+                    return false;
+                }
+                break;
+
+            case json_type_double:
+                if (json_object_get_double(cells[i]) != json_object_get_double(cells[0])) {
+                    return false;
+                }
+                break;
+
+            case json_type_string:
+                if (json_object_get_string_len(cells[i]) != json_object_get_string_len(cells[0]) ||
+                    strcmp(json_object_get_string(cells[i]), json_object_get_string(cells[0])) != 0) {
+                    return false;
+                }
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+static bool ToIntegers(json_object **cells, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (!json_object_is_type(cells[i], json_type_int)) {
+            return false;
+        }
+
+        mIntegers[i] = json_object_get_int64(cells[i]);
+    }
+
+    return true;
+}
+
+/* Finds the fewest decimal places that represent every value of the column exactly, so 21.5, 21.25 and 22 become
+ * 2150, 2125 and 2200 with a scale of 2 */
+static bool ToDecimals(json_object **cells, size_t count, int *scale)
+{
+    int columnScale = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!json_object_is_type(cells[i], json_type_double) && !json_object_is_type(cells[i], json_type_int)) {
+            return false;
+        }
+
+        double value = json_object_get_double(cells[i]);
+
+        if (!isfinite(value)) {
+            return false;
+        }
+
+        while (columnScale <= ENCODER_MAX_SCALE) {
+            double scaled = round(value * mPowersOfTen[columnScale]);
+
+            if (fabs(scaled) < MAX_EXACT_INTEGER && scaled / mPowersOfTen[columnScale] == value) {
+                break;
+            }
+
+            columnScale++;
+        }
+
+        if (columnScale > ENCODER_MAX_SCALE) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        double value = json_object_get_double(cells[i]);
+        double scaled = round(value * mPowersOfTen[columnScale]);
+
+        if (fabs(scaled) >= MAX_EXACT_INTEGER || scaled / mPowersOfTen[columnScale] != value) {
+            return false;
+        }
+
+        mIntegers[i] = (int64_t)scaled;
+    }
+
+    *scale = columnScale;
+    return true;
+}
+
+static bool ToTimes(json_object **cells, size_t count, int *digits)
+{
+    if (!json_object_is_type(cells[0], json_type_string)) {
+        return false;
+    }
+
+    int columnDigits = json_object_get_string_len(cells[0]) == TIME_TEXT_LENGTH_MS ? 3 : 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!json_object_is_type(cells[i], json_type_string) ||
+            !ParseTime(json_object_get_string(cells[i]), (size_t)json_object_get_string_len(cells[i]), columnDigits,
+                       &mIntegers[i])) {
+            return false;
+        }
+    }
+
+    *digits = columnDigits;
+    return true;
+}
+
+static bool ParseTime(const char *text, size_t length, int digits, int64_t *timeMs)
+{
+    int year, month, day, hour, minute, second;
+    int milliseconds = 0;
+    char formatted[TIME_TEXT_LENGTH_MS + 1];
+
+    if (length != (digits ? TIME_TEXT_LENGTH_MS : TIME_TEXT_LENGTH) ||
+        sscanf(text, "%4d-%2d-%2dT%2d:%2d:%2d", &year, &month, &day, &hour, &minute, &second) != 6 ||
+        (digits && sscanf(text + TIME_TEXT_LENGTH - 1, ".%3d", &milliseconds) != 1)) {
+        return false;
+    }
+
+    /* Days from the civil calendar, valid for any proleptic Gregorian date */
+    int y = year - (month <= 2);
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yearOfEra = y - era * 400;
+    int64_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    int64_t days = era * 146097 + dayOfEra - 719468;
+
+    *timeMs = ((days * 24 + hour) * 60 + minute) * 60000 + second * 1000 + milliseconds;
+
+    /* Only text the decoder writes back identically is taken, anything else goes into a values column */
+    FormatTime(*timeMs, digits, formatted, sizeof(formatted));
+    return strncmp(formatted, text, length) == 0;
+}
+
+static void FormatTime(int64_t timeMs, int digits, char *text, size_t size)
+{
+    int64_t seconds = timeMs >= 0 ? timeMs / 1000 : -((-timeMs + 999) / 1000);
+    time_t t = (time_t)seconds;
+    struct tm tm;
+
+    text[0] = '\0';
+
+    if (gmtime_r(&t, &tm) == NULL) {
+        return;
+    }
+
+    size_t length = strftime(text, size, "%Y-%m-%dT%H:%M:%S", &tm);
+
+    if (digits) {
+        snprintf(text + length, size - length, ".%03dZ", (int)(timeMs - seconds * 1000));
+    } else {
+        snprintf(text + length, size - length, "Z");
+    }
+}
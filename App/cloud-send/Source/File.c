@@ -26,11 +26,14 @@ int File_Read(const char *file, char *data, size_t bufferSize)
 
     memset(data, 0, bufferSize);
 
+    /* A file that does not fit is an error, a reading cut off is not worth sending */
     while ((ch = fgetc(fptr)) != EOF) {
-        data[n] = (char)ch;
-        if (++n == bufferSize - 1) {
-            break;
+        if (n == bufferSize - 1) {
+            fclose(fptr);
+            return -1;
         }
+
+        data[n++] = (char)ch;
     }
 
     /* Add null terminator at the end, just in case the buffer is dirty. */
@@ -48,12 +51,30 @@ int File_ReadList(const char *listFile, FileInfo *files, int maxFileCount)
 
     while (fgets(file, sizeof(file), fptr)) {
         size_t len = strlen(file);
+        char *name = file;
 
         if (file[len - 1] == '\n') {
             file[len - 1] = '\0';
         }
 
-        strncpy(files[fileCount].filename, file, FILE_MAX_STRING_LENGTH - 1);
+        memset(&files[fileCount], 0, sizeof(FileInfo));
+
+        /* A line may start with an annotation in brackets, e.g. "[high] /path/to/file" */
+        if (name[0] == '[') {
+            char *end = strchr(name, ']');
+
+            if (end) {
+                *end = '\0';
+                strncpy(files[fileCount].annotation, name + 1, FILE_MAX_ANNOTATION_LENGTH - 1);
+                name = end + 1;
+
+                while (*name == ' ' || *name == '\t') {
+                    name++;
+                }
+            }
+        }
+
+        strncpy(files[fileCount].filename, name, FILE_MAX_STRING_LENGTH - 1);
         files[fileCount].sendStatus = false;
         fileCount++;
 
@@ -89,6 +110,6 @@ int File_CleanList(FileInfo *files, int count)
 void FileInfo_SetSendStatus(FileInfo *fileInfo, bool status)
 {
     if (fileInfo) {
-        fileInfo->sendStatus = true;
+        fileInfo->sendStatus = status;
     }
 }
\ No newline at end of file
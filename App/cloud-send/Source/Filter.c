@@ -0,0 +1,301 @@
+#include "Filter.h"
+#include "KeyFields.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <json-c/json.h>
+
+typedef struct sDeadband {
+    char field[FILTER_MAX_FIELD_LENGTH];
+    double band;
+    bool isRelative;
+} Deadband;
+
+typedef enum eValueType {
+    VALUE_TYPE_NONE,
+    VALUE_TYPE_NUMBER,
+    VALUE_TYPE_OTHER,
+} ValueType;
+
+/* Numbers are kept as they are, anything else only as a hash of its JSON text since it is only ever compared for
+ * equality. This keeps every sensor entry the same fixed size. */
+typedef struct sFieldValue {
+    ValueType type;
+    double number;
+    uint64_t hash;
+} FieldValue;
+
+typedef struct sSensor {
+    uint64_t key;
+    bool inUse;
+    uint64_t lastSentMs;
+    FieldValue values[FILTER_MAX_FIELDS];
+} Sensor;
+
+static Deadband mDeadbands[FILTER_MAX_FIELDS];
+static size_t mDeadbandCount = 0;
+static KeyFields mKeyFields;
+static uint64_t mHeartbeatMs = 0;
+static Sensor *mSensors = NULL;
+static json_tokener *mTokener = NULL;
+static FilterStats mStats;
+
+static uint64_t GetSensorKey(json_object *obj);
+static Sensor *FindSensor(uint64_t key, bool *isNew);
+static bool ReadValue(json_object *obj, const char *field, FieldValue *value);
+static bool HasChanged(const Deadband *deadband, const FieldValue *last, const FieldValue *value);
+
+int Filter_Initialize(void)
+{
+    Filter_Deinitialize();
+
+    mSensors = calloc(FILTER_MAX_SENSORS, sizeof(Sensor));
+    mTokener = json_tokener_new();
+
+    if (mSensors == NULL || mTokener == NULL) {
+        Filter_Deinitialize();
+        return -1;
+    }
+
+    return 0;
+}
+
+void Filter_Deinitialize(void)
+{
+    free(mSensors);
+    mSensors = NULL;
+
+    if (mTokener) {
+        json_tokener_free(mTokener);
+        mTokener = NULL;
+    }
+
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+int Filter_SetKeyFields(const char *fields)
+{
+    return KeyFields_Parse(&mKeyFields, fields);
+}
+
+int Filter_AddDeadbands(const char *spec)
+{
+    char buffer[FILTER_MAX_FIELDS * FILTER_MAX_FIELD_LENGTH];
+    char *saveptr = NULL;
+
+    if (spec == NULL || strlen(spec) >= sizeof(buffer)) {
+        return -1;
+    }
+
+    strcpy(buffer, spec);
+
+    /* Entries are "field:band", "field:band%" or just "field", which suppresses only readings that are unchanged */
+    for (char *token = strtok_r(buffer, ", ", &saveptr); token; token = strtok_r(NULL, ", ", &saveptr)) {
+        char *colon = strchr(token, ':');
+        Deadband deadband = {0};
+
+        if (colon) {
+            char *end = NULL;
+            *colon = '\0';
+            deadband.band = strtod(colon + 1, &end);
+
+            if (end == colon + 1 || deadband.band < 0) {
+                return -1;
+            }
+
+            if (*end == '%') {
+                deadband.isRelative = true;
+                end++;
+            }
+
+            if (*end != '\0') {
+                return -1;
+            }
+        }
+
+        if (mDeadbandCount == FILTER_MAX_FIELDS || *token == '\0' || strlen(token) >= FILTER_MAX_FIELD_LENGTH) {
+            return -1;
+        }
+
+        strcpy(deadband.field, token);
+        mDeadbands[mDeadbandCount++] = deadband;
+    }
+
+    return 0;
+}
+
+void Filter_SetHeartbeat(unsigned int seconds)
+{
+    mHeartbeatMs = (uint64_t)seconds * 1000;
+}
+
+bool Filter_IsEnabled(void)
+{
+    return mDeadbandCount > 0 && mSensors != NULL;
+}
+
+FilterResult Filter_Check(const char *payload, size_t size, uint64_t nowMs)
+{
+    if (!Filter_IsEnabled() || payload == NULL) {
+        return FILTER_RESULT_SEND;
+    }
+
+    mStats.readingCount++;
+
+    json_tokener_reset(mTokener);
+    json_object *obj = json_tokener_parse_ex(mTokener, payload, (int)size);
+
+    /* Anything that is not a single JSON object is sent as it is */
+    if (obj == NULL || !json_object_is_type(obj, json_type_object)) {
+        mStats.passThroughCount++;
+        json_object_put(obj);
+        return FILTER_RESULT_SEND;
+    }
+
+    FieldValue values[FILTER_MAX_FIELDS];
+    size_t presentCount = 0;
+
+    for (size_t i = 0; i < mDeadbandCount; i++) {
+        presentCount += ReadValue(obj, mDeadbands[i].field, &values[i]);
+    }
+
+    bool isNew = false;
+    Sensor *sensor = presentCount ? FindSensor(GetSensorKey(obj), &isNew) : NULL;
+    json_object_put(obj);
+
+    /* Readings without any of the filtered fields, or beyond the number of sensors that can be tracked, are sent */
+    if (sensor == NULL) {
+        mStats.passThroughCount++;
+        return FILTER_RESULT_SEND;
+    }
+
+    bool changed = isNew;
+
+    for (size_t i = 0; i < mDeadbandCount && !changed; i++) {
+        changed = HasChanged(&mDeadbands[i], &sensor->values[i], &values[i]);
+    }
+
+    if (!changed && mHeartbeatMs && nowMs - sensor->lastSentMs >= mHeartbeatMs) {
+        changed = true;
+        mStats.heartbeatCount++;
+    }
+
+    if (!changed) {
+        mStats.suppressedCount++;
+        mStats.suppressedBytes += size;
+        return FILTER_RESULT_SUPPRESS;
+    }
+
+    /* The deadband is measured from the last value sent, so a slow drift is still reported once it adds up */
+    for (size_t i = 0; i < mDeadbandCount; i++) {
+        if (values[i].type != VALUE_TYPE_NONE) {
+            sensor->values[i] = values[i];
+        }
+    }
+
+    sensor->lastSentMs = nowMs;
+    return FILTER_RESULT_SEND;
+}
+
+void Filter_GetStats(FilterStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+    }
+}
+
+static uint64_t GetSensorKey(json_object *obj)
+{
+    uint64_t key = KEYFIELDS_HASH_SEED;
+
+    /* Without key fields all readings belong to one sensor */
+    for (size_t i = 0; i < mKeyFields.count; i++) {
+        json_object *value = NULL;
+        const char *text = "";
+
+        if (json_object_object_get_ex(obj, mKeyFields.names[i], &value) && value) {
+            text = json_object_get_string(value);
+        }
+
+        key = KeyFields_Hash(key, text, strlen(text) + 1);
+    }
+
+    return key;
+}
+
+/* Open addressing with linear probing; entries are never removed */
+static Sensor *FindSensor(uint64_t key, bool *isNew)
+{
+    size_t index = (size_t)(key % FILTER_MAX_SENSORS);
+
+    for (size_t i = 0; i < FILTER_MAX_SENSORS; i++) {
+        Sensor *sensor = &mSensors[(index + i) % FILTER_MAX_SENSORS];
+
+        if (sensor->inUse && sensor->key == key) {
+            *isNew = false;
+            return sensor;
+        }
+
+        if (!sensor->inUse) {
+            /* Keep the table at most three quarters full so probes stay short */
+            if (mStats.sensorCount >= FILTER_MAX_SENSORS * 3 / 4) {
+                break;
+            }
+
+            memset(sensor, 0, sizeof(Sensor));
+            sensor->inUse = true;
+            sensor->key = key;
+            mStats.sensorCount++;
+            *isNew = true;
+            return sensor;
+        }
+    }
+
+    mStats.sensorOverflowCount++;
+    return NULL;
+}
+
+static bool ReadValue(json_object *obj, const char *field, FieldValue *value)
+{
+    json_object *member = NULL;
+
+    memset(value, 0, sizeof(FieldValue));
+
+    if (!json_object_object_get_ex(obj, field, &member)) {
+        return false;
+    }
+
+    if (json_object_is_type(member, json_type_double) || json_object_is_type(member, json_type_int)) {
+        value->type = VALUE_TYPE_NUMBER;
+        value->number = json_object_get_double(member);
+    } else {
+        const char *text = json_object_to_json_string_ext(member, JSON_C_TO_STRING_PLAIN);
+        value->type = VALUE_TYPE_OTHER;
+        value->hash = KeyFields_Hash(KEYFIELDS_HASH_SEED, text, strlen(text));
+    }
+
+    return true;
+}
+
+static bool HasChanged(const Deadband *deadband, const FieldValue *last, const FieldValue *value)
+{
+    /* A field missing from this reading says nothing about a change */
+    if (value->type == VALUE_TYPE_NONE) {
+        return false;
+    }
+
+    if (value->type != last->type) {
+        return true;
+    }
+
+    if (value->type == VALUE_TYPE_OTHER) {
+        return value->hash != last->hash;
+    }
+
+    double band = deadband->isRelative ? fabs(last->number) * deadband->band / 100.0 : deadband->band;
+    double delta = fabs(value->number - last->number);
+
+    /* A band of zero reports every change */
+    return band > 0 ? delta >= band : delta > 0;
+}
@@ -0,0 +1,39 @@
+#include "KeyFields.h"
+#include <string.h>
+
+#define FNV_PRIME 0x100000001b3ull
+
+/* Takes a comma or space separated list of member names; the previous list is replaced even if the new one fails */
+int KeyFields_Parse(KeyFields *keyFields, const char *fields)
+{
+    char buffer[KEYFIELDS_MAX_COUNT * KEYFIELDS_MAX_LENGTH];
+    char *saveptr = NULL;
+
+    if (keyFields == NULL || fields == NULL || strlen(fields) >= sizeof(buffer)) {
+        return -1;
+    }
+
+    strcpy(buffer, fields);
+    keyFields->count = 0;
+
+    for (char *token = strtok_r(buffer, ", ", &saveptr); token; token = strtok_r(NULL, ", ", &saveptr)) {
+        if (keyFields->count == KEYFIELDS_MAX_COUNT || strlen(token) >= KEYFIELDS_MAX_LENGTH) {
+            return -1;
+        }
+
+        strcpy(keyFields->names[keyFields->count++], token);
+    }
+
+    return 0;
+}
+
+/* FNV-1a; start with KEYFIELDS_HASH_SEED and pass the result back in to hash several pieces as one */
+uint64_t KeyFields_Hash(uint64_t hash, const char *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
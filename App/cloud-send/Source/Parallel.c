@@ -0,0 +1,233 @@
+#include "Parallel.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/* The items are split into one contiguous shard per worker. A shard is a range packed into one word, the next item
+ * in the upper and the end in the lower half, so it is claimed from with a single compare and swap. The owner takes
+ * from the front and keeps the order of the list, workers whose own shard has drained steal from the back. */
+typedef struct sParallelShard {
+    uint64_t range;
+} __attribute__((aligned(64))) ParallelShard;
+
+typedef struct sParallelState {
+    ParallelShard shards[PARALLEL_MAX_WORKERS];
+    ParallelWorkerStats stats[PARALLEL_MAX_WORKERS];
+} ParallelState;
+
+static ParallelState *mState = NULL;
+static size_t mWorkerCount = 0;
+static size_t mWorkerIndex = 0;
+static bool mIsWorker = false;
+static pid_t mWorkers[PARALLEL_MAX_WORKERS];
+static size_t mStartedCount = 0;
+
+static bool ClaimFront(ParallelShard *shard, size_t *item);
+static bool ClaimBack(ParallelShard *shard, size_t *item);
+
+int Parallel_Initialize(size_t workerCount, size_t itemCount)
+{
+    if (workerCount == 0 || workerCount > PARALLEL_MAX_WORKERS || itemCount > UINT32_MAX) {
+        return -1;
+    }
+
+    /* Anonymous shared memory survives fork, so every worker sees the same shards */
+    void *map = mmap(NULL, sizeof(ParallelState), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    mState = (ParallelState *)map;
+    memset(mState, 0, sizeof(ParallelState));
+
+    for (size_t i = 0; i < workerCount; i++) {
+        uint64_t start = itemCount * i / workerCount;
+        uint64_t end = itemCount * (i + 1) / workerCount;
+        mState->shards[i].range = (start << 32) | end;
+    }
+
+    mWorkerCount = workerCount;
+    mStartedCount = 0;
+    mIsWorker = false;
+    return 0;
+}
+
+void Parallel_Deinitialize(void)
+{
+    if (mState) {
+        munmap(mState, sizeof(ParallelState));
+        mState = NULL;
+    }
+
+    mWorkerCount = 0;
+    mStartedCount = 0;
+}
+
+/* Returns in every worker with its index set, and once in the coordinator after all workers were started */
+ParallelRole Parallel_Start(void)
+{
+    if (mState == NULL) {
+        return PARALLEL_ROLE_FAILED;
+    }
+
+    /* Anything still buffered would otherwise be printed once per worker */
+    fflush(stdout);
+
+    for (size_t i = 0; i < mWorkerCount; i++) {
+        pid_t pid = fork();
+
+        if (pid == 0) {
+            mIsWorker = true;
+            mWorkerIndex = i;
+            mStartedCount = 0;
+            return PARALLEL_ROLE_WORKER;
+        }
+
+        if (pid < 0) {
+            printf("Failed to start worker %zu\n", i);
+            Parallel_Stop();
+            Parallel_Wait();
+            return PARALLEL_ROLE_FAILED;
+        }
+
+        mWorkers[mStartedCount++] = pid;
+    }
+
+    return PARALLEL_ROLE_COORDINATOR;
+}
+
+size_t Parallel_GetWorkerCount(void)
+{
+    return mWorkerCount;
+}
+
+size_t Parallel_GetWorkerIndex(void)
+{
+    return mWorkerIndex;
+}
+
+bool Parallel_IsWorker(void)
+{
+    return mIsWorker;
+}
+
+bool Parallel_Claim(size_t *item)
+{
+    if (!mIsWorker) {
+        return false;
+    }
+
+    ParallelWorkerStats *stats = &mState->stats[mWorkerIndex];
+
+    if (ClaimFront(&mState->shards[mWorkerIndex], item)) {
+        stats->claimCount++;
+        return true;
+    }
+
+    /* Starting with the next worker spreads the thieves over the shards that are left */
+    for (size_t i = 1; i < mWorkerCount; i++) {
+        if (ClaimBack(&mState->shards[(mWorkerIndex + i) % mWorkerCount], item)) {
+            stats->claimCount++;
+            stats->stolenCount++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Parallel_Report(const ParallelWorkerStats *stats)
+{
+    if (!mIsWorker) {
+        return;
+    }
+
+    ParallelWorkerStats *slot = &mState->stats[mWorkerIndex];
+    size_t claimCount = slot->claimCount;
+    size_t stolenCount = slot->stolenCount;
+
+    *slot = *stats;
+    slot->claimCount = claimCount;
+    slot->stolenCount = stolenCount;
+    slot->isReported = true;
+}
+
+/* Returns 0 once every worker has exited with 0 */
+int Parallel_Wait(void)
+{
+    int res = 0;
+
+    for (size_t i = 0; i < mStartedCount; i++) {
+        int status = 0;
+
+        while (waitpid(mWorkers[i], &status, 0) < 0) {
+            if (errno != EINTR) {
+                status = -1;
+                break;
+            }
+        }
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            res = -1;
+        }
+    }
+
+    mStartedCount = 0;
+    return res;
+}
+
+/* Only calls kill(), so this is safe from a signal handler */
+void Parallel_Stop(void)
+{
+    Parallel_Signal(SIGINT);
+}
+
+/* Passes a signal of the coordinator on to the workers */
+void Parallel_Signal(int signum)
+{
+    for (size_t i = 0; !mIsWorker && i < mStartedCount; i++) {
+        kill(mWorkers[i], signum);
+    }
+}
+
+void Parallel_GetWorkerStats(size_t worker, ParallelWorkerStats *stats)
+{
+    if (stats && mState && worker < mWorkerCount) {
+        *stats = mState->stats[worker];
+    }
+}
+
+static bool ClaimFront(ParallelShard *shard, size_t *item)
+{
+    uint64_t range = __atomic_load_n(&shard->range, __ATOMIC_ACQUIRE);
+
+    while ((range >> 32) < (range & UINT32_MAX)) {
+        if (__atomic_compare_exchange_n(&shard->range, &range, range + (1ull << 32), false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            *item = (size_t)(range >> 32);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool ClaimBack(ParallelShard *shard, size_t *item)
+{
+    uint64_t range = __atomic_load_n(&shard->range, __ATOMIC_ACQUIRE);
+
+    while ((range >> 32) < (range & UINT32_MAX)) {
+        if (__atomic_compare_exchange_n(&shard->range, &range, range - 1, false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            *item = (size_t)(range & UINT32_MAX) - 1;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,310 @@
+#include "Scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fnmatch.h>
+
+typedef enum eRuleType {
+    RULE_TYPE_PATTERN,
+    RULE_TYPE_DIRECTORY,
+} RuleType;
+
+typedef struct sRule {
+    RuleType type;
+    SchedulerLane lane;
+    char value[FILE_MAX_STRING_LENGTH];
+} Rule;
+
+typedef struct sLaneQueue {
+    FileInfo **items;
+    size_t head;
+    size_t count;
+    int weight;
+    int current;
+} LaneQueue;
+
+static const char *mLaneNames[SCHEDULER_LANE_COUNT] = {"high", "normal", "low"};
+static const int mDefaultWeights[SCHEDULER_LANE_COUNT] = {8, 3, 1};
+
+static LaneQueue mLanes[SCHEDULER_LANE_COUNT];
+static SchedulerLaneStats mStats[SCHEDULER_LANE_COUNT];
+static Rule mRules[SCHEDULER_MAX_RULES];
+static size_t mRuleCount = 0;
+static size_t mCapacity = 0;
+
+static int AddRule(RuleType type, SchedulerLane lane, const char *value);
+static bool MatchRule(const Rule *rule, const char *filename);
+
+int Scheduler_Initialize(size_t capacity)
+{
+    Scheduler_Deinitialize();
+
+    for (size_t i = 0; i < SCHEDULER_LANE_COUNT; i++) {
+        mLanes[i].items = calloc(capacity, sizeof(FileInfo *));
+
+        if (mLanes[i].items == NULL) {
+            Scheduler_Deinitialize();
+            return -1;
+        }
+
+        mLanes[i].weight = mDefaultWeights[i];
+    }
+
+    mCapacity = capacity;
+    return 0;
+}
+
+void Scheduler_Deinitialize(void)
+{
+    for (size_t i = 0; i < SCHEDULER_LANE_COUNT; i++) {
+        free(mLanes[i].items);
+    }
+
+    memset(mLanes, 0, sizeof(mLanes));
+    memset(mStats, 0, sizeof(mStats));
+    mCapacity = 0;
+}
+
+int Scheduler_SetWeights(const char *weights)
+{
+    int values[SCHEDULER_LANE_COUNT];
+
+    if (weights == NULL ||
+        sscanf(weights, "%d , %d , %d", &values[0], &values[1], &values[2]) != SCHEDULER_LANE_COUNT) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < SCHEDULER_LANE_COUNT; i++) {
+        if (values[i] <= 0) {
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < SCHEDULER_LANE_COUNT; i++) {
+        mLanes[i].weight = values[i];
+        mLanes[i].current = 0;
+    }
+
+    return 0;
+}
+
+int Scheduler_AddPatterns(SchedulerLane lane, const char *patterns)
+{
+    char buffer[FILE_MAX_STRING_LENGTH];
+    char *saveptr = NULL;
+    int res = 0;
+
+    if (patterns == NULL || strlen(patterns) >= sizeof(buffer)) {
+        return -1;
+    }
+
+    strcpy(buffer, patterns);
+
+    for (char *token = strtok_r(buffer, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr)) {
+        while (*token == ' ') {
+            token++;
+        }
+
+        if (*token) {
+            res |= AddRule(RULE_TYPE_PATTERN, lane, token);
+        }
+    }
+
+    return res;
+}
+
+int Scheduler_AddDirectory(SchedulerLane lane, const char *directory)
+{
+    return AddRule(RULE_TYPE_DIRECTORY, lane, directory);
+}
+
+int Scheduler_ParseLane(const char *name, SchedulerLane *lane)
+{
+    for (size_t i = 0; name && i < SCHEDULER_LANE_COUNT; i++) {
+        if (strcasecmp(mLaneNames[i], name) == 0) {
+            if (lane) {
+                *lane = (SchedulerLane)i;
+            }
+
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+const char *Scheduler_GetLaneName(SchedulerLane lane)
+{
+    return lane < SCHEDULER_LANE_COUNT ? mLaneNames[lane] : "unknown";
+}
+
+SchedulerLane Scheduler_Classify(const FileInfo *file)
+{
+    SchedulerLane lane;
+
+    /* An annotation in the list file wins over directory and pattern rules */
+    if (file->annotation[0] && Scheduler_ParseLane(file->annotation, &lane) == 0) {
+        return lane;
+    }
+
+    for (size_t i = 0; i < mRuleCount; i++) {
+        if (MatchRule(&mRules[i], file->filename)) {
+            return mRules[i].lane;
+        }
+    }
+
+    return SCHEDULER_LANE_NORMAL;
+}
+
+int Scheduler_Enqueue(FileInfo *file, uint64_t nowMs)
+{
+    SchedulerLane lane = Scheduler_Classify(file);
+    LaneQueue *queue = &mLanes[lane];
+
+    if (queue->count == mCapacity) {
+        return -1;
+    }
+
+    queue->items[(queue->head + queue->count) % mCapacity] = file;
+    queue->count++;
+
+    file->lane = lane;
+    file->enqueueTimeMs = nowMs;
+    file->dispatchTimeMs = 0;
+    mStats[lane].enqueueCount++;
+    return 0;
+}
+
+FileInfo *Scheduler_Next(uint64_t nowMs)
+{
+    LaneQueue *selected = NULL;
+    int totalWeight = 0;
+
+    /* Smooth weighted round robin over the lanes that have work, so a busy low lane still gets its share without
+     * ever delaying high priority files by more than a few sends */
+    for (size_t i = 0; i < SCHEDULER_LANE_COUNT; i++) {
+        LaneQueue *queue = &mLanes[i];
+
+        if (queue->count == 0) {
+            continue;
+        }
+
+        queue->current += queue->weight;
+        totalWeight += queue->weight;
+
+        if (selected == NULL || queue->current > selected->current) {
+            selected = queue;
+        }
+    }
+
+    if (selected == NULL) {
+        return NULL;
+    }
+
+    selected->current -= totalWeight;
+
+    FileInfo *file = selected->items[selected->head];
+    selected->head = (selected->head + 1) % mCapacity;
+    selected->count--;
+
+    if (selected->count == 0) {
+        selected->current = 0;
+    }
+
+    uint64_t queueMs = nowMs - file->enqueueTimeMs;
+    SchedulerLaneStats *stats = &mStats[file->lane];
+    stats->totalQueueMs += queueMs;
+
+    if (queueMs > stats->maxQueueMs) {
+        stats->maxQueueMs = queueMs;
+    }
+
+    file->dispatchTimeMs = nowMs;
+    return file;
+}
+
+size_t Scheduler_GetQueuedCount(void)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < SCHEDULER_LANE_COUNT; i++) {
+        count += mLanes[i].count;
+    }
+
+    return count;
+}
+
+void Scheduler_Complete(FileInfo *file, bool success, uint64_t nowMs)
+{
+    if (file == NULL || file->lane < 0 || file->lane >= SCHEDULER_LANE_COUNT) {
+        return;
+    }
+
+    SchedulerLaneStats *stats = &mStats[file->lane];
+    uint64_t latencyMs = nowMs - file->enqueueTimeMs;
+
+    if (success) {
+        stats->successCount++;
+    } else {
+        stats->failCount++;
+    }
+
+    stats->totalLatencyMs += latencyMs;
+
+    if (latencyMs > stats->maxLatencyMs) {
+        stats->maxLatencyMs = latencyMs;
+    }
+}
+
+void Scheduler_GetLaneStats(SchedulerLane lane, SchedulerLaneStats *stats)
+{
+    if (stats && lane < SCHEDULER_LANE_COUNT) {
+        *stats = mStats[lane];
+    }
+}
+
+static int AddRule(RuleType type, SchedulerLane lane, const char *value)
+{
+    if (mRuleCount == SCHEDULER_MAX_RULES || value == NULL || strlen(value) == 0 ||
+        strlen(value) >= FILE_MAX_STRING_LENGTH) {
+        return -1;
+    }
+
+    Rule *rule = &mRules[mRuleCount++];
+    rule->type = type;
+    rule->lane = lane;
+    strcpy(rule->value, value);
+
+    /* Directory rules match on a path prefix, store them with exactly one trailing slash, "/" included */
+    if (type == RULE_TYPE_DIRECTORY) {
+        size_t len = strlen(rule->value);
+
+        while (len > 0 && rule->value[len - 1] == '/') {
+            rule->value[--len] = '\0';
+        }
+
+        if (len + 1 < FILE_MAX_STRING_LENGTH) {
+            strcat(rule->value, "/");
+        }
+    }
+
+    return 0;
+}
+
+static bool MatchRule(const Rule *rule, const char *filename)
+{
+    if (rule->type == RULE_TYPE_DIRECTORY) {
+        return strncmp(filename, rule->value, strlen(rule->value)) == 0;
+    }
+
+    /* Patterns without a slash match the file name only, others match the whole path */
+    const char *subject = filename;
+
+    if (strchr(rule->value, '/') == NULL) {
+        const char *slash = strrchr(filename, '/');
+        subject = slash ? slash + 1 : filename;
+    }
+
+    return fnmatch(rule->value, subject, 0) == 0;
+}
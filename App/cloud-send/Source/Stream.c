@@ -0,0 +1,189 @@
+#include "Stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+static char *mBuffer = NULL;
+static size_t mStart = 0;
+static size_t mEnd = 0;
+static int mFd = -1;
+static bool mIsFifo = false;
+static bool mIsDiscarding = false;
+static bool mIsEnd = false;
+static StreamStats mStats;
+
+static StreamResult Next(const char **record, size_t *size, bool canRead);
+static int Fill(void);
+
+int Stream_Open(const char *path)
+{
+    Stream_Close();
+
+    if (path == NULL) {
+        mFd = STDIN_FILENO;
+    } else {
+        struct stat st;
+        mIsFifo = stat(path, &st) == 0 && S_ISFIFO(st.st_mode);
+
+        /* A FIFO is opened for writing as well, so there always is a writer: the open does not wait for the first
+         * one, and when the last one closes the FIFO reads as empty rather than at its end, instead of waking poll()
+         * over and over */
+        mFd = open(path, (mIsFifo ? O_RDWR : O_RDONLY) | O_NONBLOCK);
+
+        if (mFd < 0) {
+            mIsFifo = false;
+            return -1;
+        }
+    }
+
+    mBuffer = malloc(STREAM_BUFFER_SIZE);
+
+    if (mBuffer == NULL) {
+        Stream_Close();
+        return -1;
+    }
+
+    return 0;
+}
+
+void Stream_Close(void)
+{
+    if (mFd > STDIN_FILENO) {
+        close(mFd);
+    }
+
+    free(mBuffer);
+    mBuffer = NULL;
+    mFd = -1;
+    mStart = 0;
+    mEnd = 0;
+    mIsFifo = false;
+    mIsDiscarding = false;
+    mIsEnd = false;
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+StreamResult Stream_Next(const char **record, size_t *size)
+{
+    return Next(record, size, true);
+}
+
+/* Returns the complete records that were read from the stream but not taken yet, without reading any further */
+StreamResult Stream_NextBuffered(const char **record, size_t *size)
+{
+    return Next(record, size, false);
+}
+
+bool Stream_IsFifo(void)
+{
+    return mIsFifo;
+}
+
+void Stream_GetStats(StreamStats *stats)
+{
+    if (stats) {
+        *stats = mStats;
+    }
+}
+
+static StreamResult Next(const char **record, size_t *size, bool canRead)
+{
+    if (mFd < 0 || record == NULL || size == NULL) {
+        return STREAM_RESULT_ERROR;
+    }
+
+    for (;;) {
+        char *newline = memchr(mBuffer + mStart, '\n', mEnd - mStart);
+
+        if (newline) {
+            char *line = mBuffer + mStart;
+            size_t len = (size_t)(newline - line);
+            mStart += len + 1;
+
+            /* The tail of a record that did not fit in the buffer is dropped together with its head */
+            if (mIsDiscarding) {
+                mIsDiscarding = false;
+                continue;
+            }
+
+            if (len == 0 || (len == 1 && line[0] == '\r')) {
+                continue;
+            }
+
+            *newline = '\0';
+            *record = line;
+            *size = len;
+            mStats.recordCount++;
+            return STREAM_RESULT_RECORD;
+        }
+
+        if (mIsEnd) {
+            /* A last record without a trailing new line still counts */
+            if (mEnd > mStart && !mIsDiscarding) {
+                *record = mBuffer + mStart;
+                *size = mEnd - mStart;
+                mBuffer[mEnd] = '\0';
+                mStart = mEnd;
+                mStats.recordCount++;
+                return STREAM_RESULT_RECORD;
+            }
+
+            return STREAM_RESULT_END;
+        }
+
+        int res = canRead ? Fill() : 0;
+
+        if (res <= 0) {
+            return res == 0 ? STREAM_RESULT_AGAIN : STREAM_RESULT_ERROR;
+        }
+    }
+}
+
+/* Reads what is available without blocking. Returns the number of bytes read, 0 when nothing is available yet and
+ * -1 on error. */
+static int Fill(void)
+{
+    /* Move the partial record to the front so the read can use the rest of the buffer */
+    if (mStart > 0) {
+        memmove(mBuffer, mBuffer + mStart, mEnd - mStart);
+        mEnd -= mStart;
+        mStart = 0;
+    }
+
+    /* One byte is kept for the terminator of a last record without a new line */
+    if (mEnd == STREAM_BUFFER_SIZE - 1) {
+        if (!mIsDiscarding) {
+            mIsDiscarding = true;
+            mStats.droppedCount++;
+        }
+
+        mEnd = 0;
+    }
+
+    struct pollfd pfd = {mFd, POLLIN, 0};
+
+    if (poll(&pfd, 1, 0) <= 0 || (pfd.revents & (POLLIN | POLLHUP)) == 0) {
+        return 0;
+    }
+
+    ssize_t n = read(mFd, mBuffer + mEnd, STREAM_BUFFER_SIZE - 1 - mEnd);
+    mStats.readCount++;
+
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+
+    if (n == 0) {
+        mIsEnd = true;
+        return 1;
+    }
+
+    mEnd += (size_t)n;
+    mStats.byteCount += (uint64_t)n;
+    return (int)n;
+}
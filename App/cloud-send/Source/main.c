@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
@@ -8,40 +9,154 @@
 #include <time.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/signalfd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 #include "Cloud.h"
 #include "File.h"
+#include "Scheduler.h"
+#include "Batcher.h"
+#include "Stream.h"
+#include "Ring.h"
+#include "Filter.h"
+#include "Aggregator.h"
+#include "Encoder.h"
+#include "Parallel.h"
+#include "Claim.h"
+#include "Clock.h"
+#include "Metrics.h"
+#include "Config.h"
+#include "TlsSession.h"
 
 #define MAX_FILE_COUNT 1024
 #define DEFAULT_CONFIGURATION_PATH "/etc/cloud-apps/cloud.conf"
+#define RATE_LIMIT_TIER_LENGTH 8
+#define DEFAULT_RETRY_TIMEOUT_SECONDS 300
+#define DEFAULT_IN_FLIGHT_WINDOW 32
+#define SCHEDULER_FEED_DEPTH 4
+#define PARALLEL_CLAIM_DEPTH 8
+#define DEFAULT_DRAIN_TIMEOUT_SECONDS 10
+#define DRAIN_FILE_LENGTH 256
+#define ENCODING_NAME_LENGTH 8
 
 typedef void (*SignalHandler_t)(int);
 
-typedef struct sConfigurationSetting {
-    char *name;
-    char *value;
-} ConfigurationSetting;
+/* The JSON of an encoded message that is sent without a batch, passed as its context */
+typedef struct sRecordCopy {
+    size_t size;
+    char data[];
+} RecordCopy;
 
 static bool mExit = false;
 static int mExitCode;
 static bool mOptionFileSpecified = false;
 static bool mOptionListSpecified = false;
+static bool mOptionStreamSpecified = false;
+static const char *mStreamPath = NULL;
+static bool mOptionRingSpecified = false;
+static const char *mRingPath = NULL;
+static bool mOptionTransportSpecified = false;
+static CloudTransport mOptionTransport = CLOUD_TRANSPORT_MQTT;
+static size_t mParallelCount = 1;
+static bool mOptionClaimSpecified = false;
+static unsigned int mClaimLeaseSeconds = CLAIM_DEFAULT_LEASE_SECONDS;
+static bool mIsClaimDrained = false;
+static uint64_t mSendStartMs = 0;
+static Ring mRing;
 static FileInfo mFiles[MAX_FILE_COUNT];
 static int mFileCount = 0;
 static int mFilesInProgressCount = 0;
 static int mFileSendSuccessCount = 0;
 static int mFileSendFailCount = 0;
+static int mFileSubmitCount = 0;
+static int mFileAbsorbCount = 0;
+static int mFileMissCount = 0;
+static size_t mInFlightWindow = DEFAULT_IN_FLIGHT_WINDOW;
+static BatcherParams mBatcherParams;
 static bool mDisableCleanup = false;
 static CloudConnectionStatus mConnectionStatus = CLOUD_CONNECTION_DISCONNECTED_UNKNOWN;
-static char mStringData[512];
+static char *mStringData = NULL;
+static size_t mStringDataSize = 0;
 static CloudConnectParams mCloudConnectParams;
+static RateLimiterParams mRateLimiterParams;
+static char mRateLimitTier[RATE_LIMIT_TIER_LENGTH];
+static unsigned int mRateLimitUnits = 1;
+static MetricsParams mMetricsParams;
+static int mSignalFd = -1;
+static bool mIsDraining = false;
+static uint64_t mDrainDeadlineMs = 0;
+static unsigned int mDrainTimeoutSeconds = DEFAULT_DRAIN_TIMEOUT_SECONDS;
+static char mDrainFile[DRAIN_FILE_LENGTH];
+static int mDrainFd = -1;
+static char mReplayPath[DRAIN_FILE_LENGTH + 8];
+static FILE *mReplayFile = NULL;
+static char *mReplayLine = NULL;
+static size_t mReplayLineSize = 0;
+static size_t mKeptCount = 0;
+static size_t mLostCount = 0;
+static const char *mConfigPath = NULL;
+static char mEncoding[ENCODING_NAME_LENGTH] = "json";
+static unsigned int mAggregateWindowSeconds = 0;
+static unsigned int mHeartbeatSeconds = 0;
+static bool mIsLogTraceOn = true;
+static unsigned int mTwinReportIntervalSeconds = CLOUD_DEFAULT_REPORT_INTERVAL_SECONDS;
+static char mTlsSessionDirectory[TLSSESSION_MAX_PATH_LENGTH];
 
 static int ParseArguments(int argc, char *argv[]);
 static int ReadConfigurationFile(const char *filename);
 static int ParseConfigFile(const char *filename);
+static int HandleConfigurationSetting(ConfigurationSetting *setting, void *context);
 static int ValidateConfigurationSetting(ConfigurationSetting *setting);
 static void ProcessConfigurationSetting(ConfigurationSetting *setting, CloudConnectParams *params);
+static int SetCredential(CredentialHandle *handle, const char *filename);
+static void ReloadConfiguration(void);
+static void TuneSetting(CloudTuningSetting *tuning);
+static int ParseTransport(const char *value, void *result);
+static int ParseRetryPolicy(const char *value, void *result);
+static int CheckRateLimitTier(const char *value, void *result);
+static int CheckEncoding(const char *value, void *result);
+static int ApplyRateLimit(void);
+static int ApplyConnection(void);
+static int ApplyBatching(void);
+static int ApplyPipeline(void);
+static bool IsTerminalConnectionStatus(CloudConnectionStatus status);
+static void SendScheduledFiles(void);
+static int ReadReading(const char *filename);
+static void ClaimFiles(void);
+static bool HasQueuedFiles(void);
+static void ResolveClaim(FileInfo *file, bool success);
+static size_t GetIdentityCount(void);
+static void SelectIdentity(size_t worker);
+static const char *GetNextLine(const char *line);
+static int RunCoordinator(ParallelRole role);
+static int ReportWorkerStats(void);
+static void SendStreamRecords(void);
+static void SendRingRecords(void);
+static void CompleteRecord(bool success);
+static bool AbsorbReading(const char *data, size_t size);
+static void SendAggregates(void);
+static bool EncodeMessage(const void **data, size_t *size, CloudMessageOptions *options);
+static RecordCopy *CopyRecord(const char *record, size_t size);
+static CloudPriority LaneToPriority(SchedulerLane lane);
+static void BatchFlushHandler(Batch *batch);
+static void CompleteBatch(Batch *batch, bool success);
+static int ProcessLaneSetting(ConfigurationSetting *setting);
 static void RegisterSignalHandler(SignalHandler_t signalHandler);
 static void SignalHandler(int signum);
+static int OpenSignalFd(void);
+static void HandleSignals(void);
+static void StartDrain(void);
+static void Drain(void);
+static void KeepUnsentMessage(const void *data, size_t size, const char *contentType, void *contextData);
+static void KeepRecord(const char *record, size_t size);
+static void KeepRemainingRecords(void);
+static void OpenKeptRecords(void);
+static bool ReplayKeptRecords(void);
+static void CloseKeptRecords(void);
+static int InitializeMetrics(void);
+static void AddWorkerIndex(char *path, size_t size, size_t worker);
+static void CollectMetrics(void);
 static void CloudEventHandler(CloudEvent evt, void *data);
 static void msleep(unsigned int milliseconds);
 
@@ -55,34 +170,168 @@ typedef enum eAppState {
 static AppState mState = APP_STATE_IDLE;
 static void AppStateMachine(void);
 static void ExitAction(int exitCode);
+static void PrintRateLimitStats(void);
+static void PrintSendStats(void);
+static void PrintTlsStats(void);
+static void PrintLaneStats(void);
+static void PrintBatchStats(void);
+static void PrintStreamStats(void);
+static void PrintFilterStats(void);
+static void PrintAggregateStats(void);
+static void PrintEncoderStats(void);
+static void PrintParallelStats(void);
+static void PrintClaimStats(void);
 static void CleanUp(void);
 
+/* Settings with a plain type. The reloadable ones are applied to the running connection when the configuration file
+ * changes or on SIGHUP, and may be tuned through the device twin; the others take effect on the next start. Everything
+ * else, e.g. credentials and the rules of the pipeline, is handled by ValidateConfigurationSetting() at start only. */
+static const ConfigField mConfigSchema[] = {
+    {"RateLimitTier", CONFIG_TYPE_STRING, mRateLimitTier, sizeof(mRateLimitTier), CheckRateLimitTier, ApplyRateLimit,
+     true},
+    {"RateLimitUnits", CONFIG_TYPE_UINT, &mRateLimitUnits, 0, NULL, ApplyRateLimit, true},
+    {"MessagesPerSecond", CONFIG_TYPE_DOUBLE, &mRateLimiterParams.messagesPerSecond, 0, NULL, ApplyRateLimit, true},
+    {"BytesPerSecond", CONFIG_TYPE_DOUBLE, &mRateLimiterParams.bytesPerSecond, 0, NULL, ApplyRateLimit, true},
+    {"DailyMessageBudget", CONFIG_TYPE_ULONG, &mRateLimiterParams.dailyMessageBudget, 0, NULL, ApplyRateLimit, true},
+    {"InFlightWindow", CONFIG_TYPE_SIZE, &mInFlightWindow, 0, NULL, ApplyConnection, true},
+    {"LogTrace", CONFIG_TYPE_SWITCH, &mIsLogTraceOn, 0, NULL, ApplyConnection, true},
+    {"TwinReportIntervalSeconds", CONFIG_TYPE_UINT, &mTwinReportIntervalSeconds, 0, NULL, ApplyConnection, true},
+    {"LingerMs", CONFIG_TYPE_UINT, &mBatcherParams.lingerMs, 0, NULL, ApplyBatching, true},
+    {"LatencyBudgetMs", CONFIG_TYPE_UINT, &mBatcherParams.latencyBudgetMs, 0, NULL, ApplyBatching, true},
+    {"BatchMaxBytes", CONFIG_TYPE_SIZE, &mBatcherParams.maxBytes, 0, NULL, ApplyBatching, true},
+    {"BatchMaxReadings", CONFIG_TYPE_SIZE, &mBatcherParams.maxReadings, 0, NULL, ApplyBatching, true},
+    /* The encoding is the compression of the payload, see Encoder.h */
+    {"Encoding", CONFIG_TYPE_STRING, mEncoding, sizeof(mEncoding), CheckEncoding, ApplyPipeline, true},
+    {"AggregateWindowSeconds", CONFIG_TYPE_UINT, &mAggregateWindowSeconds, 0, NULL, ApplyPipeline, true},
+    {"HeartbeatSeconds", CONFIG_TYPE_UINT, &mHeartbeatSeconds, 0, NULL, ApplyPipeline, true},
+    {"DrainTimeoutSeconds", CONFIG_TYPE_UINT, &mDrainTimeoutSeconds, 0, NULL, NULL, true},
+    {"Transport", CONFIG_TYPE_PARSED, &mCloudConnectParams.transport, sizeof(CloudTransport), ParseTransport, NULL,
+     false},
+    {"RetryPolicy", CONFIG_TYPE_PARSED, &mCloudConnectParams.retryPolicy, sizeof(CloudRetryPolicy), ParseRetryPolicy,
+     NULL, false},
+    {"RetryTimeoutSeconds", CONFIG_TYPE_SIZE, &mCloudConnectParams.retryTimeoutSeconds, 0, NULL, NULL, false},
+    {"SasTokenLifetimeSeconds", CONFIG_TYPE_SIZE, &mCloudConnectParams.sasTokenLifetimeSeconds, 0, NULL, NULL, false},
+    {"TlsSessionDirectory", CONFIG_TYPE_STRING, mTlsSessionDirectory, sizeof(mTlsSessionDirectory), NULL, NULL, false},
+    {"TwinTuning", CONFIG_TYPE_SWITCH, &mCloudConnectParams.isTuningEnabled, 0, NULL, NULL, false},
+    {"ClaimLeaseSeconds", CONFIG_TYPE_UINT, &mClaimLeaseSeconds, 0, NULL, NULL, false},
+    {"MetricsIntervalSeconds", CONFIG_TYPE_UINT, &mMetricsParams.intervalSeconds, 0, NULL, NULL, false},
+};
+
+#define CONFIG_SCHEMA_COUNT (sizeof(mConfigSchema) / sizeof(mConfigSchema[0]))
+
 int main(int argc, char *argv[])
 {
+    mCloudConnectParams.retryPolicy = CLOUD_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER;
+    mCloudConnectParams.retryTimeoutSeconds = DEFAULT_RETRY_TIMEOUT_SECONDS;
+    mCloudConnectParams.isTuningEnabled = true;
+
+    /* The scheduler, the filter and the aggregator collect their rules while the configuration is parsed */
+    if (Scheduler_Initialize(MAX_FILE_COUNT) != 0 || Filter_Initialize() != 0 || Aggregator_Initialize() != 0 ||
+        Encoder_Initialize() != 0) {
+        return -1;
+    }
+
     /* Process command line arguments. Exit with error if failed. */
     if (ParseArguments(argc, argv) != 0) {
         return -1;
     }
 
+    ApplyPipeline();
+
     /* Register handler to catch system signals such as CTRL+C. */
     RegisterSignalHandler(SignalHandler);
 
+    /* Each worker carries on from here as a cloud-send of its own, with its own connection and event loop, while the
+     * coordinator waits for them. Starting them before the SDK is initialized keeps its state out of the fork. */
+    if (mParallelCount > 1) {
+        ParallelRole role =
+            (Parallel_Initialize(mParallelCount, (size_t)mFileCount) == 0) ? Parallel_Start() : PARALLEL_ROLE_FAILED;
+
+        if (role != PARALLEL_ROLE_WORKER) {
+            return RunCoordinator(role);
+        }
+
+        SelectIdentity(Parallel_GetWorkerIndex());
+    }
+
+    if (OpenSignalFd() != 0) {
+        return -1;
+    }
+
+    if (mConfigPath && Config_Watch(mConfigPath) != 0) {
+        printf("Not watching %s for changes, reload with SIGHUP\n", mConfigPath);
+    }
+
+    if (mOptionClaimSpecified && Claim_Initialize(mClaimLeaseSeconds) != 0) {
+        return -1;
+    }
+
+    /* The identity is final here, each worker keeps the sessions of its own device */
+    if (TlsSession_Configure(mTlsSessionDirectory,
+                             mCloudConnectParams.isX509 ? mCloudConnectParams.cert : mCloudConnectParams.key) != 0) {
+        printf("Not resuming TLS sessions from %s\n", mTlsSessionDirectory);
+    }
+
     if (Cloud_Initialize() != 0) {
         return -1;
     }
 
+    if (InitializeMetrics() != 0) {
+        Cloud_Deinitialize();
+        return -1;
+    }
+
     Cloud_RegisterEventHandler(CloudEventHandler);
+    Cloud_RegisterUnsentHandler(KeepUnsentMessage);
+    ApplyRateLimit();
+    ApplyConnection();
+
+    if (Batcher_Initialize(&mBatcherParams, BatchFlushHandler) != 0) {
+        Cloud_Deinitialize();
+        return -1;
+    }
 
     mExitCode = 0;
 
     while (!mExit) {
-        AppStateMachine();
+        if (mIsDraining) {
+            Drain();
+        } else {
+            AppStateMachine();
+        }
+
         Cloud_Task();
-        msleep(1);
+        Metrics_Task(Clock_GetMs());
+        HandleSignals();
+
+        if (Config_IsChanged()) {
+            ReloadConfiguration();
+        }
+
+        /* Producers wake the ring endpoint up as soon as they commit a record */
+        if (mOptionRingSpecified) {
+            Ring_Wait(&mRing, 1);
+        } else {
+            msleep(1);
+        }
     }
 
+    /* Messages that are still queued or in flight fail here and are kept, together with what was never sent */
     Cloud_Deinitialize();
+    KeepRemainingRecords();
+    Metrics_Deinitialize();
     CleanUp();
+    Claim_Deinitialize();
+    Batcher_Deinitialize();
+    Scheduler_Deinitialize();
+    Stream_Close();
+    RingServer_Close(&mRing);
+    Filter_Deinitialize();
+    Aggregator_Deinitialize();
+    Encoder_Deinitialize();
+    Parallel_Deinitialize();
+    Config_Unwatch();
+    close(mSignalFd);
 
     return mExitCode;
 }
@@ -101,6 +350,21 @@ static void PrintUsage(void)
                                      "\n"
                                      "  -f FILE, --file FILE     File to send.\n"
                                      "  -l FILE, --list FILE     File that contains a list of files to send.\n"
+                                     "  -i, --stdin              Send new line delimited records read from stdin.\n"
+                                     "  -p PATH, --fifo PATH     Send new line delimited records read from a named\n"
+                                     "                           pipe, until interrupted.\n"
+                                     "  -r PATH, --ring PATH     Serve a shared memory ring to local producers on the\n"
+                                     "                           Unix socket PATH and send their records, until\n"
+                                     "                           interrupted.\n"
+                                     "  -t NAME, --transport NAME\n"
+                                     "                           Transport to the IoT Hub: mqtt, mqtt_websocket, amqp,\n"
+                                     "                           amqp_websocket or http. Overrides Transport in the\n"
+                                     "                           configuration file.\n"
+                                     "  -j N, --parallel N       Send the list with N worker processes, each with a\n"
+                                     "                           connection of its own. The connection string file\n"
+                                     "                           needs one line per worker, except for http.\n"
+                                     "  -k, --claim              Claim each file before sending it, so several\n"
+                                     "                           instances can send from the same spool.\n"
                                      "  -g, --no-clean-up        Disable file clean up.\n"
                                      "  -h, --help               Print this message and exit.\n";
     /* clang-format on */
@@ -119,6 +383,12 @@ static int ParseArguments(int argc, char *argv[])
         {"conf-file", required_argument, 0, 'c'},
         {"file", required_argument, 0, 'f'},
         {"list", required_argument, 0, 'l'},
+        {"stdin", no_argument, 0, 'i'},
+        {"fifo", required_argument, 0, 'p'},
+        {"ring", required_argument, 0, 'r'},
+        {"transport", required_argument, 0, 't'},
+        {"parallel", required_argument, 0, 'j'},
+        {"claim", no_argument, 0, 'k'},
         {"no-clean-up", no_argument, 0, 'g'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0},
@@ -128,12 +398,12 @@ static int ParseArguments(int argc, char *argv[])
     int long_index = 0;
     bool connectionStringOk = false;
     bool configFileOk = false;
+    char *end = NULL;
 
-    while ((opt = getopt_long(argc, argv, "c:C:f:l:gh", long_options, &long_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "c:C:f:l:ip:r:t:j:kgh", long_options, &long_index)) != -1) {
         switch (opt) {
             case 'c':
-                if (File_Validate(optarg) == 0 &&
-                    File_Read(optarg, mCloudConnectParams.key, 4096) == 0) {
+                if (File_Validate(optarg) == 0 && SetCredential(&mCloudConnectParams.key, optarg) == 0) {
                     mCloudConnectParams.isX509 = false;
                     connectionStringOk = true;
                 } else {
@@ -174,6 +444,50 @@ static int ParseArguments(int argc, char *argv[])
                 }
                 break;
 
+            case 'i':
+                mOptionStreamSpecified = true;
+                mStreamPath = NULL;
+                break;
+
+            case 'p':
+                if (File_Validate(optarg) == 0) {
+                    mOptionStreamSpecified = true;
+                    mStreamPath = optarg;
+                } else {
+                    printf("Pipe %s doesn't exist\n", optarg);
+                    exit(-1);
+                }
+                break;
+
+            case 'r':
+                mOptionRingSpecified = true;
+                mRingPath = optarg;
+                break;
+
+            case 't':
+                if (Cloud_ParseTransport(optarg, &mOptionTransport) != 0) {
+                    printf("Unknown transport %s\n", optarg);
+                    exit(-1);
+                }
+
+                mOptionTransportSpecified = true;
+                break;
+
+            case 'j':
+                errno = 0;
+                mParallelCount = strtoul(optarg, &end, 10);
+
+                if (errno || end == optarg || *end != '\0' || optarg[0] == '-' || mParallelCount == 0 ||
+                    mParallelCount > PARALLEL_MAX_WORKERS) {
+                    printf("Option --parallel/-j takes 1 to %d workers, not %s\n", PARALLEL_MAX_WORKERS, optarg);
+                    exit(-1);
+                }
+                break;
+
+            case 'k':
+                mOptionClaimSpecified = true;
+                break;
+
             case 'g':
                 mDisableCleanup = true;
                 break;
@@ -200,6 +514,11 @@ static int ParseArguments(int argc, char *argv[])
         }
     }
 
+    /* The command line wins over the configuration file, whichever came first */
+    if (mOptionTransportSpecified) {
+        mCloudConnectParams.transport = mOptionTransport;
+    }
+
     /* Validate mandatory options */
     res = 0;
 
@@ -209,6 +528,30 @@ static int ParseArguments(int argc, char *argv[])
     } else if (mOptionFileSpecified && mOptionListSpecified) {
         res = -1;
         printf("Options --file/-f and --list/-l cannot be specified at the same time\n");
+    } else if (mOptionStreamSpecified && (mOptionFileSpecified || mOptionListSpecified)) {
+        res = -1;
+        printf("Options --stdin/-i and --fifo/-p cannot be combined with --file/-f or --list/-l\n");
+    } else if (mOptionRingSpecified && (mOptionFileSpecified || mOptionListSpecified || mOptionStreamSpecified)) {
+        res = -1;
+        printf("Option --ring/-r cannot be combined with other input options\n");
+    } else if (mOptionClaimSpecified && !mOptionFileSpecified && !mOptionListSpecified) {
+        res = -1;
+        printf("Option --claim/-k only works with --file/-f or --list/-l\n");
+    } else if (mParallelCount > 1 && !mOptionListSpecified) {
+        res = -1;
+        printf("Option --parallel/-j only works with --list/-l\n");
+    } else if (mParallelCount > 1 && GetIdentityCount() < mParallelCount &&
+               mCloudConnectParams.transport != CLOUD_TRANSPORT_HTTP) {
+        /* The hub drops a connection when the same device connects again, so connections cannot share an identity */
+        res = -1;
+        printf("Each of the %zu workers needs a device identity of its own, found %zu. Only http can share one\n",
+               mParallelCount, GetIdentityCount());
+    } else if (mOptionRingSpecified && RingServer_Open(&mRing, mRingPath, RING_DEFAULT_CAPACITY) != 0) {
+        res = -1;
+        printf("Failed to serve the ring on %s\n", mRingPath);
+    } else if (mOptionStreamSpecified && Stream_Open(mStreamPath) != 0) {
+        res = -1;
+        printf("Failed to open %s\n", mStreamPath ? mStreamPath : "stdin");
     }
 
     return res;
@@ -219,6 +562,7 @@ static int ReadConfigurationFile(const char *filename)
     int res;
     if (File_Validate(filename) == 0 && ParseConfigFile(filename) == 0) {
         res = 0;
+        mConfigPath = filename;
     } else {
         res = -1;
         printf("Failed to read configuration file %s.\n", optarg);
@@ -228,79 +572,21 @@ static int ReadConfigurationFile(const char *filename)
 
 static int ParseConfigFile(const char *filename)
 {
-    FILE *file = fopen(filename, "r");
-    int res = 0;
-
-    if (file == NULL) {
-        perror("Error opening file");
-        return -1;
-    }
-
-    char line[512];
-
-    while (fgets(line, sizeof(line), file)) {
-        /* Remove trailing newline character */
-        line[strcspn(line, "\n")] = '\0';
-
-        /* Ignore empty lines and lines starting with '#' */
-        if (line[0] == '\0' || line[0] == '#') {
-            continue;
-        }
-
-        /* Find the '=' character to split setting name and value */
-        char *delimiter = strchr(line, '=');
-
-        if (delimiter == NULL) {
-            fprintf(stderr, "Invalid line format: %s\n", line);
-            fclose(file);
-            return -1;
-        }
-
-        /* Extract setting name and value */
-        /* Replace '=' with '\0' to split string */
-        *delimiter = '\0';
-        char *name = line;
-        char *value = delimiter + 1;
-
-        /* Trim leading and trailing spaces from setting value */
-        while (*value && (*value == ' ' || *value == '\t')) {
-            value++;
-        }
-
-        size_t len = strlen(value);
-
-        while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t')) {
-            value[--len] = '\0';
-        }
-
-        /* Allocate memory for configuration setting and store values */
-        ConfigurationSetting *setting = malloc(sizeof(ConfigurationSetting));
-        if (setting == NULL) {
-            perror("Memory allocation failed");
-            fclose(file);
-            return -1;
-        }
-
-        setting->name = strdup(name);
-        setting->value = strdup(value);
-        res = ValidateConfigurationSetting(setting);
-
-        if (res == 0) {
-            ProcessConfigurationSetting(setting, &mCloudConnectParams);
-        }
+    int res =
+        Config_Load(filename, mConfigSchema, CONFIG_SCHEMA_COUNT, HandleConfigurationSetting, &mCloudConnectParams);
+    mCloudConnectParams.isX509 =
+        CredentialStore_GetLength(mCloudConnectParams.cert) && CredentialStore_GetLength(mCloudConnectParams.key);
+    return res;
+}
 
-        /* Don't forget to free memory for name and value */
-        free(setting->name);
-        free(setting->value);
-        free(setting);
+static int HandleConfigurationSetting(ConfigurationSetting *setting, void *context)
+{
+    int res = ValidateConfigurationSetting(setting);
 
-        if (res != 0) {
-            break;
-        }
+    if (res == 0) {
+        ProcessConfigurationSetting(setting, (CloudConnectParams *)context);
     }
 
-    fclose(file);
-    mCloudConnectParams.isX509 = strlen(mCloudConnectParams.cert) && strlen(mCloudConnectParams.key);
     return res;
 }
 
@@ -310,14 +596,41 @@ static int ValidateConfigurationSetting(ConfigurationSetting *setting)
 
     if (strcmp("HostName", setting->name) == 0) {
         res |= strlen(setting->value) == 0;
+        res |= strlen(setting->value) >= sizeof(mCloudConnectParams.hostname);
     } else if (strcmp("DeviceId", setting->name) == 0) {
         res |= strlen(setting->value) == 0;
+        res |= strlen(setting->value) >= sizeof(mCloudConnectParams.deviceId);
     } else if (strcmp("CertFile", setting->name) == 0) {
         res |= strlen(setting->value) == 0;
         res |= File_Validate(setting->value);
     } else if (strcmp("KeyFile", setting->name) == 0) {
         res |= strlen(setting->value) == 0;
         res |= File_Validate(setting->value);
+    } else if (strcmp("TrustedCertFile", setting->name) == 0) {
+        res |= strlen(setting->value) == 0;
+        res |= File_Validate(setting->value);
+    } else if (strcmp("RateLimitStateFile", setting->name) == 0) {
+        res |= strlen(setting->value) == 0;
+        res |= strlen(setting->value) >= sizeof(mRateLimiterParams.stateFile);
+    } else if (strcmp("DrainFile", setting->name) == 0) {
+        res |= strlen(setting->value) == 0;
+        res |= strlen(setting->value) >= sizeof(mDrainFile);
+    } else if (strcmp("MetricsFile", setting->name) == 0 || strcmp("MetricsSocket", setting->name) == 0) {
+        res |= strlen(setting->value) == 0;
+        res |= strlen(setting->value) >= METRICS_MAX_PATH_LENGTH - 4;
+    } else if (strcmp("DeadbandFields", setting->name) == 0) {
+        res |= Filter_AddDeadbands(setting->value) != 0;
+    } else if (strcmp("DeadbandKey", setting->name) == 0) {
+        res |= Filter_SetKeyFields(setting->value) != 0;
+    } else if (strcmp("AggregateFields", setting->name) == 0) {
+        res |= Aggregator_AddFields(setting->value) != 0;
+    } else if (strcmp("AggregateKey", setting->name) == 0) {
+        res |= Aggregator_SetKeyFields(setting->value) != 0;
+    } else if (strcmp("HighPriorityPattern", setting->name) == 0 || strcmp("LowPriorityPattern", setting->name) == 0 ||
+               strcmp("HighPriorityDirectory", setting->name) == 0 ||
+               strcmp("LowPriorityDirectory", setting->name) == 0 || strcmp("LaneWeights", setting->name) == 0) {
+        /* Lane rules are validated by adding them, the scheduler rejects malformed ones */
+        res |= ProcessLaneSetting(setting);
     } else {
         printf("Ignoring unknown configuration: %s\n", setting->name);
     }
@@ -328,134 +641,1300 @@ static int ValidateConfigurationSetting(ConfigurationSetting *setting)
 static void ProcessConfigurationSetting(ConfigurationSetting *setting, CloudConnectParams *params)
 {
     if (strcmp("HostName", setting->name) == 0) {
-        strcpy(params->hostname, setting->value);
+        snprintf(params->hostname, sizeof(params->hostname), "%s", setting->value);
     } else if (strcmp("DeviceId", setting->name) == 0) {
-        strcpy(params->deviceId, setting->value);
+        snprintf(params->deviceId, sizeof(params->deviceId), "%s", setting->value);
     } else if (strcmp("CertFile", setting->name) == 0) {
-        File_Read(setting->value, params->cert, 4096);
+        SetCredential(&params->cert, setting->value);
     } else if (strcmp("KeyFile", setting->name) == 0) {
-        File_Read(setting->value, params->key, 4096);
+        SetCredential(&params->key, setting->value);
+    } else if (strcmp("TrustedCertFile", setting->name) == 0) {
+        SetCredential(&params->trustedCert, setting->value);
+    } else if (strcmp("RateLimitStateFile", setting->name) == 0) {
+        snprintf(mRateLimiterParams.stateFile, sizeof(mRateLimiterParams.stateFile), "%s", setting->value);
+    } else if (strcmp("DrainFile", setting->name) == 0) {
+        snprintf(mDrainFile, sizeof(mDrainFile), "%s", setting->value);
+    } else if (strcmp("MetricsFile", setting->name) == 0) {
+        snprintf(mMetricsParams.textFile, sizeof(mMetricsParams.textFile), "%s", setting->value);
+    } else if (strcmp("MetricsSocket", setting->name) == 0) {
+        snprintf(mMetricsParams.socketPath, sizeof(mMetricsParams.socketPath), "%s", setting->value);
+    }
+}
+
+/* A setting that comes again replaces the credential loaded before */
+static int SetCredential(CredentialHandle *handle, const char *filename)
+{
+    CredentialHandle loaded = CredentialStore_Load(filename);
+
+    CredentialStore_Release(*handle);
+    *handle = loaded;
+    return loaded == CREDENTIAL_NONE ? -1 : 0;
+}
+
+static int ProcessLaneSetting(ConfigurationSetting *setting)
+{
+    if (strcmp("HighPriorityPattern", setting->name) == 0) {
+        return Scheduler_AddPatterns(SCHEDULER_LANE_HIGH, setting->value);
+    } else if (strcmp("LowPriorityPattern", setting->name) == 0) {
+        return Scheduler_AddPatterns(SCHEDULER_LANE_LOW, setting->value);
+    } else if (strcmp("HighPriorityDirectory", setting->name) == 0) {
+        return Scheduler_AddDirectory(SCHEDULER_LANE_HIGH, setting->value);
+    } else if (strcmp("LowPriorityDirectory", setting->name) == 0) {
+        return Scheduler_AddDirectory(SCHEDULER_LANE_LOW, setting->value);
+    } else if (strcmp("LaneWeights", setting->name) == 0) {
+        return Scheduler_SetWeights(setting->value);
+    }
+
+    return -1;
+}
+
+/* Only the settings of the schema are read again. Credentials, file names and the rules of the pipeline keep what the
+ * process started with. */
+static void ReloadConfiguration(void)
+{
+    if (mConfigPath) {
+        Config_Reload(mConfigPath, mConfigSchema, CONFIG_SCHEMA_COUNT);
+    }
+}
+
+/* The reloadable settings of the configuration file may also be changed through the device twin while sending, with
+ * the same names and checks. The schema keeps the tuned value, so applying its group of settings again keeps it too. */
+static void TuneSetting(CloudTuningSetting *tuning)
+{
+    tuning->isApplied = Config_Set(mConfigSchema, CONFIG_SCHEMA_COUNT, tuning->name, tuning->value) == 0;
+}
+
+static int ParseTransport(const char *value, void *result)
+{
+    return Cloud_ParseTransport(value, (CloudTransport *)result);
+}
+
+static int ParseRetryPolicy(const char *value, void *result)
+{
+    return Cloud_ParseRetryPolicy(value, (CloudRetryPolicy *)result);
+}
+
+static int CheckRateLimitTier(const char *value, void *result)
+{
+    RateLimiterParams params;
+
+    return RateLimiter_GetTierParams(value, 1, &params);
+}
+
+static int CheckEncoding(const char *value, void *result)
+{
+    return Encoder_ParseFormat(value, NULL);
+}
+
+static int ApplyRateLimit(void)
+{
+    RateLimiterParams params = mRateLimiterParams;
+
+    /* The tier provides defaults; explicitly configured limits take precedence */
+    if (mRateLimitTier[0] && RateLimiter_GetTierParams(mRateLimitTier, mRateLimitUnits, &params) == 0) {
+        if (mRateLimiterParams.messagesPerSecond > 0) {
+            params.messagesPerSecond = mRateLimiterParams.messagesPerSecond;
+        }
+
+        if (mRateLimiterParams.dailyMessageBudget > 0) {
+            params.dailyMessageBudget = mRateLimiterParams.dailyMessageBudget;
+        }
     }
+
+    Cloud_SetRateLimit(&params);
+    return 0;
+}
+
+static int ApplyConnection(void)
+{
+    Cloud_SetInFlightWindow(mInFlightWindow);
+    Cloud_SetLogTrace(mIsLogTraceOn);
+    Cloud_SetReportInterval(mTwinReportIntervalSeconds);
+    return 0;
+}
+
+static int ApplyBatching(void)
+{
+    return Batcher_Configure(&mBatcherParams);
+}
+
+static int ApplyPipeline(void)
+{
+    Filter_SetHeartbeat(mHeartbeatSeconds);
+    Aggregator_SetWindow(mAggregateWindowSeconds);
+    return Encoder_SetFormat(mEncoding);
 }
 
 static void RegisterSignalHandler(SignalHandler_t signalHandler)
 {
     /* Register signal handler */
     signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+    signal(SIGHUP, signalHandler);
 }
 
+/* Only the coordinator of --parallel handles signals here, it passes them on to the workers and waits for them. A
+ * sending process takes them from its signal descriptor once it is open. */
 static void SignalHandler(int signum)
 {
+    /* Each worker watches the configuration file itself, a SIGHUP only asks them to read it again */
+    if (signum == SIGHUP) {
+        Parallel_Signal(SIGHUP);
+        return;
+    }
+
     mExit = true;
+    Parallel_Stop();
 }
 
-static void CloudEventHandler(CloudEvent evt, void *data)
+/* The sending process reads SIGINT, SIGTERM and SIGHUP from a descriptor in its event loop, so a signal starts the
+ * drain or a reload at a defined point instead of interrupting the loop wherever it is */
+static int OpenSignalFd(void)
 {
-    switch (evt) {
-        case CLOUD_EVENT_CONNECTIONSTATUSCHANGED:
-            mConnectionStatus = *((CloudConnectionStatus *)data);
-            break;
+    sigset_t mask;
 
-        case CLOUD_EVENT_SENDDATASUCCEEDED:
-            if (mFilesInProgressCount) {
-                mFilesInProgressCount--;
-            }
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
 
-            FileInfo_SetSendStatus((FileInfo *)data, true);
-            mFileSendSuccessCount++;
-            break;
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
+        return -1;
+    }
 
-        case CLOUD_EVENT_SENDDATAFAILED:
-            if (mFilesInProgressCount) {
-                mFilesInProgressCount--;
-            }
+    mSignalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    return mSignalFd < 0 ? -1 : 0;
+}
 
-            FileInfo_SetSendStatus((FileInfo *)data, false);
-            mFileSendFailCount++;
-            break;
+static void HandleSignals(void)
+{
+    struct signalfd_siginfo info;
+
+    while (read(mSignalFd, &info, sizeof(info)) == sizeof(info)) {
+        /* CTRL+C reaches the whole process group, so a worker also gets the signal the coordinator passes on */
+        bool isPassedOn = Parallel_IsWorker() && info.ssi_pid == (uint32_t)getppid();
+
+        if (info.ssi_signo == SIGHUP) {
+            ReloadConfiguration();
+        } else if (!mIsDraining) {
+            StartDrain();
+        } else if (info.ssi_signo == SIGINT && !isPassedOn) {
+            /* A second CTRL+C does not wait for the acknowledgements, what is left is still kept */
+            mExit = true;
+        }
+    }
+}
 
-        default:
-            break;
+/* Once stopped, nothing new is taken in. What was taken in is sent until it is acknowledged or the drain timeout runs
+ * out, whatever is left then is kept for the next run. */
+static void StartDrain(void)
+{
+    mIsDraining = true;
+    mDrainDeadlineMs = Clock_GetMs() + (uint64_t)mDrainTimeoutSeconds * 1000;
+
+    /* Readings held back for a window or a batch go out now rather than when their time is up */
+    Aggregator_FlushAll();
+    Batcher_FlushAll();
+
+    if (mFilesInProgressCount || Aggregator_HasPending()) {
+        printf("Stopping, waiting up to %u s for %d records in flight\n", mDrainTimeoutSeconds,
+               mFilesInProgressCount);
     }
 }
 
-void msleep(unsigned int milliseconds)
+static void Drain(void)
 {
-    time_t seconds = milliseconds / 1000;
-    long nsRemainder = (milliseconds % 1000) * 1000000;
-    struct timespec timeToSleep = {seconds, nsRemainder};
-    nanosleep(&timeToSleep, NULL);
+    bool isSending = mState == APP_STATE_SENDINPROGRESS && !IsTerminalConnectionStatus(mConnectionStatus);
+
+    if (isSending) {
+        SendAggregates();
+    }
+
+    if (!isSending || Clock_GetMs() >= mDrainDeadlineMs ||
+        (mFilesInProgressCount == 0 && Batcher_GetOpenCount() == 0 && !Aggregator_HasPending())) {
+        mExit = true;
+    }
 }
 
-static void AppStateMachine(void)
+/* Records read from a file stay in it until they are acknowledged. Records read from a stream or the ring and window
+ * summaries exist only in memory, those that fail while stopping are kept in the drain file. */
+static void KeepUnsentMessage(const void *data, size_t size, const char *contentType, void *contextData)
 {
-    switch (mState) {
-        case APP_STATE_IDLE:
-            if ((mOptionFileSpecified || mOptionListSpecified) && mFileCount) {
-                if (Cloud_Connect(&mCloudConnectParams) == 0) {
-                    mConnectionStatus = CLOUD_CONNECTION_DISCONNECTED_UNKNOWN;
-                    mState = APP_STATE_CONNECTING;
-                } else {
-                    ExitAction(-1);
-                }
-            }
-            break;
+    Batch *batch = (Batch *)contextData;
+    const char *reading;
+    size_t readingSize;
 
-        case APP_STATE_CONNECTING:
-            if (mConnectionStatus != CLOUD_CONNECTION_DISCONNECTED_UNKNOWN) {
-                if (mConnectionStatus == CLOUD_CONNECTION_CONNECTED) {
-                    mState = APP_STATE_CONNECTED;
-                } else {
-                    ExitAction(-1);
-                }
-            }
-            break;
+    if (!mIsDraining) {
+        return;
+    }
 
-        case APP_STATE_CONNECTED:
-            for (size_t i = 0; i < mFileCount; i++) {
-                if (File_Read(mFiles[i].filename, mStringData, sizeof(mStringData)) == 0) {
-                    if (Cloud_SendData(mStringData, &mFiles[i]) == 0) {
-                        mFilesInProgressCount++;
-                    } else {
-                        printf("Failed to send %s\n", mFiles[i].filename);
-                    }
-                } else {
-                    printf("Failed to read %s\n", mFiles[i].filename);
-                }
-            }
+    /* Ring records and summaries are sent on their own, encoded ones carry their JSON. Binary ones are not kept, a line
+     * holds JSON. */
+    if (!Batcher_IsBatch(contextData)) {
+        RecordCopy *copy = (RecordCopy *)contextData;
+
+        if (copy) {
+            KeepRecord(copy->data, copy->size);
+        } else if (contentType && strcmp(contentType, "application/json") == 0) {
+            KeepRecord((const char *)data, size);
+        } else {
+            mLostCount++;
+        }
 
-            if (mFilesInProgressCount) {
-                mFileSendSuccessCount = 0;
-                mFileSendFailCount = 0;
-                mState = APP_STATE_SENDINPROGRESS;
-            } else {
-                ExitAction(-1);
-            }
-            break;
+        return;
+    }
 
-        case APP_STATE_SENDINPROGRESS:
-            if (mFilesInProgressCount == 0) {
-                printf("Sent %d files. OK: %d, NOK: %d\n", mFileCount, mFileSendSuccessCount, mFileSendFailCount);
-                ExitAction(0);
-            }
-            break;
+    /* The readings of a batch are kept as they were before encoding */
+    for (size_t i = 0; i < batch->count; i++) {
+        if (batch->contexts[i] == NULL && Batcher_GetReading(batch, i, &reading, &readingSize) == 0) {
+            KeepRecord(reading, readingSize);
+        }
+    }
+}
 
-        default:
-            break;
+/* Each record is appended as one line with a single write, so workers can share the drain file */
+static void KeepRecord(const char *record, size_t size)
+{
+    struct iovec iov[2] = {{(void *)record, size}, {"\n", 1}};
+
+    if (mDrainFd < 0 && mDrainFile[0]) {
+        mDrainFd = open(mDrainFile, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    }
+
+    if (mDrainFd < 0 || size == 0 || memchr(record, '\n', size) ||
+        writev(mDrainFd, iov, 2) != (ssize_t)(size + 1)) {
+        mLostCount++;
+        return;
     }
+
+    mKeptCount++;
 }
 
-static void ExitAction(int exitCode)
+/* Keeps what was taken in but never handed to the Cloud library, then reports what was kept */
+static void KeepRemainingRecords(void)
 {
-    mOptionFileSpecified = false;
-    mOptionListSpecified = false;
-    mExit = true;
-    mExitCode = exitCode;
-    mState = APP_STATE_IDLE;
+    const char *record;
+    size_t size;
+    RingRecord ringRecord;
+    ssize_t len;
+
+    /* Kept records that were not replayed yet move on to the drain file, the ones replayed are kept if unsent */
+    while (mReplayFile && (len = getline(&mReplayLine, &mReplayLineSize, mReplayFile)) >= 0) {
+        size = (size_t)len - (len > 0 && mReplayLine[len - 1] == '\n');
+
+        if (size) {
+            KeepRecord(mReplayLine, size);
+        }
+    }
+
+    CloseKeptRecords();
+
+    if (mIsDraining) {
+        while (Aggregator_Next(&record, &size)) {
+            KeepRecord(record, size);
+            Aggregator_Pop();
+        }
+
+        while (mOptionStreamSpecified && Stream_NextBuffered(&record, &size) == STREAM_RESULT_RECORD) {
+            KeepRecord(record, size);
+        }
+
+        while (mOptionRingSpecified && Ring_Peek(&mRing, &ringRecord)) {
+            if (ringRecord.type == RING_RECORD_JSON) {
+                KeepRecord(ringRecord.data, ringRecord.size);
+            } else {
+                mLostCount++;
+            }
+
+            Ring_Release(&mRing, &ringRecord);
+        }
+    }
+
+    if (mKeptCount) {
+        printf("Kept %zu unsent records in %s\n", mKeptCount, mDrainFile);
+    }
+
+    if (mLostCount) {
+        printf("Could not keep %zu unsent records%s\n", mLostCount, mDrainFile[0] ? "" : ", DrainFile is not set");
+    }
+
+    if (mDrainFd >= 0) {
+        close(mDrainFd);
+        mDrainFd = -1;
+    }
+
+    free(mReplayLine);
+    mReplayLine = NULL;
 }
 
-static void CleanUp(void)
+/* The records kept by the last run are renamed before they are replayed, so records kept by this run do not mix with
+ * them. A replay that was cut short is finished first. */
+static void OpenKeptRecords(void)
 {
+    if (mDrainFile[0] == '\0') {
+        return;
+    }
+
+    snprintf(mReplayPath, sizeof(mReplayPath), "%s.replay", mDrainFile);
+
+    if (access(mReplayPath, F_OK) != 0 && rename(mDrainFile, mReplayPath) != 0) {
+        return;
+    }
+
+    mReplayFile = fopen(mReplayPath, "r");
+}
+
+/* Kept records go out before new ones. They were filtered and aggregated before they were kept, so they are handed to
+ * the batcher as they are. Returns true while there are more. */
+static bool ReplayKeptRecords(void)
+{
+    ssize_t len = 0;
+
+    if (mReplayFile == NULL) {
+        return false;
+    }
+
+    while (Cloud_GetPendingCount() < SCHEDULER_FEED_DEPTH && Batcher_CanAccept() &&
+           (len = getline(&mReplayLine, &mReplayLineSize, mReplayFile)) >= 0) {
+        uint64_t nowMs = Clock_GetMs();
+
+        if (len <= 1) {
+            continue;
+        }
+
+        mFilesInProgressCount++;
+        mFileSubmitCount++;
+
+        if (Batcher_Add(SCHEDULER_LANE_NORMAL, false, mReplayLine, (size_t)len, NULL, nowMs, nowMs) != 0) {
+            mFilesInProgressCount--;
+            mFileSubmitCount--;
+            mLostCount++;
+        }
+    }
+
+    if (len >= 0) {
+        Batcher_Task(Clock_GetMs());
+        return true;
+    }
+
+    /* Whatever of it is still in flight is kept again if it fails while stopping */
+    printf("Replayed %s\n", mReplayPath);
+    CloseKeptRecords();
+    Batcher_FlushAll();
+    return false;
+}
+
+static void CloseKeptRecords(void)
+{
+    if (mReplayFile) {
+        fclose(mReplayFile);
+        unlink(mReplayPath);
+        mReplayFile = NULL;
+    }
+}
+
+/* Each worker of --parallel has a connection of its own, which it exports in a file and on a socket of its own */
+static int InitializeMetrics(void)
+{
+    if (mMetricsParams.textFile[0] == '\0' && mMetricsParams.socketPath[0] == '\0') {
+        return 0;
+    }
+
+    if (Parallel_IsWorker()) {
+        size_t worker = Parallel_GetWorkerIndex();
+
+        snprintf(mMetricsParams.labels, sizeof(mMetricsParams.labels), "app=\"cloud-send\",worker=\"%zu\"", worker);
+        AddWorkerIndex(mMetricsParams.textFile, sizeof(mMetricsParams.textFile), worker);
+        AddWorkerIndex(mMetricsParams.socketPath, sizeof(mMetricsParams.socketPath), worker);
+    } else {
+        snprintf(mMetricsParams.labels, sizeof(mMetricsParams.labels), "app=\"cloud-send\"");
+    }
+
+    if (Metrics_Initialize(&mMetricsParams) != 0) {
+        return -1;
+    }
+
+    Metrics_AddCollector(Cloud_CollectMetrics);
+    Metrics_AddCollector(CollectMetrics);
+    Metrics_AddCollector(TlsSession_CollectMetrics);
+    return 0;
+}
+
+/* cloud-send.prom becomes cloud-send-2.prom for worker 2 */
+static void AddWorkerIndex(char *path, size_t size, size_t worker)
+{
+    char extension[METRICS_MAX_PATH_LENGTH];
+    char *dot = strrchr(path, '.');
+    char *slash = strrchr(path, '/');
+
+    if (path[0] == '\0') {
+        return;
+    }
+
+    if (dot == NULL || (slash && dot < slash)) {
+        dot = path + strlen(path);
+    }
+
+    snprintf(extension, sizeof(extension), "%s", dot);
+    snprintf(dot, size - (size_t)(dot - path), "-%zu%s", worker, extension);
+}
+
+static void CollectMetrics(void)
+{
+    Metrics_Set("cloud_send_readings_sent_total", METRICS_TYPE_COUNTER, "Files or records confirmed by the IoT Hub.",
+                mFileSendSuccessCount);
+    Metrics_Set("cloud_send_readings_failed_total", METRICS_TYPE_COUNTER, "Files or records that could not be sent.",
+                mFileSendFailCount);
+    Metrics_Set("cloud_send_readings_absorbed_total", METRICS_TYPE_COUNTER,
+                "Files taken in by the filter or the aggregator instead of being sent.", mFileAbsorbCount);
+    Metrics_Set("cloud_send_readings_in_progress", METRICS_TYPE_GAUGE, "Files or records sent and not yet confirmed.",
+                mFilesInProgressCount);
+    Metrics_Set("cloud_send_files_queued", METRICS_TYPE_GAUGE, "Files waiting in the scheduler to be sent.",
+                (double)Scheduler_GetQueuedCount());
+    Metrics_Set("cloud_send_batches_open", METRICS_TYPE_GAUGE, "Batches collecting readings.",
+                (double)Batcher_GetOpenCount());
+
+    if (mOptionRingSpecified) {
+        RingStats stats;
+        Ring_GetStats(&mRing, &stats);
+        Metrics_Set("cloud_send_ring_used_bytes", METRICS_TYPE_GAUGE, "Bytes of records waiting in the ring.",
+                    (double)stats.used);
+        Metrics_Set("cloud_send_ring_full_total", METRICS_TYPE_COUNTER, "Times a producer found the ring full.",
+                    (double)stats.fullCount);
+    }
+
+    if (mOptionStreamSpecified) {
+        StreamStats stats;
+        Stream_GetStats(&stats);
+        Metrics_Set("cloud_send_stream_records_total", METRICS_TYPE_COUNTER, "Records read from the stream.",
+                    (double)stats.recordCount);
+        Metrics_Set("cloud_send_stream_dropped_total", METRICS_TYPE_COUNTER, "Records dropped as too long.",
+                    (double)stats.droppedCount);
+    }
+}
+
+static void CloudEventHandler(CloudEvent evt, void *data)
+{
+    switch (evt) {
+        case CLOUD_EVENT_CONNECTIONSTATUSCHANGED:
+            mConnectionStatus = *((CloudConnectionStatus *)data);
+            break;
+
+        /* Ring records and summaries are sent without a batch, an encoded one with a copy of its JSON */
+        case CLOUD_EVENT_SENDDATASUCCEEDED:
+            if (Batcher_IsBatch(data)) {
+                CompleteBatch((Batch *)data, true);
+            } else {
+                free(data);
+                CompleteRecord(true);
+            }
+            break;
+
+        case CLOUD_EVENT_SENDDATAFAILED:
+            if (Batcher_IsBatch(data)) {
+                CompleteBatch((Batch *)data, false);
+            } else {
+                free(data);
+                CompleteRecord(false);
+            }
+            break;
+
+        case CLOUD_EVENT_TUNINGREQUESTED:
+            TuneSetting((CloudTuningSetting *)data);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void msleep(unsigned int milliseconds)
+{
+    time_t seconds = milliseconds / 1000;
+    long nsRemainder = (milliseconds % 1000) * 1000000;
+    struct timespec timeToSleep = {seconds, nsRemainder};
+    nanosleep(&timeToSleep, NULL);
+}
+
+static void AppStateMachine(void)
+{
+    switch (mState) {
+        case APP_STATE_IDLE:
+            if (((mOptionFileSpecified || mOptionListSpecified) && mFileCount) || mOptionStreamSpecified ||
+                mOptionRingSpecified) {
+                if (Cloud_Connect(&mCloudConnectParams) == 0) {
+                    mConnectionStatus = CLOUD_CONNECTION_DISCONNECTED_UNKNOWN;
+                    mState = APP_STATE_CONNECTING;
+                } else {
+                    ExitAction(-1);
+                }
+            }
+            break;
+
+        case APP_STATE_CONNECTING:
+            /* Other failures are retried by the client according to the retry policy */
+            if (mConnectionStatus == CLOUD_CONNECTION_CONNECTED) {
+                mState = APP_STATE_CONNECTED;
+            } else if (IsTerminalConnectionStatus(mConnectionStatus)) {
+                ExitAction(-1);
+            }
+            break;
+
+        case APP_STATE_CONNECTED:
+            mFileSendSuccessCount = 0;
+            mFileSendFailCount = 0;
+            mFileSubmitCount = 0;
+            mFileAbsorbCount = 0;
+            mFileMissCount = 0;
+            mSendStartMs = Clock_GetMs();
+
+            /* Workers claim their files as they go */
+            for (size_t i = 0; i < mFileCount && !Parallel_IsWorker(); i++) {
+                Scheduler_Enqueue(&mFiles[i], Clock_GetMs());
+            }
+
+            /* Records kept by the last run are sent by the endpoints that keep them */
+            if (mOptionStreamSpecified || mOptionRingSpecified) {
+                OpenKeptRecords();
+            }
+
+            mState = APP_STATE_SENDINPROGRESS;
+            break;
+
+        case APP_STATE_SENDINPROGRESS:
+            SendAggregates();
+
+            if (mOptionStreamSpecified) {
+                SendStreamRecords();
+                break;
+            }
+
+            if (mOptionRingSpecified) {
+                SendRingRecords();
+                break;
+            }
+
+            SendScheduledFiles();
+
+            if (!HasQueuedFiles() && mFilesInProgressCount == 0 && Batcher_GetOpenCount() == 0 &&
+                !Aggregator_HasPending()) {
+                /* The coordinator prints the summary of all workers */
+                if (Parallel_IsWorker()) {
+                    ExitAction(ReportWorkerStats());
+                    break;
+                }
+
+                /* Files taken by another instance were not for this one to send */
+                if (mFileSubmitCount == 0 && mFileAbsorbCount == 0 && mFileMissCount == 0) {
+                    ExitAction(-1);
+                    break;
+                }
+
+                printf("Sent %d files. OK: %d, NOK: %d\n", mFileCount, mFileSendSuccessCount, mFileSendFailCount);
+                PrintFilterStats();
+                PrintAggregateStats();
+                PrintLaneStats();
+                PrintBatchStats();
+                PrintEncoderStats();
+                PrintRateLimitStats();
+                PrintSendStats();
+                PrintClaimStats();
+                ExitAction(0);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void SendScheduledFiles(void)
+{
+    FileInfo *file;
+
+    if (Parallel_IsWorker()) {
+        ClaimFiles();
+    }
+
+    if (mOptionClaimSpecified) {
+        Claim_Task(Clock_GetMs());
+    }
+
+    /* Files are handed to the batcher a few at a time so the scheduler, not the pending queue, decides the order
+     * between lanes. The batcher holds readings for up to the linger time and sends them as one message. */
+    while (Cloud_GetPendingCount() < SCHEDULER_FEED_DEPTH && Batcher_CanAccept() &&
+           (file = Scheduler_Next(Clock_GetMs())) != NULL) {
+        if (mOptionClaimSpecified && Claim_Acquire(file) != 0) {
+            mFileMissCount++;
+            continue;
+        }
+
+        if (ReadReading(file->filename) != 0) {
+            printf("Failed to read %s\n", file->filename);
+            ResolveClaim(file, false);
+            continue;
+        }
+
+        /* The content of an absorbed reading goes out with a window summary or was unchanged, its file is cleaned up
+         * like a sent one */
+        if (AbsorbReading(mStringData, strlen(mStringData))) {
+            FileInfo_SetSendStatus(file, true);
+            ResolveClaim(file, true);
+            mFileAbsorbCount++;
+            continue;
+        }
+
+        /* Count before adding, a batch can be flushed and its result reported before Batcher_Add returns */
+        mFilesInProgressCount++;
+        mFileSubmitCount++;
+
+        /* High priority readings are not held back, they only pick up what is already waiting in their lane */
+        if (Batcher_Add(file->lane, file->lane == SCHEDULER_LANE_HIGH, mStringData, strlen(mStringData), file,
+                        file->enqueueTimeMs, Clock_GetMs()) != 0) {
+            mFilesInProgressCount--;
+            mFileSubmitCount--;
+            printf("Failed to send %s\n", file->filename);
+            ResolveClaim(file, false);
+        }
+    }
+
+    /* Nothing else is going to arrive once the scheduler is empty, waiting out the linger time gains nothing */
+    if (!HasQueuedFiles()) {
+        Aggregator_FlushAll();
+        Batcher_FlushAll();
+    } else {
+        Batcher_Task(Clock_GetMs());
+    }
+}
+
+/* The buffer grows to the largest file read so far. A reading has to fit into a batch, a larger file is rejected
+ * rather than sent cut off. */
+static int ReadReading(const char *filename)
+{
+    struct stat st;
+
+    if (stat(filename, &st) != 0) {
+        return -1;
+    }
+
+    if ((size_t)st.st_size > BATCHER_MAX_BYTES) {
+        printf("%s is larger than %d bytes\n", filename, BATCHER_MAX_BYTES);
+        return -1;
+    }
+
+    if ((size_t)st.st_size + 1 > mStringDataSize) {
+        char *buffer = realloc(mStringData, (size_t)st.st_size + 1);
+
+        if (buffer == NULL) {
+            return -1;
+        }
+
+        mStringData = buffer;
+        mStringDataSize = (size_t)st.st_size + 1;
+    }
+
+    return File_Read(filename, mStringData, mStringDataSize);
+}
+
+/* Workers take files from the shared queue a few at a time, so the ones that finish early can steal the rest */
+static void ClaimFiles(void)
+{
+    size_t index;
+
+    while (!mIsClaimDrained && Scheduler_GetQueuedCount() < PARALLEL_CLAIM_DEPTH) {
+        if (!Parallel_Claim(&index)) {
+            mIsClaimDrained = true;
+            break;
+        }
+
+        Scheduler_Enqueue(&mFiles[index], Clock_GetMs());
+    }
+}
+
+static bool HasQueuedFiles(void)
+{
+    return Scheduler_GetQueuedCount() || (Parallel_IsWorker() && !mIsClaimDrained);
+}
+
+/* A claimed file is done with as soon as its result is known: deleted once acknowledged, otherwise returned to the
+ * spool for the next run */
+static void ResolveClaim(FileInfo *file, bool success)
+{
+    if (!mOptionClaimSpecified) {
+        return;
+    }
+
+    if (success && !mDisableCleanup) {
+        Claim_Finalize(file);
+    } else {
+        Claim_Release(file);
+    }
+}
+
+/* The connection string file holds one connection string per line, one for each identity. The lines are only read,
+ * so that the composed text is cleared as a whole when it is freed. */
+static size_t GetIdentityCount(void)
+{
+    char *connectionStrings;
+    size_t count = 0;
+
+    if (mCloudConnectParams.isX509) {
+        return 1;
+    }
+
+    if ((connectionStrings = CredentialStore_Compose(mCloudConnectParams.key)) == NULL) {
+        return 0;
+    }
+
+    for (const char *line = connectionStrings + strspn(connectionStrings, "\r\n"); *line; line = GetNextLine(line)) {
+        count++;
+    }
+
+    CredentialStore_Free(connectionStrings);
+    return count;
+}
+
+/* Over http the workers can take turns on the identities, there is no connection that a second one would drop */
+static void SelectIdentity(size_t worker)
+{
+    char *connectionStrings;
+    size_t count = GetIdentityCount();
+
+    if (mCloudConnectParams.isX509 || count == 0 ||
+        (connectionStrings = CredentialStore_Compose(mCloudConnectParams.key)) == NULL) {
+        return;
+    }
+
+    const char *line = connectionStrings + strspn(connectionStrings, "\r\n");
+
+    for (size_t i = 0; i < worker % count; i++) {
+        line = GetNextLine(line);
+    }
+
+    CredentialStore_Release(mCloudConnectParams.key);
+    mCloudConnectParams.key = CredentialStore_Add(line, strcspn(line, "\r\n"));
+    CredentialStore_Free(connectionStrings);
+}
+
+/* The start of the non-empty line after the one at line, the terminator when there is none */
+static const char *GetNextLine(const char *line)
+{
+    line += strcspn(line, "\r\n");
+    return line + strspn(line, "\r\n");
+}
+
+static int RunCoordinator(ParallelRole role)
+{
+    int res = (role == PARALLEL_ROLE_COORDINATOR) ? Parallel_Wait() : -1;
+
+    if (role == PARALLEL_ROLE_COORDINATOR) {
+        PrintParallelStats();
+    }
+
+    Parallel_Deinitialize();
+    Scheduler_Deinitialize();
+    Filter_Deinitialize();
+    Aggregator_Deinitialize();
+    Encoder_Deinitialize();
+    return res;
+}
+
+/* Files that could not be read count against a worker only when it got nothing else through */
+static int ReportWorkerStats(void)
+{
+    ParallelWorkerStats stats;
+    CloudSendStats sendStats;
+
+    Parallel_GetWorkerStats(Parallel_GetWorkerIndex(), &stats);
+    Cloud_GetSendStats(&sendStats);
+
+    stats.successCount = (size_t)mFileSendSuccessCount;
+    stats.failCount = (size_t)mFileSendFailCount;
+    stats.absorbCount = (size_t)mFileAbsorbCount;
+    stats.messageCount = sendStats.ackCount;
+    stats.resendCount = sendStats.resendCount;
+    stats.reconnectCount = sendStats.reconnectCount;
+    stats.elapsedMs = Clock_GetMs() - mSendStartMs;
+    stats.exitCode =
+        (stats.claimCount && mFileSubmitCount == 0 && mFileAbsorbCount == 0 && mFileMissCount == 0) ? -1 : 0;
+
+    Parallel_Report(&stats);
+    return stats.exitCode;
+}
+
+static void SendStreamRecords(void)
+{
+    StreamResult res = STREAM_RESULT_AGAIN;
+    const char *record;
+    size_t size;
+
+    if (ReplayKeptRecords()) {
+        return;
+    }
+
+    /* The stream is only read while there is room in front of the in-flight window. Once it is full the pipe
+     * buffer fills up and the writer blocks, which is the backpressure the data logger sees. */
+    while (Cloud_GetPendingCount() < SCHEDULER_FEED_DEPTH && Batcher_CanAccept() &&
+           (res = Stream_Next(&record, &size)) == STREAM_RESULT_RECORD) {
+        uint64_t nowMs = Clock_GetMs();
+
+        if (AbsorbReading(record, size)) {
+            continue;
+        }
+
+        mFilesInProgressCount++;
+        mFileSubmitCount++;
+
+        if (Batcher_Add(SCHEDULER_LANE_NORMAL, false, record, size, NULL, nowMs, nowMs) != 0) {
+            mFilesInProgressCount--;
+            mFileSubmitCount--;
+            printf("Failed to send a record of %zu bytes\n", size);
+        }
+    }
+
+    if (res == STREAM_RESULT_ERROR) {
+        printf("Failed to read %s\n", mStreamPath ? mStreamPath : "stdin");
+        ExitAction(-1);
+        return;
+    }
+
+    if (res != STREAM_RESULT_END) {
+        Batcher_Task(Clock_GetMs());
+        return;
+    }
+
+    Aggregator_FlushAll();
+    Batcher_FlushAll();
+
+    if (mFilesInProgressCount == 0 && Batcher_GetOpenCount() == 0 && !Aggregator_HasPending()) {
+        printf("Sent %d records. OK: %d, NOK: %d\n", mFileSubmitCount, mFileSendSuccessCount, mFileSendFailCount);
+        PrintStreamStats();
+        PrintFilterStats();
+        PrintAggregateStats();
+        PrintBatchStats();
+        PrintEncoderStats();
+        PrintRateLimitStats();
+        PrintSendStats();
+        ExitAction(mFileSendFailCount ? -1 : 0);
+    }
+}
+
+static void SendRingRecords(void)
+{
+    RingRecord record;
+
+    RingServer_Task(&mRing);
+
+    if (ReplayKeptRecords()) {
+        return;
+    }
+
+    /* Records are sent straight from the shared memory; the Cloud library copies the payload into the IoT Hub
+     * message, after which the space goes back to the producers. While the in-flight window is full the ring fills up and
+     * producers wait for space. */
+    while (Cloud_GetPendingCount() < SCHEDULER_FEED_DEPTH && Ring_Peek(&mRing, &record)) {
+        CloudMessageOptions options = {0};
+        const void *data = record.data;
+        size_t size = record.size;
+        RecordCopy *copy = NULL;
+
+        if (record.type == RING_RECORD_JSON && AbsorbReading(record.data, record.size)) {
+            Ring_Release(&mRing, &record);
+            continue;
+        }
+
+        if (record.type == RING_RECORD_BINARY) {
+            options.contentType = "application/octet-stream";
+            options.contentEncoding = "";
+        } else if (EncodeMessage(&data, &size, &options)) {
+            copy = CopyRecord(record.data, record.size);
+        }
+
+        mFilesInProgressCount++;
+        mFileSubmitCount++;
+
+        /* The record stays in the ring and is tried again on the next pass */
+        if (Cloud_SendDataEx(data, size, &options, copy) != 0) {
+            mFilesInProgressCount--;
+            mFileSubmitCount--;
+            free(copy);
+            break;
+        }
+
+        Ring_Release(&mRing, &record);
+    }
+
+    /* Nothing more comes out of a corrupt ring, what was taken from it is still sent */
+    if (mRing.isCorrupt && !mIsDraining) {
+        mExitCode = -1;
+        StartDrain();
+    }
+}
+
+/* Returns true when the reading is folded into a window summary or suppressed as unchanged */
+static bool AbsorbReading(const char *data, size_t size)
+{
+    if (Aggregator_Add(data, size, Clock_GetRealtimeMs())) {
+        return true;
+    }
+
+    return Filter_Check(data, size, Clock_GetMs()) == FILTER_RESULT_SUPPRESS;
+}
+
+static void SendAggregates(void)
+{
+    const char *summary;
+    size_t size;
+
+    Aggregator_Task(Clock_GetRealtimeMs());
+
+    /* Summaries of a closed window are queued together and sent at the pace of the other messages */
+    while (Cloud_GetPendingCount() < SCHEDULER_FEED_DEPTH && Aggregator_Next(&summary, &size)) {
+        CloudMessageOptions options = {0};
+        const void *data = summary;
+        size_t jsonSize = size;
+        RecordCopy *copy = EncodeMessage(&data, &size, &options) ? CopyRecord(summary, jsonSize) : NULL;
+
+        mFilesInProgressCount++;
+
+        if (Cloud_SendDataEx(data, size, &options, copy) != 0) {
+            mFilesInProgressCount--;
+            free(copy);
+            break;
+        }
+
+        Aggregator_Pop();
+    }
+}
+
+/* Replaces a JSON message by its encoded form when an encoding is configured and returns true if it did. The Cloud
+ * library copies the payload, so the encoder's buffer is free again once the message is queued. */
+static bool EncodeMessage(const void **data, size_t *size, CloudMessageOptions *options)
+{
+    const void *encoded;
+    size_t encodedSize;
+
+    if (Encoder_Encode(*data, *size, &encoded, &encodedSize) != 0) {
+        return false;
+    }
+
+    *data = encoded;
+    *size = encodedSize;
+    options->contentType = Encoder_GetContentType();
+    options->contentEncoding = "";
+    return true;
+}
+
+/* The JSON of a message that is sent encoded without a batch, so that it can be kept if the message fails. Without
+ * memory for it the message is still sent, only not kept. */
+static RecordCopy *CopyRecord(const char *record, size_t size)
+{
+    RecordCopy *copy = malloc(sizeof(RecordCopy) + size);
+
+    if (copy) {
+        copy->size = size;
+        memcpy(copy->data, record, size);
+    }
+
+    return copy;
+}
+
+static void BatchFlushHandler(Batch *batch)
+{
+    CloudMessageOptions options = {0};
+    const void *data = batch->data;
+    size_t size = batch->size;
+
+    options.priority = LaneToPriority((SchedulerLane)batch->lane);
+    EncodeMessage(&data, &size, &options);
+
+    if (Cloud_SendDataEx(data, size, &options, batch) != 0) {
+        printf("Failed to send a batch of %zu readings\n", batch->count);
+        KeepUnsentMessage(data, size, options.contentType, batch);
+        CompleteBatch(batch, false);
+    }
+}
+
+static void CompleteBatch(Batch *batch, bool success)
+{
+    uint64_t nowMs = Clock_GetMs();
+
+    for (size_t i = 0; i < batch->count; i++) {
+        FileInfo *file = (FileInfo *)batch->contexts[i];
+
+        /* Records read from a stream have no file behind them */
+        if (file) {
+            FileInfo_SetSendStatus(file, success);
+            Scheduler_Complete(file, success, nowMs);
+            ResolveClaim(file, success);
+        }
+
+        CompleteRecord(success);
+    }
+
+    Batcher_Release(batch);
+}
+
+static void CompleteRecord(bool success)
+{
+    if (mFilesInProgressCount) {
+        mFilesInProgressCount--;
+    }
+
+    if (success) {
+        mFileSendSuccessCount++;
+    } else {
+        mFileSendFailCount++;
+    }
+}
+
+static CloudPriority LaneToPriority(SchedulerLane lane)
+{
+    switch (lane) {
+        case SCHEDULER_LANE_HIGH:
+            return CLOUD_PRIORITY_HIGH;
+
+        case SCHEDULER_LANE_LOW:
+            return CLOUD_PRIORITY_LOW;
+
+        default:
+            return CLOUD_PRIORITY_NORMAL;
+    }
+}
+
+static void PrintLaneStats(void)
+{
+    for (int i = 0; i < SCHEDULER_LANE_COUNT; i++) {
+        SchedulerLaneStats stats;
+        Scheduler_GetLaneStats((SchedulerLane)i, &stats);
+        size_t done = stats.successCount + stats.failCount;
+
+        if (stats.enqueueCount == 0) {
+            continue;
+        }
+
+        printf("Lane %-6s files: %zu, queue avg/max: %llu/%llu ms, latency avg/max: %llu/%llu ms\n",
+               Scheduler_GetLaneName((SchedulerLane)i), stats.enqueueCount,
+               (unsigned long long)(stats.totalQueueMs / stats.enqueueCount), (unsigned long long)stats.maxQueueMs,
+               (unsigned long long)(done ? stats.totalLatencyMs / done : 0), (unsigned long long)stats.maxLatencyMs);
+    }
+}
+
+static void PrintBatchStats(void)
+{
+    BatcherStats stats;
+    Batcher_GetStats(&stats);
+
+    if (stats.batchCount == 0 || stats.batchCount == stats.readingCount) {
+        return;
+    }
+
+    printf("Batches: %zu, readings per message avg/max: %.1f/%zu, sizes 1: %zu, 2-4: %zu, 5-16: %zu, 17+: %zu\n",
+           stats.batchCount, (double)stats.readingCount / stats.batchCount, stats.maxReadings, stats.histogram[0],
+           stats.histogram[1], stats.histogram[2], stats.histogram[3]);
+    printf("Flushed on");
+
+    for (int i = 0; i < BATCHER_FLUSH_REASON_COUNT; i++) {
+        if (stats.flushReasons[i]) {
+            printf(" %s: %zu", Batcher_GetFlushReasonName((BatcherFlushReason)i), stats.flushReasons[i]);
+        }
+    }
+
+    printf("\n");
+}
+
+static void PrintFilterStats(void)
+{
+    FilterStats stats;
+    Filter_GetStats(&stats);
+
+    if (stats.readingCount == 0) {
+        return;
+    }
+
+    printf("Filter: %zu readings, suppressed: %zu (%.1f%%, %llu bytes), heartbeats: %zu, not filtered: %zu, "
+           "sensors: %zu\n",
+           stats.readingCount, stats.suppressedCount, 100.0 * (double)stats.suppressedCount / stats.readingCount,
+           (unsigned long long)stats.suppressedBytes, stats.heartbeatCount, stats.passThroughCount,
+           stats.sensorCount);
+}
+
+static void PrintAggregateStats(void)
+{
+    AggregatorStats stats;
+    Aggregator_GetStats(&stats);
+
+    if (stats.readingCount == 0) {
+        return;
+    }
+
+    printf("Aggregate: %zu readings (%zu values) in %zu windows, summaries: %zu, sensors: %zu, over capacity: %zu, "
+           "state: %zu KB\n",
+           stats.readingCount, stats.valueCount, stats.windowCount, stats.summaryCount, stats.sensorCount,
+           stats.overflowCount, stats.stateBytes / 1024);
+}
+
+static void PrintEncoderStats(void)
+{
+    EncoderStats stats;
+    Encoder_GetStats(&stats);
+
+    if (stats.readingCount == 0) {
+        return;
+    }
+
+    double jsonPerReading = (double)stats.jsonBytes / stats.readingCount;
+    double encodedPerReading = (double)stats.encodedBytes / stats.readingCount;
+
+    printf("Encoding: %zu messages (%zu columnar), %zu readings, bytes/reading: %.1f JSON, %.1f encoded (%.0f%%), "
+           "sent as JSON: %zu\n",
+           stats.messageCount, stats.columnarCount, stats.readingCount, jsonPerReading, encodedPerReading,
+           100.0 * encodedPerReading / jsonPerReading, stats.passThroughCount);
+}
+
+/* Throughput is over the slowest worker, which is when the last file was done */
+static void PrintParallelStats(void)
+{
+    ParallelWorkerStats stats;
+    size_t successCount = 0;
+    size_t failCount = 0;
+    size_t messageCount = 0;
+    uint64_t elapsedMs = 0;
+
+    for (size_t i = 0; i < Parallel_GetWorkerCount(); i++) {
+        Parallel_GetWorkerStats(i, &stats);
+
+        if (!stats.isReported) {
+            printf("Worker %zu: failed, its %zu claimed files are left for the next run\n", i, stats.claimCount);
+            continue;
+        }
+
+        printf("Worker %zu: %zu files, %zu stolen. OK: %zu, NOK: %zu, absorbed: %zu, messages: %zu in %.1f s\n", i,
+               stats.claimCount, stats.stolenCount, stats.successCount, stats.failCount, stats.absorbCount,
+               stats.messageCount, (double)stats.elapsedMs / 1000.0);
+
+        if (stats.resendCount || stats.reconnectCount) {
+            printf("Worker %zu: reconnects: %zu, resent messages: %zu\n", i, stats.reconnectCount, stats.resendCount);
+        }
+
+        successCount += stats.successCount;
+        failCount += stats.failCount;
+        messageCount += stats.messageCount;
+        elapsedMs = stats.elapsedMs > elapsedMs ? stats.elapsedMs : elapsedMs;
+    }
+
+    printf("Sent %d files with %zu workers. OK: %zu, NOK: %zu\n", mFileCount, Parallel_GetWorkerCount(), successCount,
+           failCount);
+
+    if (elapsedMs) {
+        printf("Throughput: %.1f messages/s\n", (double)messageCount * 1000.0 / (double)elapsedMs);
+    }
+}
+
+static void PrintClaimStats(void)
+{
+    ClaimStats stats;
+
+    if (!mOptionClaimSpecified) {
+        return;
+    }
+
+    Claim_GetStats(&stats);
+    printf("Claims: %zu claimed, %zu taken by another instance, %zu returned, %zu recovered from %zu expired claims\n",
+           stats.claimCount, stats.missCount, stats.releaseCount, stats.recoverCount, stats.expiredCount);
+}
+
+static void PrintStreamStats(void)
+{
+    StreamStats stats;
+    Stream_GetStats(&stats);
+
+    printf("Stream: %llu bytes in %zu reads, records: %zu, dropped: %zu\n", (unsigned long long)stats.byteCount,
+           stats.readCount, stats.recordCount, stats.droppedCount);
+}
+
+static bool IsTerminalConnectionStatus(CloudConnectionStatus status)
+{
+    return status == CLOUD_CONNECTION_DISCONNECTED_BAD_CREDENTIAL ||
+           status == CLOUD_CONNECTION_DISCONNECTED_DEVICE_DISABLED ||
+           status == CLOUD_CONNECTION_DISCONNECTED_RETRY_EXPIRED;
+}
+
+static void PrintRateLimitStats(void)
+{
+    RateLimiterStats stats;
+    RateLimiter_GetStats(&stats);
+
+    if (stats.throttleSignalCount || stats.waitCount || stats.budgetRejectCount) {
+        printf("Rate limit: %.1f msg/s, %.0f B/s effective. Waits: %zu, throttle signals: %zu, over budget: %zu, "
+               "used today: %lu\n",
+               stats.effectiveMessagesPerSecond, stats.effectiveBytesPerSecond, stats.waitCount,
+               stats.throttleSignalCount, stats.budgetRejectCount, stats.dailyMessagesUsed);
+    }
+}
+
+static void PrintSendStats(void)
+{
+    CloudSendStats stats;
+    Cloud_GetSendStats(&stats);
+
+    if (stats.resendCount || stats.reconnectCount) {
+        printf("Reconnects: %zu, resent messages: %zu\n", stats.reconnectCount, stats.resendCount);
+    }
+
+    if (stats.tokenRenewCount) {
+        printf("SAS token renewals: %zu, %.1f ms average, %llu ms longest\n", stats.tokenRenewCount,
+               (double)stats.tokenRenewMs / (double)stats.tokenRenewCount, (unsigned long long)stats.maxTokenRenewMs);
+    }
+
+    PrintTlsStats();
+}
+
+/* The reduction compares the resumed handshakes with the full ones that established their sessions */
+static void PrintTlsStats(void)
+{
+    TlsSessionStats stats;
+    TlsSession_GetStats(&stats);
+
+    if (stats.handshakeCount == 0) {
+        return;
+    }
+
+    printf("TLS handshakes: %zu, resumed: %zu", stats.handshakeCount, stats.resumedCount);
+
+    if (stats.resumedCount && stats.resumedFullHandshakeMs) {
+        double resumedMs = (double)stats.resumedHandshakeMs / (double)stats.resumedCount;
+        double fullMs = (double)stats.resumedFullHandshakeMs / (double)stats.resumedCount;
+
+        printf(", %.1f ms resumed against %.1f ms full, %.0f%% less", resumedMs, fullMs,
+               100.0 * (fullMs - resumedMs) / fullMs);
+    } else if (stats.handshakeCount > stats.resumedCount) {
+        printf(", %.1f ms full", (double)stats.fullHandshakeMs / (double)(stats.handshakeCount - stats.resumedCount));
+    }
+
+    printf("\n");
+}
+
+static void ExitAction(int exitCode)
+{
+    mOptionFileSpecified = false;
+    mOptionListSpecified = false;
+    mExit = true;
+    mExitCode = exitCode;
+    mState = APP_STATE_IDLE;
+}
+
+static void CleanUp(void)
+{
+    /* Claimed files were finalized as their results came in, the ones still claimed were not sent */
+    if (mOptionClaimSpecified) {
+        for (int i = 0; i < mFileCount; i++) {
+            Claim_Release(&mFiles[i]);
+        }
+
+        return;
+    }
+
     if (mDisableCleanup) {
         return;
     }